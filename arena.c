@@ -0,0 +1,106 @@
+/**
+ *
+ * @file arena.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+__thread Arena *requestArena;
+
+static ArenaBlock *arena_new_block(Arena *arena, size_t size)
+{
+    ArenaBlock *block = (ArenaBlock *)malloc(sizeof(ArenaBlock) + size);
+    if (block == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    arena->heapCalls++;
+    return block;
+}
+
+void arena_init(Arena *arena, size_t blockSize)
+{
+    arena->blockSize = blockSize;
+    arena->allocations = 0;
+    arena->heapCalls = 0;
+    arena->head = arena_new_block(arena, blockSize);
+    arena->current = arena->head;
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGNMENT - 1) & ~((size_t)ARENA_ALIGNMENT - 1);
+    arena->allocations++;
+
+    while (arena->current->used + size > arena->current->size)
+    {
+        if (arena->current->next == NULL)
+        {
+            size_t blockSize = size > arena->blockSize ? size : arena->blockSize;
+            arena->current->next = arena_new_block(arena, blockSize);
+        }
+        arena->current = arena->current->next;
+        arena->current->used = 0;
+    }
+
+    void *memory = arena->current->data + arena->current->used;
+    arena->current->used += size;
+    return memory;
+}
+
+char *arena_strndup(Arena *arena, const char *string, size_t length)
+{
+    char *copy = (char *)arena_alloc(arena, length + 1);
+    memcpy(copy, string, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+ArenaMark arena_mark(Arena *arena)
+{
+    ArenaMark mark;
+    mark.block = arena->current;
+    mark.used = arena->current->used;
+    return mark;
+}
+
+void arena_release(Arena *arena, ArenaMark mark)
+{
+    arena->current = mark.block;
+    arena->current->used = mark.used;
+}
+
+void arena_reset(Arena *arena)
+{
+    arena->current = arena->head;
+    arena->current->used = 0;
+    arena->allocations = 0;
+    arena->heapCalls = 0;
+}
+
+void arena_dispose(Arena *arena)
+{
+    ArenaBlock *block = arena->head;
+    while (block != NULL)
+    {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->head = NULL;
+    arena->current = NULL;
+}
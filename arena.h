@@ -0,0 +1,138 @@
+/**
+ *
+ * @file arena.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+enum ArenaConst
+{
+    ARENA_BLOCK_SIZE = 65536, // default size of one arena block
+    ARENA_ALIGNMENT = 16
+};
+
+/**
+ * Structure representing one heap block owned by an arena.
+ */
+typedef struct ArenaBlock
+{
+    struct ArenaBlock *next; /**< The next block in the chain. */
+    size_t size;             /**< The usable size of the block in bytes. */
+    size_t used;             /**< The number of bytes already handed out. */
+    unsigned char data[];    /**< The block memory. */
+} ArenaBlock;
+
+/**
+ * Structure representing a bump pointer arena.
+ *
+ * The arena hands out memory from a chain of blocks. Resetting the arena rewinds
+ * all blocks without returning them to the heap, so once the chain is large enough
+ * for a request no further heap calls are made.
+ */
+typedef struct
+{
+    ArenaBlock *head;      /**< The first block in the chain. */
+    ArenaBlock *current;   /**< The block allocations are currently served from. */
+    size_t blockSize;      /**< The size of newly created blocks. */
+    size_t allocations;    /**< Number of allocations since the last reset. */
+    size_t heapCalls;      /**< Number of heap calls since the last reset. */
+} Arena;
+
+/**
+ * Structure representing a saved arena position.
+ */
+typedef struct
+{
+    ArenaBlock *block; /**< The block that was current when the mark was taken. */
+    size_t used;       /**< The used bytes of that block. */
+} ArenaMark;
+
+/**
+ * Arena used by the request currently being processed by the thread.
+ */
+extern __thread Arena *requestArena;
+
+/**
+ * Initialize Arena.
+ *
+ * Prepares the arena and allocates its first block.
+ *
+ * @param arena     A pointer to the arena to initialize.
+ * @param blockSize The size of one arena block in bytes.
+ */
+void arena_init(Arena *arena, size_t blockSize);
+
+/**
+ * Allocate Memory from Arena.
+ *
+ * Returns aligned memory from the current block, moving to the next block
+ * of the chain or allocating a new one only if the current block is exhausted.
+ *
+ * @param arena A pointer to the arena.
+ * @param size  The number of bytes requested.
+ *
+ * @return A pointer to the allocated memory. The process exits if the heap is exhausted.
+ */
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Duplicate Bytes into Arena.
+ *
+ * Copies the given bytes into the arena and null-terminates the copy.
+ *
+ * @param arena  A pointer to the arena.
+ * @param string A pointer to the bytes to copy.
+ * @param length The number of bytes to copy.
+ *
+ * @return A pointer to the null-terminated copy.
+ */
+char *arena_strndup(Arena *arena, const char *string, size_t length);
+
+/**
+ * Save Arena Position.
+ *
+ * @param arena A pointer to the arena.
+ *
+ * @return The current position of the arena.
+ */
+ArenaMark arena_mark(Arena *arena);
+
+/**
+ * Release Arena Memory up to Mark.
+ *
+ * Releases all memory allocated after the mark was taken.
+ *
+ * @param arena A pointer to the arena.
+ * @param mark  The position returned by arena_mark().
+ */
+void arena_release(Arena *arena, ArenaMark mark);
+
+/**
+ * Reset Arena.
+ *
+ * Rewinds every block of the arena and clears the allocation counters.
+ * The blocks are kept for the next request.
+ *
+ * @param arena A pointer to the arena.
+ */
+void arena_reset(Arena *arena);
+
+/**
+ * Dispose Arena.
+ *
+ * Returns all blocks of the arena to the heap.
+ *
+ * @param arena A pointer to the arena.
+ */
+void arena_dispose(Arena *arena);
+
+#endif
@@ -17,61 +17,138 @@
 #include <stdbool.h>
 #include <ctype.h>
 #include "utils.h"
+#include "arena.h"
 #include "ldap.h"
 #include "bind.h"
+#include "compare.h"
+#include "password.h"
+#include "credcache.h"
+#include "stats.h"
+#include "trace.h"
+#include "response.h"
 
-extern int currentTagPosition;
+extern __thread int currentTagPosition;
 
-LdapBind ldap_bind(unsigned char *data, int messageId)
+LdapBind ldap_bind(const unsigned char *data, size_t length, int messageId)
 {
-    debug(1, "****BIND REQUEST****\n");
     LdapBind bind;
     bind.messageId = messageId;
-    bind.version = get_int_value(data);
-    bind.name = get_string_value(data);
-    bind.authChoice = get_ldap_element_info(data).tagValue;
+    bind.version = 0;
+    bind.name = "";
+    bind.authChoice = -1;
+    bind.password = NULL;
+    bind.passwordLength = 0;
+
+    size_t position = 0, elementLength;
+    if (ber_read_header(data, length, &position, &elementLength) != LDAP_MESSAGE_PREFIX ||
+        ber_read_header(data, length, &position, &elementLength) != INTEGER_TYPE)
+        return bind;
+    position += elementLength;
+    if (ber_read_header(data, length, &position, &elementLength) != LDAP_BIND_REQUEST)
+        return bind;
+    size_t end = position + elementLength;
+
+    // the version is a single byte, a second one allows a leading zero
+    if (ber_read_header(data, end, &position, &elementLength) != INTEGER_TYPE || elementLength == 0 || elementLength > 2)
+        return bind;
+    for (size_t i = 0; i < elementLength; i++)
+        bind.version = bind.version * 256 + data[position++];
+
+    if (ber_read_header(data, end, &position, &elementLength) != OCTET_STRING_TYPE)
+        return bind;
+    bind.name = arena_strndup(requestArena, (const char *)data + position, elementLength);
+    position += elementLength;
+
+    // the credentials of a simple bind are the content of the context specific tag
+    bind.authChoice = ber_read_header(data, end, &position, &elementLength);
+    if (bind.authChoice == -1)
+        return bind;
+    bind.password = (const char *)data + position;
+    bind.passwordLength = elementLength;
     return bind;
 }
 
-void ldap_bind_response(LdapBind bind, int clientSocket)
+void ldap_bind_response_encode(unsigned char *buff, int *offset, int resultCode)
 {
-    debug(1, "****BIND RESPONSE****\n");
-    int offset = 0;
-    unsigned char buff[MAX_BUFFER_SIZE];
-    memset(buff, 0, MAX_BUFFER_SIZE); // clear the buffer
+    add_ldap_byte(buff, offset, LDAP_BIND_RESPONSE);
+    add_ldap_byte(buff, offset, 0x07);
 
-    create_ldap_header(buff, &offset, bind.messageId);
+    add_ldap_byte(buff, offset, ENUMERATED_TYPE);
+    add_ldap_byte(buff, offset, 0x01);
+    add_ldap_byte(buff, offset, resultCode);
 
-    add_ldap_byte(buff, &offset, LDAP_BIND_RESPONSE);
-    add_ldap_byte(buff, &offset, 0x07);
+    add_ldap_string(buff, offset, "");
 
-    add_ldap_byte(buff, &offset, ENUMERATED_TYPE);
-    add_ldap_byte(buff, &offset, 0x01);
+    add_ldap_string(buff, offset, "");
+}
 
-    if (bind.authChoice != SIMPLE_BIND)
-    {
-        add_ldap_byte(buff, &offset, AUTH_METHOD_NOT_SUPPORTED);
-    }
-    else if (bind.version != 0x03)
+static int ldap_bind_verify(LdapBind bind, const Directory *directory)
+{
+    size_t row;
+    if (!find_entry_by_dn(directory, bind.name, &row))
     {
-        add_ldap_byte(buff, &offset, PROTOCOL_ERROR);
+        // an unknown name takes as long as a wrong password
+        password_waste(bind.password, bind.passwordLength);
+        stats_add(&stats->passwordVerifications, 1);
+        return INVALID_CREDENTIALS;
     }
-    else if (strcmp(bind.name, "") != 0)
+
+    int column = directory->schema.password;
+    char *scratch = (char *)arena_alloc(requestArena, directory->columns[column].maxLength + 1);
+    Field stored = directory_value(directory, row, column, scratch);
+    if (credcache_lookup(row, stored.value, stored.length, bind.password, bind.passwordLength))
+        return SUCCESS;
+
+    Field rest = stored, value;
+    int verifications = 0;
+    while (field_next_value(&rest, directory->schema.attributes[column].separator, &value))
     {
-        add_ldap_byte(buff, &offset, INVALID_DN_SYNTAX);
+        if (value.length == 0)
+            continue;
+        verifications++;
+        if (password_verify(value.value, value.length, bind.password, bind.passwordLength))
+        {
+            stats_add(&stats->passwordVerifications, verifications);
+            credcache_store(row, stored.value, stored.length, bind.password, bind.passwordLength);
+            return SUCCESS;
+        }
     }
-    else
+    if (verifications == 0)
     {
-        add_ldap_byte(buff, &offset, SUCCESS);
+        password_waste(bind.password, bind.passwordLength);
+        verifications++;
     }
+    stats_add(&stats->passwordVerifications, verifications);
+    return INVALID_CREDENTIALS;
+}
 
-    add_ldap_string(buff, &offset, "");
+int ldap_bind_evaluate(LdapBind bind, const Directory *directory)
+{
+    int resultCode;
+    if (bind.password == NULL)
+        resultCode = PROTOCOL_ERROR;
+    else if (bind.authChoice != SIMPLE_BIND)
+        resultCode = AUTH_METHOD_NOT_SUPPORTED;
+    else if (bind.version != 0x03)
+        resultCode = PROTOCOL_ERROR;
+    else if (strcmp(bind.name, "") == 0)
+        resultCode = bind.passwordLength == 0 ? SUCCESS : INVALID_CREDENTIALS;
+    else if (directory->schema.password == -1)
+        resultCode = INVALID_DN_SYNTAX; // names are not supported without passwords
+    else if (bind.passwordLength == 0)
+        resultCode = UNWILLING_TO_PERFORM; // an unauthenticated bind, RFC 4513 section 5.1.2
+    else
+        resultCode = ldap_bind_verify(bind, directory);
 
-    add_ldap_string(buff, &offset, "");
+    if (resultCode == INVALID_CREDENTIALS)
+        stats_add(&stats->bindFailures, 1);
+    return resultCode;
+}
 
-    buff[LDAP_MSG_LENGTH_OFFSET] = offset - 2; // ldap msg tag, and length
-    ldap_send(buff, clientSocket, offset);
-    free(bind.name);
+void ldap_bind_response(LdapBind bind, int resultCode, int clientSocket)
+{
+    trace(TRACE_INFO, TRACE_BIND, bind.messageId, bind.version, resultCode);
 
-    print_hex_message(buff, offset);
+    // only the message id differs between the responses with the same result
+    response_send(RESPONSE_BIND, resultCode, bind.messageId, clientSocket);
 }
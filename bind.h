@@ -11,6 +11,9 @@
  */
 #ifndef _BIND_H
 #define _BIND_H
+
+#include "directory.h"
+
 /**
  * Structure representing an LDAP Bind message.
  *
@@ -23,6 +26,8 @@ typedef struct
     int version;    /**< The protocol version associated with the LDAP Bind message. */
     char *name;     /**< The distinguished name associated with the LDAP Bind message. */
     int authChoice; /**<*/
+    const char *password; /**< The simple credentials, not terminated, or NULL if the request is malformed. */
+    int passwordLength;   /**< The length of the simple credentials. */
 } LdapBind;
 
 enum AuthChoice
@@ -35,17 +40,47 @@ enum AuthChoice
  * LDAP Bind Operation.
  *
  * Initiates an LDAP bind operation using the provided data and message ID.
+ * No element is read past the given length.
  *
- * @param data  A pointer to the data required for the bind operation.
+ * @param data  A pointer to the whole LDAP message of the bind request.
+ * @param length The length of the message.
  * @param messageId An integer representing the unique identifier for the LDAP message.
  *
  * @return An LdapBind structure representing the result of the bind operation.
  *
- * The caller is responsible for managing any associated memory. 
- * The 'name' field in the structure is dynamically
- * allocated and should be freed by the caller when no longer needed.
+ * The 'name' field in the structure is allocated from the request arena,
+ * the 'password' field points into the message and is NULL if the request
+ * could not be decoded.
+ */
+LdapBind ldap_bind(const unsigned char *data, size_t length, int messageId);
+
+/**
+ * Evaluate LDAP Bind.
+ *
+ * An empty name with empty credentials is an anonymous bind. A name is looked up
+ * like the entry of a compare and the credentials are verified against the values of
+ * the password attribute of the entry, asking the credential cache first. Unknown
+ * names spend the same time as a wrong password. Without a password attribute in the
+ * schema only anonymous binds are accepted.
+ *
+ * @param bind      The LdapBind structure representing the Bind request.
+ * @param directory A pointer to the loaded database file.
+ *
+ * @return The result code of the bind.
+ */
+int ldap_bind_evaluate(LdapBind bind, const Directory *directory);
+
+/**
+ * Encode LDAP Bind Response.
+ *
+ * Encodes the protocol operation of a bind response without a message header,
+ * used to build the response templates.
+ *
+ * @param buff          A pointer to the buffer.
+ * @param offset        A pointer to the offset in the buffer, moved past the response.
+ * @param resultCode    The result code of the bind.
  */
-LdapBind ldap_bind(unsigned char *data, int messageId);
+void ldap_bind_response_encode(unsigned char *buff, int *offset, int resultCode);
 
 /**
  * Send an LDAP Bind response to the client.
@@ -55,9 +90,10 @@ LdapBind ldap_bind(unsigned char *data, int messageId);
  * including the message ID and result code.
  *
  * @param bind The LdapBind structure representing the Bind request.
+ * @param resultCode The result code returned by ldap_bind_evaluate().
  * @param clientSocket The socket for communication with the client.
  */
-void ldap_bind_response(LdapBind bind, int clientSocket);
+void ldap_bind_response(LdapBind bind, int resultCode, int clientSocket);
 
 void ldap_send(unsigned char *bufin, int clientSocket, int offset);
 
@@ -0,0 +1,65 @@
+/**
+ *
+ * @file bloom.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "bloom.h"
+
+int bloom_init(BloomFilter *bloom, size_t keyCount)
+{
+    size_t bits = (keyCount > 0 ? keyCount : 1) * BLOOM_BITS_PER_KEY;
+    bloom->blockCount = (bits + BLOOM_BLOCK_WORDS * 64 - 1) / (BLOOM_BLOCK_WORDS * 64);
+    bloom->blocks = (uint64_t *)aligned_alloc(64, bloom->blockCount * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    if (bloom->blocks == NULL)
+        return -1;
+    memset(bloom->blocks, 0, bloom->blockCount * BLOOM_BLOCK_WORDS * sizeof(uint64_t));
+    return 0;
+}
+
+void bloom_add(BloomFilter *bloom, uint64_t hash)
+{
+    uint64_t *block = bloom->blocks + ((hash >> 32) % bloom->blockCount) * BLOOM_BLOCK_WORDS;
+    uint32_t bits = (uint32_t)hash;
+
+    // derive the bit positions within the block from the low half of the hash
+    for (int i = 0; i < BLOOM_HASHES; i++)
+    {
+        bits = bits * 0x9E3779B1U + 0x7F4A7C15U;
+        unsigned int bit = bits >> 23; // 9 bits, 0..511
+        __atomic_fetch_or(&block[bit >> 6], 1ULL << (bit & 63), __ATOMIC_RELAXED);
+    }
+}
+
+bool bloom_may_contain(const BloomFilter *bloom, uint64_t hash)
+{
+    if (bloom->blocks == NULL)
+        return true;
+
+    const uint64_t *block = bloom->blocks + ((hash >> 32) % bloom->blockCount) * BLOOM_BLOCK_WORDS;
+    uint32_t bits = (uint32_t)hash;
+
+    for (int i = 0; i < BLOOM_HASHES; i++)
+    {
+        bits = bits * 0x9E3779B1U + 0x7F4A7C15U;
+        unsigned int bit = bits >> 23;
+        if ((block[bit >> 6] & (1ULL << (bit & 63))) == 0)
+            return false;
+    }
+    return true;
+}
+
+void bloom_dispose(BloomFilter *bloom)
+{
+    free(bloom->blocks);
+    bloom->blocks = NULL;
+    bloom->blockCount = 0;
+}
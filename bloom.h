@@ -0,0 +1,77 @@
+/**
+ *
+ * @file bloom.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _BLOOM_H
+#define _BLOOM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum BloomConst
+{
+    BLOOM_BLOCK_WORDS = 8,  // one block is a 64 byte cache line
+    BLOOM_BITS_PER_KEY = 10,
+    BLOOM_HASHES = 7
+};
+
+/**
+ * Structure representing a blocked Bloom filter.
+ *
+ * All bits of one key are set within a single cache line sized block,
+ * so every lookup touches exactly one cache line.
+ */
+typedef struct
+{
+    uint64_t *blocks;  /**< The filter bits, BLOOM_BLOCK_WORDS words per block. */
+    size_t blockCount; /**< The number of blocks. */
+} BloomFilter;
+
+/**
+ * Initialize Bloom Filter.
+ *
+ * Sizes the filter for the expected number of keys.
+ *
+ * @param bloom     A pointer to the filter to initialize.
+ * @param keyCount  The expected number of keys.
+ *
+ * @return 0 on success, -1 if the allocation failed.
+ */
+int bloom_init(BloomFilter *bloom, size_t keyCount);
+
+/**
+ * Add Key to Bloom Filter.
+ *
+ * Sets the bits of the key atomically, so several threads may add keys at once.
+ *
+ * @param bloom A pointer to the filter.
+ * @param hash  The hash of the key.
+ */
+void bloom_add(BloomFilter *bloom, uint64_t hash);
+
+/**
+ * Check Key in Bloom Filter.
+ *
+ * @param bloom A pointer to the filter.
+ * @param hash  The hash of the key.
+ *
+ * @return false if the key was certainly not added, true if it may have been added.
+ */
+bool bloom_may_contain(const BloomFilter *bloom, uint64_t hash);
+
+/**
+ * Dispose Bloom Filter.
+ *
+ * @param bloom A pointer to the filter.
+ */
+void bloom_dispose(BloomFilter *bloom);
+
+#endif
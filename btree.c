@@ -0,0 +1,637 @@
+/**
+ *
+ * @file btree.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "stats.h"
+#include "btree.h"
+
+#define BTREE_MAGIC "ISABTREE"
+
+enum BtreeLayout
+{
+    BTREE_VERSION = 1,
+    BTREE_PAGE_HEADER = 8,         // type, reserved byte, 16-bit entry count and 32-bit link
+    BTREE_WRITE_PAGES = 64         // pages collected before one write while building
+};
+
+enum BtreeFrameState
+{
+    BTREE_FRAME_EMPTY = 0,
+    BTREE_FRAME_LOADING = 1, // read by the process that missed it, others wait
+    BTREE_FRAME_READY = 2
+};
+
+/**
+ * Structure representing the header page of an index file, in host byte order.
+ */
+typedef struct
+{
+    char magic[8];                          /**< BTREE_MAGIC. */
+    uint32_t version;                       /**< BTREE_VERSION. */
+    uint32_t pageSize;                      /**< BTREE_PAGE_SIZE. */
+    uint32_t root;                          /**< The page of the root. */
+    uint32_t height;                        /**< The number of levels including the leaves. */
+    uint32_t pageCount;                     /**< The number of pages including the header. */
+    uint32_t reserved;                      /**< Zero. */
+    uint64_t entryCount;                    /**< The number of entries. */
+    unsigned char stamp[BTREE_STAMP_SIZE];  /**< The identity of the indexed data. */
+} BtreeHeader;
+
+/**
+ * Structure representing one frame of the buffer pool.
+ */
+typedef struct
+{
+    uint32_t file;     /**< The number of the index file of the page. */
+    uint32_t page;     /**< The page held by the frame. */
+    int next;          /**< The next frame in the bucket chain or -1. */
+    int pins;          /**< The number of readers of the frame, which is not replaced while they read it. */
+    int state;         /**< The BtreeFrameState. */
+    int referenced;    /**< CLOCK reference bit. */
+} BtreeFrame;
+
+/**
+ * Structure representing the shared buffer pool header.
+ *
+ * The page data is followed by the header, the bucket heads and the frames.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;   /**< Process shared lock guarding the frames. */
+    pthread_cond_t changed; /**< Signaled when a frame was read or unpinned while someone waits. */
+    int waiters;            /**< The number of readers waiting for a frame. */
+    int frameCount;         /**< The number of frames. */
+    int bucketCount;        /**< The number of buckets, a power of two. */
+    int hand;               /**< The CLOCK hand. */
+} BtreePool;
+
+/**
+ * Structure representing the first key of a page written by the build, the separator of its parent.
+ */
+typedef struct
+{
+    const char *key; /**< The first key of the page. */
+    uint8_t length;  /**< The length of the key. */
+    uint32_t page;   /**< The page. */
+} BtreeSeparator;
+
+/**
+ * Structure representing an index file being written page by page.
+ */
+typedef struct
+{
+    int fd;                 /**< The descriptor of the temporary file. */
+    uint32_t pageCount;     /**< The number of pages written or buffered, the header included. */
+    unsigned char *buffer;  /**< The pages not written yet. */
+    int buffered;           /**< The number of buffered pages. */
+    bool failed;            /**< Flag indicating whether a write failed. */
+} BtreeWriter;
+
+static BtreePool *pool;
+static unsigned char *poolPages;
+static int *poolBuckets;
+static BtreeFrame *poolFrames;
+static uint32_t nextFile = 0;
+
+void btree_pool_init(size_t budget)
+{
+    size_t frameSize = BTREE_PAGE_SIZE + sizeof(BtreeFrame) + 2 * sizeof(int);
+    if (budget == 0)
+        return;
+    int frameCount = budget / frameSize;
+    if (frameCount < BTREE_MIN_POOL_FRAMES)
+        frameCount = BTREE_MIN_POOL_FRAMES;
+
+    int bucketCount = 1;
+    while (bucketCount < frameCount)
+        bucketCount <<= 1;
+
+    // the pages come first, so every frame is page aligned
+    size_t size = (size_t)frameCount * BTREE_PAGE_SIZE + sizeof(BtreePool) + bucketCount * sizeof(int) +
+                  frameCount * sizeof(BtreeFrame);
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+
+    poolPages = (unsigned char *)memory;
+    pool = (BtreePool *)(poolPages + (size_t)frameCount * BTREE_PAGE_SIZE);
+    poolBuckets = (int *)(pool + 1);
+    poolFrames = (BtreeFrame *)(poolBuckets + bucketCount);
+    pool->frameCount = frameCount;
+    pool->bucketCount = bucketCount;
+    for (int i = 0; i < bucketCount; i++)
+        poolBuckets[i] = -1;
+    for (int i = 0; i < frameCount; i++)
+        poolFrames[i].next = -1;
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&pool->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    pthread_condattr_t conditionAttributes;
+    pthread_condattr_init(&conditionAttributes);
+    pthread_condattr_setpshared(&conditionAttributes, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&pool->changed, &conditionAttributes);
+    pthread_condattr_destroy(&conditionAttributes);
+}
+
+static int *btree_pool_bucket(uint32_t file, uint32_t page)
+{
+    uint64_t hash = (((uint64_t)file << 32) | page) * 0x9E3779B97F4A7C15ULL;
+    return &poolBuckets[(hash >> 32) & (pool->bucketCount - 1)];
+}
+
+static void btree_pool_unlink(int frame)
+{
+    int *link = btree_pool_bucket(poolFrames[frame].file, poolFrames[frame].page);
+    while (*link != -1 && *link != frame)
+        link = &poolFrames[*link].next;
+    if (*link == frame)
+        *link = poolFrames[frame].next;
+    poolFrames[frame].state = BTREE_FRAME_EMPTY;
+}
+
+static int btree_pool_find(uint32_t file, uint32_t page)
+{
+    int frame = *btree_pool_bucket(file, page);
+    while (frame != -1 && (poolFrames[frame].file != file || poolFrames[frame].page != page))
+        frame = poolFrames[frame].next;
+    return frame;
+}
+
+static int btree_pool_victim(void)
+{
+    // CLOCK: skip pinned and recently used frames, clearing their reference bit
+    for (int step = 0; step < 2 * pool->frameCount; step++)
+    {
+        int frame = pool->hand;
+        pool->hand = (pool->hand + 1) % pool->frameCount;
+        if (poolFrames[frame].pins > 0)
+            continue;
+        if (poolFrames[frame].referenced)
+        {
+            poolFrames[frame].referenced = 0;
+            continue;
+        }
+        return frame;
+    }
+    return -1;
+}
+
+static void btree_pool_wait(void)
+{
+    pool->waiters++;
+    pthread_cond_wait(&pool->changed, &pool->lock);
+    pool->waiters--;
+}
+
+static const unsigned char *btree_pool_pin(const BtreeIndex *tree, uint32_t page, int *pinned)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (1)
+    {
+        int frame = btree_pool_find(tree->file, page);
+        if (frame != -1 && poolFrames[frame].state == BTREE_FRAME_LOADING)
+        {
+            btree_pool_wait();
+            continue;
+        }
+        if (frame != -1)
+        {
+            poolFrames[frame].pins++;
+            poolFrames[frame].referenced = 1;
+            pthread_mutex_unlock(&pool->lock);
+            stats_add(&stats->indexPageHits, 1);
+            *pinned = frame;
+            return poolPages + (size_t)frame * BTREE_PAGE_SIZE;
+        }
+
+        frame = btree_pool_victim();
+        if (frame == -1)
+        {
+            btree_pool_wait();
+            continue;
+        }
+        if (poolFrames[frame].state != BTREE_FRAME_EMPTY)
+            btree_pool_unlink(frame);
+        BtreeFrame *entry = &poolFrames[frame];
+        int *bucket = btree_pool_bucket(tree->file, page);
+        entry->file = tree->file;
+        entry->page = page;
+        entry->pins = 1;
+        entry->referenced = 1;
+        entry->state = BTREE_FRAME_LOADING;
+        entry->next = *bucket;
+        *bucket = frame;
+        pthread_mutex_unlock(&pool->lock);
+        stats_add(&stats->indexPageMisses, 1);
+
+        // the page is read without the lock, readers of the same page wait for it
+        unsigned char *data = poolPages + (size_t)frame * BTREE_PAGE_SIZE;
+        ssize_t got = pread(tree->fd, data, BTREE_PAGE_SIZE, (off_t)page * BTREE_PAGE_SIZE);
+        if (got != BTREE_PAGE_SIZE)
+            perror("pread");
+
+        pthread_mutex_lock(&pool->lock);
+        if (got == BTREE_PAGE_SIZE)
+        {
+            entry->state = BTREE_FRAME_READY;
+        }
+        else
+        {
+            btree_pool_unlink(frame);
+            entry->pins = 0;
+            entry->referenced = 0;
+        }
+        if (pool->waiters > 0)
+            pthread_cond_broadcast(&pool->changed);
+        pthread_mutex_unlock(&pool->lock);
+        *pinned = frame;
+        return got == BTREE_PAGE_SIZE ? data : NULL;
+    }
+}
+
+static void btree_pool_unpin(int frame)
+{
+    pthread_mutex_lock(&pool->lock);
+    poolFrames[frame].pins--;
+    if (pool->waiters > 0)
+        pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static const unsigned char *btree_page(const BtreeIndex *tree, uint32_t page, unsigned char *buffer, int *pinned)
+{
+    // without a pool every page is read into the buffer of the caller
+    *pinned = -1;
+    if (pool != NULL)
+    {
+        const unsigned char *data = btree_pool_pin(tree, page, pinned);
+        if (data == NULL)
+            *pinned = -1;
+        return data;
+    }
+    if (pread(tree->fd, buffer, BTREE_PAGE_SIZE, (off_t)page * BTREE_PAGE_SIZE) != BTREE_PAGE_SIZE)
+    {
+        perror("pread");
+        return NULL;
+    }
+    return buffer;
+}
+
+static void btree_release(int pinned)
+{
+    if (pinned != -1)
+        btree_pool_unpin(pinned);
+}
+
+static uint16_t page_count(const unsigned char *page)
+{
+    uint16_t count;
+    memcpy(&count, page + 2, sizeof(count));
+    return count;
+}
+
+static uint32_t page_link(const unsigned char *page)
+{
+    uint32_t link;
+    memcpy(&link, page + 4, sizeof(link));
+    return link;
+}
+
+static const unsigned char *page_entry(const unsigned char *page, int slot)
+{
+    uint16_t offset;
+    memcpy(&offset, page + BTREE_PAGE_HEADER + slot * sizeof(uint16_t), sizeof(offset));
+    return page + offset;
+}
+
+static uint32_t entry_value(const unsigned char *entry)
+{
+    uint32_t value;
+    memcpy(&value, entry + 1 + entry[0], sizeof(value));
+    return value;
+}
+
+static int btree_key_compare(const char *left, int leftLength, const char *right, int rightLength)
+{
+    int length = leftLength < rightLength ? leftLength : rightLength;
+    int result = memcmp(left, right, length);
+    return result != 0 ? result : leftLength - rightLength;
+}
+
+static int btree_entry_compare(const void *left, const void *right)
+{
+    const BtreeEntry *a = (const BtreeEntry *)left;
+    const BtreeEntry *b = (const BtreeEntry *)right;
+    int result = btree_key_compare(a->key, a->length, b->key, b->length);
+    if (result != 0)
+        return result;
+    return a->row < b->row ? -1 : a->row > b->row;
+}
+
+static int page_first_not_below(const unsigned char *page, const char *key, int keyLength)
+{
+    // the first entry whose key is not below the key
+    int low = 0, high = page_count(page);
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        const unsigned char *entry = page_entry(page, middle);
+        if (btree_key_compare((const char *)entry + 1, entry[0], key, keyLength) < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+static void page_init(unsigned char *page, int type, uint32_t link)
+{
+    memset(page, 0, BTREE_PAGE_SIZE);
+    page[0] = type;
+    memcpy(page + 4, &link, sizeof(link));
+}
+
+static bool page_add(unsigned char *page, int *end, const char *key, uint8_t length, uint32_t value)
+{
+    // the offsets grow from the header, the entries from the end of the page
+    uint16_t count = page_count(page);
+    int offsetsEnd = BTREE_PAGE_HEADER + (count + 1) * sizeof(uint16_t);
+    int size = 1 + length + sizeof(uint32_t);
+    if (*end - size < offsetsEnd)
+        return false;
+    *end -= size;
+    page[*end] = length;
+    memcpy(page + *end + 1, key, length);
+    memcpy(page + *end + 1 + length, &value, sizeof(value));
+    uint16_t offset = *end;
+    memcpy(page + BTREE_PAGE_HEADER + count * sizeof(uint16_t), &offset, sizeof(offset));
+    count++;
+    memcpy(page + 2, &count, sizeof(count));
+    return true;
+}
+
+static void page_set_link(unsigned char *page, uint32_t link)
+{
+    memcpy(page + 4, &link, sizeof(link));
+}
+
+static void writer_flush(BtreeWriter *writer)
+{
+    size_t size = (size_t)writer->buffered * BTREE_PAGE_SIZE;
+    off_t offset = (off_t)(writer->pageCount - writer->buffered) * BTREE_PAGE_SIZE;
+    if (!writer->failed && size > 0 && pwrite(writer->fd, writer->buffer, size, offset) != (ssize_t)size)
+        writer->failed = true;
+    writer->buffered = 0;
+}
+
+static uint32_t writer_put(BtreeWriter *writer, const unsigned char *page)
+{
+    memcpy(writer->buffer + (size_t)writer->buffered * BTREE_PAGE_SIZE, page, BTREE_PAGE_SIZE);
+    writer->buffered++;
+    uint32_t number = writer->pageCount++;
+    if (writer->buffered == BTREE_WRITE_PAGES)
+        writer_flush(writer);
+    return number;
+}
+
+static size_t btree_write_leaves(BtreeWriter *writer, const BtreeEntry *entries, size_t count, BtreeSeparator *separators)
+{
+    unsigned char page[BTREE_PAGE_SIZE];
+    size_t pages = 0;
+    size_t i = 0;
+    do
+    {
+        int end = BTREE_PAGE_SIZE;
+        page_init(page, BTREE_LEAF, 0);
+        separators[pages].key = count > 0 ? entries[i].key : "";
+        separators[pages].length = count > 0 ? entries[i].length : 0;
+        while (i < count && page_add(page, &end, entries[i].key, entries[i].length, entries[i].row))
+            i++;
+        // leaves are written one after another, so the next one is the following page
+        if (i < count)
+            page_set_link(page, writer->pageCount + 1);
+        separators[pages++].page = writer_put(writer, page);
+    } while (i < count);
+    return pages;
+}
+
+static size_t btree_write_branches(BtreeWriter *writer, BtreeSeparator *children, size_t count)
+{
+    // the parents are written over the separators of their children, one parent per several children
+    unsigned char page[BTREE_PAGE_SIZE];
+    size_t parents = 0;
+    size_t i = 0;
+    while (i < count)
+    {
+        int end = BTREE_PAGE_SIZE;
+        BtreeSeparator first = children[i];
+        page_init(page, BTREE_BRANCH, first.page);
+        i++;
+        while (i < count && page_add(page, &end, children[i].key, children[i].length, children[i].page))
+            i++;
+        first.page = writer_put(writer, page);
+        children[parents++] = first;
+    }
+    return parents;
+}
+
+int btree_build(const char *path, const unsigned char *stamp, BtreeEntry *entries, size_t count)
+{
+    qsort(entries, count, sizeof(BtreeEntry), btree_entry_compare);
+
+    char temporary[4096];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+    BtreeWriter writer = {-1, 0, NULL, 0, false};
+    writer.fd = open(temporary, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    writer.buffer = (unsigned char *)malloc((size_t)BTREE_WRITE_PAGES * BTREE_PAGE_SIZE);
+    // every leaf holds at least one entry, so there are never more separators than entries
+    BtreeSeparator *separators = (BtreeSeparator *)malloc((count + 1) * sizeof(BtreeSeparator));
+    if (writer.fd == -1 || writer.buffer == NULL || separators == NULL)
+    {
+        perror(temporary);
+        if (writer.fd != -1)
+            close(writer.fd);
+        free(writer.buffer);
+        free(separators);
+        return -1;
+    }
+
+    // the header is written last, once the root is known
+    unsigned char page[BTREE_PAGE_SIZE];
+    memset(page, 0, sizeof(page));
+    writer_put(&writer, page);
+    size_t level = btree_write_leaves(&writer, entries, count, separators);
+    uint32_t height = 1;
+    while (level > 1)
+    {
+        level = btree_write_branches(&writer, separators, level);
+        height++;
+    }
+    writer_flush(&writer);
+
+    BtreeHeader *header = (BtreeHeader *)page;
+    memcpy(header->magic, BTREE_MAGIC, sizeof(header->magic));
+    header->version = BTREE_VERSION;
+    header->pageSize = BTREE_PAGE_SIZE;
+    header->root = separators[0].page;
+    header->height = height;
+    header->pageCount = writer.pageCount;
+    header->entryCount = count;
+    memcpy(header->stamp, stamp, BTREE_STAMP_SIZE);
+    if (pwrite(writer.fd, page, BTREE_PAGE_SIZE, 0) != BTREE_PAGE_SIZE)
+        writer.failed = true;
+    free(writer.buffer);
+    free(separators);
+
+    bool failed = writer.failed || fsync(writer.fd) == -1;
+    if (close(writer.fd) == -1)
+        failed = true;
+    if (failed || rename(temporary, path) == -1)
+    {
+        perror(temporary);
+        unlink(temporary);
+        return -1;
+    }
+    return 0;
+}
+
+int btree_open(BtreeIndex *tree, const char *path, const unsigned char *stamp)
+{
+    memset(tree, 0, sizeof(BtreeIndex));
+    tree->fd = -1;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    unsigned char page[BTREE_PAGE_SIZE];
+    const BtreeHeader *header = (const BtreeHeader *)page;
+    struct stat info;
+    if (pread(fd, page, BTREE_PAGE_SIZE, 0) != BTREE_PAGE_SIZE || fstat(fd, &info) == -1 ||
+        memcmp(header->magic, BTREE_MAGIC, sizeof(header->magic)) != 0 || header->version != BTREE_VERSION ||
+        header->pageSize != BTREE_PAGE_SIZE || header->height > BTREE_MAX_HEIGHT || header->root >= header->pageCount ||
+        (off_t)header->pageCount * BTREE_PAGE_SIZE != info.st_size || memcmp(header->stamp, stamp, BTREE_STAMP_SIZE) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    tree->fd = fd;
+    tree->file = __atomic_fetch_add(&nextFile, 1, __ATOMIC_RELAXED);
+    tree->root = header->root;
+    tree->height = header->height;
+    tree->pageCount = header->pageCount;
+    tree->entryCount = header->entryCount;
+    return 0;
+}
+
+void btree_close(BtreeIndex *tree)
+{
+    if (btree_is_open(tree))
+        close(tree->fd);
+    memset(tree, 0, sizeof(BtreeIndex));
+    tree->fd = -1;
+}
+
+bool btree_is_open(const BtreeIndex *tree)
+{
+    return tree->pageCount != 0;
+}
+
+static bool btree_cursor_load(BtreeCursor *cursor, uint32_t number)
+{
+    int pinned;
+    const unsigned char *page = btree_page(cursor->tree, number, cursor->page, &pinned);
+    if (page == NULL || page[0] != BTREE_LEAF)
+    {
+        btree_release(pinned);
+        cursor->count = 0;
+        return false;
+    }
+    if (page != cursor->page)
+        memcpy(cursor->page, page, BTREE_PAGE_SIZE);
+    btree_release(pinned);
+    cursor->count = page_count(cursor->page);
+    cursor->next = page_link(cursor->page);
+    cursor->slot = 0;
+    return true;
+}
+
+void btree_lookup(const BtreeIndex *tree, const char *key, int keyLength, bool prefix, BtreeCursor *cursor)
+{
+    cursor->tree = tree;
+    cursor->keyLength = keyLength < BTREE_MAX_KEY ? keyLength : BTREE_MAX_KEY;
+    memcpy(cursor->key, key, cursor->keyLength);
+    cursor->prefix = prefix;
+    cursor->count = 0;
+
+    // every branch leads to the child after the last separator below the key, where the first equal key may be
+    uint32_t number = tree->root;
+    for (uint32_t level = 1; level < tree->height; level++)
+    {
+        int pinned;
+        const unsigned char *page = btree_page(tree, number, cursor->page, &pinned);
+        if (page == NULL || page[0] != BTREE_BRANCH)
+        {
+            btree_release(pinned);
+            return;
+        }
+        int slot = page_first_not_below(page, cursor->key, cursor->keyLength);
+        number = slot == 0 ? page_link(page) : entry_value(page_entry(page, slot - 1));
+        btree_release(pinned);
+    }
+    if (btree_cursor_load(cursor, number))
+        cursor->slot = page_first_not_below(cursor->page, cursor->key, cursor->keyLength);
+}
+
+bool btree_cursor_next(BtreeCursor *cursor, size_t *row, const char **key, int *length)
+{
+    while (cursor->count > 0)
+    {
+        if (cursor->slot == cursor->count)
+        {
+            if (cursor->next == 0 || !btree_cursor_load(cursor, cursor->next))
+                break;
+            continue;
+        }
+
+        const unsigned char *entry = page_entry(cursor->page, cursor->slot);
+        const char *entryKey = (const char *)entry + 1;
+        int entryLength = entry[0];
+        // the keys are ordered, so the first one that does not match ends the walk
+        if (entryLength < cursor->keyLength || (!cursor->prefix && entryLength != cursor->keyLength) ||
+            memcmp(entryKey, cursor->key, cursor->keyLength) != 0)
+            break;
+        cursor->slot++;
+        *row = entry_value(entry);
+        if (key != NULL)
+            *key = entryKey;
+        if (length != NULL)
+            *length = entryLength;
+        return true;
+    }
+    cursor->count = 0;
+    return false;
+}
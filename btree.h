@@ -0,0 +1,164 @@
+/**
+ *
+ * @file btree.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _BTREE_H
+#define _BTREE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum BtreeConst
+{
+    BTREE_PAGE_SIZE = 4096,      // bytes of one page of an index file and of one frame of the buffer pool
+    BTREE_MAX_KEY = 255,         // longer keys are indexed by their first bytes
+    BTREE_STAMP_SIZE = 128,      // bytes identifying the data an index file was built from
+    BTREE_MAX_HEIGHT = 16,       // levels of a tree, far more than 2^32 entries need
+    BTREE_MIN_POOL_FRAMES = 16   // frames of the smallest buffer pool, enough for every page pinned at once
+};
+
+enum BtreePageType
+{
+    BTREE_LEAF = 1,  // keys and rows, linked to the next leaf
+    BTREE_BRANCH = 2 // separator keys and child pages
+};
+
+/**
+ * Structure representing one entry to be indexed.
+ */
+typedef struct
+{
+    const char *key; /**< The normalized key, not null-terminated. */
+    uint32_t row;    /**< The row holding the key. */
+    uint8_t length;  /**< The length of the key, at most BTREE_MAX_KEY. */
+} BtreeEntry;
+
+/**
+ * Structure representing an open index file.
+ *
+ * The file is a header page followed by the leaves in key order and the branch levels
+ * above them. Every page starts with its BtreePageType, the number of entries and a link,
+ * the next leaf or the leftmost child, followed by the offsets of the entries. An entry
+ * is a key length byte, the key and a 32-bit row or child page. The entries of a leaf are
+ * ordered by key and row; the key of a branch entry is the first key of its child.
+ */
+typedef struct
+{
+    int fd;              /**< The descriptor of the file or -1 if none is open. */
+    uint32_t file;       /**< The number of the file in the buffer pool. */
+    uint32_t root;       /**< The page of the root. */
+    uint32_t height;     /**< The number of levels including the leaves. */
+    uint32_t pageCount;  /**< The number of pages including the header. */
+    uint64_t entryCount; /**< The number of entries. */
+} BtreeIndex;
+
+/**
+ * Structure representing a position in the leaves of an index.
+ *
+ * The cursor works on a copy of the current leaf, so no page of the pool stays
+ * pinned between the steps of a search.
+ */
+typedef struct
+{
+    const BtreeIndex *tree;               /**< The index being walked or NULL. */
+    char key[BTREE_MAX_KEY];              /**< The key looked up or the prefix of the keys. */
+    int keyLength;                        /**< The length of the key. */
+    bool prefix;                          /**< Flag indicating whether every key starting with the key is returned. */
+    uint32_t next;                        /**< The leaf following the copied one, 0 after the last one. */
+    int slot;                             /**< The next entry of the copied leaf. */
+    int count;                            /**< The number of entries of the copied leaf, 0 once the walk ended. */
+    unsigned char page[BTREE_PAGE_SIZE];  /**< The copy of the current leaf. */
+} BtreeCursor;
+
+/**
+ * Initialize Buffer Pool.
+ *
+ * Maps the shared memory of the pool caching the pages of every open index file,
+ * replaced by the CLOCK algorithm. Has to be called before the first connection
+ * process is created.
+ *
+ * @param budget The memory budget of the pool in bytes, 0 leaves the pool disabled.
+ */
+void btree_pool_init(size_t budget);
+
+/**
+ * Build Index File.
+ *
+ * Sorts the entries by key and row and writes them bottom up into completely filled
+ * pages, so a lookup reads one page per level. The file is written next to the path
+ * and renamed over it once it is synced.
+ *
+ * @param path    The path of the index file.
+ * @param stamp   The BTREE_STAMP_SIZE bytes identifying the indexed data.
+ * @param entries The entries, reordered by the build.
+ * @param count   The number of entries.
+ *
+ * @return 0 on success, -1 if the file could not be written.
+ */
+int btree_build(const char *path, const unsigned char *stamp, BtreeEntry *entries, size_t count);
+
+/**
+ * Open Index File.
+ *
+ * @param tree  A pointer to the index to open.
+ * @param path  The path of the index file.
+ * @param stamp The BTREE_STAMP_SIZE bytes the file has to have been built with.
+ *
+ * @return 0 on success, -1 if the file is missing, damaged or was built from other data.
+ */
+int btree_open(BtreeIndex *tree, const char *path, const unsigned char *stamp);
+
+/**
+ * Close Index File.
+ *
+ * @param tree A pointer to the index.
+ */
+void btree_close(BtreeIndex *tree);
+
+/**
+ * Check Open Index.
+ *
+ * @param tree A pointer to the index.
+ *
+ * @return true if an index file is open, false otherwise.
+ */
+bool btree_is_open(const BtreeIndex *tree);
+
+/**
+ * Look up Key.
+ *
+ * Descends from the root to the first leaf that may hold the key and copies it into
+ * the cursor. Keys longer than BTREE_MAX_KEY are looked up by their first bytes, so
+ * the returned rows still have to be compared with the key.
+ *
+ * @param tree   A pointer to the open index.
+ * @param key    The normalized key or prefix.
+ * @param keyLength The length of the key.
+ * @param prefix true to return every key starting with the key, false for the key only.
+ * @param cursor A pointer to the cursor to position.
+ */
+void btree_lookup(const BtreeIndex *tree, const char *key, int keyLength, bool prefix, BtreeCursor *cursor);
+
+/**
+ * Next Entry of Cursor.
+ *
+ * Reads the following leaf from the buffer pool once the copied one is exhausted.
+ *
+ * @param cursor A pointer to the cursor.
+ * @param row    A pointer receiving the row of the entry.
+ * @param key    A pointer receiving the key of the entry, valid until the next call, or NULL.
+ * @param length A pointer receiving the length of the key or NULL.
+ *
+ * @return true if an entry was returned, false once no further key matches.
+ */
+bool btree_cursor_next(BtreeCursor *cursor, size_t *row, const char **key, int *length);
+
+#endif
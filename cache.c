@@ -0,0 +1,180 @@
+/**
+ *
+ * @file cache.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "cache.h"
+#include "hash.h"
+#include "stats.h"
+
+/**
+ * Structure representing the shared cache header.
+ *
+ * The header is followed by the bucket heads and the slots.
+ */
+typedef struct
+{
+    pthread_mutex_t lock; /**< Process shared lock guarding the whole cache. */
+    int slotCount;        /**< The number of slots. */
+    int bucketCount;      /**< The number of buckets, a power of two. */
+    int hand;             /**< The CLOCK hand. */
+} CacheHeader;
+
+static CacheHeader *cache;
+static int *buckets;
+static CacheSlot *slots;
+
+void cache_init(size_t budget)
+{
+    int slotCount = (budget - sizeof(CacheHeader)) / (sizeof(CacheSlot) + 2 * sizeof(int));
+    if (budget <= sizeof(CacheHeader) || slotCount < 1)
+        return;
+
+    int bucketCount = 1;
+    while (bucketCount < slotCount)
+        bucketCount <<= 1;
+
+    size_t size = sizeof(CacheHeader) + bucketCount * sizeof(int) + slotCount * sizeof(CacheSlot);
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+
+    cache = (CacheHeader *)memory;
+    buckets = (int *)(cache + 1);
+    slots = (CacheSlot *)(buckets + bucketCount);
+    cache->slotCount = slotCount;
+    cache->bucketCount = bucketCount;
+    cache->hand = 0;
+    for (int i = 0; i < bucketCount; i++)
+        buckets[i] = -1;
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&cache->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+bool cache_enabled(void)
+{
+    return cache != NULL;
+}
+
+static void cache_unlink(int slot)
+{
+    int *link = &buckets[slots[slot].hash & (cache->bucketCount - 1)];
+    while (*link != -1 && *link != slot)
+        link = &slots[*link].next;
+    if (*link == slot)
+        *link = slots[slot].next;
+    slots[slot].used = 0;
+}
+
+static int cache_find(const char *key, int keyLength, uint64_t hash)
+{
+    int slot = buckets[hash & (cache->bucketCount - 1)];
+    while (slot != -1)
+    {
+        CacheSlot *entry = &slots[slot];
+        if (entry->hash == hash && entry->keyLength == keyLength && memcmp(entry->key, key, keyLength) == 0)
+            return slot;
+        slot = entry->next;
+    }
+    return -1;
+}
+
+bool cache_lookup(const char *key, int keyLength, unsigned long version, uint32_t *rows, int *rowCount, int *resultCode)
+{
+    if (cache == NULL || keyLength > CACHE_KEY_SIZE)
+        return false;
+
+    uint64_t hash = hash_bytes(key, keyLength);
+    bool found = false;
+
+    pthread_mutex_lock(&cache->lock);
+    int slot = cache_find(key, keyLength, hash);
+    if (slot != -1 && slots[slot].version != version)
+    {
+        // computed for an older snapshot of the directory
+        cache_unlink(slot);
+        slot = -1;
+    }
+    if (slot != -1)
+    {
+        CacheSlot *entry = &slots[slot];
+        entry->referenced = 1;
+        memcpy(rows, entry->rows, entry->rowCount * sizeof(uint32_t));
+        *rowCount = entry->rowCount;
+        *resultCode = entry->resultCode;
+        found = true;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    stats_add(found ? &stats->cacheHits : &stats->cacheMisses, 1);
+    return found;
+}
+
+void cache_store(const char *key, int keyLength, unsigned long version, const uint32_t *rows, int rowCount, int resultCode)
+{
+    if (cache == NULL)
+        return;
+    if (keyLength > CACHE_KEY_SIZE || rowCount > CACHE_SLOT_ROWS)
+    {
+        stats_add(&stats->cacheUncacheable, 1);
+        return;
+    }
+
+    uint64_t hash = hash_bytes(key, keyLength);
+
+    pthread_mutex_lock(&cache->lock);
+    int slot = cache_find(key, keyLength, hash);
+    if (slot == -1)
+    {
+        // CLOCK: skip recently used slots, clearing their reference bit
+        while (slots[cache->hand].used && slots[cache->hand].referenced)
+        {
+            slots[cache->hand].referenced = 0;
+            cache->hand = (cache->hand + 1) % cache->slotCount;
+        }
+        slot = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->slotCount;
+        if (slots[slot].used)
+        {
+            cache_unlink(slot);
+            stats_add(&stats->cacheEvictions, 1);
+        }
+
+        CacheSlot *entry = &slots[slot];
+        entry->hash = hash;
+        entry->keyLength = keyLength;
+        memcpy(entry->key, key, keyLength);
+        entry->next = buckets[hash & (cache->bucketCount - 1)];
+        buckets[hash & (cache->bucketCount - 1)] = slot;
+        entry->used = 1;
+    }
+
+    CacheSlot *entry = &slots[slot];
+    entry->version = version;
+    entry->referenced = 0;
+    entry->resultCode = resultCode;
+    entry->rowCount = rowCount;
+    memcpy(entry->rows, rows, rowCount * sizeof(uint32_t));
+    pthread_mutex_unlock(&cache->lock);
+
+    stats_add(&stats->cacheStores, 1);
+}
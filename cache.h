@@ -0,0 +1,88 @@
+/**
+ *
+ * @file cache.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum CacheConst
+{
+    CACHE_KEY_SIZE = 256,                // maximal length of a canonical query
+    CACHE_SLOT_ROWS = 184,               // maximal number of cached rows per query
+    CACHE_DEFAULT_BUDGET = 8 * 1024 * 1024
+};
+
+/**
+ * Structure representing one cached query.
+ */
+typedef struct
+{
+    uint64_t hash;               /**< The hash of the canonical query. */
+    unsigned long version;       /**< The directory version the result was computed for. */
+    int next;                    /**< The next slot in the bucket chain or -1. */
+    unsigned char used;          /**< Flag indicating whether the slot holds a query. */
+    unsigned char referenced;    /**< CLOCK reference bit. */
+    unsigned char resultCode;    /**< The result code of the search. */
+    unsigned short keyLength;    /**< The length of the canonical query. */
+    unsigned short rowCount;     /**< The number of matching rows. */
+    char key[CACHE_KEY_SIZE];    /**< The canonical query. */
+    uint32_t rows[CACHE_SLOT_ROWS]; /**< The matching rows in directory order. */
+} CacheSlot;
+
+/**
+ * Initialize Query Cache.
+ *
+ * Maps the shared memory of the cache. Has to be called before the first
+ * connection process is created.
+ *
+ * @param budget The memory budget of the cache in bytes, 0 disables the cache.
+ */
+void cache_init(size_t budget);
+
+/**
+ * Look up Query in Cache.
+ *
+ * @param key        A pointer to the canonical query.
+ * @param keyLength  The length of the canonical query.
+ * @param version    The current directory version. Results of other versions are dropped.
+ * @param rows       A pointer to the array of at least CACHE_SLOT_ROWS rows to fill.
+ * @param rowCount   A pointer to the number of filled rows.
+ * @param resultCode A pointer to the cached result code.
+ *
+ * @return true if the query was found.
+ */
+bool cache_lookup(const char *key, int keyLength, unsigned long version, uint32_t *rows, int *rowCount, int *resultCode);
+
+/**
+ * Store Query Result in Cache.
+ *
+ * Stores the rows matching the query, evicting an unreferenced query using the CLOCK algorithm.
+ *
+ * @param key        A pointer to the canonical query.
+ * @param keyLength  The length of the canonical query.
+ * @param version    The directory version the result was computed for.
+ * @param rows       A pointer to the matching rows.
+ * @param rowCount   The number of matching rows.
+ * @param resultCode The result code of the search.
+ */
+void cache_store(const char *key, int keyLength, unsigned long version, const uint32_t *rows, int rowCount, int resultCode);
+
+/**
+ * Check whether Cache is Enabled.
+ *
+ * @return true if the cache was initialized with a non-zero budget.
+ */
+bool cache_enabled(void);
+
+#endif
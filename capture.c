@@ -0,0 +1,118 @@
+/**
+ *
+ * @file capture.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "capture.h"
+
+static int captureFile = -1;
+static uint32_t *nextConnection;
+static __thread uint32_t connection;
+static __thread unsigned char *buffer;
+static __thread size_t bufferLength;
+
+static uint64_t capture_now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+int capture_init(const char *path)
+{
+    // O_APPEND keeps the blocks of all processes whole
+    captureFile = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (captureFile == -1)
+    {
+        perror(path);
+        return -1;
+    }
+    CaptureHeader header = {CAPTURE_MAGIC, CAPTURE_VERSION, capture_now()};
+    if (write(captureFile, &header, sizeof(header)) != sizeof(header))
+    {
+        perror(path);
+        close(captureFile);
+        captureFile = -1;
+        return -1;
+    }
+
+    nextConnection = (uint32_t *)mmap(NULL, sizeof(uint32_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (nextConnection == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+    return 0;
+}
+
+void capture_open(void)
+{
+    if (captureFile == -1)
+        return;
+    buffer = (unsigned char *)malloc(CAPTURE_BUFFER_SIZE);
+    if (buffer == NULL)
+    {
+        perror("malloc");
+        return;
+    }
+    bufferLength = 0;
+    connection = __atomic_add_fetch(nextConnection, 1, __ATOMIC_RELAXED);
+}
+
+void capture_flush(void)
+{
+    if (buffer == NULL || bufferLength == 0)
+        return;
+    if (write(captureFile, buffer, bufferLength) != (ssize_t)bufferLength)
+        perror("capture");
+    bufferLength = 0;
+}
+
+static void capture_record(int type, const unsigned char *data, size_t length)
+{
+    if (bufferLength + sizeof(CaptureRecord) + length > CAPTURE_BUFFER_SIZE)
+        capture_flush();
+    CaptureRecord record = {capture_now(), connection, type, length};
+    memcpy(buffer + bufferLength, &record, sizeof(record));
+    if (length > 0)
+        memcpy(buffer + bufferLength + sizeof(record), data, length);
+    bufferLength += sizeof(record) + length;
+}
+
+void capture_data(int type, const unsigned char *data, size_t length)
+{
+    if (buffer == NULL)
+        return;
+    while (length > 0)
+    {
+        size_t chunk = length < CAPTURE_MAX_CHUNK ? length : CAPTURE_MAX_CHUNK;
+        capture_record(type, data, chunk);
+        data += chunk;
+        length -= chunk;
+    }
+}
+
+void capture_close(void)
+{
+    if (buffer == NULL)
+        return;
+    capture_record(CAPTURE_CLOSE, NULL, 0);
+    capture_flush();
+    free(buffer);
+    buffer = NULL;
+    connection = 0;
+}
@@ -0,0 +1,104 @@
+/**
+ *
+ * @file capture.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _CAPTURE_H
+#define _CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum CaptureConst
+{
+    CAPTURE_MAGIC = 0x50434C44,         // "LDCP"
+    CAPTURE_VERSION = 1,
+    CAPTURE_MAX_CHUNK = 0xFFFF,         // bytes carried by one record, longer data is split
+    CAPTURE_BUFFER_SIZE = 1 << 17       // records buffered per connection before they are written
+};
+
+enum CaptureType
+{
+    CAPTURE_REQUEST,  // bytes received from the client
+    CAPTURE_RESPONSE, // bytes of an encoded response
+    CAPTURE_CLOSE     // the connection ended, no data
+};
+
+/**
+ * Structure representing the header of a capture file.
+ *
+ * The header is followed by records, every record by its data. The records of one
+ * connection are in order, records of different connections are interleaved in
+ * blocks and have to be ordered by their time.
+ */
+typedef struct
+{
+    uint32_t magic;   /**< CAPTURE_MAGIC. */
+    uint32_t version; /**< CAPTURE_VERSION. */
+    uint64_t start;   /**< CLOCK_MONOTONIC time the capture started in nanoseconds. */
+} CaptureHeader;
+
+/**
+ * Structure representing one captured chunk of data.
+ */
+typedef struct
+{
+    uint64_t time;       /**< CLOCK_MONOTONIC time of the chunk in nanoseconds. */
+    uint32_t connection; /**< The number of the connection, starting at 1. */
+    uint16_t type;       /**< The CaptureType. */
+    uint16_t length;     /**< The number of data bytes following the record. */
+} CaptureRecord;
+
+/**
+ * Initialize Traffic Capture.
+ *
+ * Truncates the capture file and writes its header. Has to be called before the first
+ * connection process is created, all processes append to the same file.
+ *
+ * @param path The capture file.
+ *
+ * @return 0 on success, -1 if the file could not be created.
+ */
+int capture_init(const char *path);
+
+/**
+ * Start Capturing Connection.
+ *
+ * Numbers the connection served by the calling thread. Does nothing when capturing is off.
+ */
+void capture_open(void);
+
+/**
+ * Capture Data.
+ *
+ * Buffers the bytes as records of the connection served by the calling thread.
+ * Does nothing when capturing is off or no connection was opened.
+ *
+ * @param type   The CaptureType.
+ * @param data   A pointer to the bytes.
+ * @param length The number of bytes.
+ */
+void capture_data(int type, const unsigned char *data, size_t length);
+
+/**
+ * Write Captured Records.
+ *
+ * Appends the buffered records of the calling thread in one write, so the records
+ * of connections served by other processes never split them.
+ */
+void capture_flush(void);
+
+/**
+ * Stop Capturing Connection.
+ *
+ * Records the end of the connection and writes its remaining records.
+ */
+void capture_close(void);
+
+#endif
@@ -0,0 +1,180 @@
+/**
+ *
+ * @file compare.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include "utils.h"
+#include "arena.h"
+#include "directory.h"
+#include "schema.h"
+#include "normalize.h"
+#include "hash.h"
+#include "stats.h"
+#include "search.h"
+#include "compare.h"
+#include "trace.h"
+#include "response.h"
+
+extern __thread int currentTagPosition;
+
+static bool compare_read_string(const unsigned char *data, size_t end, size_t *position, char **value)
+{
+    size_t length;
+    if (ber_read_header(data, end, position, &length) != OCTET_STRING_TYPE)
+        return false;
+    *value = arena_strndup(requestArena, (const char *)data + *position, length);
+    *position += length;
+    return true;
+}
+
+LdapCompare ldap_compare(const unsigned char *data, size_t length, int messageId)
+{
+    LdapCompare compare;
+    compare.messageId = messageId;
+    compare.entry = "";
+    compare.attributeDescription = "";
+    compare.assertionValue = "";
+    compare.valid = false;
+
+    size_t position = 0, elementLength;
+    if (ber_read_header(data, length, &position, &elementLength) != LDAP_MESSAGE_PREFIX ||
+        ber_read_header(data, length, &position, &elementLength) != INTEGER_TYPE)
+        return compare;
+    position += elementLength;
+    if (ber_read_header(data, length, &position, &elementLength) != LDAP_COMPARE_REQUEST)
+        return compare;
+    size_t end = position + elementLength;
+
+    // the entry is followed by the attribute value assertion sequence
+    if (!compare_read_string(data, end, &position, &compare.entry) ||
+        ber_read_header(data, end, &position, &elementLength) != LDAP_MESSAGE_PREFIX)
+        return compare;
+    size_t assertionEnd = position + elementLength;
+    if (!compare_read_string(data, assertionEnd, &position, &compare.attributeDescription) ||
+        !compare_read_string(data, assertionEnd, &position, &compare.assertionValue))
+        return compare;
+    compare.valid = true;
+    return compare;
+}
+
+bool split_entry_dn(const Directory *directory, const char *dn, Field *rdn)
+{
+    const Schema *schema = &directory->schema;
+    int length = strlen(dn);
+    int suffixLength = strlen(directory->dnSuffix);
+    if (length < suffixLength || strcasecmp(dn + length - suffixLength, directory->dnSuffix) != 0)
+        return false;
+    length -= suffixLength;
+
+    // "uid=xbalek02" names the same entry as "xbalek02"
+    const char *equals = memchr(dn, '=', length);
+    if (equals != NULL)
+    {
+        char *name = arena_strndup(requestArena, dn, equals - dn);
+        if (schema_find(schema, name) == schema->rdn)
+        {
+            length -= equals + 1 - dn;
+            dn = equals + 1;
+        }
+    }
+    rdn->value = dn;
+    rdn->length = length;
+    return true;
+}
+
+bool find_entry_by_dn(const Directory *directory, const char *dn, size_t *row)
+{
+    const Schema *schema = &directory->schema;
+    Field value;
+    if (!split_entry_dn(directory, dn, &value))
+        return false;
+
+    const Attribute *attribute = &schema->attributes[schema->rdn];
+    char *key = (char *)arena_alloc(requestArena, value.length + 1);
+    Field rdn;
+    rdn.value = key;
+    rdn.length = normalize_value(value.value, value.length, key, true, attribute->rule == CASE_IGNORE_MATCH);
+
+    char *scratch = (char *)arena_alloc(requestArena, directory->columns[schema->rdn].maxLength + 1);
+    return directory_find_row(directory, schema->rdn, rdn, scratch, row);
+}
+
+int ldap_compare_evaluate(LdapCompare compare, Directory *directory)
+{
+    if (!compare.valid)
+        return PROTOCOL_ERROR;
+
+    int column = schema_find(&directory->schema, compare.attributeDescription);
+    if (column == -1 || column == directory->schema.password)
+        return UNDEFINED_ATTRIBUTE_TYPE;
+
+    size_t row;
+    if (!find_entry_by_dn(directory, compare.entry, &row))
+        return NO_SUCH_OBJECT;
+
+    LdapFilter filter;
+    memset(&filter, 0, sizeof(LdapFilter));
+    filter.filterType = EQUALITY_MATCH_FILTER;
+    filter.attributeValue = compare.assertionValue;
+    filter.attributeValueLength = strlen(compare.assertionValue);
+    normalize_filter(&filter, &directory->schema.attributes[column]);
+
+    // a value missing from the whole column is not in the entry either; compares have their own
+    // counters, as a false entry does not tell whether the value is elsewhere in the column
+    if (directory->schema.attributes[column].indexed)
+    {
+        stats_add(&stats->compareBloomChecks, 1);
+        if (!directory_may_contain(directory, column, hash_bytes(filter.attributeValue, filter.attributeValueLength)))
+        {
+            stats_add(&stats->compareBloomNegatives, 1);
+            return COMPARE_FALSE;
+        }
+    }
+
+    char *scratch = (char *)arena_alloc(requestArena, directory->columns[column].maxLength + 1);
+    return is_row_matching(filter, directory, row, column, scratch) ? COMPARE_TRUE : COMPARE_FALSE;
+}
+
+void ldap_compare_response_encode(unsigned char *buff, int *offset, int resultCode)
+{
+    add_ldap_byte(buff, offset, LDAP_COMPARE_RESPONSE);
+    int resultLengthOffset = *offset;
+    add_ldap_byte(buff, offset, LDAP_PLACEHOLDER);
+
+    add_ldap_byte(buff, offset, ENUMERATED_TYPE);
+    add_ldap_byte(buff, offset, 0x01);
+    add_ldap_byte(buff, offset, resultCode);
+    add_ldap_string(buff, offset, "");
+    switch (resultCode)
+    {
+    case NO_SUCH_OBJECT:
+        add_ldap_string(buff, offset, "No such entry.");
+        break;
+    case UNDEFINED_ATTRIBUTE_TYPE:
+        add_ldap_string(buff, offset, "Unknown attribute.");
+        break;
+    default:
+        add_ldap_string(buff, offset, "");
+        break;
+    }
+
+    set_ldap_length(buff, offset, resultLengthOffset);
+}
+
+void ldap_compare_response(LdapCompare compare, int resultCode, int clientSocket)
+{
+    trace(TRACE_INFO, TRACE_COMPARE, compare.messageId, resultCode, 0);
+    response_send(RESPONSE_COMPARE, resultCode, compare.messageId, clientSocket);
+}
@@ -0,0 +1,112 @@
+/**
+ *
+ * @file compare.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _COMPARE_H
+#define _COMPARE_H
+
+#include "directory.h"
+
+/**
+ * Structure representing an LDAP Compare request.
+ *
+ * The LdapCompare structure is used to represent an LDAP Compare request, containing
+ * the dn of the compared entry and the attribute value assertion.
+ */
+typedef struct
+{
+    int messageId;              /**< The unique identifier for the LDAP message. */
+    char *entry;                /**< The dn of the compared entry. */
+    char *attributeDescription; /**< The description of the compared attribute. */
+    char *assertionValue;       /**< The asserted value. */
+    bool valid;                 /**< Flag indicating whether the request could be decoded. */
+} LdapCompare;
+
+/**
+ * LDAP Compare Operation.
+ *
+ * Decodes an LDAP compare request using the provided data and message ID. No element
+ * is read past the given length; a request that does not decode is marked invalid.
+ *
+ * @param data      A pointer to the whole LDAP message of the compare request.
+ * @param length    The length of the message.
+ * @param messageId An integer representing the unique identifier for the LDAP message.
+ *
+ * @return An LdapCompare structure. The strings are allocated from the request arena.
+ */
+LdapCompare ldap_compare(const unsigned char *data, size_t length, int messageId);
+
+/**
+ * Split Entry DN.
+ *
+ * Strips the directory suffix and an optional "<rdn attribute>=" prefix from the dn.
+ *
+ * @param directory A pointer to the loaded database file.
+ * @param dn        The null-terminated dn.
+ * @param rdn       A pointer to the field receiving the rdn value, pointing into the dn.
+ *
+ * @return true if the dn ends with the directory suffix, false otherwise.
+ */
+bool split_entry_dn(const Directory *directory, const char *dn, Field *rdn);
+
+/**
+ * Find Entry by DN.
+ *
+ * Strips the directory suffix and an optional "<rdn attribute>=" prefix from the dn
+ * and looks the rdn value up in the rdn column, using its equality index when it is indexed.
+ *
+ * @param directory A pointer to the loaded database file.
+ * @param dn        The null-terminated dn.
+ * @param row       A pointer receiving the row of the entry.
+ *
+ * @return true if the entry exists, false otherwise.
+ */
+bool find_entry_by_dn(const Directory *directory, const char *dn, size_t *row);
+
+/**
+ * Evaluate LDAP Compare.
+ *
+ * Finds the compared entry and checks the asserted value against the values of
+ * its attribute. Indexed attributes are first checked against their Bloom filter,
+ * so most false comparisons do not touch the entry at all. No entry is encoded and
+ * nothing is scanned when the rdn attribute is indexed.
+ *
+ * @param compare   The LdapCompare structure.
+ * @param directory A pointer to the loaded database file.
+ *
+ * @return COMPARE_TRUE, COMPARE_FALSE, NO_SUCH_OBJECT, UNDEFINED_ATTRIBUTE_TYPE or
+ *         PROTOCOL_ERROR for a request that could not be decoded.
+ */
+int ldap_compare_evaluate(LdapCompare compare, Directory *directory);
+
+/**
+ * Encode LDAP Compare Response.
+ *
+ * Encodes the protocol operation of a compare response without a message header,
+ * used to build the response templates.
+ *
+ * @param buff          A pointer to the buffer.
+ * @param offset        A pointer to the offset in the buffer, moved past the response.
+ * @param resultCode    The result of the comparison.
+ */
+void ldap_compare_response_encode(unsigned char *buff, int *offset, int resultCode);
+
+/**
+ * Send an LDAP Compare response to the client.
+ *
+ * @param compare       The LdapCompare structure representing the Compare request.
+ * @param resultCode    The result of the comparison.
+ * @param clientSocket  The socket for communication with the client.
+ */
+void ldap_compare_response(LdapCompare compare, int resultCode, int clientSocket);
+
+void ldap_send(unsigned char *bufin, int clientSocket, int offset);
+
+#endif
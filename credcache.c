@@ -0,0 +1,147 @@
+/**
+ *
+ * @file credcache.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include "hash.h"
+#include "sha256.h"
+#include "password.h"
+#include "stats.h"
+#include "credcache.h"
+
+/**
+ * Structure representing one remembered credential.
+ */
+typedef struct
+{
+    uint64_t row;                              /**< The row of the entry plus one, 0 for an empty slot. */
+    uint64_t expires;                          /**< CLOCK_MONOTONIC time the credential is forgotten. */
+    unsigned char digest[SHA256_DIGEST_SIZE];  /**< The salted digest of the credential. */
+} CredentialSlot;
+
+/**
+ * Structure representing the credential cache shared by all connection processes.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;                                          /**< Process shared lock guarding the slots. */
+    uint64_t ttl;                                                  /**< The time to live in nanoseconds. */
+    unsigned char salt[SHA256_DIGEST_SIZE];                        /**< The random salt of the digests. */
+    CredentialSlot slots[CREDENTIAL_CACHE_SETS][CREDENTIAL_CACHE_WAYS]; /**< The sets of slots. */
+} CredentialCache;
+
+static CredentialCache *cache;
+
+static uint64_t credcache_now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+void credcache_init(double ttl)
+{
+    if (ttl <= 0)
+        return;
+    cache = (CredentialCache *)mmap(NULL, sizeof(CredentialCache), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (cache == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+    if (getrandom(cache->salt, sizeof(cache->salt), 0) != sizeof(cache->salt))
+    {
+        perror("getrandom");
+        exit(1);
+    }
+    cache->ttl = ttl * 1e9;
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&cache->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+static void credcache_digest(size_t row, const char *stored, size_t storedLength, const char *password, size_t passwordLength,
+                             unsigned char *digest)
+{
+    // the stored hash is part of the digest, so a changed password of the entry never matches
+    uint64_t header[2] = {row, storedLength};
+    Sha256 sha;
+    sha256_init(&sha);
+    sha256_update(&sha, cache->salt, sizeof(cache->salt));
+    sha256_update(&sha, header, sizeof(header));
+    sha256_update(&sha, stored, storedLength);
+    sha256_update(&sha, password, passwordLength);
+    sha256_final(&sha, digest);
+}
+
+static CredentialSlot *credcache_set(size_t row)
+{
+    uint64_t key = row;
+    return cache->slots[hash_bytes(&key, sizeof(key)) & (CREDENTIAL_CACHE_SETS - 1)];
+}
+
+bool credcache_lookup(size_t row, const char *stored, size_t storedLength, const char *password, size_t passwordLength)
+{
+    if (cache == NULL)
+        return false;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    credcache_digest(row, stored, storedLength, password, passwordLength, digest);
+    uint64_t time = credcache_now();
+
+    bool found = false;
+    pthread_mutex_lock(&cache->lock);
+    CredentialSlot *set = credcache_set(row);
+    for (int way = 0; way < CREDENTIAL_CACHE_WAYS; way++)
+    {
+        if (set[way].row == row + 1 && set[way].expires > time)
+            found = password_equal(set[way].digest, digest, sizeof(digest));
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    stats_add(found ? &stats->credentialCacheHits : &stats->credentialCacheMisses, 1);
+    return found;
+}
+
+void credcache_store(size_t row, const char *stored, size_t storedLength, const char *password, size_t passwordLength)
+{
+    if (cache == NULL)
+        return;
+    unsigned char digest[SHA256_DIGEST_SIZE];
+    credcache_digest(row, stored, storedLength, password, passwordLength, digest);
+    uint64_t time = credcache_now();
+
+    pthread_mutex_lock(&cache->lock);
+    CredentialSlot *set = credcache_set(row), *victim = &set[0];
+    for (int way = 0; way < CREDENTIAL_CACHE_WAYS; way++)
+    {
+        if (set[way].row == row + 1)
+        {
+            victim = &set[way];
+            break;
+        }
+        if (set[way].expires < victim->expires)
+            victim = &set[way];
+    }
+    victim->row = row + 1;
+    victim->expires = time + cache->ttl;
+    memcpy(victim->digest, digest, sizeof(digest));
+    pthread_mutex_unlock(&cache->lock);
+}
@@ -0,0 +1,64 @@
+/**
+ *
+ * @file credcache.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _CREDCACHE_H
+#define _CREDCACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+enum CredentialCacheConst
+{
+    CREDENTIAL_CACHE_SETS = 1024,   // sets of the cache, a power of two
+    CREDENTIAL_CACHE_WAYS = 4,      // entries of one set
+    CREDENTIAL_CACHE_DEFAULT_TTL = 300
+};
+
+/**
+ * Initialize Credential Cache.
+ *
+ * Maps the shared memory of the cache and draws its random salt. Has to be called
+ * before the first connection process is created.
+ *
+ * @param ttl Seconds a verified credential is remembered, 0 disables the cache.
+ */
+void credcache_init(double ttl);
+
+/**
+ * Look up Verified Credential.
+ *
+ * The cache keeps only a salted SHA-256 digest of the entry, its stored hash and the
+ * password, compared in constant time, never the password itself.
+ *
+ * @param row            The row of the entry.
+ * @param stored         A pointer to the stored password hash of the entry.
+ * @param storedLength   The length of the stored hash.
+ * @param password       A pointer to the password of the bind.
+ * @param passwordLength The length of the password.
+ *
+ * @return true if the same password was verified for the entry within the time to live.
+ */
+bool credcache_lookup(size_t row, const char *stored, size_t storedLength, const char *password, size_t passwordLength);
+
+/**
+ * Remember Verified Credential.
+ *
+ * Replaces the entry of the row or the entry expiring first in its set.
+ *
+ * @param row            The row of the entry.
+ * @param stored         A pointer to the stored password hash of the entry.
+ * @param storedLength   The length of the stored hash.
+ * @param password       A pointer to the verified password.
+ * @param passwordLength The length of the password.
+ */
+void credcache_store(size_t row, const char *stored, size_t storedLength, const char *password, size_t passwordLength);
+
+#endif
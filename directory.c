@@ -0,0 +1,1135 @@
+/**
+ *
+ * @file directory.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "directory.h"
+#include "normalize.h"
+#include "hash.h"
+#include "arena.h"
+#include "overlay.h"
+
+/**
+ * Structure representing the part of the file parsed by one thread.
+ */
+typedef struct
+{
+    const char *data;  /**< The first byte of the mapped file. */
+    char *keyData;     /**< The normalized key buffer of the directory. */
+    Directory *directory; /**< The directory being loaded. */
+    const int *attributeOf; /**< The attribute of every file column or -1 for skipped columns. */
+    const char *start; /**< The first byte of the chunk. */
+    const char *end;   /**< One past the last byte of the chunk. */
+    Field *values;     /**< The value slots of the first line reserved for the chunk, one per attribute. */
+    Field *keys;       /**< The key slots of the first line reserved for the chunk, one per attribute. */
+    size_t capacity;   /**< The number of reserved line slots. */
+    size_t lineCount;  /**< The number of parsed lines. */
+    pthread_t worker;  /**< The thread parsing the chunk. */
+    int started;       /**< Flag indicating whether the worker thread was started. */
+} Chunk;
+
+const char *find_separator(const char *data, const char *end)
+{
+#ifdef __SSE2__
+    const __m128i semicolon = _mm_set1_epi8(';');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (data + 16 <= end)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)data);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, semicolon), _mm_cmpeq_epi8(block, newline)));
+        if (mask != 0)
+            return data + __builtin_ctz(mask);
+        data += 16;
+    }
+#endif
+    while (data < end && *data != ';' && *data != '\n')
+        data++;
+    return data;
+}
+
+size_t count_lines(const char *data, const char *end)
+{
+    size_t count = 0;
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (data + 16 <= end)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)data);
+        count += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+        data += 16;
+    }
+#endif
+    while (data < end)
+    {
+        if (*data++ == '\n')
+            count++;
+    }
+    return count;
+}
+
+bool field_next_value(Field *rest, char separator, Field *value)
+{
+    if (rest->length < 0)
+        return false;
+
+    const char *found = separator != 0 ? (const char *)memchr(rest->value, separator, rest->length) : NULL;
+    value->value = rest->value;
+    value->length = found != NULL ? (int)(found - rest->value) : rest->length;
+    rest->value += value->length + 1;
+    rest->length -= value->length + 1;
+    return true;
+}
+
+int directory_normalize(const Attribute *attribute, Field field, char *key)
+{
+    bool foldCase = attribute->rule == CASE_IGNORE_MATCH;
+    Field rest = field, value;
+    int length = 0;
+
+    // every value of a multi-valued field is trimmed on its own
+    while (field_next_value(&rest, attribute->separator, &value))
+    {
+        if (value.value != field.value)
+            key[length++] = attribute->separator;
+        length += normalize_value(value.value, value.length, key + length, true, foldCase);
+    }
+    return length;
+}
+
+static void *parse_chunk(void *arg)
+{
+    Chunk *chunk = (Chunk *)arg;
+    const Schema *schema = &chunk->directory->schema;
+    int stride = schema->attributeCount;
+    const char *position = chunk->start;
+    chunk->lineCount = 0;
+
+    while (position < chunk->end)
+    {
+        Field *values = chunk->values + chunk->lineCount * stride;
+        Field *keys = chunk->keys + chunk->lineCount * stride;
+        const char *separator;
+        const char *fieldEnd;
+        int column = 0;
+        int firstLength = 0;
+
+        for (int attribute = 0; attribute < stride; attribute++)
+            values[attribute].value = NULL;
+
+        do
+        {
+            separator = find_separator(position, chunk->end);
+            fieldEnd = separator;
+
+            // CRLF line endings
+            if ((separator == chunk->end || *separator == '\n') && fieldEnd > position && fieldEnd[-1] == '\r')
+                fieldEnd--;
+
+            if (column == 0)
+                firstLength = (int)(fieldEnd - position);
+            int attribute = column < schema->csvColumns ? chunk->attributeOf[column] : -1;
+            if (attribute != -1)
+            {
+                char *key = chunk->keyData + (position - chunk->data);
+                values[attribute].value = position;
+                values[attribute].length = (int)(fieldEnd - position);
+                keys[attribute].value = key;
+                keys[attribute].length = directory_normalize(&schema->attributes[attribute], values[attribute], key);
+            }
+            column++;
+            position = separator + 1;
+        } while (separator < chunk->end && *separator == ';');
+
+        // skip empty lines
+        if (column == 1 && firstLength == 0)
+            continue;
+
+        // missing columns are empty
+        for (int attribute = 0; attribute < stride; attribute++)
+        {
+            if (values[attribute].value != NULL)
+                continue;
+            values[attribute].value = fieldEnd;
+            values[attribute].length = 0;
+            keys[attribute].value = fieldEnd;
+            keys[attribute].length = 0;
+        }
+        chunk->lineCount++;
+    }
+    return NULL;
+}
+
+/**
+ * Structure representing a hash table used to intern values while a column is built.
+ */
+typedef struct
+{
+    uint32_t *refs;   /**< The pool offset plus one of every slot, 0 for empty slots. */
+    uint32_t *hashes; /**< The hash of the value in every slot. */
+    size_t capacity;  /**< The number of slots, a power of two. */
+    size_t count;     /**< The number of used slots. */
+} InternTable;
+
+/**
+ * Structure representing a growable pool of value records.
+ */
+typedef struct
+{
+    unsigned char *data; /**< The records. */
+    size_t size;         /**< The used size in bytes. */
+    size_t capacity;     /**< The allocated size in bytes. */
+} Pool;
+
+/**
+ * Structure representing the work of one column building thread.
+ */
+typedef struct
+{
+    Directory *directory; /**< The directory being loaded. */
+    const Field *values;  /**< The parsed values, one per attribute of every line. */
+    const Field *keys;    /**< The normalized keys, one per attribute of every line. */
+    int column;           /**< The column to build. */
+    int failed;           /**< Flag indicating whether an allocation failed. */
+    pthread_t worker;     /**< The thread building the column. */
+    int started;          /**< Flag indicating whether the worker thread was started. */
+} ColumnBuild;
+
+static int put_varint(unsigned char *out, uint32_t value)
+{
+    int length = 0;
+    while (value >= 0x80)
+    {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+static uint32_t get_varint(const unsigned char **data)
+{
+    uint32_t value = 0;
+    int shift = 0;
+    while (**data & 0x80)
+    {
+        value |= (uint32_t)(**data & 0x7F) << shift;
+        shift += 7;
+        (*data)++;
+    }
+    value |= (uint32_t)**data << shift;
+    (*data)++;
+    return value;
+}
+
+static Field record_value(const unsigned char *record)
+{
+    Field value;
+    value.length = get_varint(&record);
+    value.value = (const char *)record;
+    return value;
+}
+
+static Field record_key(const unsigned char *record)
+{
+    Field value = record_value(record);
+    const unsigned char *keyStart = (const unsigned char *)value.value + value.length;
+    uint32_t keyLength = get_varint(&keyStart);
+    if (keyLength == 0)
+        return value;
+
+    Field key;
+    key.value = (const char *)keyStart;
+    key.length = keyLength - 1;
+    return key;
+}
+
+static int intern_table_init(InternTable *table, size_t capacity)
+{
+    table->capacity = capacity;
+    table->count = 0;
+    table->refs = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+    table->hashes = (uint32_t *)malloc(capacity * sizeof(uint32_t));
+    return table->refs == NULL || table->hashes == NULL ? -1 : 0;
+}
+
+static void intern_table_dispose(InternTable *table)
+{
+    free(table->refs);
+    free(table->hashes);
+}
+
+static int intern_table_grow(InternTable *table)
+{
+    InternTable grown;
+    if (intern_table_init(&grown, table->capacity * 2) == -1)
+    {
+        intern_table_dispose(&grown);
+        return -1;
+    }
+    for (size_t i = 0; i < table->capacity; i++)
+    {
+        if (table->refs[i] == 0)
+            continue;
+        size_t slot = table->hashes[i] & (grown.capacity - 1);
+        while (grown.refs[slot] != 0)
+            slot = (slot + 1) & (grown.capacity - 1);
+        grown.refs[slot] = table->refs[i];
+        grown.hashes[slot] = table->hashes[i];
+    }
+    grown.count = table->count;
+    intern_table_dispose(table);
+    *table = grown;
+    return 0;
+}
+
+static int append_record(Pool *pool, Field value, Field key, uint32_t *ref)
+{
+    bool sameKey = key.length == value.length && memcmp(key.value, value.value, value.length) == 0;
+    size_t recordSize = 10 + value.length + (sameKey ? 0 : key.length);
+    if (pool->size + recordSize > pool->capacity)
+    {
+        size_t capacity = pool->capacity ? pool->capacity : 4096;
+        while (capacity < pool->size + recordSize)
+            capacity *= 2;
+        unsigned char *grown = (unsigned char *)realloc(pool->data, capacity);
+        if (grown == NULL)
+            return -1;
+        pool->data = grown;
+        pool->capacity = capacity;
+    }
+    // offsets are 32-bit and the stored offset is incremented by one
+    if (pool->size + recordSize >= UINT32_MAX)
+        return -1;
+
+    *ref = pool->size;
+    unsigned char *record = pool->data + pool->size;
+    int length = put_varint(record, value.length);
+    memcpy(record + length, value.value, value.length);
+    length += value.length;
+    if (sameKey)
+    {
+        record[length++] = 0;
+    }
+    else
+    {
+        length += put_varint(record + length, key.length + 1);
+        memcpy(record + length, key.value, key.length);
+        length += key.length;
+    }
+    pool->size += length;
+
+    return 0;
+}
+
+static int intern(Pool *pool, InternTable *table, Field value, Field key, uint32_t *ref)
+{
+    uint32_t hash = (uint32_t)hash_bytes(value.value, value.length);
+    size_t slot = hash & (table->capacity - 1);
+
+    while (table->refs[slot] != 0)
+    {
+        if (table->hashes[slot] == hash)
+        {
+            Field stored = record_value(pool->data + table->refs[slot] - 1);
+            if (stored.length == value.length && memcmp(stored.value, value.value, value.length) == 0)
+            {
+                *ref = table->refs[slot] - 1;
+                return 0;
+            }
+        }
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+
+    if (append_record(pool, value, key, ref) == -1)
+        return -1;
+
+    table->refs[slot] = *ref + 1;
+    table->hashes[slot] = hash;
+    if (++table->count * 2 > table->capacity)
+        return intern_table_grow(table);
+    return 0;
+}
+
+static int intern_value(Pool *pool, InternTable *table, Field value, Field key, uint32_t *ref)
+{
+    if (table == NULL)
+        return append_record(pool, value, key, ref);
+    return intern(pool, table, value, key, ref);
+}
+
+static bool is_mail_column(const ColumnBuild *build)
+{
+    const Directory *directory = build->directory;
+    int stride = directory->schema.attributeCount;
+    size_t sample = directory->lineCount < INTERN_SAMPLE_ROWS ? directory->lineCount : INTERN_SAMPLE_ROWS;
+    size_t found = 0;
+
+    if (directory->schema.attributes[build->column].separator != 0 || sample == 0)
+        return false;
+    for (size_t i = 0; i < sample; i++)
+    {
+        Field value = build->values[i * stride + build->column];
+        if (memchr(value.value, '@', value.length) != NULL)
+            found++;
+    }
+    return found * 8 > sample * 7;
+}
+
+static int build_index(ColumnBuild *build)
+{
+    Directory *directory = build->directory;
+    const Attribute *attribute = &directory->schema.attributes[build->column];
+    EqualityIndex *index = &directory->indexes[build->column];
+    BloomFilter *bloom = &directory->blooms[build->column];
+    int stride = directory->schema.attributeCount;
+    size_t lineCount = directory->lineCount;
+
+    size_t entryCount = lineCount;
+    if (attribute->separator != 0)
+    {
+        entryCount = 0;
+        for (size_t i = 0; i < lineCount; i++)
+        {
+            Field rest = build->keys[i * stride + build->column], value;
+            while (field_next_value(&rest, attribute->separator, &value))
+                entryCount++;
+        }
+    }
+
+    index->bucketCount = 1024;
+    while (index->bucketCount < entryCount)
+        index->bucketCount <<= 1;
+    index->entryCount = entryCount;
+    index->buckets = (uint32_t *)calloc(index->bucketCount, sizeof(uint32_t));
+    index->next = (uint32_t *)malloc((entryCount > 0 ? entryCount : 1) * sizeof(uint32_t));
+    if (attribute->separator != 0)
+        index->rows = (uint32_t *)malloc((entryCount > 0 ? entryCount : 1) * sizeof(uint32_t));
+    if (index->buckets == NULL || index->next == NULL || (attribute->separator != 0 && index->rows == NULL) ||
+        bloom_init(bloom, entryCount) == -1)
+        return -1;
+
+    // rows are chained from the last one, so every chain ends up in ascending order
+    size_t entry = entryCount;
+    for (size_t i = lineCount; i-- > 0;)
+    {
+        Field rest = build->keys[i * stride + build->column], value;
+        while (field_next_value(&rest, attribute->separator, &value))
+        {
+            uint64_t hash = hash_bytes(value.value, value.length);
+            size_t bucket = hash & (index->bucketCount - 1);
+            entry--;
+            index->next[entry] = index->buckets[bucket];
+            index->buckets[bucket] = entry + 1;
+            if (index->rows != NULL)
+                index->rows[entry] = i;
+            bloom_add(bloom, hash);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Structure representing the work of one disk index building thread.
+ */
+typedef struct
+{
+    Directory *directory;                  /**< The loaded directory. */
+    int column;                            /**< The indexed column. */
+    char path[4096];                       /**< The path of the index file. */
+    unsigned char stamp[BTREE_STAMP_SIZE]; /**< The identity of the file, its rows and the keys of the column. */
+    int pending;                           /**< Flag indicating whether the file has to be built. */
+    int failed;                            /**< Flag indicating whether the build failed. */
+    pthread_t worker;                      /**< The thread building the file. */
+    int started;                           /**< Flag indicating whether the worker thread was started. */
+} TreeBuild;
+
+static void split_mail(Field mail, Field *local, Field *domain)
+{
+    const char *at = (const char *)memrchr(mail.value, '@', mail.length);
+    local->value = mail.value;
+    local->length = at == NULL ? mail.length : at - mail.value;
+    domain->value = at == NULL ? mail.value + mail.length : at + 1;
+    domain->length = at == NULL ? -1 : mail.length - local->length - 1;
+}
+
+static unsigned char *shrink(unsigned char *data, size_t size)
+{
+    unsigned char *shrunk = (unsigned char *)realloc(data, size > 0 ? size : 1);
+    return shrunk == NULL ? data : shrunk;
+}
+
+static void *build_column(void *arg)
+{
+    ColumnBuild *build = (ColumnBuild *)arg;
+    Directory *directory = build->directory;
+    Column *column = &directory->columns[build->column];
+    size_t lineCount = directory->lineCount;
+    int stride = directory->schema.attributeCount;
+    bool splitDomain = is_mail_column(build);
+    bool dedupe = true;
+
+    Pool pool = {0}, domainPool = {0};
+    InternTable table, domainTable;
+    uint32_t *domainRefs = NULL;
+    size_t domainCapacity = 0;
+    build->failed = 0;
+
+    column->refs = (uint32_t *)malloc((lineCount > 0 ? lineCount : 1) * sizeof(uint32_t));
+    if (splitDomain)
+        column->domainIds = (uint32_t *)malloc((lineCount > 0 ? lineCount : 1) * sizeof(uint32_t));
+    if (column->refs == NULL || (splitDomain && column->domainIds == NULL) ||
+        intern_table_init(&table, 1024) == -1 || intern_table_init(&domainTable, 64) == -1)
+    {
+        build->failed = 1;
+        return NULL;
+    }
+
+    for (size_t i = 0; i < lineCount && !build->failed; i++)
+    {
+        Field value = build->values[i * stride + build->column];
+        Field key = build->keys[i * stride + build->column];
+        int length = value.length > key.length ? value.length : key.length;
+        if (length > column->maxLength)
+            column->maxLength = length;
+
+        if (dedupe && i == INTERN_SAMPLE_ROWS && table.count * 8 > i * 7)
+        {
+            // values are nearly all distinct, the table would only cost time
+            dedupe = false;
+            intern_table_dispose(&table);
+            table.refs = table.hashes = NULL;
+        }
+
+        if (!splitDomain)
+        {
+            build->failed |= intern_value(&pool, dedupe ? &table : NULL, value, key, &column->refs[i]);
+            continue;
+        }
+
+        Field local, domain, localKey, domainKey;
+        split_mail(value, &local, &domain);
+        split_mail(key, &localKey, &domainKey);
+        if (domain.length == -1 || domainKey.length == -1)
+        {
+            // not a mail address, stored whole
+            column->domainIds[i] = 0;
+            build->failed |= intern_value(&pool, dedupe ? &table : NULL, value, key, &column->refs[i]);
+            continue;
+        }
+
+        uint32_t domainRef;
+        size_t domainCount = domainTable.count;
+        build->failed |= intern_value(&pool, dedupe ? &table : NULL, local, localKey, &column->refs[i]);
+        build->failed |= intern(&domainPool, &domainTable, domain, domainKey, &domainRef);
+        if (domainTable.count != domainCount)
+        {
+            // first occurrence of the domain gets the next id, id 0 is reserved
+            if (domainTable.count + 1 > domainCapacity)
+            {
+                domainCapacity = domainCapacity ? domainCapacity * 2 : 64;
+                uint32_t *grown = (uint32_t *)realloc(domainRefs, domainCapacity * sizeof(uint32_t));
+                if (grown == NULL)
+                {
+                    build->failed = 1;
+                    break;
+                }
+                domainRefs = grown;
+            }
+            domainRefs[domainTable.count] = domainRef;
+            column->domainIds[i] = domainTable.count;
+        }
+        else
+        {
+            // ids are handed out in the order of first occurrence, so the refs are sorted
+            uint32_t low = 1, high = domainTable.count;
+            while (low < high)
+            {
+                uint32_t middle = (low + high) / 2;
+                if (domainRefs[middle] < domainRef)
+                    low = middle + 1;
+                else
+                    high = middle;
+            }
+            column->domainIds[i] = low;
+        }
+    }
+
+    intern_table_dispose(&table);
+    intern_table_dispose(&domainTable);
+    if (!build->failed && directory->schema.attributes[build->column].indexed)
+        build->failed = build_index(build) == -1;
+
+    column->pool = shrink(pool.data, pool.size);
+    column->poolSize = pool.size;
+    if (splitDomain)
+    {
+        column->domainPool = shrink(domainPool.data, domainPool.size);
+        column->domainPoolSize = domainPool.size;
+        column->domainRefs = domainRefs;
+        column->domainCount = domainTable.count + 1;
+    }
+    return NULL;
+}
+
+int directory_load(Directory *directory, const Schema *schema, const char *path, int threads)
+{
+    memset(directory, 0, sizeof(Directory));
+    directory->schema = *schema;
+    directory->version = 1;
+    directory->dnSuffix = DIRECTORY_DN_SUFFIX;
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -1;
+
+    struct stat info;
+    if (fstat(fd, &info) == -1)
+    {
+        close(fd);
+        return -1;
+    }
+    directory->size = info.st_size;
+    if (directory->size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    char *mapped = (char *)mmap(NULL, directory->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return -1;
+    madvise(mapped, directory->size, MADV_SEQUENTIAL);
+
+    if (threads <= 0)
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if ((size_t)threads > directory->size / LOADER_MIN_CHUNK_SIZE)
+        threads = (int)(directory->size / LOADER_MIN_CHUNK_SIZE);
+    if (threads < 1)
+        threads = 1;
+
+    const char *data = mapped;
+    const char *end = data + directory->size;
+    Chunk *chunks = (Chunk *)calloc(threads, sizeof(Chunk));
+    if (chunks == NULL)
+    {
+        munmap(mapped, directory->size);
+        return -1;
+    }
+
+    // split at line boundaries and count the lines of every chunk
+    const char *start = data;
+    size_t capacity = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        const char *chunkEnd = i == threads - 1 ? end : data + directory->size / threads * (i + 1);
+        if (chunkEnd < start)
+            chunkEnd = start;
+        while (chunkEnd < end && chunkEnd[-1] != '\n')
+            chunkEnd++;
+
+        chunks[i].start = start;
+        chunks[i].end = chunkEnd;
+        chunks[i].capacity = count_lines(start, chunkEnd) + 1;
+        capacity += chunks[i].capacity;
+        start = chunkEnd;
+    }
+
+    int stride = schema->attributeCount;
+    int attributeOf[SCHEMA_LINE_SIZE];
+    for (int column = 0; column < schema->csvColumns; column++)
+        attributeOf[column] = -1;
+    for (int attribute = 0; attribute < stride; attribute++)
+        attributeOf[schema->attributes[attribute].csvColumn] = attribute;
+
+    Field *values = (Field *)malloc(capacity * stride * sizeof(Field));
+    Field *keys = (Field *)malloc(capacity * stride * sizeof(Field));
+    char *keyData = (char *)malloc(directory->size);
+    if (values == NULL || keys == NULL || keyData == NULL)
+    {
+        free(chunks);
+        free(values);
+        free(keys);
+        free(keyData);
+        munmap(mapped, directory->size);
+        return -1;
+    }
+
+    size_t slot = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        chunks[i].data = data;
+        chunks[i].keyData = keyData;
+        chunks[i].directory = directory;
+        chunks[i].attributeOf = attributeOf;
+        chunks[i].values = values + slot * stride;
+        chunks[i].keys = keys + slot * stride;
+        slot += chunks[i].capacity;
+    }
+
+    for (int i = 1; i < threads; i++)
+        chunks[i].started = pthread_create(&chunks[i].worker, NULL, parse_chunk, &chunks[i]) == 0;
+    for (int i = 0; i < threads; i++)
+    {
+        if (chunks[i].started)
+            pthread_join(chunks[i].worker, NULL);
+        else
+            parse_chunk(&chunks[i]);
+    }
+
+    // close the gaps left between chunks
+    for (int i = 0; i < threads; i++)
+    {
+        memmove(values + directory->lineCount * stride, chunks[i].values, chunks[i].lineCount * stride * sizeof(Field));
+        memmove(keys + directory->lineCount * stride, chunks[i].keys, chunks[i].lineCount * stride * sizeof(Field));
+        directory->lineCount += chunks[i].lineCount;
+    }
+    free(chunks);
+
+    // intern the lines into the columns, one thread per column
+    ColumnBuild builds[SCHEMA_MAX_ATTRIBUTES];
+    int failed = 0;
+    for (int column = 0; column < stride; column++)
+    {
+        builds[column].directory = directory;
+        builds[column].values = values;
+        builds[column].keys = keys;
+        builds[column].column = column;
+        builds[column].started = column > 0 && pthread_create(&builds[column].worker, NULL, build_column, &builds[column]) == 0;
+    }
+    for (int column = 0; column < stride; column++)
+    {
+        if (builds[column].started)
+            pthread_join(builds[column].worker, NULL);
+        else
+            build_column(&builds[column]);
+        failed |= builds[column].failed;
+    }
+
+    free(values);
+    free(keys);
+    free(keyData);
+    munmap(mapped, directory->size);
+    if (failed)
+    {
+        directory_dispose(directory);
+        return -1;
+    }
+
+    directory->naiveMemory = 2 * directory->size + directory->lineCount * stride * 2 * sizeof(Field);
+    for (int column = 0; column < stride; column++)
+    {
+        Column *values = &directory->columns[column];
+        directory->memory += values->poolSize + directory->lineCount * sizeof(uint32_t);
+        if (values->domainIds != NULL)
+            directory->memory += values->domainPoolSize + directory->lineCount * sizeof(uint32_t) + values->domainCount * sizeof(uint32_t);
+
+        EqualityIndex *index = &directory->indexes[column];
+        if (index->buckets == NULL)
+            continue;
+        directory->indexMemory += index->bucketCount * sizeof(uint32_t) + index->entryCount * sizeof(uint32_t) +
+                                  (index->rows != NULL ? index->entryCount * sizeof(uint32_t) : 0) +
+                                  directory->blooms[column].blockCount * BLOOM_BLOCK_WORDS * sizeof(uint64_t);
+    }
+    return 0;
+}
+
+static void tree_stamp(const Directory *directory, int column, const struct stat *info, unsigned char *stamp)
+{
+    // the file decides the rows, the attribute and its matching rule the keys
+    const Attribute *attribute = &directory->schema.attributes[column];
+    struct
+    {
+        uint64_t size;
+        uint64_t lineCount;
+        int64_t modified;
+        int64_t modifiedNanoseconds;
+        int32_t csvColumn;
+        int32_t rule;
+        int32_t separator;
+        char name[SCHEMA_NAME_SIZE];
+    } identity;
+    memset(&identity, 0, sizeof(identity));
+    identity.size = info->st_size;
+    identity.lineCount = directory->lineCount;
+    identity.modified = info->st_mtim.tv_sec;
+    identity.modifiedNanoseconds = info->st_mtim.tv_nsec;
+    identity.csvColumn = attribute->csvColumn;
+    identity.rule = attribute->rule;
+    identity.separator = attribute->separator;
+    memcpy(identity.name, attribute->name, SCHEMA_NAME_SIZE);
+    memset(stamp, 0, BTREE_STAMP_SIZE);
+    memcpy(stamp, &identity, sizeof(identity));
+}
+
+static void *build_tree(void *arg)
+{
+    TreeBuild *build = (TreeBuild *)arg;
+    Directory *directory = build->directory;
+    char separator = directory->schema.attributes[build->column].separator;
+    size_t capacity = directory->lineCount > 0 ? directory->lineCount : 1;
+    size_t count = 0;
+    BtreeEntry *entries = (BtreeEntry *)malloc(capacity * sizeof(BtreeEntry));
+    char *scratch = (char *)malloc(directory->columns[build->column].maxLength + 1);
+    Arena copies;
+    arena_init(&copies, ARENA_BLOCK_SIZE);
+    build->failed = entries == NULL || scratch == NULL;
+
+    for (size_t row = 0; row < directory->lineCount && !build->failed; row++)
+    {
+        Field rest = directory_key(directory, row, build->column, scratch), value;
+        // assembled keys are overwritten by the next row, the others stay in the pool
+        if (rest.value == scratch)
+        {
+            char *copy = (char *)arena_alloc(&copies, rest.length > 0 ? rest.length : 1);
+            memcpy(copy, rest.value, rest.length);
+            rest.value = copy;
+        }
+        while (field_next_value(&rest, separator, &value))
+        {
+            if (count == capacity)
+            {
+                BtreeEntry *grown = (BtreeEntry *)realloc(entries, 2 * capacity * sizeof(BtreeEntry));
+                if (grown == NULL)
+                {
+                    build->failed = 1;
+                    break;
+                }
+                entries = grown;
+                capacity *= 2;
+            }
+            entries[count].key = value.value;
+            entries[count].length = value.length < BTREE_MAX_KEY ? value.length : BTREE_MAX_KEY;
+            entries[count].row = row;
+            count++;
+        }
+    }
+    if (!build->failed)
+        build->failed = btree_build(build->path, build->stamp, entries, count) == -1;
+
+    arena_dispose(&copies);
+    free(scratch);
+    free(entries);
+    return NULL;
+}
+
+int directory_open_trees(Directory *directory, const char *path)
+{
+    struct stat info;
+    if (stat(path, &info) == -1)
+    {
+        perror(path);
+        return -1;
+    }
+
+    TreeBuild builds[SCHEMA_MAX_ATTRIBUTES];
+    int built = 0, failed = 0;
+    int stride = directory->schema.attributeCount;
+    for (int column = 0; column < stride; column++)
+    {
+        TreeBuild *build = &builds[column];
+        memset(build, 0, sizeof(TreeBuild));
+        if (!directory->schema.attributes[column].indexed)
+            continue;
+        build->directory = directory;
+        build->column = column;
+        snprintf(build->path, sizeof(build->path), "%s.%s.idx", path, directory->schema.attributes[column].name);
+        tree_stamp(directory, column, &info, build->stamp);
+        if (btree_open(&directory->trees[column], build->path, build->stamp) == 0)
+            continue;
+        build->pending = 1;
+        build->started = pthread_create(&build->worker, NULL, build_tree, build) == 0;
+        built++;
+    }
+    for (int column = 0; column < stride; column++)
+    {
+        TreeBuild *build = &builds[column];
+        if (!build->pending)
+            continue;
+        if (build->started)
+            pthread_join(build->worker, NULL);
+        else
+            build_tree(build);
+        if (build->failed || btree_open(&directory->trees[column], build->path, build->stamp) == -1)
+            failed = 1;
+    }
+    if (failed)
+    {
+        for (int column = 0; column < stride; column++)
+            btree_close(&directory->trees[column]);
+        return -1;
+    }
+
+    // the disk indexes replace the equality indexes, the Bloom filters stay
+    for (int column = 0; column < stride; column++)
+    {
+        EqualityIndex *index = &directory->indexes[column];
+        if (!btree_is_open(&directory->trees[column]) || index->buckets == NULL)
+            continue;
+        directory->indexMemory -= index->bucketCount * sizeof(uint32_t) + index->entryCount * sizeof(uint32_t) +
+                                  (index->rows != NULL ? index->entryCount * sizeof(uint32_t) : 0);
+        directory->treeSize += (size_t)directory->trees[column].pageCount * BTREE_PAGE_SIZE;
+        free(index->buckets);
+        free(index->next);
+        free(index->rows);
+        memset(index, 0, sizeof(EqualityIndex));
+    }
+    return built;
+}
+
+void directory_dispose(Directory *directory)
+{
+    for (int column = 0; column < SCHEMA_MAX_ATTRIBUTES; column++)
+    {
+        Column *values = &directory->columns[column];
+        free(values->pool);
+        free(values->refs);
+        free(values->domainIds);
+        free(values->domainPool);
+        free(values->domainRefs);
+        bloom_dispose(&directory->blooms[column]);
+
+        EqualityIndex *index = &directory->indexes[column];
+        free(index->buckets);
+        free(index->next);
+        free(index->rows);
+        btree_close(&directory->trees[column]);
+    }
+    memset(directory, 0, sizeof(Directory));
+}
+
+// the fields of a deleted row
+static const Field emptyField = {"", 0};
+
+Field directory_value(const Directory *directory, size_t row, int column, char *scratch)
+{
+    if (directory->overlay != NULL)
+    {
+        const OverlayRecord *record = overlay_record(directory->overlay, row);
+        if (record != NULL)
+            return record->deleted ? emptyField : overlay_value(record, column);
+    }
+
+    const Column *values = &directory->columns[column];
+    Field local = record_value(values->pool + values->refs[row]);
+    if (values->domainIds == NULL || values->domainIds[row] == 0)
+        return local;
+
+    Field domain = record_value(values->domainPool + values->domainRefs[values->domainIds[row]]);
+    memcpy(scratch, local.value, local.length);
+    scratch[local.length] = '@';
+    memcpy(scratch + local.length + 1, domain.value, domain.length);
+
+    Field value;
+    value.value = scratch;
+    value.length = local.length + 1 + domain.length;
+    return value;
+}
+
+Field directory_key(const Directory *directory, size_t row, int column, char *scratch)
+{
+    if (directory->overlay != NULL)
+    {
+        const OverlayRecord *record = overlay_record(directory->overlay, row);
+        if (record != NULL)
+            return record->deleted ? emptyField : overlay_key(record, column);
+    }
+
+    const Column *values = &directory->columns[column];
+    Field local = record_key(values->pool + values->refs[row]);
+    if (values->domainIds == NULL || values->domainIds[row] == 0)
+        return local;
+
+    Field domain = record_key(values->domainPool + values->domainRefs[values->domainIds[row]]);
+    memcpy(scratch, local.value, local.length);
+    scratch[local.length] = '@';
+    memcpy(scratch + local.length + 1, domain.value, domain.length);
+
+    Field key;
+    key.value = scratch;
+    key.length = local.length + 1 + domain.length;
+    return key;
+}
+
+size_t directory_row_count(const Directory *directory)
+{
+    if (directory->overlay == NULL)
+        return directory->lineCount;
+    return __atomic_load_n(&directory->overlay->rowCount, __ATOMIC_ACQUIRE);
+}
+
+bool directory_row_exists(const Directory *directory, size_t row)
+{
+    if (directory->overlay == NULL)
+        return true;
+    const OverlayRecord *record = overlay_record(directory->overlay, row);
+    return record == NULL || !record->deleted;
+}
+
+unsigned long directory_version(const Directory *directory)
+{
+    if (directory->overlay == NULL)
+        return directory->version;
+    return directory->version + __atomic_load_n(&directory->overlay->sequence, __ATOMIC_ACQUIRE);
+}
+
+bool directory_may_contain(const Directory *directory, int column, uint64_t hash)
+{
+    if (bloom_may_contain(&directory->blooms[column], hash))
+        return true;
+    return directory->overlay != NULL && overlay_may_contain(directory->overlay, column, hash);
+}
+
+bool directory_index_lookup(const Directory *directory, int column, Field key, IndexCursor *cursor)
+{
+    const EqualityIndex *index = &directory->indexes[column];
+    bool disk = btree_is_open(&directory->trees[column]);
+    if (index->buckets == NULL && !disk)
+        return false;
+
+    uint64_t hash = hash_bytes(key.value, key.length);
+    cursor->index = disk ? NULL : index;
+    cursor->entry = disk ? 0 : index->buckets[hash & (index->bucketCount - 1)];
+    cursor->overlay = directory->overlay;
+    cursor->column = column;
+    cursor->overlayEntry = directory->overlay != NULL ? overlay_index_lookup(directory->overlay, column, hash) : 0;
+    cursor->overlayEnd = 0;
+    cursor->directory = directory;
+    cursor->tree.tree = NULL;
+    if (disk)
+        btree_lookup(&directory->trees[column], key.value, key.length, false, &cursor->tree);
+    return true;
+}
+
+bool directory_prefix_lookup(const Directory *directory, int column, Field prefix, IndexCursor *cursor)
+{
+    if (!btree_is_open(&directory->trees[column]))
+        return false;
+
+    cursor->index = NULL;
+    cursor->entry = 0;
+    cursor->overlay = directory->overlay;
+    cursor->column = column;
+    // written keys cannot be looked up by a prefix, every key written so far is walked
+    cursor->overlayEntry = 0;
+    cursor->overlayEnd = directory->overlay != NULL ? overlay_written_end(directory->overlay) : 0;
+    cursor->directory = directory;
+    btree_lookup(&directory->trees[column], prefix.value, prefix.length, true, &cursor->tree);
+    return true;
+}
+
+static bool is_earlier_prefix_key(const IndexCursor *cursor, size_t row, const char *key, int length)
+{
+    const Directory *directory = cursor->directory;
+    char separator = directory->schema.attributes[cursor->column].separator;
+    if (separator == 0)
+        return false;
+
+    // multi-valued columns are never split at '@', so the key needs no scratch buffer
+    const BtreeCursor *tree = &cursor->tree;
+    Field rest = directory_key(directory, row, cursor->column, NULL), value;
+    while (field_next_value(&rest, separator, &value))
+    {
+        int valueLength = value.length < BTREE_MAX_KEY ? value.length : BTREE_MAX_KEY;
+        if (valueLength < tree->keyLength || memcmp(value.value, tree->key, tree->keyLength) != 0)
+            continue;
+        int common = valueLength < length ? valueLength : length;
+        int order = memcmp(value.value, key, common);
+        if (order < 0 || (order == 0 && valueLength < length))
+            return true;
+    }
+    return false;
+}
+
+static bool index_cursor_base_next(IndexCursor *cursor, size_t *row)
+{
+    if (cursor->tree.tree == NULL)
+    {
+        if (cursor->entry == 0)
+            return false;
+        uint32_t entry = cursor->entry - 1;
+        *row = cursor->index->rows != NULL ? cursor->index->rows[entry] : entry;
+        cursor->entry = cursor->index->next[entry];
+        return true;
+    }
+
+    const char *key;
+    int length;
+    while (btree_cursor_next(&cursor->tree, row, &key, &length))
+    {
+        // a row holding several keys with the prefix is returned at the first of them
+        if (!cursor->tree.prefix || !is_earlier_prefix_key(cursor, *row, key, length))
+            return true;
+    }
+    return false;
+}
+
+bool index_cursor_next(IndexCursor *cursor, size_t *row)
+{
+    while (index_cursor_base_next(cursor, row))
+    {
+        // written rows are found by the keys of their current record
+        if (cursor->overlay == NULL || overlay_record(cursor->overlay, *row) == NULL)
+            return true;
+    }
+    if (cursor->overlay == NULL)
+        return false;
+    if (cursor->tree.tree != NULL && cursor->tree.prefix)
+        return overlay_written_next(cursor->overlay, cursor->column, &cursor->overlayEntry, cursor->overlayEnd, row);
+    return overlay_index_next(cursor->overlay, cursor->column, &cursor->overlayEntry, row);
+}
+
+static bool is_key_in_row(const Directory *directory, int column, Field key, char *scratch, size_t row)
+{
+    if (!directory_row_exists(directory, row))
+        return false;
+    Field rest = directory_key(directory, row, column, scratch), value;
+    while (field_next_value(&rest, directory->schema.attributes[column].separator, &value))
+    {
+        if (value.length == key.length && memcmp(value.value, key.value, key.length) == 0)
+            return true;
+    }
+    return false;
+}
+
+bool directory_find_row(const Directory *directory, int column, Field key, char *scratch, size_t *row)
+{
+    IndexCursor cursor;
+    if (directory_index_lookup(directory, column, key, &cursor))
+    {
+        while (index_cursor_next(&cursor, row))
+        {
+            if (is_key_in_row(directory, column, key, scratch, *row))
+                return true;
+        }
+        return false;
+    }
+
+    size_t rowCount = directory_row_count(directory);
+    for (*row = 0; *row < rowCount; (*row)++)
+    {
+        if (is_key_in_row(directory, column, key, scratch, *row))
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,341 @@
+/**
+ *
+ * @file directory.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _DIRECTORY_H
+#define _DIRECTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "bloom.h"
+#include "btree.h"
+#include "schema.h"
+
+#define DIRECTORY_DN_SUFFIX ",dc=fit,dc=vut,dc=cz" // appended to the rdn value of every entry to form its dn
+
+enum DirectoryConst
+{
+    LOADER_MIN_CHUNK_SIZE = 1 << 20, // files smaller than this are not worth splitting
+    INTERN_SAMPLE_ROWS = 4096        // rows sampled before deciding whether a column is worth deduplicating
+};
+
+/**
+ * Structure representing one field of the database file.
+ *
+ * The value is not null-terminated.
+ */
+typedef struct
+{
+    const char *value; /**< The first byte of the field. */
+    int length;        /**< The length of the field in bytes. */
+} Field;
+
+/**
+ * Structure representing one column of the loaded directory, holding one declared attribute.
+ *
+ * Every distinct value is stored once in the pool as a record of a varint length,
+ * the value bytes and a varint of the normalized key length plus one followed by the key
+ * bytes, or a zero when the key equals the value. Rows refer to records by 32-bit pool offsets.
+ * Multi-valued fields are stored whole with their separators. Columns of single-valued mail addresses are
+ * split at the last '@' into the local part, stored in the pool, and the domain, stored once
+ * in the domain dictionary.
+ */
+typedef struct
+{
+    unsigned char *pool;     /**< The interned value records. */
+    size_t poolSize;         /**< The used size of the pool in bytes. */
+    uint32_t *refs;          /**< The pool offset of the value of every row. */
+    uint32_t *domainIds;     /**< The domain of every row, 0 for none, or NULL for columns that are not split. */
+    unsigned char *domainPool; /**< The interned domain records. */
+    size_t domainPoolSize;   /**< The used size of the domain pool in bytes. */
+    uint32_t *domainRefs;    /**< The domain pool offset of every domain id. */
+    uint32_t domainCount;    /**< The number of domain ids including the empty domain 0. */
+    int maxLength;           /**< The length of the longest value or key of the column. */
+} Column;
+
+/**
+ * Structure representing the equality index of one column.
+ *
+ * Every value of every row is one entry, chained into the bucket of the hash of its
+ * normalized key. Chains are ordered by row.
+ */
+typedef struct
+{
+    uint32_t *buckets;  /**< The first entry plus one of every bucket, 0 for empty buckets. */
+    uint32_t *next;     /**< The next entry plus one in the same bucket, 0 at the end of the chain. */
+    uint32_t *rows;     /**< The row of every entry or NULL if every entry is the row with the same number. */
+    size_t bucketCount; /**< The number of buckets, a power of two. */
+    size_t entryCount;  /**< The number of entries. */
+} EqualityIndex;
+
+typedef struct Overlay Overlay;
+typedef struct Directory Directory;
+
+/**
+ * Structure representing a position in a bucket of an equality index or in a disk index.
+ */
+typedef struct
+{
+    const EqualityIndex *index; /**< The index being walked or NULL when the disk index is walked. */
+    uint32_t entry;             /**< The next entry plus one or 0 at the end. */
+    const Overlay *overlay;     /**< The written changes or NULL for a read-only directory. */
+    int column;                 /**< The column being looked up. */
+    uint32_t overlayEntry;      /**< The next entry plus one of the index of written keys, walked after the bucket,
+                                     or the next written key of a prefix walk. */
+    uint32_t overlayEnd;        /**< The number of written keys when a prefix walk began. */
+    const Directory *directory; /**< The directory, whose rows are checked for keys a prefix walk returned before. */
+    BtreeCursor tree;           /**< The position in the disk index. */
+} IndexCursor;
+
+/**
+ * Structure representing the loaded database file.
+ */
+struct Directory
+{
+    size_t size;      /**< The size of the database file in bytes. */
+    size_t lineCount; /**< The number of loaded lines. */
+    Schema schema;    /**< The attributes of the columns. */
+    Column columns[SCHEMA_MAX_ATTRIBUTES]; /**< The values of every declared attribute. */
+    BloomFilter blooms[SCHEMA_MAX_ATTRIBUTES]; /**< Bloom filters of the normalized keys of indexed attributes. */
+    EqualityIndex indexes[SCHEMA_MAX_ATTRIBUTES]; /**< Equality indexes of indexed attributes without a disk index. */
+    BtreeIndex trees[SCHEMA_MAX_ATTRIBUTES];      /**< Disk indexes of indexed attributes, open after directory_open_trees(). */
+    unsigned long version; /**< The version of the loaded file, directory_version() adds the written changes. */
+    const char *dnSuffix;  /**< The suffix appended to the rdn value of every entry to form its dn. */
+    size_t memory;         /**< The number of bytes used by the loaded columns. */
+    size_t indexMemory;    /**< The number of bytes used by the Bloom filters and equality indexes. */
+    size_t treeSize;       /**< The number of bytes of the disk indexes. */
+    size_t naiveMemory;    /**< The number of bytes the file, its keys and line array would take. */
+    Overlay *overlay;      /**< The changes written since the file was loaded or NULL for a read-only directory. */
+};
+
+/**
+ * Load Directory.
+ *
+ * Maps the database file into memory, splits it into chunks at line boundaries
+ * and parses the chunks in parallel. Fields may be of any length and lines may end
+ * with either LF or CRLF. Empty lines are skipped and columns not declared by the schema
+ * are ignored. A normalized matching key is computed for every field by the matching
+ * rule of its attribute. The parsed lines are then interned into the columns, one thread
+ * per column, the Bloom filters and equality indexes of indexed attributes are built
+ * and the file is unmapped.
+ *
+ * @param directory A pointer to the directory to fill.
+ * @param schema    A pointer to the schema of the file, copied into the directory.
+ * @param path      The path to the semicolon separated database file.
+ * @param threads   The number of parser threads, 0 to use all online cores.
+ *
+ * @return 0 on success, -1 if the file could not be opened or mapped.
+ */
+int directory_load(Directory *directory, const Schema *schema, const char *path, int threads);
+
+/**
+ * Open Disk Indexes.
+ *
+ * Opens a B+tree index file for every indexed attribute, <path>.<attribute>.idx, and
+ * releases the equality index it replaces. A missing file or one built from another
+ * version of the database file or schema is built anew, one thread per attribute.
+ * Has to be called before the directory gets an overlay.
+ *
+ * @param directory A pointer to the loaded directory.
+ * @param path      The path of the loaded database file.
+ *
+ * @return The number of index files built, -1 if an index file could not be written or opened.
+ */
+int directory_open_trees(Directory *directory, const char *path);
+
+/**
+ * Dispose Directory.
+ *
+ * Releases the columns, Bloom filters, equality indexes and disk indexes of the directory.
+ *
+ * @param directory A pointer to the directory to dispose.
+ */
+void directory_dispose(Directory *directory);
+
+/**
+ * Normalize Field.
+ *
+ * Computes the matching key of a field by the matching rule of its attribute,
+ * trimming every value of a multi-valued field on its own. The key is never longer
+ * than the field.
+ *
+ * @param attribute A pointer to the attribute of the field.
+ * @param field     The field.
+ * @param key       A pointer to the buffer receiving the key.
+ *
+ * @return The length of the key.
+ */
+int directory_normalize(const Attribute *attribute, Field field, char *key);
+
+/**
+ * Get Row Count.
+ *
+ * @param directory A pointer to the directory.
+ *
+ * @return The number of rows including added and deleted ones, rows below it may be visited.
+ */
+size_t directory_row_count(const Directory *directory);
+
+/**
+ * Check Row.
+ *
+ * @param directory A pointer to the directory.
+ * @param row       The row.
+ *
+ * @return false if the row was deleted, true otherwise.
+ */
+bool directory_row_exists(const Directory *directory, size_t row);
+
+/**
+ * Get Content Version.
+ *
+ * @param directory A pointer to the directory.
+ *
+ * @return The version of the content, changed by every write.
+ */
+unsigned long directory_version(const Directory *directory);
+
+/**
+ * Check Bloom Filters.
+ *
+ * @param directory A pointer to the directory.
+ * @param column    The indexed column.
+ * @param hash      The hash of the normalized key.
+ *
+ * @return false if no row holds the key, true if some row may hold it.
+ */
+bool directory_may_contain(const Directory *directory, int column, uint64_t hash);
+
+/**
+ * Get Value.
+ *
+ * @param directory A pointer to the directory.
+ * @param row       The row of the value.
+ * @param column    The column of the value.
+ * @param scratch   A pointer to a buffer of at least maxLength bytes of the column,
+ *                  used when the value has to be assembled.
+ *
+ * @return The value of the field.
+ */
+Field directory_value(const Directory *directory, size_t row, int column, char *scratch);
+
+/**
+ * Get Normalized Key.
+ *
+ * @param directory A pointer to the directory.
+ * @param row       The row of the key.
+ * @param column    The column of the key.
+ * @param scratch   A pointer to a buffer of at least maxLength bytes of the column,
+ *                  used when the key has to be assembled.
+ *
+ * @return The normalized matching key of the field.
+ */
+Field directory_key(const Directory *directory, size_t row, int column, char *scratch);
+
+/**
+ * Next Value of Field.
+ *
+ * Splits the next value off a multi-valued field. A field without the separator
+ * has exactly one value, which may be empty.
+ *
+ * @param rest      A pointer to the rest of the field, advanced past the returned value.
+ *                  Its length is -1 once every value was returned.
+ * @param separator The separator of the values or 0 for single-valued fields.
+ * @param value     A pointer to the field receiving the value.
+ *
+ * @return true if a value was returned, false at the end of the field.
+ */
+bool field_next_value(Field *rest, char separator, Field *value);
+
+/**
+ * Look up Equality Index.
+ *
+ * Positions the cursor at the bucket of the normalized key or at the key in the disk
+ * index. The cursor returns every row that may hold the key, so the rows still have
+ * to be compared with the key. Rows of the database file come in ascending order,
+ * written rows follow them.
+ *
+ * @param directory A pointer to the directory.
+ * @param column    The column to look up.
+ * @param key       The normalized key.
+ * @param cursor    A pointer to the cursor to position.
+ *
+ * @return true if the column is indexed, false otherwise.
+ */
+bool directory_index_lookup(const Directory *directory, int column, Field key, IndexCursor *cursor);
+
+/**
+ * Look up Prefix in Disk Index.
+ *
+ * Positions the cursor at the first key starting with the normalized prefix. The cursor
+ * returns every row holding such a key once, rows of the database file in the order of
+ * their keys followed by written rows, and the rows still have to be compared with the filter.
+ *
+ * @param directory A pointer to the directory.
+ * @param column    The column to look up.
+ * @param prefix    The normalized prefix.
+ * @param cursor    A pointer to the cursor to position.
+ *
+ * @return true if the column has a disk index, false otherwise.
+ */
+bool directory_prefix_lookup(const Directory *directory, int column, Field prefix, IndexCursor *cursor);
+
+/**
+ * Find Row by Key.
+ *
+ * Finds a row holding the normalized key in the column, using the equality index
+ * of indexed columns and a scan of the others. Deleted rows are skipped.
+ *
+ * @param directory A pointer to the directory.
+ * @param column    The column to search.
+ * @param key       The normalized key.
+ * @param scratch   A pointer to a buffer of at least maxLength bytes of the column.
+ * @param row       A pointer receiving the row.
+ *
+ * @return true if a row was found, false otherwise.
+ */
+bool directory_find_row(const Directory *directory, int column, Field key, char *scratch, size_t *row);
+
+/**
+ * Next Row of Index Cursor.
+ *
+ * @param cursor    A pointer to the cursor.
+ * @param row       A pointer receiving the next candidate row.
+ *
+ * @return true if a row was returned, false at the end of the bucket.
+ */
+bool index_cursor_next(IndexCursor *cursor, size_t *row);
+
+/**
+ * Find Next Separator.
+ *
+ * Finds the first ';' or '\n' in the given range using vectorized byte scans where available.
+ *
+ * @param data A pointer to the first byte to scan.
+ * @param end  A pointer one past the last byte to scan.
+ *
+ * @return A pointer to the separator or end if there is none.
+ */
+const char *find_separator(const char *data, const char *end);
+
+/**
+ * Count Lines.
+ *
+ * Counts '\n' bytes in the given range using vectorized byte scans where available.
+ *
+ * @param data A pointer to the first byte to scan.
+ * @param end  A pointer one past the last byte to scan.
+ *
+ * @return The number of '\n' bytes in the range.
+ */
+size_t count_lines(const char *data, const char *end);
+
+#endif
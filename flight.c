@@ -0,0 +1,204 @@
+/**
+ *
+ * @file flight.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "arena.h"
+#include "bind.h"
+#include "hash.h"
+#include "stats.h"
+#include "flight.h"
+
+__thread FlightBuffer *responseCapture;
+
+static bool enabled;
+static pthread_mutex_t flightLock = PTHREAD_MUTEX_INITIALIZER;
+static Flight flights[FLIGHT_SLOTS];
+
+void flight_init(void)
+{
+    for (int i = 0; i < FLIGHT_SLOTS; i++)
+        pthread_cond_init(&flights[i].finished, NULL);
+    enabled = true;
+}
+
+bool flight_enabled(void)
+{
+    return enabled;
+}
+
+Flight *flight_begin(const char *key, int keyLength, bool *leader)
+{
+    uint64_t hash = hash_bytes(key, keyLength);
+    Flight *flight = NULL;
+    Flight *freeSlot = NULL;
+
+    pthread_mutex_lock(&flightLock);
+    for (int i = 0; i < FLIGHT_SLOTS; i++)
+    {
+        Flight *slot = &flights[i];
+        if (!slot->used)
+        {
+            if (freeSlot == NULL)
+                freeSlot = slot;
+        }
+        else if (!slot->done && slot->hash == hash && slot->keyLength == keyLength && memcmp(slot->key, key, keyLength) == 0)
+        {
+            flight = slot;
+            break;
+        }
+    }
+
+    if (flight != NULL)
+    {
+        flight->references++;
+        flight->followers++;
+        *leader = false;
+    }
+    else if (freeSlot != NULL)
+    {
+        flight = freeSlot;
+        flight->used = true;
+        flight->done = false;
+        flight->hash = hash;
+        flight->keyLength = keyLength;
+        memcpy(flight->key, key, keyLength);
+        flight->abandoned = false;
+        flight->references = 1;
+        flight->followers = 0;
+        flight->result.length = 0;
+        *leader = true;
+    }
+    pthread_mutex_unlock(&flightLock);
+
+    if (flight != NULL && !*leader)
+        stats_add(&stats->searchesCoalesced, 1);
+    return flight;
+}
+
+static void flight_release(Flight *flight)
+{
+    if (--flight->references == 0)
+    {
+        free(flight->result.data);
+        memset(&flight->result, 0, sizeof(FlightBuffer));
+        flight->used = false;
+    }
+}
+
+static void flight_end(Flight *flight, bool abandoned)
+{
+    pthread_mutex_lock(&flightLock);
+    flight->abandoned = abandoned;
+    __atomic_store_n(&flight->done, true, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&flight->finished);
+    flight_release(flight);
+    pthread_mutex_unlock(&flightLock);
+}
+
+void flight_finish(Flight *flight)
+{
+    flight_end(flight, false);
+}
+
+void flight_abandon(Flight *flight)
+{
+    flight_end(flight, true);
+}
+
+bool flight_ready(Flight *flight)
+{
+    return __atomic_load_n(&flight->done, __ATOMIC_ACQUIRE);
+}
+
+void flight_leave(Flight *flight)
+{
+    pthread_mutex_lock(&flightLock);
+    flight_release(flight);
+    pthread_mutex_unlock(&flightLock);
+}
+
+bool flight_follow(Flight *flight, int messageId, int clientSocket)
+{
+    pthread_mutex_lock(&flightLock);
+    while (!flight->done)
+        pthread_cond_wait(&flight->finished, &flightLock);
+    bool abandoned = flight->abandoned;
+    pthread_mutex_unlock(&flightLock);
+
+    if (abandoned)
+    {
+        flight_leave(flight);
+        return false;
+    }
+
+    // the result is immutable once the leader is done
+    const unsigned char *data = flight->result.data;
+    size_t length = flight->result.length;
+    size_t position = 0;
+    int offset = 0;
+    // a new header is at most 8 bytes longer than the replaced one
+    unsigned char *buff = (unsigned char *)arena_alloc(requestArena, length * 2 + 32);
+
+    while (position + 2 <= length)
+    {
+        // skip the message header and the message id of the leader
+        int lengthOfLength = data[position + 1] & 0x80 ? (data[position + 1] & 0x7F) + 1 : 1;
+        size_t messageLength = 0;
+        if (lengthOfLength == 1)
+            messageLength = data[position + 1];
+        for (int i = 1; i < lengthOfLength; i++)
+            messageLength = messageLength * 256 + data[position + 1 + i];
+        size_t messageEnd = position + 1 + lengthOfLength + messageLength;
+        size_t idPosition = position + 1 + lengthOfLength;
+        size_t opPosition = idPosition + 2 + data[idPosition + 1];
+        int opLength = messageEnd - opPosition;
+
+        add_ldap_byte(buff, &offset, LDAP_MESSAGE_PREFIX);
+        int lengthOffset = offset;
+        add_ldap_byte(buff, &offset, LDAP_PLACEHOLDER);
+        add_integer(buff, &offset, messageId);
+        memcpy(buff + offset, data + opPosition, opLength);
+        offset += opLength;
+        set_ldap_length(buff, &offset, lengthOffset);
+
+        position = messageEnd;
+    }
+    if (offset > 0)
+        ldap_send(buff, clientSocket, offset);
+
+    flight_leave(flight);
+    return true;
+}
+
+void flight_capture(const unsigned char *data, int length)
+{
+    FlightBuffer *buffer = responseCapture;
+    if (buffer->length + length > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity : MAX_BUFFER_SIZE;
+        while (capacity < buffer->length + length)
+            capacity *= 2;
+        unsigned char *grown = (unsigned char *)realloc(buffer->data, capacity);
+        if (grown == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+        buffer->data = grown;
+        buffer->capacity = capacity;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
@@ -0,0 +1,154 @@
+/**
+ *
+ * @file flight.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _FLIGHT_H
+#define _FLIGHT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "cache.h"
+
+enum FlightConst
+{
+    FLIGHT_SLOTS = 64 // maximal number of distinct searches in flight at once
+};
+
+/**
+ * Structure representing a growable buffer of encoded LDAP messages.
+ */
+typedef struct
+{
+    unsigned char *data; /**< The encoded messages. */
+    size_t length;       /**< The number of used bytes. */
+    size_t capacity;     /**< The number of allocated bytes. */
+} FlightBuffer;
+
+/**
+ * Structure representing one search in flight.
+ *
+ * The first connection running a query is its leader. Connections sending the same query
+ * while the leader runs become followers, wait for the leader and replay its responses
+ * with their own message ids.
+ */
+typedef struct
+{
+    char key[CACHE_KEY_SIZE]; /**< The canonical query. */
+    int keyLength;            /**< The length of the canonical query. */
+    uint64_t hash;            /**< The hash of the canonical query. */
+    bool used;                /**< Flag indicating whether the slot is in use. */
+    bool done;                /**< Flag indicating whether the leader finished. */
+    bool abandoned;           /**< Flag indicating whether the leader gave up before finishing. */
+    int references;           /**< The number of connections using the flight. */
+    int followers;            /**< The number of connections waiting for the leader. */
+    pthread_cond_t finished;  /**< Signaled when the leader finishes. */
+    FlightBuffer result;      /**< The responses sent by the leader, captured while it runs. */
+} Flight;
+
+/**
+ * Responses sent by the current thread are appended here when not NULL.
+ */
+extern __thread FlightBuffer *responseCapture;
+
+/**
+ * Initialize Search Coalescing.
+ *
+ * Coalescing is only possible when connections are served by threads of one process.
+ */
+void flight_init(void);
+
+/**
+ * Check whether Search Coalescing is Enabled.
+ *
+ * @return true if flight_init() was called.
+ */
+bool flight_enabled(void);
+
+/**
+ * Begin Search.
+ *
+ * Attaches to the running search of the same query or starts a new one. The leader
+ * has to capture its responses into the result of the flight, by pointing responseCapture
+ * to it while it runs, until flight_finish() or flight_abandon() is called.
+ *
+ * @param key       A pointer to the canonical query.
+ * @param keyLength The length of the canonical query.
+ * @param leader    A pointer to the flag set when the caller has to run the search.
+ *
+ * @return The flight of the query or NULL if no slot is free and the search has to run uncoalesced.
+ */
+Flight *flight_begin(const char *key, int keyLength, bool *leader);
+
+/**
+ * Finish Search as Leader.
+ *
+ * Publishes the captured responses to the followers and releases the flight.
+ *
+ * @param flight A pointer to the flight returned by flight_begin().
+ */
+void flight_finish(Flight *flight);
+
+/**
+ * Abandon Search as Leader.
+ *
+ * Releases the flight without a result. The followers run the search themselves.
+ *
+ * @param flight A pointer to the flight returned by flight_begin().
+ */
+void flight_abandon(Flight *flight);
+
+/**
+ * Check whether Leader Finished.
+ *
+ * Lets a follower wait for the leader without blocking its other operations.
+ *
+ * @param flight A pointer to the flight returned by flight_begin().
+ *
+ * @return true if flight_follow() would not block.
+ */
+bool flight_ready(Flight *flight);
+
+/**
+ * Follow Search.
+ *
+ * Waits for the leader to finish and sends its responses to the client with
+ * the given message id.
+ *
+ * @param flight        A pointer to the flight returned by flight_begin().
+ * @param messageId     The message id of the follower's request.
+ * @param clientSocket  The socket of the follower.
+ *
+ * @return true if the responses were sent, false if the leader abandoned the search
+ *         and the follower has to run it. The flight is released either way.
+ */
+bool flight_follow(Flight *flight, int messageId, int clientSocket);
+
+/**
+ * Leave Search as Follower.
+ *
+ * Releases the flight without waiting for the leader.
+ *
+ * @param flight A pointer to the flight returned by flight_begin().
+ */
+void flight_leave(Flight *flight);
+
+/**
+ * Capture Response.
+ *
+ * Appends the sent message to the buffer responseCapture points to.
+ *
+ * @param data      A pointer to the encoded message.
+ * @param length    The length of the message.
+ */
+void flight_capture(const unsigned char *data, int length);
+
+#endif
@@ -0,0 +1,47 @@
+/**
+ *
+ * @file hash.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <string.h>
+#include "hash.h"
+
+static uint64_t hash_mix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xFF51AFD7ED558CCDULL;
+    value ^= value >> 33;
+    value *= 0xC4CEB9FE1A85EC53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+uint64_t hash_bytes(const void *data, int length)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ (uint64_t)length;
+
+    // eight bytes at a time, the tail is zero padded
+    while (length >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        hash = hash_mix(hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        bytes += 8;
+        length -= 8;
+    }
+    if (length > 0)
+    {
+        uint64_t word = 0;
+        memcpy(&word, bytes, length);
+        hash = hash_mix(hash ^ word) * 0x9E3779B97F4A7C15ULL;
+    }
+    return hash_mix(hash);
+}
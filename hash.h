@@ -0,0 +1,30 @@
+/**
+ *
+ * @file hash.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <stdint.h>
+
+/**
+ * Hash Bytes.
+ *
+ * Computes a 64-bit hash of the given bytes. The hash is stable across processes,
+ * so it can be used for structures built before the connection processes are forked.
+ *
+ * @param data      A pointer to the bytes to hash.
+ * @param length    The number of bytes to hash.
+ *
+ * @return          The 64-bit hash of the bytes.
+ */
+uint64_t hash_bytes(const void *data, int length);
+
+#endif
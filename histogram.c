@@ -0,0 +1,86 @@
+/**
+ *
+ * @file histogram.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdint.h>
+#include "histogram.h"
+
+static int histogram_bucket(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS)
+        return value;
+    int exponent = 63 - __builtin_clzll(value);
+    int mantissa = (value >> (exponent - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+    return (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + mantissa;
+}
+
+static uint64_t histogram_bucket_low(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return bucket;
+    int exponent = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+    uint64_t mantissa = bucket % HISTOGRAM_SUB_BUCKETS;
+    return (HISTOGRAM_SUB_BUCKETS + mantissa) << (exponent - HISTOGRAM_SUB_BITS);
+}
+
+static uint64_t histogram_bucket_width(int bucket)
+{
+    if (bucket < HISTOGRAM_SUB_BUCKETS)
+        return 1;
+    return (uint64_t)1 << (bucket / HISTOGRAM_SUB_BUCKETS - 1);
+}
+
+void histogram_record(Histogram *histogram, uint64_t value)
+{
+    __atomic_add_fetch(&histogram->buckets[histogram_bucket(value)], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->sum, value, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+}
+
+void histogram_merge(Histogram *target, const Histogram *source)
+{
+    target->count += __atomic_load_n(&source->count, __ATOMIC_RELAXED);
+    target->sum += __atomic_load_n(&source->sum, __ATOMIC_RELAXED);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        target->buckets[i] += __atomic_load_n(&source->buckets[i], __ATOMIC_RELAXED);
+}
+
+uint64_t histogram_quantile(const Histogram *histogram, double quantile)
+{
+    // the count may lag behind the buckets while values are recorded, so the buckets are summed
+    uint64_t total = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+        total += histogram->buckets[i];
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (uint64_t)(quantile * total);
+    if (rank >= total)
+        rank = total - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+    {
+        seen += histogram->buckets[i];
+        if (seen > rank)
+            return histogram_bucket_low(i) + histogram_bucket_width(i) / 2;
+    }
+    return 0;
+}
+
+uint64_t histogram_max(const Histogram *histogram)
+{
+    for (int i = HISTOGRAM_BUCKETS - 1; i >= 0; i--)
+    {
+        if (histogram->buckets[i] > 0)
+            return histogram_bucket_low(i) + histogram_bucket_width(i) - 1;
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+/**
+ *
+ * @file histogram.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <stdint.h>
+
+enum HistogramConst
+{
+    HISTOGRAM_SUB_BITS = 4,                                 // every power of two is split into 16 buckets
+    HISTOGRAM_SUB_BUCKETS = 1 << HISTOGRAM_SUB_BITS,
+    HISTOGRAM_BUCKETS = (64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS // enough for any 64-bit value
+};
+
+/**
+ * Structure representing a log-linear histogram.
+ *
+ * Values below 16 have a bucket each, larger values share a bucket with values
+ * differing by less than 1/16 of their power of two, so every quantile is known
+ * within 6.25 % while the histogram has a fixed size.
+ */
+typedef struct
+{
+    uint64_t count;                     /**< The number of recorded values. */
+    uint64_t sum;                       /**< The sum of the recorded values. */
+    uint64_t buckets[HISTOGRAM_BUCKETS]; /**< The number of values in every bucket. */
+} Histogram;
+
+/**
+ * Record Value.
+ *
+ * Adds the value with relaxed atomic increments, so several writers may share the histogram.
+ *
+ * @param histogram A pointer to the histogram.
+ * @param value     The value to record.
+ */
+void histogram_record(Histogram *histogram, uint64_t value);
+
+/**
+ * Merge Histograms.
+ *
+ * @param target    A pointer to the histogram receiving the values.
+ * @param source    A pointer to the histogram to add.
+ */
+void histogram_merge(Histogram *target, const Histogram *source);
+
+/**
+ * Get Quantile.
+ *
+ * @param histogram A pointer to the histogram.
+ * @param quantile  The quantile in <0, 1>.
+ *
+ * @return The middle of the bucket holding the quantile, 0 for an empty histogram.
+ */
+uint64_t histogram_quantile(const Histogram *histogram, double quantile);
+
+/**
+ * Get Maximum.
+ *
+ * @param histogram A pointer to the histogram.
+ *
+ * @return The upper bound of the highest non-empty bucket, 0 for an empty histogram.
+ */
+uint64_t histogram_max(const Histogram *histogram);
+
+#endif
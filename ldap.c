@@ -15,17 +15,106 @@
 #include <string.h>
 #include <stdbool.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
+#include <poll.h>
 #include <ctype.h>
 #include "utils.h"
+#include "directory.h"
 #include "ldap.h"
 #include "bind.h"
 #include "search.h"
+#include "compare.h"
+#include "update.h"
+#include "arena.h"
+#include "output.h"
+#include "stats.h"
+#include "trace.h"
+#include "monitor.h"
+#include "profile.h"
+#include "slowlog.h"
+#include "capture.h"
+#include "response.h"
 
-// represents offset pointer to revecied data
-int currentTagPosition;
+// represents offset pointer to revecied data, every connection thread has its own
+__thread int currentTagPosition;
 
-int ldap_handle_request(unsigned char *data, size_t length, int clientSocket, FILE *file)
+static Operation *operation_start(Connection *connection, int messageId)
 {
+    for (int i = 0; i < MAX_OPERATIONS; i++)
+    {
+        Operation *operation = &connection->operations[i];
+        if (operation->used)
+            continue;
+        if (!operation->arenaReady)
+        {
+            arena_init(&operation->arena, ARENA_BLOCK_SIZE);
+            operation->arenaReady = true;
+        }
+        operation->used = true;
+        operation->messageId = messageId;
+        connection->running++;
+        return operation;
+    }
+    return NULL;
+}
+
+static void operation_end(Connection *connection, Operation *operation, bool abandoned)
+{
+    trace(TRACE_DEBUG, TRACE_ARENA, operation->messageId, operation->arena.allocations, operation->arena.heapCalls);
+    stats_add(&stats->arenaAllocations, operation->arena.allocations);
+    stats_add(&stats->arenaHeapCalls, operation->arena.heapCalls);
+    if (abandoned)
+    {
+        // an abandoned search gives its memory back right away
+        arena_dispose(&operation->arena);
+        operation->arenaReady = false;
+    }
+    else
+    {
+        arena_reset(&operation->arena);
+    }
+    operation->used = false;
+    connection->running--;
+}
+
+static bool ldap_has_control(const unsigned char *data, size_t length, const char *oid)
+{
+    // the controls follow the message id and the protocol operation
+    size_t position = 0, elementLength;
+    if (ber_read_header(data, length, &position, &elementLength) != LDAP_MESSAGE_PREFIX)
+        return false;
+    for (int i = 0; i < 2; i++)
+    {
+        if (ber_read_header(data, length, &position, &elementLength) == -1)
+            return false;
+        position += elementLength;
+    }
+    if (ber_read_header(data, length, &position, &elementLength) != CONTROLS_TYPE)
+        return false;
+
+    size_t end = position + elementLength;
+    size_t oidLength = strlen(oid);
+    while (position < end)
+    {
+        if (ber_read_header(data, end, &position, &elementLength) != LDAP_MESSAGE_PREFIX)
+            return false;
+        size_t controlEnd = position + elementLength;
+        size_t typeLength;
+        if (ber_read_header(data, controlEnd, &position, &typeLength) != OCTET_STRING_TYPE)
+            return false;
+        if (typeLength == oidLength && memcmp(data + position, oid, oidLength) == 0)
+            return true;
+        position = controlEnd;
+    }
+    return false;
+}
+
+static int ldap_dispatch_request(Connection *connection, unsigned char *data, size_t length)
+{
+    int clientSocket = connection->clientSocket;
+    Directory *directory = connection->directory;
+    uint64_t startTime = monitor_now();
+
     if (length < 5)
     {
         ldap_notice_of_disconnection(clientSocket);
@@ -37,71 +126,356 @@ int ldap_handle_request(unsigned char *data, size_t length, int clientSocket, FI
 
     int messageId = get_int_value(data);
     elementInfo = get_ldap_element_info(data);
+    trace(TRACE_INFO, TRACE_REQUEST, messageId, elementInfo.tagValue, length);
 
     switch (elementInfo.tagValue)
     {
     case LDAP_BIND_REQUEST:;
-        LdapBind bind = ldap_bind(data, messageId);
-        ldap_bind_response(bind, clientSocket);
+        profile_operation(PROFILE_BIND);
+        LdapBind bind = ldap_bind(data, length, messageId);
+        int bindResult = ldap_bind_evaluate(bind, directory);
+        profile_switch(PROFILE_ENCODE);
+        ldap_bind_response(bind, bindResult, clientSocket);
+        monitor_record(MONITOR_BIND, monitor_now() - startTime);
+        stats_add(&stats->binds, 1);
         break;
 
     case LDAP_SEARCH_REQUEST:;
-        LdapSearch search = ldap_search(data, messageId);
-        print_ldap_search(search);
-        ldap_search_response(search, clientSocket, file);
-        dispose_ldap_search(search);
+        // the search keeps its own memory until it is finished
+        profile_operation(PROFILE_SEARCH);
+        Operation *operation = operation_start(connection, messageId);
+        requestArena = &operation->arena;
+        LdapSearch search = ldap_search(data, messageId, &directory->schema);
+        search.explain = ldap_has_control(data, length, SEARCH_EXPLAIN_OID);
+        trace(TRACE_INFO, TRACE_SEARCH, messageId, search.filter.filterType, search.sizeLimit);
+        profile_switch(PROFILE_PLAN);
+        if (monitor_is_base(search.baseObject))
+        {
+            // the server's own statistics are answered right away
+            monitor_search(search, clientSocket);
+            operation_end(connection, operation, false);
+        }
+        else
+        {
+            search_cursor_begin(&operation->cursor, search, directory, clientSocket);
+            if (operation->cursor.state == SEARCH_DONE)
+                operation_end(connection, operation, false);
+        }
+        requestArena = &connection->arena;
+        stats_add(&stats->searches, 1);
+        break;
+
+    case LDAP_COMPARE_REQUEST:;
+        profile_operation(PROFILE_COMPARE);
+        LdapCompare compare = ldap_compare(data, length, messageId);
+        profile_switch(PROFILE_MATCH);
+        int resultCode = ldap_compare_evaluate(compare, directory);
+        profile_switch(PROFILE_ENCODE);
+        ldap_compare_response(compare, resultCode, clientSocket);
+        monitor_record(MONITOR_COMPARE, monitor_now() - startTime);
+        stats_add(&stats->compares, 1);
+        break;
+
+    case LDAP_ADD_REQUEST:
+    case LDAP_DELETE_REQUEST:
+    case LDAP_MODIFY_REQUEST:;
+        profile_operation(PROFILE_UPDATE);
+        LdapUpdate update = ldap_update(data, length, messageId);
+        profile_switch(PROFILE_MATCH);
+        int updateResult = ldap_update_evaluate(update, directory);
+        profile_switch(PROFILE_ENCODE);
+        ldap_update_response(update, updateResult, clientSocket);
+        monitor_record(MONITOR_UPDATE, monitor_now() - startTime);
+        break;
+
+    case LDAP_ABANDON_REQUEST:;
+        // the message id of the abandoned operation is the content of the request
+        int idLength = data[elementInfo.start];
+        if (elementInfo.start + 1 + idLength > (int)length)
+            return -1;
+        int abandonedId = 0;
+        for (int i = 0; i < idLength; i++)
+            abandonedId = abandonedId * 256 + data[elementInfo.start + 1 + i];
+
+        for (int i = 0; i < MAX_OPERATIONS; i++)
+        {
+            Operation *abandoned = &connection->operations[i];
+            if (abandoned->used && abandoned->messageId == abandonedId)
+            {
+                search_cursor_abandon(&abandoned->cursor);
+                operation_end(connection, abandoned, true);
+                trace(TRACE_INFO, TRACE_ABANDON, messageId, abandonedId, connection->running);
+                stats_add(&stats->abandons, 1);
+            }
+        }
         break;
 
     case LDAP_UNBIND_REQUEST:
-        debug(1, "****UNBIND REQUEST****\n");
+        trace(TRACE_INFO, TRACE_UNBIND, messageId, 0, 0);
         return -1;
         break;
 
     default:
         ldap_notice_of_disconnection(clientSocket);
-        debug(1, "Received an unknown or unsupported operation.\n");
+        trace(TRACE_INFO, TRACE_UNSUPPORTED, messageId, elementInfo.tagValue, length);
         return -1;
     }
 
     return 0;
 }
 
+int ldap_handle_request(Connection *connection, unsigned char *data, size_t length)
+{
+    // the stages are charged to the connection until the request type is known
+    profile_begin(PROFILE_CONNECTION, PROFILE_DECODE);
+    int result = ldap_dispatch_request(connection, data, length);
+    profile_end(true);
+    return result;
+}
+
+long ldap_message_length(const unsigned char *data, size_t length)
+{
+    if (length < 2)
+        return 0;
+    if (data[0] != LDAP_MESSAGE_PREFIX)
+        return -1;
+    if (data[1] < 0x80)
+        return 2 + data[1];
+
+    int lengthOfLength = data[1] & 0x7F;
+    if (lengthOfLength == 0 || lengthOfLength > 4)
+        return -1;
+    if (length < 2 + (size_t)lengthOfLength)
+        return 0;
+
+    long messageLength = 0;
+    for (int i = 0; i < lengthOfLength; i++)
+        messageLength = messageLength * 256 + data[2 + i];
+    return 2 + lengthOfLength + messageLength;
+}
+
+void ldap_notice_of_disconnection_encode(unsigned char *buff, int *offset)
+{
+    add_ldap_byte(buff, offset, LDAP_EXTENDED_RESPONSE);
+    int extendedResponseOffset = *offset;
+    add_ldap_byte(buff, offset, LDAP_PLACEHOLDER);
+
+    add_ldap_byte(buff, offset, ENUMERATED_TYPE);
+    add_ldap_byte(buff, offset, 1);
+    add_ldap_byte(buff, offset, UNAVAILABLE);
+
+    add_ldap_string(buff, offset, "");
+    add_ldap_string(buff, offset, "Received an unknown or unsupported message.");
+    add_ldap_oid(buff, offset, "1.3.6.1.4.1.1466.20036");
+    buff[extendedResponseOffset] = *offset - extendedResponseOffset - 1;
+}
+
 void ldap_notice_of_disconnection(int clientSocket)
 {
-    int offset = 0;
-    unsigned char buff[MAX_BUFFER_SIZE];
-    memset(buff, 0, MAX_BUFFER_SIZE); // clear the buffer
-
-    create_ldap_header(buff, &offset, 0);
-    add_ldap_byte(buff, &offset, LDAP_EXTENDED_RESPONSE);
-    int extendedResponseOffset = offset;
-    add_ldap_byte(buff, &offset, LDAP_PLACEHOLDER);
-
-    add_ldap_byte(buff, &offset, ENUMERATED_TYPE);
-    add_ldap_byte(buff, &offset, 1);
-    add_ldap_byte(buff, &offset, UNAVAILABLE);
-
-    add_ldap_string(buff, &offset, "");
-    add_ldap_string(buff, &offset, "Received an unknown or unsupported message.");
-    add_ldap_oid(buff, &offset, "1.3.6.1.4.1.1466.20036");
-    buff[LDAP_MSG_LENGTH_OFFSET] = offset - 2; // ldap msg tag, and length
-    buff[extendedResponseOffset] = offset - extendedResponseOffset - 1;
-    ldap_send(buff, clientSocket, offset);
+    // unsolicited notifications have the message id 0
+    response_send(RESPONSE_NOTICE, UNAVAILABLE, 0, clientSocket);
 }
 
-void ldap(int clientSocket, FILE *file)
+static int ldap_handle_input(Connection *connection)
 {
-    size_t receivedBytes;
-    int recivedDataCode = 0;
-    while (recivedDataCode != -1)
+    size_t position = 0;
+    int result = 0;
+
+    // a search is only started when there is a slot for it, the rest waits in the buffer
+    while (result != -1 && connection->running < MAX_OPERATIONS)
     {
-        unsigned char *receivedData = ldap_receive(clientSocket, &receivedBytes);
-        debug(1, "Received data from client:\n");
-        print_hex_message(receivedData, receivedBytes);
+        size_t available = connection->inputLength - position;
+        long length = ldap_message_length(connection->input + position, available);
+        if (length == -1 || length > CONNECTION_INPUT_SIZE)
+        {
+            ldap_notice_of_disconnection(connection->clientSocket);
+            printf("Received an unknown or unsupported message.\n");
+            result = -1;
+            break;
+        }
+        if (length == 0 || (size_t)length > available)
+            break;
+
+        unsigned char *data = connection->input + position;
+        trace_bytes(data, length);
 
         currentTagPosition = 0;
-        recivedDataCode = ldap_handle_request(receivedData, receivedBytes, clientSocket, file);
-        // Free the allocated memory for receivedData
-        free(receivedData);
+        result = ldap_handle_request(connection, data, length);
+        position += length;
+
+        // everything allocated by the request lives in the arena
+        Arena *arena = &connection->arena;
+        trace(TRACE_DEBUG, TRACE_ARENA, 0, arena->allocations, arena->heapCalls);
+        connection->requests++;
+        stats_add(&stats->requests, 1);
+        stats_add(&stats->arenaAllocations, arena->allocations);
+        stats_add(&stats->arenaHeapCalls, arena->heapCalls);
+        arena_reset(arena);
+    }
+
+    memmove(connection->input, connection->input + position, connection->inputLength - position);
+    connection->inputLength -= position;
+    return result;
+}
+
+static void ldap_peer_address(int clientSocket, char *out, size_t size)
+{
+    struct sockaddr_storage address;
+    socklen_t addressLength = sizeof(address);
+    char host[INET6_ADDRSTRLEN] = "-";
+    int port = 0;
+
+    if (getpeername(clientSocket, (struct sockaddr *)&address, &addressLength) == 0)
+    {
+        if (address.ss_family == AF_INET6)
+        {
+            struct sockaddr_in6 *address6 = (struct sockaddr_in6 *)&address;
+            inet_ntop(AF_INET6, &address6->sin6_addr, host, sizeof(host));
+            port = ntohs(address6->sin6_port);
+        }
+        else if (address.ss_family == AF_INET)
+        {
+            struct sockaddr_in *address4 = (struct sockaddr_in *)&address;
+            inet_ntop(AF_INET, &address4->sin_addr, host, sizeof(host));
+            port = ntohs(address4->sin_port);
+        }
+    }
+    snprintf(out, size, "[%s]:%d", host, port);
+}
+
+static bool ldap_all_waiting(Connection *connection)
+{
+    for (int i = 0; i < MAX_OPERATIONS; i++)
+    {
+        if (connection->operations[i].used && !search_cursor_waiting(&connection->operations[i].cursor))
+            return false;
     }
-}
\ No newline at end of file
+    return true;
+}
+
+static bool ldap_request_buffered(Connection *connection)
+{
+    long length = ldap_message_length(connection->input, connection->inputLength);
+    return length == -1 || (length > 0 && (size_t)length <= connection->inputLength);
+}
+
+void ldap(int clientSocket, Directory *directory)
+{
+    Connection *connection = (Connection *)calloc(1, sizeof(Connection));
+    if (connection == NULL)
+    {
+        perror("calloc");
+        return;
+    }
+    connection->clientSocket = clientSocket;
+    connection->directory = directory;
+    ldap_peer_address(clientSocket, connection->address, sizeof(connection->address));
+    clientAddress = connection->address;
+    arena_init(&connection->arena, ARENA_BLOCK_SIZE);
+    requestArena = &connection->arena;
+    outputQueue = &connection->output;
+    trace(TRACE_INFO, TRACE_CONNECTION_OPEN, clientSocket, 0, 0);
+    capture_open();
+
+    int result = 0;
+    while (result != -1)
+    {
+        // a client not reading its results gets no new ones until it catches up
+        size_t pending = output_queue_pending(&connection->output);
+        if (!connection->paused && pending >= OUTPUT_HIGH_WATER)
+        {
+            connection->paused = true;
+            stats_add(&stats->outputPauses, 1);
+            trace(TRACE_INFO, TRACE_PAUSE, clientSocket, pending, 0);
+        }
+        else if (connection->paused && pending <= OUTPUT_LOW_WATER)
+        {
+            connection->paused = false;
+            trace(TRACE_INFO, TRACE_RESUME, clientSocket, pending, 0);
+        }
+
+        // block for the next request only when no search can make progress and none waits in the buffer
+        bool readable = connection->running < MAX_OPERATIONS && !connection->paused;
+        bool startable = readable && ldap_request_buffered(connection);
+        int timeout = 0;
+        if (connection->paused || (connection->running == 0 && !startable))
+            timeout = -1;
+        else if (!startable && ldap_all_waiting(connection))
+            timeout = 1;
+        // captured records of an idle connection are written before it waits
+        if (timeout == -1)
+            capture_flush();
+        struct pollfd pollFd = {clientSocket, (readable ? POLLIN : 0) | (pending > 0 ? POLLOUT : 0), 0};
+        int ready = poll(&pollFd, 1, timeout);
+        if (ready > 0 && (pollFd.revents & POLLOUT))
+        {
+            profile_begin(PROFILE_CONNECTION, PROFILE_SEND);
+            int drained = output_queue_drain(&connection->output, clientSocket);
+            profile_end(false);
+            if (drained == -1)
+                break;
+        }
+        if (ready > 0 && readable && (pollFd.revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            int received = ldap_receive(clientSocket, connection->input + connection->inputLength,
+                                        CONNECTION_INPUT_SIZE - connection->inputLength);
+            if (received == 0)
+                break;
+            connection->inputLength += received;
+        }
+        if (connection->paused)
+            continue;
+
+        result = ldap_handle_input(connection);
+
+        // every running search makes one step, filling at most its share of the room left in the queue
+        size_t queued = output_queue_pending(&connection->output);
+        size_t room = queued < OUTPUT_HIGH_WATER ? OUTPUT_HIGH_WATER - queued : 0;
+        size_t share = connection->running > 1 ? room / connection->running : room;
+        int first = connection->firstSlot;
+        connection->firstSlot = (first + 1) % MAX_OPERATIONS;
+        for (int step = 0; step < MAX_OPERATIONS && result != -1; step++)
+        {
+            Operation *operation = &connection->operations[(first + step) % MAX_OPERATIONS];
+            if (!operation->used)
+                continue;
+            requestArena = &operation->arena;
+            profile_begin(PROFILE_SEARCH, PROFILE_MATCH);
+            bool finished = search_cursor_step(&operation->cursor, SEARCH_SLICE_ROWS, share);
+            profile_end(false);
+            if (finished)
+                operation_end(connection, operation, false);
+        }
+        requestArena = &connection->arena;
+
+        // everything produced by this round leaves in one write
+        profile_begin(PROFILE_CONNECTION, PROFILE_SEND);
+        int drained = output_queue_drain(&connection->output, clientSocket);
+        profile_end(false);
+        if (drained == -1)
+            break;
+    }
+
+    // the responses before an unbind or a disconnection notice are still delivered
+    output_queue_flush(&connection->output, clientSocket);
+    outputQueue = NULL;
+    output_queue_dispose(&connection->output);
+
+    for (int i = 0; i < MAX_OPERATIONS; i++)
+    {
+        Operation *operation = &connection->operations[i];
+        if (operation->used)
+        {
+            search_cursor_abandon(&operation->cursor);
+            operation_end(connection, operation, true);
+        }
+        if (operation->arenaReady)
+            arena_dispose(&operation->arena);
+    }
+    arena_dispose(&connection->arena);
+    requestArena = NULL;
+    clientAddress = NULL;
+    capture_close();
+    trace(TRACE_INFO, TRACE_CONNECTION_CLOSE, clientSocket, connection->requests, 0);
+    free(connection);
+}
@@ -14,35 +14,119 @@
 #ifndef _LDAP_H
 #define _LDAP_H
 
-void ldap(int clientSocket, FILE *file);
+#include <stdbool.h>
+#include "directory.h"
+#include "arena.h"
+#include "output.h"
+#include "search.h"
+#include "slowlog.h"
+
+enum ConnectionConst
+{
+    CONNECTION_INPUT_SIZE = 16384, // the largest accepted request
+    MAX_OPERATIONS = 16            // searches of one connection running at once
+};
+
+/**
+ * Structure representing a search running on a connection.
+ */
+typedef struct
+{
+    bool used;           /**< Flag indicating whether the slot holds a running search. */
+    bool arenaReady;     /**< Flag indicating whether the arena was initialized. */
+    int messageId;       /**< The message id of the search, used by abandon requests. */
+    Arena arena;         /**< The memory of the search, kept for the next search of the slot. */
+    SearchCursor cursor; /**< The progress of the search. */
+} Operation;
+
+/**
+ * Structure representing a connected client.
+ */
+typedef struct
+{
+    int clientSocket;                      /**< The socket of the client. */
+    Directory *directory;                  /**< The loaded database file. */
+    Arena arena;                           /**< The memory of requests answered right away. */
+    unsigned char input[CONNECTION_INPUT_SIZE]; /**< Received bytes not handled yet. */
+    size_t inputLength;                    /**< The number of received bytes not handled yet. */
+    Operation operations[MAX_OPERATIONS];  /**< The searches in progress. */
+    int running;                           /**< The number of searches in progress. */
+    int firstSlot;                         /**< The operation stepped first in the next round. */
+    OutputQueue output;                    /**< Encoded responses not sent yet. */
+    bool paused;                           /**< Flag indicating whether the client has too much unread output. */
+    size_t requests;                       /**< The number of handled requests. */
+    char address[SLOW_LOG_CLIENT_SIZE];    /**< The address and port of the client. */
+} Connection;
+
+/**
+ * Serve LDAP Client.
+ *
+ * Receives and handles LDAP requests from the client until the client unbinds
+ * or an unsupported message is received. Received bytes are split into messages,
+ * so a client may send several requests at once. Searches run in steps interleaved
+ * with reading further requests, so a long search does not block the requests sent
+ * after it and can be abandoned while it runs. Responses are queued and sent when the
+ * socket is writable; while the client has more than OUTPUT_HIGH_WATER bytes unread,
+ * no results are produced and no requests are read until it drops below OUTPUT_LOW_WATER.
+ * Every running search may fill an equal share of the room below OUTPUT_HIGH_WATER in
+ * each round, so a large result does not hold back the searches sent after it.
+ *
+ * @param clientSocket  The socket of the connected client.
+ * @param directory     A pointer to the loaded database file.
+ */
+void ldap(int clientSocket, Directory *directory);
 
 /**
  * Receive LDAP data from a client socket.
  *
- * This function receives LDAP data from the specified client socket
- * and stores it in a buffer. It also updates the receivedBytes variable
- * with the number of bytes received.
+ * This function receives the available LDAP data from the specified client socket
+ * into the given buffer. The data may hold several messages or a part of one.
  *
  * @param clientSocket The socket to receive data from.
- * @param receivedBytes A pointer to a size_t variable to store the number of received bytes.
+ * @param buffer A pointer to the buffer receiving the data.
+ * @param size The free space of the buffer.
+ *
+ * @return The number of received bytes, 0 if the connection was closed or failed.
+ */
+int ldap_receive(int clientSocket, unsigned char *buffer, size_t size);
+
+/**
+ * Get Length of LDAP Message.
+ *
+ * @param data      A pointer to the received data.
+ * @param length    The number of received bytes.
  *
- * @return A pointer to the received data (a dynamically allocated buffer).
- *         The caller is responsible for freeing this buffer.
+ * @return The length of the first message including its tag and length, 0 if it was
+ *         not received completely yet or -1 if the data is not an LDAP message.
  */
-unsigned char *ldap_receive(int clientSocket, size_t *receivedBytes);
+long ldap_message_length(const unsigned char *data, size_t length);
 /**
  * Parse an LDAP request to determine the LDAP operation.
  *
  * This function analyzes the provided LDAP request data to determine the type
  * of LDAP operation it represents, such as bind, search, modify, etc.
+ * Searches are started in a free operation slot and answered by later steps,
+ * abandon requests stop the search with the given message id.
  *
+ * @param connection A pointer to the connection the request was received on.
  * @param data The LDAP request data to be parsed.
  * @param length The length of the LDAP request data.
  *
  * @return 0 if the LDAP request is successfully parsed and represents a valid LDAP operation.
  *         A non-zero value is returned if an error occurs during parsing.
  */
-int ldap_handle_request(unsigned char *data, size_t length, int clientSocket, FILE *file);
+int ldap_handle_request(Connection *connection, unsigned char *data, size_t length);
+
+/**
+ * Encode LDAP Notice of Disconnection.
+ *
+ * Encodes the protocol operation of the notice without a message header,
+ * used to build its response template.
+ *
+ * @param buff      A pointer to the buffer.
+ * @param offset    A pointer to the offset in the buffer, moved past the notice.
+ */
+void ldap_notice_of_disconnection_encode(unsigned char *buff, int *offset);
 
 /**
  * LDAP Notice of Disconnection.
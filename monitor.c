@@ -0,0 +1,191 @@
+/**
+ *
+ * @file monitor.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/sysinfo.h>
+#include "utils.h"
+#include "stats.h"
+#include "monitor.h"
+#include "replication.h"
+
+static MonitorSlot *monitorSlots;
+static int monitorSlotCount;
+
+static const char *histogramNames[MONITOR_HISTOGRAM_COUNT] = {
+    [MONITOR_BIND] = "bind",
+    [MONITOR_SEARCH] = "search",
+    [MONITOR_COMPARE] = "compare",
+    [MONITOR_UPDATE] = "update",
+    [MONITOR_FILTER_EQUALITY] = "filter-equality",
+    [MONITOR_FILTER_PREFIX] = "filter-prefix",
+    [MONITOR_FILTER_SUFFIX] = "filter-suffix",
+    [MONITOR_FILTER_INFIX] = "filter-infix",
+    [MONITOR_FILTER_OTHER] = "filter-other",
+    [MONITOR_PATH_SCAN] = "path-scan",
+    [MONITOR_PATH_INDEX] = "path-index",
+    [MONITOR_PATH_CACHE] = "path-cache",
+    [MONITOR_PATH_COALESCED] = "path-coalesced",
+    [MONITOR_PATH_BLOOM] = "path-bloom",
+    [MONITOR_PATH_NONE] = "path-none",
+    [MONITOR_ENCODE] = "encode-entry",
+    [MONITOR_ENTRIES] = "entries",
+};
+
+static const char monitorBase[] = "cn=monitor";
+
+void monitor_init(void)
+{
+    monitorSlotCount = get_nprocs_conf();
+    if (monitorSlotCount < 1)
+        monitorSlotCount = 1;
+    if (monitorSlotCount > MONITOR_MAX_SLOTS)
+        monitorSlotCount = MONITOR_MAX_SLOTS;
+
+    monitorSlots = (MonitorSlot *)mmap(NULL, monitorSlotCount * sizeof(MonitorSlot), PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (monitorSlots == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+}
+
+uint64_t monitor_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void monitor_record(int histogram, uint64_t value)
+{
+    if (monitorSlots == NULL)
+        return;
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+        cpu = 0;
+    histogram_record(&monitorSlots[cpu % monitorSlotCount].histograms[histogram], value);
+}
+
+bool monitor_is_base(const char *baseObject)
+{
+    int length = strlen(baseObject);
+    int baseLength = strlen(monitorBase);
+    if (length < baseLength || strcasecmp(baseObject + length - baseLength, monitorBase) != 0)
+        return false;
+    return length == baseLength || baseObject[length - baseLength - 1] == ',';
+}
+
+static void monitor_send_entry(int messageId, const char *name, const char **types, char values[][32], int count, int clientSocket)
+{
+    int offset = 0;
+    unsigned char buff[MAX_BUFFER_SIZE];
+
+    create_ldap_header(buff, &offset, messageId);
+    add_ldap_byte(buff, &offset, LDAP_SEARCH_RESULT_ENTRY);
+    int resultLengthOffset = offset;
+    add_ldap_byte(buff, &offset, LDAP_PLACEHOLDER);
+
+    char dn[SCHEMA_NAME_SIZE + sizeof(monitorBase) + 4];
+    snprintf(dn, sizeof(dn), "cn=%s,%s", name, monitorBase);
+    add_ldap_octets(buff, &offset, dn, strlen(dn));
+
+    add_ldap_byte(buff, &offset, LDAP_PARTIAL_ATTRIBUTE_LIST);
+    int attributeListOffset = offset;
+    add_ldap_byte(buff, &offset, LDAP_PLACEHOLDER);
+    Field cn = {name, strlen(name)};
+    add_ldap_attribute_list(buff, &offset, "cn", cn, 0);
+    for (int i = 0; i < count; i++)
+    {
+        Field value = {values[i], strlen(values[i])};
+        add_ldap_attribute_list(buff, &offset, types[i], value, 0);
+    }
+
+    set_ldap_length(buff, &offset, attributeListOffset);
+    set_ldap_length(buff, &offset, resultLengthOffset);
+    set_ldap_length(buff, &offset, LDAP_MSG_LENGTH_OFFSET);
+    ldap_send(buff, clientSocket, offset);
+}
+
+static bool monitor_wanted(const char *baseObject, const char *name)
+{
+    // the base is either cn=monitor or cn=<name>,cn=monitor
+    int prefixLength = strlen(baseObject) - strlen(monitorBase) - 1;
+    if (prefixLength <= 0)
+        return true;
+    return prefixLength == (int)strlen(name) + 3 && strncasecmp(baseObject, "cn=", 3) == 0 &&
+           strncasecmp(baseObject + 3, name, strlen(name)) == 0;
+}
+
+void monitor_search(LdapSearch search, int clientSocket)
+{
+    static const char *types[] = {"count", "mean", "p50", "p90", "p99", "p999", "max", "unit"};
+    char values[sizeof(types) / sizeof(types[0])][32];
+
+    Histogram *merged = (Histogram *)malloc(sizeof(Histogram));
+    if (merged == NULL)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    for (int histogram = 0; histogram < MONITOR_HISTOGRAM_COUNT && monitorSlots != NULL; histogram++)
+    {
+        if (!monitor_wanted(search.baseObject, histogramNames[histogram]))
+            continue;
+
+        // the per-core slots are summed only when someone asks
+        memset(merged, 0, sizeof(Histogram));
+        for (int slot = 0; slot < monitorSlotCount; slot++)
+            histogram_merge(merged, &monitorSlots[slot].histograms[histogram]);
+
+        snprintf(values[0], sizeof(values[0]), "%llu", (unsigned long long)merged->count);
+        snprintf(values[1], sizeof(values[1]), "%llu", (unsigned long long)(merged->count ? merged->sum / merged->count : 0));
+        snprintf(values[2], sizeof(values[2]), "%llu", (unsigned long long)histogram_quantile(merged, 0.5));
+        snprintf(values[3], sizeof(values[3]), "%llu", (unsigned long long)histogram_quantile(merged, 0.9));
+        snprintf(values[4], sizeof(values[4]), "%llu", (unsigned long long)histogram_quantile(merged, 0.99));
+        snprintf(values[5], sizeof(values[5]), "%llu", (unsigned long long)histogram_quantile(merged, 0.999));
+        snprintf(values[6], sizeof(values[6]), "%llu", (unsigned long long)histogram_max(merged));
+        snprintf(values[7], sizeof(values[7]), "%s", histogram == MONITOR_ENTRIES ? "entries" : "ns");
+        monitor_send_entry(search.messageId, histogramNames[histogram], types, values, 8, clientSocket);
+    }
+    free(merged);
+
+    if (monitor_wanted(search.baseObject, "counters"))
+    {
+        const char *counterTypes[MONITOR_MAX_COUNTERS];
+        char counterValues[MONITOR_MAX_COUNTERS][32];
+        int count = 0;
+        for (const StatsCounter *counter = statsCounters; counter->name != NULL && count < MONITOR_MAX_COUNTERS; counter++, count++)
+        {
+            counterTypes[count] = counter->name;
+            snprintf(counterValues[count], sizeof(counterValues[count]), "%zu", stats_get(counter));
+        }
+        monitor_send_entry(search.messageId, "counters", counterTypes, counterValues, count, clientSocket);
+    }
+
+    const char *replicationTypes[REPLICATION_MONITOR_FIELDS];
+    char replicationValues[REPLICATION_MONITOR_FIELDS][32];
+    int replicationCount;
+    if (monitor_wanted(search.baseObject, "replication") && (replicationCount = replication_monitor(replicationTypes, replicationValues)) > 0)
+        monitor_send_entry(search.messageId, "replication", replicationTypes, replicationValues, replicationCount, clientSocket);
+
+    int offset = 0;
+    unsigned char buff[MAX_BUFFER_SIZE];
+    create_ldap_header(buff, &offset, search.messageId);
+    ldap_search_res_done(buff, &offset, SUCCESS, NULL, clientSocket);
+}
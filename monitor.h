@@ -0,0 +1,105 @@
+/**
+ *
+ * @file monitor.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _MONITOR_H
+#define _MONITOR_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "histogram.h"
+#include "search.h"
+
+enum MonitorConst
+{
+    MONITOR_MAX_SLOTS = 64,    // per-core copies of the histograms
+    MONITOR_ENCODE_SAMPLE = 64, // one of this many encoded entries is timed
+    MONITOR_MAX_COUNTERS = 48   // statistics counters returned by cn=counters,cn=monitor
+};
+
+enum MonitorHistogram
+{
+    MONITOR_BIND,
+    MONITOR_SEARCH,
+    MONITOR_COMPARE,
+    MONITOR_UPDATE,
+    MONITOR_FILTER_EQUALITY,
+    MONITOR_FILTER_PREFIX,
+    MONITOR_FILTER_SUFFIX,
+    MONITOR_FILTER_INFIX,
+    MONITOR_FILTER_OTHER,
+    MONITOR_PATH_SCAN,
+    MONITOR_PATH_INDEX,
+    MONITOR_PATH_CACHE,
+    MONITOR_PATH_COALESCED,
+    MONITOR_PATH_BLOOM,
+    MONITOR_PATH_NONE,
+    MONITOR_ENCODE,
+    MONITOR_ENTRIES,
+    MONITOR_HISTOGRAM_COUNT
+};
+
+/**
+ * Structure representing the histograms updated by one core.
+ */
+typedef struct
+{
+    Histogram histograms[MONITOR_HISTOGRAM_COUNT]; /**< The histograms in MonitorHistogram order. */
+} __attribute__((aligned(64))) MonitorSlot;
+
+/**
+ * Initialize Monitor.
+ *
+ * Maps the shared memory holding one slot of histograms per core, up to MONITOR_MAX_SLOTS.
+ * Has to be called before the first connection process is created.
+ */
+void monitor_init(void);
+
+/**
+ * Get Monitor Time.
+ *
+ * @return The monotonic time in nanoseconds.
+ */
+uint64_t monitor_now(void);
+
+/**
+ * Record Value.
+ *
+ * Records the value into the slot of the core the caller runs on, so writers on
+ * different cores do not share cache lines. Does nothing before monitor_init().
+ *
+ * @param histogram The MonitorHistogram.
+ * @param value     The latency in nanoseconds or the number of entries.
+ */
+void monitor_record(int histogram, uint64_t value);
+
+/**
+ * Check Monitor Base.
+ *
+ * @param baseObject The base object of a search.
+ *
+ * @return true if the base is cn=monitor or an entry below it.
+ */
+bool monitor_is_base(const char *baseObject);
+
+/**
+ * Answer Monitor Search.
+ *
+ * Sends an entry cn=<histogram>,cn=monitor for every histogram with its count, mean,
+ * p50, p90, p99, p999 and max, and an entry cn=counters,cn=monitor with the statistics
+ * counters, followed by the search result done. A base naming one entry returns only that
+ * entry. The filter and scope are ignored.
+ *
+ * @param search        The search with a monitor base.
+ * @param clientSocket  The socket the responses are sent to.
+ */
+void monitor_search(LdapSearch search, int clientSocket);
+
+#endif
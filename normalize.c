@@ -0,0 +1,86 @@
+/**
+ *
+ * @file normalize.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdbool.h>
+#include "normalize.h"
+
+static unsigned int fold_code_point(unsigned int codePoint)
+{
+    if (codePoint >= 'A' && codePoint <= 'Z')
+        return codePoint + 0x20;
+    if (codePoint < 0xC0)
+        return codePoint;
+    // Latin-1 Supplement
+    if (codePoint <= 0xDE)
+        return codePoint == 0xD7 ? codePoint : codePoint + 0x20;
+    // Latin Extended-A
+    if ((codePoint >= 0x100 && codePoint <= 0x137) || (codePoint >= 0x14A && codePoint <= 0x177))
+        return codePoint | 1;
+    if ((codePoint >= 0x139 && codePoint <= 0x148) || (codePoint >= 0x179 && codePoint <= 0x17E))
+        return (codePoint & 1) ? codePoint + 1 : codePoint;
+    if (codePoint == 0x178)
+        return 0xFF;
+    // Greek
+    if (codePoint >= 0x391 && codePoint <= 0x3A9 && codePoint != 0x3A2)
+        return codePoint + 0x20;
+    // Cyrillic
+    if (codePoint >= 0x400 && codePoint <= 0x40F)
+        return codePoint + 0x50;
+    if (codePoint >= 0x410 && codePoint <= 0x42F)
+        return codePoint + 0x20;
+    return codePoint;
+}
+
+int normalize_value(const char *value, int length, char *out, bool trim, bool foldCase)
+{
+    const unsigned char *in = (const unsigned char *)value;
+    int i = 0, j = 0;
+    bool pendingSpace = false;
+
+    while (i < length)
+    {
+        unsigned char byte = in[i];
+
+        if (byte == ' ' || byte == '\t' || byte == '\r' || byte == '\n')
+        {
+            pendingSpace = true;
+            i++;
+            continue;
+        }
+        if (pendingSpace && (j > 0 || !trim))
+            out[j++] = ' ';
+        pendingSpace = false;
+
+        if (byte < 0x80)
+        {
+            out[j++] = (foldCase && byte >= 'A' && byte <= 'Z') ? byte + 0x20 : byte;
+            i++;
+        }
+        else if (foldCase && (byte & 0xE0) == 0xC0 && i + 1 < length && (in[i + 1] & 0xC0) == 0x80)
+        {
+            // only two byte sequences contain foldable code points
+            unsigned int codePoint = fold_code_point(((byte & 0x1F) << 6) | (in[i + 1] & 0x3F));
+            out[j++] = 0xC0 | (codePoint >> 6);
+            out[j++] = 0x80 | (codePoint & 0x3F);
+            i += 2;
+        }
+        else
+        {
+            out[j++] = byte;
+            i++;
+        }
+    }
+    if (pendingSpace && !trim)
+        out[j++] = ' ';
+
+    return j;
+}
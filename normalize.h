@@ -0,0 +1,35 @@
+/**
+ *
+ * @file normalize.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _NORMALIZE_H
+#define _NORMALIZE_H
+
+#include <stdbool.h>
+
+/**
+ * Normalize Value for Matching.
+ *
+ * Collapses every run of whitespace into a single space and, for case insensitive
+ * matching, case-folds the UTF-8 encoded value (ASCII, Latin-1, Latin Extended-A, Greek and Cyrillic). Case folding of the supported
+ * scripts never changes the encoded length, so the normalized value is never longer
+ * than the original one. Invalid UTF-8 sequences are copied unchanged.
+ *
+ * @param value     A pointer to the value to normalize.
+ * @param length    The length of the value in bytes.
+ * @param out       A pointer to the output buffer of at least 'length' bytes. May be equal to 'value'.
+ * @param trim      Flag indicating whether leading and trailing whitespace is removed.
+ * @param foldCase  Flag indicating whether the value is case-folded.
+ *
+ * @return          The length of the normalized value in bytes.
+ */
+int normalize_value(const char *value, int length, char *out, bool trim, bool foldCase);
+
+#endif
@@ -0,0 +1,104 @@
+/**
+ *
+ * @file output.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "utils.h"
+#include "output.h"
+#include "trace.h"
+
+__thread OutputQueue *outputQueue;
+
+void output_queue_push(OutputQueue *queue, const unsigned char *data, size_t length)
+{
+    if (queue->length + length > queue->capacity)
+    {
+        // move the unsent bytes to the front before growing
+        if (queue->start > 0)
+        {
+            memmove(queue->data, queue->data + queue->start, queue->length - queue->start);
+            queue->length -= queue->start;
+            queue->start = 0;
+        }
+        if (queue->length + length > queue->capacity)
+        {
+            size_t capacity = queue->capacity ? queue->capacity : MAX_BUFFER_SIZE;
+            while (capacity < queue->length + length)
+                capacity *= 2;
+            unsigned char *grown = (unsigned char *)realloc(queue->data, capacity);
+            if (grown == NULL)
+            {
+                perror("realloc");
+                exit(1);
+            }
+            queue->data = grown;
+            queue->capacity = capacity;
+        }
+    }
+    memcpy(queue->data + queue->length, data, length);
+    queue->length += length;
+}
+
+int output_queue_drain(OutputQueue *queue, int clientSocket)
+{
+    while (queue->start < queue->length)
+    {
+        ssize_t sent = send(clientSocket, queue->data + queue->start, queue->length - queue->start, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (sent < 0)
+        {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            if (errno == EINTR)
+                continue;
+            perror("ERROR in sendto");
+            return -1;
+        }
+        queue->start += sent;
+        trace(TRACE_DEBUG, TRACE_SEND, clientSocket, sent, queue->length - queue->start);
+    }
+    queue->start = 0;
+    queue->length = 0;
+    return 0;
+}
+
+void output_queue_flush(OutputQueue *queue, int clientSocket)
+{
+    while (output_queue_pending(queue) > 0)
+    {
+        struct pollfd pollFd = {clientSocket, POLLOUT, 0};
+        if (poll(&pollFd, 1, OUTPUT_FLUSH_TIMEOUT) <= 0 || output_queue_drain(queue, clientSocket) == -1)
+            return;
+    }
+}
+
+size_t output_queue_pending(const OutputQueue *queue)
+{
+    return queue->length - queue->start;
+}
+
+bool output_queue_full(const OutputQueue *queue)
+{
+    return output_queue_pending(queue) >= OUTPUT_HIGH_WATER;
+}
+
+void output_queue_dispose(OutputQueue *queue)
+{
+    free(queue->data);
+    queue->data = NULL;
+    queue->start = 0;
+    queue->length = 0;
+    queue->capacity = 0;
+}
@@ -0,0 +1,104 @@
+/**
+ *
+ * @file output.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _OUTPUT_H
+#define _OUTPUT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+enum OutputConst
+{
+    OUTPUT_HIGH_WATER = 256 * 1024, // pending bytes at which a connection stops producing results
+    OUTPUT_LOW_WATER = 64 * 1024,   // pending bytes at which it starts producing them again
+    OUTPUT_FLUSH_TIMEOUT = 5000     // milliseconds a closing connection waits for the client to read
+};
+
+/**
+ * Structure representing the encoded messages of a connection waiting to be sent.
+ *
+ * Messages are appended at the end and sent from the start, so everything queued
+ * between two writes leaves in one send call.
+ */
+typedef struct
+{
+    unsigned char *data; /**< The queued bytes. */
+    size_t start;        /**< The offset of the first byte not sent yet. */
+    size_t length;       /**< The offset one past the last queued byte. */
+    size_t capacity;     /**< The allocated size of data in bytes. */
+} OutputQueue;
+
+/**
+ * Output queue of the connection served by the thread, NULL to send directly.
+ */
+extern __thread OutputQueue *outputQueue;
+
+/**
+ * Push to Output Queue.
+ *
+ * Appends an encoded message to the queue. The queue grows as needed, its size is
+ * bounded by the callers pausing at the high-water mark.
+ *
+ * @param queue  A pointer to the queue.
+ * @param data   A pointer to the encoded message.
+ * @param length The length of the message in bytes.
+ */
+void output_queue_push(OutputQueue *queue, const unsigned char *data, size_t length);
+
+/**
+ * Drain Output Queue.
+ *
+ * Sends as much of the queue as the socket accepts without blocking.
+ *
+ * @param queue        A pointer to the queue.
+ * @param clientSocket The socket of the connection.
+ *
+ * @return 0 on success, -1 if the connection was closed or failed.
+ */
+int output_queue_drain(OutputQueue *queue, int clientSocket);
+
+/**
+ * Flush Output Queue.
+ *
+ * Waits until the whole queue is sent, giving up when the client reads nothing
+ * for OUTPUT_FLUSH_TIMEOUT milliseconds. Used when the connection is closing.
+ *
+ * @param queue        A pointer to the queue.
+ * @param clientSocket The socket of the connection.
+ */
+void output_queue_flush(OutputQueue *queue, int clientSocket);
+
+/**
+ * Get Pending Bytes.
+ *
+ * @param queue A pointer to the queue.
+ *
+ * @return The number of queued bytes not sent yet.
+ */
+size_t output_queue_pending(const OutputQueue *queue);
+
+/**
+ * Check High-Water Mark.
+ *
+ * @param queue A pointer to the queue.
+ *
+ * @return true if no more results should be produced until the queue drains.
+ */
+bool output_queue_full(const OutputQueue *queue);
+
+/**
+ * Dispose Output Queue.
+ *
+ * @param queue A pointer to the queue.
+ */
+void output_queue_dispose(OutputQueue *queue);
+
+#endif
@@ -0,0 +1,254 @@
+/**
+ *
+ * @file overlay.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "hash.h"
+#include "overlay.h"
+
+static void *overlay_map(size_t size)
+{
+    // only the pages that are written to take memory
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        perror("mmap");
+        return NULL;
+    }
+    return memory;
+}
+
+int overlay_create(Directory *directory)
+{
+    Overlay *overlay = (Overlay *)overlay_map(sizeof(Overlay));
+    if (overlay == NULL)
+        return -1;
+    overlay->baseRows = directory->lineCount;
+    overlay->rowCount = directory->lineCount;
+    overlay->poolSize = sizeof(uint64_t); // offset 0 stands for no record
+    overlay->rows = (uint32_t *)overlay_map((directory->lineCount + OVERLAY_MAX_ADDED_ROWS) * sizeof(uint32_t));
+    overlay->buckets = (uint32_t *)overlay_map(OVERLAY_INDEX_BUCKETS * sizeof(uint32_t));
+    overlay->entries = (OverlayEntry *)overlay_map(OVERLAY_INDEX_ENTRIES * sizeof(OverlayEntry));
+    overlay->bloom = (uint64_t *)overlay_map(OVERLAY_BLOOM_BITS / 8);
+    overlay->pool = (unsigned char *)overlay_map(OVERLAY_POOL_SIZE);
+    if (overlay->rows == NULL || overlay->buckets == NULL || overlay->entries == NULL || overlay->bloom == NULL || overlay->pool == NULL)
+        return -1;
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&overlay->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+
+    directory->overlay = overlay;
+    return 0;
+}
+
+void overlay_lock(Overlay *overlay)
+{
+    pthread_mutex_lock(&overlay->lock);
+}
+
+void overlay_unlock(Overlay *overlay)
+{
+    pthread_mutex_unlock(&overlay->lock);
+}
+
+static uint64_t overlay_hash(int column, uint64_t hash)
+{
+    // the keys of all columns share the buckets and the filter
+    hash ^= (uint64_t)(column + 1) * 0x9E3779B97F4A7C15ULL;
+    return hash ^ (hash >> 29);
+}
+
+static void overlay_add_key(Overlay *overlay, size_t row, uint32_t record, int column, Field key)
+{
+    uint64_t hash = overlay_hash(column, hash_bytes(key.value, key.length));
+    uint64_t first = hash & (OVERLAY_BLOOM_BITS - 1), second = (hash >> 32) & (OVERLAY_BLOOM_BITS - 1);
+    __atomic_fetch_or(&overlay->bloom[first / 64], 1ULL << (first % 64), __ATOMIC_RELAXED);
+    __atomic_fetch_or(&overlay->bloom[second / 64], 1ULL << (second % 64), __ATOMIC_RELAXED);
+
+    // the entry is complete before walks in write order can reach it
+    size_t bucket = hash & (OVERLAY_INDEX_BUCKETS - 1);
+    OverlayEntry *entry = &overlay->entries[overlay->entryCount];
+    entry->row = row;
+    entry->record = record;
+    entry->column = column;
+    entry->next = overlay->buckets[bucket];
+    __atomic_store_n(&overlay->entryCount, overlay->entryCount + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&overlay->buckets[bucket], overlay->entryCount, __ATOMIC_RELEASE);
+}
+
+static void overlay_publish(Overlay *overlay, size_t row, uint32_t record)
+{
+    __atomic_store_n(&overlay->rows[row], record, __ATOMIC_RELEASE);
+    if (row == overlay->rowCount)
+        __atomic_store_n(&overlay->rowCount, row + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&overlay->sequence, 1, __ATOMIC_RELEASE);
+}
+
+static size_t overlay_record_size(const Schema *schema, const Field *values, size_t *keyCount)
+{
+    // a normalized key is never longer than its value
+    size_t size = sizeof(OverlayRecord);
+    *keyCount = 0;
+    if (values == NULL)
+        return (size + 7) & ~(size_t)7;
+    size += schema->attributeCount * sizeof(OverlaySpan);
+    for (int column = 0; column < schema->attributeCount; column++)
+    {
+        size += 2 * values[column].length;
+        if (!schema->attributes[column].indexed)
+            continue;
+        Field rest = values[column], value;
+        while (field_next_value(&rest, schema->attributes[column].separator, &value))
+            (*keyCount)++;
+    }
+    return (size + 7) & ~(size_t)7;
+}
+
+bool overlay_has_room(const Directory *directory, size_t row, const Field *values)
+{
+    const Overlay *overlay = directory->overlay;
+    size_t keyCount, size = overlay_record_size(&directory->schema, values, &keyCount);
+    if (values == NULL)
+        return row < overlay->rowCount && overlay->poolSize + size <= OVERLAY_POOL_SIZE;
+    return row <= overlay->rowCount && (row < overlay->rowCount || row - overlay->baseRows < OVERLAY_MAX_ADDED_ROWS) &&
+           overlay->poolSize + size <= OVERLAY_POOL_SIZE && overlay->entryCount + keyCount <= OVERLAY_INDEX_ENTRIES;
+}
+
+int overlay_put(Directory *directory, size_t row, const Field *values)
+{
+    Overlay *overlay = directory->overlay;
+    const Schema *schema = &directory->schema;
+    size_t headerSize = sizeof(OverlayRecord) + schema->attributeCount * sizeof(OverlaySpan);
+    if (!overlay_has_room(directory, row, values))
+        return -1;
+
+    uint32_t offset = overlay->poolSize;
+    OverlayRecord *record = (OverlayRecord *)(overlay->pool + offset);
+    record->deleted = 0;
+    size_t position = headerSize;
+    for (int column = 0; column < schema->attributeCount; column++)
+    {
+        OverlaySpan *span = &record->spans[column];
+        span->valueOffset = position;
+        span->valueLength = values[column].length;
+        memcpy((char *)record + position, values[column].value, values[column].length);
+        position += values[column].length;
+        span->keyOffset = position;
+        span->keyLength = directory_normalize(&schema->attributes[column], values[column], (char *)record + position);
+        position += span->keyLength;
+    }
+    record->size = (position + 7) & ~(size_t)7;
+    overlay->poolSize += record->size;
+
+    // the entries only become valid once the record is the current one
+    for (int column = 0; column < schema->attributeCount; column++)
+    {
+        if (!schema->attributes[column].indexed)
+            continue;
+        Field rest = overlay_key(record, column), key;
+        while (field_next_value(&rest, schema->attributes[column].separator, &key))
+            overlay_add_key(overlay, row, offset, column, key);
+    }
+    overlay_publish(overlay, row, offset);
+    return 0;
+}
+
+int overlay_delete(Directory *directory, size_t row)
+{
+    Overlay *overlay = directory->overlay;
+    size_t size = (sizeof(OverlayRecord) + 7) & ~(size_t)7;
+    if (!overlay_has_room(directory, row, NULL))
+        return -1;
+
+    uint32_t offset = overlay->poolSize;
+    OverlayRecord *record = (OverlayRecord *)(overlay->pool + offset);
+    record->deleted = 1;
+    record->size = size;
+    overlay->poolSize += size;
+    overlay_publish(overlay, row, offset);
+    return 0;
+}
+
+const OverlayRecord *overlay_record(const Overlay *overlay, size_t row)
+{
+    uint32_t offset = __atomic_load_n(&overlay->rows[row], __ATOMIC_ACQUIRE);
+    return offset != 0 ? (const OverlayRecord *)(overlay->pool + offset) : NULL;
+}
+
+Field overlay_value(const OverlayRecord *record, int column)
+{
+    Field value;
+    value.value = (const char *)record + record->spans[column].valueOffset;
+    value.length = record->spans[column].valueLength;
+    return value;
+}
+
+Field overlay_key(const OverlayRecord *record, int column)
+{
+    Field key;
+    key.value = (const char *)record + record->spans[column].keyOffset;
+    key.length = record->spans[column].keyLength;
+    return key;
+}
+
+uint32_t overlay_index_lookup(const Overlay *overlay, int column, uint64_t hash)
+{
+    hash = overlay_hash(column, hash);
+    return __atomic_load_n(&overlay->buckets[hash & (OVERLAY_INDEX_BUCKETS - 1)], __ATOMIC_ACQUIRE);
+}
+
+bool overlay_index_next(const Overlay *overlay, int column, uint32_t *entry, size_t *row)
+{
+    while (*entry != 0)
+    {
+        const OverlayEntry *current = &overlay->entries[*entry - 1];
+        *entry = current->next;
+        if ((int)current->column == column && __atomic_load_n(&overlay->rows[current->row], __ATOMIC_ACQUIRE) == current->record)
+        {
+            *row = current->row;
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t overlay_written_end(const Overlay *overlay)
+{
+    return __atomic_load_n(&overlay->entryCount, __ATOMIC_ACQUIRE);
+}
+
+bool overlay_written_next(const Overlay *overlay, int column, uint32_t *entry, uint32_t end, size_t *row)
+{
+    while (*entry < end)
+    {
+        const OverlayEntry *current = &overlay->entries[(*entry)++];
+        if ((int)current->column == column && __atomic_load_n(&overlay->rows[current->row], __ATOMIC_ACQUIRE) == current->record)
+        {
+            *row = current->row;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool overlay_may_contain(const Overlay *overlay, int column, uint64_t hash)
+{
+    hash = overlay_hash(column, hash);
+    uint64_t first = hash & (OVERLAY_BLOOM_BITS - 1), second = (hash >> 32) & (OVERLAY_BLOOM_BITS - 1);
+    return (__atomic_load_n(&overlay->bloom[first / 64], __ATOMIC_RELAXED) & (1ULL << (first % 64))) != 0 &&
+           (__atomic_load_n(&overlay->bloom[second / 64], __ATOMIC_RELAXED) & (1ULL << (second % 64))) != 0;
+}
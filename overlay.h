@@ -0,0 +1,247 @@
+/**
+ *
+ * @file overlay.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _OVERLAY_H
+#define _OVERLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "directory.h"
+
+enum OverlayConst
+{
+    OVERLAY_POOL_SIZE = 1 << 28,      // bytes of written entries kept until the next restart
+    OVERLAY_MAX_ADDED_ROWS = 1 << 20, // entries added until the next restart
+    OVERLAY_INDEX_BUCKETS = 1 << 20,  // buckets of the index of written keys, a power of two
+    OVERLAY_INDEX_ENTRIES = 1 << 22,  // keys of indexed attributes written until the next restart
+    OVERLAY_BLOOM_BITS = 1 << 23      // bits of the filter of keys written since the start, a power of two
+};
+
+/**
+ * Structure representing one key written to an indexed attribute.
+ *
+ * An entry is only valid while its record is the current record of its row.
+ */
+typedef struct
+{
+    uint32_t row;    /**< The row the key was written to. */
+    uint32_t record; /**< The pool offset of the record holding the key. */
+    uint32_t column; /**< The column of the key. */
+    uint32_t next;   /**< The next entry plus one in the same bucket, 0 at the end of the chain. */
+} OverlayEntry;
+
+/**
+ * Structure representing the value and the key of one attribute in a record.
+ */
+typedef struct
+{
+    uint32_t valueOffset; /**< The offset of the value from the start of the record. */
+    uint32_t valueLength; /**< The length of the value. */
+    uint32_t keyOffset;   /**< The offset of the normalized key from the start of the record. */
+    uint32_t keyLength;   /**< The length of the normalized key. */
+} OverlaySpan;
+
+/**
+ * Structure representing the written state of one row.
+ *
+ * Records are never changed once published, a write appends a new one, so readers
+ * never wait for writers.
+ */
+typedef struct
+{
+    uint32_t deleted;     /**< Flag indicating whether the row was deleted. */
+    uint32_t size;        /**< The size of the record in bytes. */
+    OverlaySpan spans[];  /**< The span of every attribute of the schema, absent in deleted records. */
+} OverlayRecord;
+
+/**
+ * Structure representing the changes written to a directory since it was loaded.
+ *
+ * The overlay lives in memory shared by the listening process and all connection
+ * processes. Rows from the database file keep their numbers, added rows follow them.
+ */
+struct Overlay
+{
+    pthread_mutex_t lock;    /**< Process shared lock serializing the writers, readers never take it. */
+    uint64_t sequence;       /**< The number of applied changes, part of the directory version. */
+    size_t baseRows;         /**< The number of rows loaded from the database file. */
+    size_t rowCount;         /**< The number of rows including the added ones. */
+    size_t poolSize;         /**< The used size of the record pool in bytes. */
+    size_t entryCount;       /**< The number of used index entries. */
+    uint32_t *rows;          /**< The pool offset of the current record of every row, 0 if it was never written. */
+    uint32_t *buckets;       /**< The first index entry plus one of every bucket, 0 for empty buckets. */
+    OverlayEntry *entries;   /**< The index entries, newest first in every chain. */
+    uint64_t *bloom;         /**< The Bloom filter of the keys written to indexed attributes. */
+    unsigned char *pool;     /**< The records. */
+};
+
+/**
+ * Create Overlay.
+ *
+ * Maps the shared memory of the overlay and attaches it to the directory, which
+ * makes the directory writable. Has to be called before the first connection
+ * process is created.
+ *
+ * @param directory A pointer to the loaded directory.
+ *
+ * @return 0 on success, -1 if the memory could not be mapped.
+ */
+int overlay_create(Directory *directory);
+
+/**
+ * Lock Overlay for Writing.
+ *
+ * @param overlay A pointer to the overlay.
+ */
+void overlay_lock(Overlay *overlay);
+
+/**
+ * Unlock Overlay.
+ *
+ * @param overlay A pointer to the overlay.
+ */
+void overlay_unlock(Overlay *overlay);
+
+/**
+ * Check Room for Write.
+ *
+ * Lets a change be checked before it is logged, so a logged change can always be applied.
+ *
+ * @param directory A pointer to the directory.
+ * @param row       The row to write.
+ * @param values    The values to write as in overlay_put() or NULL to check a delete.
+ *
+ * @return true if the write fits into the overlay, false if it is full.
+ */
+bool overlay_has_room(const Directory *directory, size_t row, const Field *values);
+
+/**
+ * Write Row.
+ *
+ * Publishes a new record holding the values of every attribute of the schema.
+ * The caller has to hold the overlay lock.
+ *
+ * @param directory A pointer to the directory.
+ * @param row       The row to replace or the row count to add a row.
+ * @param values    The values of every attribute of the schema, multi-valued ones joined by their separator.
+ *
+ * @return 0 on success, -1 if the overlay is full.
+ */
+int overlay_put(Directory *directory, size_t row, const Field *values);
+
+/**
+ * Delete Row.
+ *
+ * The caller has to hold the overlay lock.
+ *
+ * @param directory A pointer to the directory.
+ * @param row       The row to delete.
+ *
+ * @return 0 on success, -1 if the overlay is full.
+ */
+int overlay_delete(Directory *directory, size_t row);
+
+/**
+ * Get Record of Row.
+ *
+ * @param overlay A pointer to the overlay.
+ * @param row     The row.
+ *
+ * @return The current record of the row or NULL if it was never written.
+ */
+const OverlayRecord *overlay_record(const Overlay *overlay, size_t row);
+
+/**
+ * Get Value of Record.
+ *
+ * @param record A pointer to a record that is not deleted.
+ * @param column The column.
+ *
+ * @return The value of the column.
+ */
+Field overlay_value(const OverlayRecord *record, int column);
+
+/**
+ * Get Normalized Key of Record.
+ *
+ * @param record A pointer to a record that is not deleted.
+ * @param column The column.
+ *
+ * @return The normalized key of the column.
+ */
+Field overlay_key(const OverlayRecord *record, int column);
+
+/**
+ * Find Written Key.
+ *
+ * @param overlay A pointer to the overlay.
+ * @param column  The indexed column.
+ * @param hash    The hash of the normalized key.
+ *
+ * @return The newest index entry plus one of the bucket of the key, 0 if there is none.
+ */
+uint32_t overlay_index_lookup(const Overlay *overlay, int column, uint64_t hash);
+
+/**
+ * Next Row Holding Written Key.
+ *
+ * Walks a bucket from the entry returned by overlay_index_lookup(), skipping entries
+ * of other columns and of records that were replaced since.
+ *
+ * @param overlay A pointer to the overlay.
+ * @param column  The column being looked up.
+ * @param entry   A pointer to the next entry plus one, advanced past the returned row.
+ * @param row     A pointer receiving the row.
+ *
+ * @return true if a row was returned, false at the end of the bucket.
+ */
+bool overlay_index_next(const Overlay *overlay, int column, uint32_t *entry, size_t *row);
+
+/**
+ * Get End of Written Keys.
+ *
+ * @param overlay A pointer to the overlay.
+ *
+ * @return The number of index entries written so far, the end of a walk by overlay_written_next().
+ */
+uint32_t overlay_written_end(const Overlay *overlay);
+
+/**
+ * Next Row of Written Keys.
+ *
+ * Walks the index entries in the order they were written, skipping entries of other
+ * columns and of records that were replaced since. The keys of one record follow each
+ * other, so a row holding several keys is returned several times in a row.
+ *
+ * @param overlay A pointer to the overlay.
+ * @param column  The column being walked.
+ * @param entry   A pointer to the next entry, advanced past the returned row.
+ * @param end     The end of the walk returned by overlay_written_end().
+ * @param row     A pointer receiving the row.
+ *
+ * @return true if a row was returned, false at the end of the walk.
+ */
+bool overlay_written_next(const Overlay *overlay, int column, uint32_t *entry, uint32_t end, size_t *row);
+
+/**
+ * Check Written Key.
+ *
+ * @param overlay A pointer to the overlay.
+ * @param column  The indexed column.
+ * @param hash    The hash of the normalized key.
+ *
+ * @return false if the key was never written to the column, true if it may have been.
+ */
+bool overlay_may_contain(const Overlay *overlay, int column, uint64_t hash);
+
+#endif
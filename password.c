@@ -0,0 +1,140 @@
+/**
+ *
+ * @file password.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/random.h>
+#include "sha256.h"
+#include "password.h"
+
+static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789./";
+
+bool password_equal(const void *a, const void *b, size_t length)
+{
+    const volatile unsigned char *left = (const volatile unsigned char *)a;
+    const volatile unsigned char *right = (const volatile unsigned char *)b;
+    unsigned char difference = 0;
+    for (size_t i = 0; i < length; i++)
+        difference |= left[i] ^ right[i];
+    return difference == 0;
+}
+
+static int decode_character(char character)
+{
+    // '+' of the standard alphabet is accepted as well
+    if (character == '+')
+        return 62;
+    const char *position = memchr(alphabet, character, 64);
+    return position != NULL ? position - alphabet : -1;
+}
+
+static int decode_base64(const char *text, size_t length, unsigned char *out, size_t size)
+{
+    while (length > 0 && text[length - 1] == '=')
+        length--;
+    size_t written = 0;
+    unsigned int bits = 0;
+    int bitCount = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        int value = decode_character(text[i]);
+        if (value == -1)
+            return -1;
+        bits = (bits << 6) | value;
+        bitCount += 6;
+        if (bitCount >= 8)
+        {
+            bitCount -= 8;
+            if (written == size)
+                return -1;
+            out[written++] = (bits >> bitCount) & 0xFF;
+        }
+    }
+    return written;
+}
+
+static size_t encode_base64(const unsigned char *data, size_t length, char *out)
+{
+    size_t written = 0;
+    unsigned int bits = 0;
+    int bitCount = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        bits = (bits << 8) | data[i];
+        bitCount += 8;
+        while (bitCount >= 6)
+        {
+            bitCount -= 6;
+            out[written++] = alphabet[(bits >> bitCount) & 0x3F];
+        }
+    }
+    if (bitCount > 0)
+        out[written++] = alphabet[(bits << (6 - bitCount)) & 0x3F];
+    out[written] = '\0';
+    return written;
+}
+
+bool password_verify(const char *stored, size_t storedLength, const char *password, size_t passwordLength)
+{
+    size_t schemeLength = strlen(PASSWORD_SCHEME);
+    if (storedLength <= schemeLength || strncasecmp(stored, PASSWORD_SCHEME, schemeLength) != 0)
+        return false;
+    const char *position = stored + schemeLength, *end = stored + storedLength;
+
+    unsigned long iterations = 0;
+    while (position < end && *position >= '0' && *position <= '9' && iterations <= PASSWORD_MAX_ITERATIONS)
+        iterations = iterations * 10 + (*position++ - '0');
+    if (position == end || *position != '$' || iterations == 0 || iterations > PASSWORD_MAX_ITERATIONS)
+        return false;
+    const char *salt = ++position;
+    const char *dollar = memchr(salt, '$', end - salt);
+    if (dollar == NULL)
+        return false;
+
+    unsigned char saltBytes[SHA256_BLOCK_SIZE], key[PASSWORD_KEY_SIZE], derived[PASSWORD_KEY_SIZE];
+    int saltLength = decode_base64(salt, dollar - salt, saltBytes, sizeof(saltBytes));
+    int keyLength = decode_base64(dollar + 1, end - dollar - 1, key, sizeof(key));
+    if (saltLength <= 0 || keyLength != PASSWORD_KEY_SIZE)
+        return false;
+
+    pbkdf2_sha256(password, passwordLength, saltBytes, saltLength, iterations, derived, sizeof(derived));
+    bool equal = password_equal(derived, key, sizeof(key));
+    memset(derived, 0, sizeof(derived));
+    return equal;
+}
+
+void password_waste(const char *password, size_t passwordLength)
+{
+    static const unsigned char salt[PASSWORD_SALT_SIZE] = {0};
+    unsigned char derived[PASSWORD_KEY_SIZE];
+    pbkdf2_sha256(password, passwordLength, salt, sizeof(salt), PASSWORD_DEFAULT_ITERATIONS, derived, sizeof(derived));
+    memset(derived, 0, sizeof(derived));
+}
+
+int password_hash(const char *password, size_t passwordLength, unsigned long iterations, char *out, size_t size)
+{
+    unsigned char salt[PASSWORD_SALT_SIZE], key[PASSWORD_KEY_SIZE];
+    if (getrandom(salt, sizeof(salt), 0) != sizeof(salt))
+    {
+        perror("getrandom");
+        return -1;
+    }
+    pbkdf2_sha256(password, passwordLength, salt, sizeof(salt), iterations, key, sizeof(key));
+
+    char saltText[PASSWORD_SALT_SIZE * 2], keyText[PASSWORD_KEY_SIZE * 2];
+    encode_base64(salt, sizeof(salt), saltText);
+    encode_base64(key, sizeof(key), keyText);
+    int length = snprintf(out, size, "%s%lu$%s$%s", PASSWORD_SCHEME, iterations, saltText, keyText);
+    return length < 0 || (size_t)length >= size ? -1 : 0;
+}
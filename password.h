@@ -0,0 +1,83 @@
+/**
+ *
+ * @file password.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _PASSWORD_H
+#define _PASSWORD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define PASSWORD_SCHEME "{PBKDF2-SHA256}"
+
+enum PasswordConst
+{
+    PASSWORD_SALT_SIZE = 16,
+    PASSWORD_KEY_SIZE = 32,
+    PASSWORD_DEFAULT_ITERATIONS = 100000,
+    PASSWORD_MAX_ITERATIONS = 10000000, // a damaged hash must not stall the connection for minutes
+    PASSWORD_HASH_SIZE = 128            // the longest hash written by password_hash()
+};
+
+/**
+ * Compare Bytes in Constant Time.
+ *
+ * The time depends only on the length, not on the position of the first difference.
+ *
+ * @param a      A pointer to the first bytes.
+ * @param b      A pointer to the second bytes.
+ * @param length The number of bytes.
+ *
+ * @return true if the bytes are equal.
+ */
+bool password_equal(const void *a, const void *b, size_t length);
+
+/**
+ * Verify Password.
+ *
+ * Derives the key of the password with the iterations and salt of the stored hash
+ * and compares it with the stored key in constant time. The stored hash has the form
+ * "{PBKDF2-SHA256}<iterations>$<salt>$<key>" with the salt and key in the base64
+ * alphabet using '.' instead of '+' and no padding, as written by passlib.
+ *
+ * @param stored         A pointer to the stored hash.
+ * @param storedLength   The length of the stored hash.
+ * @param password       A pointer to the password.
+ * @param passwordLength The length of the password.
+ *
+ * @return true if the password matches, false if it does not or the hash is not valid.
+ */
+bool password_verify(const char *stored, size_t storedLength, const char *password, size_t passwordLength);
+
+/**
+ * Spend Verification Time.
+ *
+ * Derives a key as password_verify() does with the default iterations, so a bind of an
+ * unknown entry takes as long as a bind with a wrong password.
+ *
+ * @param password       A pointer to the password.
+ * @param passwordLength The length of the password.
+ */
+void password_waste(const char *password, size_t passwordLength);
+
+/**
+ * Hash Password.
+ *
+ * @param password       A pointer to the password.
+ * @param passwordLength The length of the password.
+ * @param iterations     The iteration count.
+ * @param out            A pointer to the buffer receiving the null-terminated hash.
+ * @param size           The size of the buffer, PASSWORD_HASH_SIZE is enough.
+ *
+ * @return 0 on success, -1 if no random salt could be read or the buffer is too small.
+ */
+int password_hash(const char *password, size_t passwordLength, unsigned long iterations, char *out, size_t size);
+
+#endif
@@ -0,0 +1,175 @@
+/**
+ *
+ * @file profile.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "profile.h"
+
+/**
+ * Structure representing the profile totals of all connections.
+ */
+typedef struct
+{
+    uint64_t cycles[PROFILE_OPERATION_COUNT][PROFILE_STAGE_COUNT]; /**< The cycles charged to every stage. */
+    uint64_t requests[PROFILE_OPERATION_COUNT];                    /**< The number of profiled requests. */
+} ProfileTotals;
+
+/**
+ * Structure representing the profiled work of one thread.
+ */
+typedef struct
+{
+    int operation;   /**< The operation charged. */
+    int stage;       /**< The stage charged. */
+    uint64_t start;  /**< The cycle counter when the stage became current. */
+    uint64_t cycles[PROFILE_STAGE_COUNT]; /**< The cycles charged since profile_begin(). */
+} ProfileState;
+
+bool profiling;
+static ProfileTotals *totals;
+static double cyclesPerNanosecond = 1.0;
+static const char *foldedFile;
+static __thread ProfileState state;
+
+static const char *operationNames[PROFILE_OPERATION_COUNT] = {"bind", "search", "compare", "update", "connection"};
+static const char *stageNames[PROFILE_STAGE_COUNT] = {"decode", "filter", "plan", "match", "encode", "send", "other"};
+
+void profile_init(const char *foldedPath)
+{
+    totals = (ProfileTotals *)mmap(NULL, sizeof(ProfileTotals), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (totals == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+
+    // the cycle counter rate is only needed to print times
+    struct timespec start, end, pause = {0, 20000000};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t startCycles = profile_cycles();
+    nanosleep(&pause, NULL);
+    uint64_t endCycles = profile_cycles();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double nanoseconds = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    if (nanoseconds > 0 && endCycles > startCycles)
+        cyclesPerNanosecond = (endCycles - startCycles) / nanoseconds;
+
+    foldedFile = foldedPath;
+    profiling = true;
+}
+
+void profile_begin(int operation, int stage)
+{
+    if (!profiling)
+        return;
+    memset(state.cycles, 0, sizeof(state.cycles));
+    state.operation = operation;
+    state.stage = stage;
+    state.start = profile_cycles();
+}
+
+static void profile_charge(void)
+{
+    uint64_t now = profile_cycles();
+    state.cycles[state.stage] += now - state.start;
+    state.start = now;
+}
+
+static void profile_flush(void)
+{
+    for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++)
+    {
+        if (state.cycles[stage] > 0)
+            __atomic_add_fetch(&totals->cycles[state.operation][stage], state.cycles[stage], __ATOMIC_RELAXED);
+        state.cycles[stage] = 0;
+    }
+}
+
+void profile_operation(int operation)
+{
+    if (!profiling)
+        return;
+    profile_charge();
+    profile_flush();
+    state.operation = operation;
+}
+
+int profile_switch(int stage)
+{
+    if (!profiling)
+        return 0;
+    profile_charge();
+    int previous = state.stage;
+    state.stage = stage;
+    return previous;
+}
+
+void profile_end(bool request)
+{
+    if (!profiling)
+        return;
+    profile_charge();
+    profile_flush();
+    if (request)
+        __atomic_add_fetch(&totals->requests[state.operation], 1, __ATOMIC_RELAXED);
+}
+
+void profile_dump(void)
+{
+    if (!profiling)
+        return;
+
+    uint64_t all = 0;
+    for (int operation = 0; operation < PROFILE_OPERATION_COUNT; operation++)
+        for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++)
+            all += __atomic_load_n(&totals->cycles[operation][stage], __ATOMIC_RELAXED);
+
+    printf("Profile (%.2f cycles per ns):\n", cyclesPerNanosecond);
+    printf("%-10s %-7s %14s %7s %14s %12s\n", "operation", "stage", "cycles", "share", "cycles/req", "ns/req");
+    for (int operation = 0; operation < PROFILE_OPERATION_COUNT; operation++)
+    {
+        uint64_t requests = __atomic_load_n(&totals->requests[operation], __ATOMIC_RELAXED);
+        for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++)
+        {
+            uint64_t cycles = __atomic_load_n(&totals->cycles[operation][stage], __ATOMIC_RELAXED);
+            if (cycles == 0)
+                continue;
+            double perRequest = requests ? (double)cycles / requests : 0.0;
+            printf("%-10s %-7s %14llu %6.2f%% %14.0f %12.0f\n", operationNames[operation], stageNames[stage],
+                   (unsigned long long)cycles, all ? 100.0 * cycles / all : 0.0, perRequest, perRequest / cyclesPerNanosecond);
+        }
+    }
+    fflush(stdout);
+
+    if (foldedFile == NULL)
+        return;
+    FILE *file = fopen(foldedFile, "w");
+    if (file == NULL)
+    {
+        perror(foldedFile);
+        return;
+    }
+    for (int operation = 0; operation < PROFILE_OPERATION_COUNT; operation++)
+    {
+        for (int stage = 0; stage < PROFILE_STAGE_COUNT; stage++)
+        {
+            uint64_t cycles = __atomic_load_n(&totals->cycles[operation][stage], __ATOMIC_RELAXED);
+            if (cycles > 0)
+                fprintf(file, "ldap;%s;%s %llu\n", operationNames[operation], stageNames[stage], (unsigned long long)cycles);
+        }
+    }
+    fclose(file);
+}
@@ -0,0 +1,124 @@
+/**
+ *
+ * @file profile.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _PROFILE_H
+#define _PROFILE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+enum ProfileOperation
+{
+    PROFILE_BIND,
+    PROFILE_SEARCH,
+    PROFILE_COMPARE,
+    PROFILE_UPDATE,
+    PROFILE_CONNECTION, // work of the connection not belonging to one request
+    PROFILE_OPERATION_COUNT
+};
+
+enum ProfileStage
+{
+    PROFILE_DECODE, // BER decoding of the request
+    PROFILE_FILTER, // parsing and normalizing the search filter
+    PROFILE_PLAN,   // Bloom filter, cache and index lookups
+    PROFILE_MATCH,  // checking candidate rows against the filter
+    PROFILE_ENCODE, // encoding entries and results
+    PROFILE_SEND,   // queueing and sending encoded messages
+    PROFILE_OTHER,
+    PROFILE_STAGE_COUNT
+};
+
+/**
+ * Flag indicating whether profiling was enabled by -P.
+ */
+extern bool profiling;
+
+/**
+ * Read Cycle Counter.
+ *
+ * @return The time stamp counter where available, the monotonic time in nanoseconds otherwise.
+ */
+static inline uint64_t profile_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/**
+ * Initialize Profiling.
+ *
+ * Maps the totals shared with the connection processes and measures the rate of the cycle counter.
+ *
+ * @param foldedPath The file receiving folded stacks on every dump.
+ */
+void profile_init(const char *foldedPath);
+
+/**
+ * Begin Profiled Work.
+ *
+ * Starts charging the cycles of the calling thread to the operation and stage.
+ *
+ * @param operation The ProfileOperation.
+ * @param stage     The first ProfileStage.
+ */
+void profile_begin(int operation, int stage);
+
+/**
+ * Set Profiled Operation.
+ *
+ * Charges the cycles so far to the current operation and continues with another one,
+ * used once the operation of a request is decoded.
+ *
+ * @param operation The ProfileOperation.
+ */
+void profile_operation(int operation);
+
+/**
+ * Switch Stage.
+ *
+ * Charges the cycles since the last switch to the current stage and makes the
+ * given stage current, so every cycle is charged to exactly one stage.
+ *
+ * @param stage The new ProfileStage.
+ *
+ * @return The previous stage, to be restored by another switch.
+ */
+int profile_switch(int stage);
+
+/**
+ * End Profiled Work.
+ *
+ * Charges the cycles of the current stage and adds the totals of the thread to the shared totals.
+ *
+ * @param request true if the work was a whole request and counts towards the requests of the operation.
+ */
+void profile_end(bool request);
+
+/**
+ * Dump Profile.
+ *
+ * Prints the cycles of every stage of every operation, their share and their average
+ * per request, and rewrites the folded stacks file with one line "ldap;<operation>;<stage> <cycles>"
+ * per stage, ready for flame graph tools.
+ */
+void profile_dump(void);
+
+#endif
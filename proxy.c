@@ -0,0 +1,1349 @@
+/**
+ *
+ * @file proxy.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "utils.h"
+#include "arena.h"
+#include "output.h"
+#include "stats.h"
+#include "trace.h"
+#include "monitor.h"
+#include "response.h"
+#include "search.h"
+#include "compare.h"
+#include "ldap.h"
+#include "shard.h"
+#include "proxy.h"
+
+extern __thread int currentTagPosition;
+
+typedef struct ProxyClient ProxyClient;
+
+/**
+ * Structure representing a request in flight on a backend connection.
+ */
+typedef struct
+{
+    bool used;           /**< Flag indicating whether the slot waits for a response. */
+    uint32_t round;      /**< The number of times the slot was taken, part of the message id. */
+    uint32_t id;         /**< The message id of the request on the backend connection. */
+    ProxyClient *client; /**< The client of the request, referenced by the slot. */
+    int operation;       /**< The operation of the client the request belongs to. */
+    uint64_t serial;     /**< The serial of the operation, telling it from later ones in the same place. */
+    int shard;           /**< The shard of the backend. */
+} ProxySlot;
+
+/**
+ * Structure representing one pooled connection to a backend.
+ *
+ * The slots are guarded by the lock and the socket by the send lock, so a writer
+ * blocked by a backend that does not read never stops the reader taking responses.
+ */
+typedef struct
+{
+    const char *address;              /**< The address of the backend. */
+    int shard;                        /**< The shard served by the backend. */
+    pthread_mutex_t lock;             /**< The lock of the slots and the connected flag. */
+    pthread_cond_t slotFreed;         /**< Signaled when a slot is freed or the connection is lost. */
+    pthread_mutex_t sendLock;         /**< The lock of writes to the socket. */
+    int socket;                       /**< The connected socket or -1. */
+    bool connected;                   /**< Flag indicating whether requests can be sent. */
+    ProxySlot slots[PROXY_LINK_SLOTS]; /**< The requests in flight, the slot of a message id is (id - 1) % PROXY_LINK_SLOTS. */
+    int nextSlot;                     /**< The slot tried first by the next request. */
+} ProxyLink;
+
+/**
+ * Structure representing a client request forwarded to one or more shards.
+ */
+typedef struct
+{
+    bool used;                             /**< Flag indicating whether the operation is in progress. */
+    bool search;                           /**< Flag indicating whether the entries of the shards are merged. */
+    bool paged;                            /**< Flag indicating whether the simple paged results control was sent. */
+    bool parked;                           /**< Flag indicating whether a page was sent and the next one was not asked for yet. */
+    bool limited;                          /**< Flag indicating whether the size limit was exceeded. */
+    bool sweep;                            /**< Flag indicating whether the shards still answering have to be abandoned. */
+    bool finished;                         /**< Flag indicating whether the result was sent, the operation ends after the sweep. */
+    int kind;                              /**< The ResponseKind of the results made by the proxy. */
+    int messageId;                         /**< The message id of the client. */
+    uint64_t serial;                       /**< The serial of the operation, also the cookie of its pages. */
+    uint32_t shards[SHARD_MAX_COUNT];      /**< The backend message id of every shard still answering or 0. */
+    uint32_t answered;                     /**< The shards that sent their result, one bit each. */
+    int pending;                           /**< The number of shards without a result. */
+    int sizeLimit;                         /**< The size limit of the search, 0 for none. */
+    int received;                          /**< The number of entries received from the shards. */
+    int pageSize;                          /**< The size of the current page. */
+    int pageEntries;                       /**< The number of entries sent in the current page. */
+    unsigned char *done;                   /**< The protocol operation of the result chosen so far or NULL. */
+    int doneLength;                        /**< The length of the result. */
+    int doneCode;                          /**< The result code of the result. */
+    unsigned char *held;                   /**< The entries of the next pages, each a 32-bit length and a protocol operation. */
+    size_t heldStart;                      /**< The offset of the first held entry. */
+    size_t heldLength;                     /**< The offset past the last held entry. */
+    size_t heldCapacity;                   /**< The allocated size of held. */
+    int histogram;                         /**< The MonitorHistogram of the request. */
+    uint64_t startTime;                    /**< The monitor time the request was received. */
+} ProxyOperation;
+
+/**
+ * Structure representing a client served by the proxy.
+ *
+ * Reader threads deliver responses into the output queue under the lock and wake
+ * the client thread through the pipe. Every slot of a backend connection holding a
+ * request of the client references it, so the client is freed by the last reference.
+ */
+struct ProxyClient
+{
+    int socket;                                      /**< The socket of the client. */
+    int wake[2];                                     /**< The pipe waking the client thread. */
+    int pin;                                         /**< The connection of every backend used by the client. */
+    int refs;                                        /**< The number of references. */
+    pthread_mutex_t lock;                            /**< The lock of the operations and the output queue. */
+    OutputQueue output;                              /**< Encoded responses not sent yet. */
+    ProxyOperation operations[PROXY_MAX_OPERATIONS]; /**< The requests in progress. */
+    int running;                                     /**< The number of requests in progress. */
+    uint64_t nextSerial;                             /**< The serial of the next operation. */
+    Arena arena;                                     /**< The memory of the request being handled. */
+    bool paused;                                     /**< Flag indicating whether the client has too much unread output. */
+    unsigned char input[CONNECTION_INPUT_SIZE];      /**< Received bytes not handled yet. */
+    size_t inputLength;                              /**< The number of received bytes not handled yet. */
+};
+
+/**
+ * Structure representing a shard whose request has to be abandoned.
+ */
+typedef struct
+{
+    int shard;   /**< The shard. */
+    uint32_t id; /**< The backend message id of the request. */
+} ProxyAbandon;
+
+static bool proxyEnabled = false;
+static Directory *proxyDirectory;
+static ShardMap proxyShards;
+static ProxyLink proxyLinks[SHARD_MAX_COUNT][PROXY_POOL_SIZE];
+static int proxyClients = 0;
+
+static void proxy_client_release(ProxyClient *client)
+{
+    if (__atomic_sub_fetch(&client->refs, 1, __ATOMIC_ACQ_REL) != 0)
+        return;
+    close(client->wake[0]);
+    close(client->wake[1]);
+    pthread_mutex_destroy(&client->lock);
+    free(client);
+}
+
+static void proxy_client_wake(ProxyClient *client)
+{
+    // a full pipe already wakes the client
+    char byte = 0;
+    if (write(client->wake[1], &byte, 1) == -1 && errno != EAGAIN)
+        perror("write");
+}
+
+static int proxy_connect(const char *address)
+{
+    // <port> or <host>:<port>
+    char host[NI_MAXHOST] = "";
+    const char *port = address;
+    const char *colon = strrchr(address, ':');
+    if (colon != NULL)
+    {
+        size_t length = colon - address;
+        if (length >= sizeof(host))
+            return -1;
+        memcpy(host, address, length);
+        host[length] = '\0';
+        port = colon + 1;
+    }
+
+    struct addrinfo hints, *results;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &results) != 0)
+        return -1;
+
+    int tcpSocket = -1;
+    for (struct addrinfo *candidate = results; candidate != NULL && tcpSocket == -1; candidate = candidate->ai_next)
+    {
+        tcpSocket = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (tcpSocket != -1 && connect(tcpSocket, candidate->ai_addr, candidate->ai_addrlen) == -1)
+        {
+            close(tcpSocket);
+            tcpSocket = -1;
+        }
+    }
+    freeaddrinfo(results);
+    // requests are already coalesced by the clients
+    if (tcpSocket != -1 && setsockopt(tcpSocket, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int)) < 0)
+        perror("setsockopt(TCP_NODELAY) failed");
+    return tcpSocket;
+}
+
+static bool proxy_send_all(int socket, const unsigned char *data, size_t length)
+{
+    size_t sent = 0;
+    while (sent < length)
+    {
+        ssize_t result = send(socket, data + sent, length - sent, MSG_NOSIGNAL);
+        if (result < 0 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            return false;
+        sent += result;
+    }
+    return true;
+}
+
+static int proxy_message_header(unsigned char *header, int messageId, int length)
+{
+    // the same minimal encoding the server uses, so the proxy answers byte for byte like it
+    unsigned char id[8];
+    int idLength = 0;
+    add_integer(id, &idLength, messageId);
+    int headerLength = 0;
+    add_ldap_byte(header, &headerLength, LDAP_MESSAGE_PREFIX);
+    add_ldap_length(header, &headerLength, idLength + length);
+    memcpy(header + headerLength, id, idLength);
+    return headerLength + idLength;
+}
+
+static long proxy_read_integer(const unsigned char *data, size_t length, size_t *position, int tag)
+{
+    size_t contentLength;
+    if (ber_read_header(data, length, position, &contentLength) != tag || contentLength == 0 || contentLength > 4)
+        return -1;
+    long value = 0;
+    for (size_t i = 0; i < contentLength; i++)
+        value = value * 256 + data[*position + i];
+    *position += contentLength;
+    return value;
+}
+
+static int proxy_result_code(const unsigned char *body, int length)
+{
+    size_t position = 0, contentLength;
+    if (ber_read_header(body, length, &position, &contentLength) == -1)
+        return OTHER;
+    long code = proxy_read_integer(body, length, &position, ENUMERATED_TYPE);
+    return code == -1 ? OTHER : (int)code;
+}
+
+static int proxy_template(int kind, int resultCode, unsigned char *body)
+{
+    // the protocol operation of the template without its message header
+    unsigned char message[RESPONSE_MESSAGE_SIZE];
+    int offset = 0;
+    create_ldap_header(message, &offset, 1);
+    response_append(message, &offset, kind, resultCode);
+    size_t position = 0, contentLength;
+    ber_read_header(message, offset, &position, &contentLength);
+    proxy_read_integer(message, offset, &position, INTEGER_TYPE);
+    memcpy(body, message + position, offset - position);
+    return offset - position;
+}
+
+static int proxy_page_control(unsigned char *buff, uint64_t cookie)
+{
+    // [0] { { pagedResultsControl, OCTET STRING { SEQUENCE { size 0, cookie } } } }
+    int offset = 0;
+    add_ldap_byte(buff, &offset, CONTROLS_TYPE);
+    int controlsOffset = offset;
+    add_ldap_byte(buff, &offset, LDAP_PLACEHOLDER);
+    add_ldap_byte(buff, &offset, LDAP_MESSAGE_PREFIX);
+    int controlOffset = offset;
+    add_ldap_byte(buff, &offset, LDAP_PLACEHOLDER);
+    add_ldap_string(buff, &offset, PROXY_PAGED_RESULTS_OID);
+    add_ldap_byte(buff, &offset, OCTET_STRING_TYPE);
+    int valueOffset = offset;
+    add_ldap_byte(buff, &offset, LDAP_PLACEHOLDER);
+    add_ldap_byte(buff, &offset, LDAP_MESSAGE_PREFIX);
+    int sequenceOffset = offset;
+    add_ldap_byte(buff, &offset, LDAP_PLACEHOLDER);
+    add_integer(buff, &offset, 0);
+    unsigned char bytes[PROXY_COOKIE_SIZE];
+    for (int i = 0; i < PROXY_COOKIE_SIZE; i++)
+        bytes[i] = cookie >> (8 * (PROXY_COOKIE_SIZE - 1 - i));
+    add_ldap_octets(buff, &offset, (const char *)bytes, cookie != 0 ? PROXY_COOKIE_SIZE : 0);
+    set_ldap_length(buff, &offset, sequenceOffset);
+    set_ldap_length(buff, &offset, valueOffset);
+    set_ldap_length(buff, &offset, controlOffset);
+    set_ldap_length(buff, &offset, controlsOffset);
+    return offset;
+}
+
+static bool proxy_paged_control(const unsigned char *data, size_t length, size_t position, int *pageSize, uint64_t *cookie)
+{
+    // the controls follow the protocol operation
+    size_t elementLength;
+    if (ber_read_header(data, length, &position, &elementLength) != CONTROLS_TYPE)
+        return false;
+
+    size_t end = position + elementLength;
+    size_t oidLength = strlen(PROXY_PAGED_RESULTS_OID);
+    while (position < end)
+    {
+        if (ber_read_header(data, end, &position, &elementLength) != LDAP_MESSAGE_PREFIX)
+            return false;
+        size_t controlEnd = position + elementLength;
+        size_t typeLength;
+        if (ber_read_header(data, controlEnd, &position, &typeLength) != OCTET_STRING_TYPE)
+            return false;
+        if (typeLength != oidLength || memcmp(data + position, PROXY_PAGED_RESULTS_OID, oidLength) != 0)
+        {
+            position = controlEnd;
+            continue;
+        }
+        position += typeLength;
+
+        // the criticality is optional, the value is a sequence of the size and the cookie
+        int tag = ber_read_header(data, controlEnd, &position, &elementLength);
+        if (tag == BOOLEAN_TYPE)
+        {
+            position += elementLength;
+            tag = ber_read_header(data, controlEnd, &position, &elementLength);
+        }
+        if (tag != OCTET_STRING_TYPE ||
+            ber_read_header(data, controlEnd, &position, &elementLength) != LDAP_MESSAGE_PREFIX)
+            return false;
+        size_t sequenceEnd = position + elementLength;
+        size_t sizeLength, cookieLength;
+        if (ber_read_header(data, sequenceEnd, &position, &sizeLength) != INTEGER_TYPE || sizeLength > 4)
+            return false;
+        *pageSize = 0;
+        for (size_t i = 0; i < sizeLength; i++)
+            *pageSize = *pageSize * 256 + data[position + i];
+        position += sizeLength;
+        if (ber_read_header(data, sequenceEnd, &position, &cookieLength) != OCTET_STRING_TYPE ||
+            (cookieLength != 0 && cookieLength != PROXY_COOKIE_SIZE))
+            return false;
+        *cookie = 0;
+        for (size_t i = 0; i < cookieLength; i++)
+            *cookie = *cookie << 8 | data[position + i];
+        return true;
+    }
+    return false;
+}
+
+static void proxy_push(ProxyClient *client, int messageId, const unsigned char *body, int length,
+                       const unsigned char *control, int controlLength)
+{
+    unsigned char header[16];
+    int headerLength = proxy_message_header(header, messageId, length + controlLength);
+    output_queue_push(&client->output, header, headerLength);
+    output_queue_push(&client->output, body, length);
+    if (controlLength > 0)
+        output_queue_push(&client->output, control, controlLength);
+}
+
+static ProxyOperation *proxy_operation_start(ProxyClient *client, int messageId, int kind, int histogram)
+{
+    for (int i = 0; i < PROXY_MAX_OPERATIONS; i++)
+    {
+        ProxyOperation *operation = &client->operations[i];
+        if (operation->used)
+            continue;
+        memset(operation, 0, sizeof(ProxyOperation));
+        operation->used = true;
+        operation->kind = kind;
+        operation->messageId = messageId;
+        operation->serial = ++client->nextSerial;
+        operation->histogram = histogram;
+        operation->startTime = monitor_now();
+        client->running++;
+        return operation;
+    }
+    return NULL;
+}
+
+static void proxy_operation_end(ProxyClient *client, ProxyOperation *operation)
+{
+    free(operation->done);
+    free(operation->held);
+    operation->done = NULL;
+    operation->held = NULL;
+    operation->used = false;
+    client->running--;
+}
+
+static bool proxy_operation_running(const ProxyOperation *operation)
+{
+    for (int shard = 0; shard < proxyShards.count; shard++)
+    {
+        if (operation->shards[shard] != 0)
+            return true;
+    }
+    return false;
+}
+
+static void proxy_operation_finish(ProxyClient *client, ProxyOperation *operation, const unsigned char *body, int length)
+{
+    monitor_record(operation->histogram, monitor_now() - operation->startTime);
+    unsigned char control[64];
+    int controlLength = operation->paged ? proxy_page_control(control, 0) : 0;
+    proxy_push(client, operation->messageId, body, length, control, controlLength);
+
+    // the shards still answering are abandoned by the client thread
+    if (proxy_operation_running(operation))
+    {
+        operation->finished = true;
+        operation->sweep = true;
+        return;
+    }
+    proxy_operation_end(client, operation);
+}
+
+static void proxy_operation_settle(ProxyClient *client, ProxyOperation *operation)
+{
+    if (operation->parked || operation->heldStart != operation->heldLength || (operation->pending > 0 && !operation->limited))
+        return;
+    if (operation->limited)
+    {
+        unsigned char body[RESPONSE_TEMPLATE_SIZE];
+        int length = proxy_template(RESPONSE_SEARCH_DONE, SIZE_LIMIT_EXCEEDED, body);
+        proxy_operation_finish(client, operation, body, length);
+    }
+    else
+    {
+        proxy_operation_finish(client, operation, operation->done, operation->doneLength);
+    }
+}
+
+static void proxy_page_done(ProxyClient *client, ProxyOperation *operation)
+{
+    // the page is full and there is more, the client asks for the rest with the cookie
+    unsigned char body[RESPONSE_TEMPLATE_SIZE];
+    int length = proxy_template(RESPONSE_SEARCH_DONE, SUCCESS, body);
+    unsigned char control[64];
+    int controlLength = proxy_page_control(control, operation->serial);
+    proxy_push(client, operation->messageId, body, length, control, controlLength);
+    operation->parked = true;
+}
+
+static void proxy_hold(ProxyOperation *operation, const unsigned char *body, int length)
+{
+    size_t needed = operation->heldLength + sizeof(uint32_t) + length;
+    if (needed > operation->heldCapacity)
+    {
+        size_t capacity = operation->heldCapacity == 0 ? PROXY_LINK_BUFFER_SIZE : operation->heldCapacity;
+        while (capacity < needed)
+            capacity *= 2;
+        unsigned char *held = (unsigned char *)realloc(operation->held, capacity);
+        if (held == NULL)
+        {
+            perror("realloc");
+            return;
+        }
+        operation->held = held;
+        operation->heldCapacity = capacity;
+    }
+    uint32_t entryLength = length;
+    memcpy(operation->held + operation->heldLength, &entryLength, sizeof(uint32_t));
+    memcpy(operation->held + operation->heldLength + sizeof(uint32_t), body, length);
+    operation->heldLength = needed;
+}
+
+static void proxy_send_held(ProxyClient *client, ProxyOperation *operation)
+{
+    while (operation->heldStart < operation->heldLength && operation->pageEntries < operation->pageSize)
+    {
+        uint32_t length;
+        memcpy(&length, operation->held + operation->heldStart, sizeof(uint32_t));
+        proxy_push(client, operation->messageId, operation->held + operation->heldStart + sizeof(uint32_t), length, NULL, 0);
+        operation->heldStart += sizeof(uint32_t) + length;
+        operation->pageEntries++;
+    }
+    if (operation->heldStart == operation->heldLength)
+        operation->heldStart = operation->heldLength = 0;
+    else
+        proxy_page_done(client, operation);
+}
+
+static void proxy_search_entry(ProxyClient *client, ProxyOperation *operation, const unsigned char *body, int length)
+{
+    if (operation->limited)
+        return;
+    // one entry past the limit, as the server finds it, makes the search exceed it
+    if (operation->sizeLimit != 0 && operation->received == operation->sizeLimit)
+    {
+        operation->limited = true;
+        operation->sweep = true;
+        proxy_operation_settle(client, operation);
+        return;
+    }
+    operation->received++;
+
+    if (!operation->parked && (!operation->paged || operation->pageEntries < operation->pageSize))
+    {
+        proxy_push(client, operation->messageId, body, length, NULL, 0);
+        operation->pageEntries++;
+        return;
+    }
+    proxy_hold(operation, body, length);
+    if (!operation->parked)
+        proxy_page_done(client, operation);
+}
+
+static void proxy_operation_result(ProxyClient *client, int index, uint64_t serial, int shard, int tag,
+                                   const unsigned char *body, int length)
+{
+    ProxyOperation *operation = &client->operations[index];
+    if (!operation->used || operation->serial != serial || operation->finished)
+        return;
+    if (operation->search && tag == LDAP_SEARCH_RESULT_ENTRY)
+    {
+        proxy_search_entry(client, operation, body, length);
+        return;
+    }
+
+    // the last response of the shard
+    operation->shards[shard] = 0;
+    operation->answered |= 1u << shard;
+    operation->pending--;
+    if (operation->limited)
+        return;
+    int code = proxy_result_code(body, length);
+    if (operation->done == NULL || (operation->doneCode == SUCCESS && code != SUCCESS))
+    {
+        unsigned char *done = (unsigned char *)realloc(operation->done, length);
+        if (done == NULL)
+        {
+            perror("realloc");
+            return;
+        }
+        memcpy(done, body, length);
+        operation->done = done;
+        operation->doneLength = length;
+        operation->doneCode = code;
+    }
+    proxy_operation_settle(client, operation);
+}
+
+static void proxy_operation_fail(ProxyClient *client, int index, uint64_t serial, int shard)
+{
+    unsigned char body[RESPONSE_TEMPLATE_SIZE];
+    ProxyOperation *operation = &client->operations[index];
+    int length = proxy_template(operation->kind, UNAVAILABLE, body);
+    proxy_operation_result(client, index, serial, shard, body[0], body, length);
+}
+
+static void proxy_link_response(ProxyLink *link, const unsigned char *data, size_t length)
+{
+    size_t position = 0, contentLength;
+    if (ber_read_header(data, length, &position, &contentLength) != LDAP_MESSAGE_PREFIX)
+        return;
+    long id = proxy_read_integer(data, length, &position, INTEGER_TYPE);
+    size_t bodyStart = position;
+    int tag = ber_read_header(data, length, &position, &contentLength);
+    // unsolicited notifications end with the connection, which fails the requests in flight
+    if (id <= 0 || tag == -1)
+        return;
+    int bodyLength = position + contentLength - bodyStart;
+
+    pthread_mutex_lock(&link->lock);
+    ProxySlot *slot = &link->slots[(id - 1) % PROXY_LINK_SLOTS];
+    if (!slot->used || slot->id != id)
+    {
+        // an abandoned request
+        pthread_mutex_unlock(&link->lock);
+        return;
+    }
+    ProxySlot request = *slot;
+    bool last = tag != LDAP_SEARCH_RESULT_ENTRY;
+    if (last)
+    {
+        // the reference of the slot is handed over to the delivery
+        slot->used = false;
+        pthread_cond_signal(&link->slotFreed);
+    }
+    else
+    {
+        __atomic_add_fetch(&request.client->refs, 1, __ATOMIC_ACQ_REL);
+    }
+    pthread_mutex_unlock(&link->lock);
+
+    ProxyClient *client = request.client;
+    pthread_mutex_lock(&client->lock);
+    proxy_operation_result(client, request.operation, request.serial, request.shard, tag, data + bodyStart, bodyLength);
+    pthread_mutex_unlock(&client->lock);
+    proxy_client_wake(client);
+    proxy_client_release(client);
+}
+
+static void proxy_link_lost(ProxyLink *link, int socket)
+{
+    pthread_mutex_lock(&link->sendLock);
+    link->socket = -1;
+    pthread_mutex_unlock(&link->sendLock);
+    close(socket);
+
+    // the requests in flight fail, the references of their slots are handed over
+    ProxySlot *failed = (ProxySlot *)malloc(sizeof(link->slots));
+    int count = 0;
+    pthread_mutex_lock(&link->lock);
+    link->connected = false;
+    for (int i = 0; i < PROXY_LINK_SLOTS; i++)
+    {
+        if (!link->slots[i].used)
+            continue;
+        link->slots[i].used = false;
+        if (failed != NULL)
+            failed[count++] = link->slots[i];
+    }
+    pthread_cond_broadcast(&link->slotFreed);
+    pthread_mutex_unlock(&link->lock);
+
+    for (int i = 0; i < count; i++)
+    {
+        ProxyClient *client = failed[i].client;
+        pthread_mutex_lock(&client->lock);
+        proxy_operation_fail(client, failed[i].operation, failed[i].serial, failed[i].shard);
+        pthread_mutex_unlock(&client->lock);
+        proxy_client_wake(client);
+        proxy_client_release(client);
+    }
+    free(failed);
+}
+
+static void *proxy_link_reader(void *arg)
+{
+    ProxyLink *link = (ProxyLink *)arg;
+
+    // the profile report is left to the accepting thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    size_t capacity = PROXY_LINK_BUFFER_SIZE;
+    unsigned char *buffer = (unsigned char *)malloc(capacity);
+    if (buffer == NULL)
+    {
+        perror("malloc");
+        return NULL;
+    }
+    bool reported = false;
+    while (1)
+    {
+        int socket = proxy_connect(link->address);
+        if (socket == -1)
+        {
+            // one message for the whole pool
+            if (!reported && link == proxyLinks[link->shard])
+                fprintf(stderr, "Backend %s of shard %d is unreachable, retrying\n", link->address, link->shard);
+            reported = true;
+            sleep(PROXY_RETRY);
+            continue;
+        }
+        if (reported && link == proxyLinks[link->shard])
+            debug(1, "Reconnected to the backend %s of shard %d\n", link->address, link->shard);
+        reported = false;
+        pthread_mutex_lock(&link->sendLock);
+        link->socket = socket;
+        pthread_mutex_unlock(&link->sendLock);
+        pthread_mutex_lock(&link->lock);
+        link->connected = true;
+        pthread_mutex_unlock(&link->lock);
+
+        size_t length = 0;
+        while (1)
+        {
+            ssize_t received = recv(socket, buffer + length, capacity - length, 0);
+            if (received < 0 && errno == EINTR)
+                continue;
+            if (received <= 0)
+                break;
+            length += received;
+
+            size_t position = 0;
+            long messageLength = 0;
+            while ((messageLength = ldap_message_length(buffer + position, length - position)) > 0 &&
+                   (size_t)messageLength <= length - position)
+            {
+                proxy_link_response(link, buffer + position, messageLength);
+                position += messageLength;
+            }
+            if (messageLength == -1)
+                break;
+            memmove(buffer, buffer + position, length - position);
+            length -= position;
+
+            // an entry larger than the buffer
+            if ((size_t)messageLength > capacity)
+            {
+                unsigned char *larger = (unsigned char *)realloc(buffer, messageLength);
+                if (larger == NULL)
+                    break;
+                buffer = larger;
+                capacity = messageLength;
+            }
+        }
+        if (link == proxyLinks[link->shard])
+            fprintf(stderr, "Lost the backend %s of shard %d, reconnecting\n", link->address, link->shard);
+        reported = true;
+        proxy_link_lost(link, socket);
+    }
+    return NULL;
+}
+
+static bool proxy_forward(ProxyClient *client, int index, uint64_t serial, int shard, const unsigned char *body,
+                          int length, uint32_t *id)
+{
+    ProxyLink *link = &proxyLinks[shard][client->pin];
+    pthread_mutex_lock(&link->lock);
+    ProxySlot *slot = NULL;
+    while (link->connected && slot == NULL)
+    {
+        for (int i = 0; i < PROXY_LINK_SLOTS && slot == NULL; i++)
+        {
+            int candidate = (link->nextSlot + i) % PROXY_LINK_SLOTS;
+            if (!link->slots[candidate].used)
+                slot = &link->slots[candidate];
+        }
+        if (slot == NULL)
+            pthread_cond_wait(&link->slotFreed, &link->lock);
+    }
+    if (slot == NULL)
+    {
+        pthread_mutex_unlock(&link->lock);
+        return false;
+    }
+    int number = slot - link->slots;
+    link->nextSlot = (number + 1) % PROXY_LINK_SLOTS;
+    // message ids stay below the one of abandon requests
+    slot->round = (slot->round + 1) % (PROXY_ABANDON_ID / PROXY_LINK_SLOTS - 1);
+    slot->id = slot->round * PROXY_LINK_SLOTS + number + 1;
+    slot->used = true;
+    slot->client = client;
+    slot->operation = index;
+    slot->serial = serial;
+    slot->shard = shard;
+    *id = slot->id;
+    __atomic_add_fetch(&client->refs, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_unlock(&link->lock);
+
+    unsigned char stackMessage[512];
+    unsigned char *message = length + 16 <= (int)sizeof(stackMessage) ? stackMessage : (unsigned char *)malloc(length + 16);
+    bool sent = false;
+    if (message != NULL)
+    {
+        int headerLength = proxy_message_header(message, *id, length);
+        memcpy(message + headerLength, body, length);
+        pthread_mutex_lock(&link->sendLock);
+        sent = link->socket != -1 && proxy_send_all(link->socket, message, headerLength + length);
+        pthread_mutex_unlock(&link->sendLock);
+        if (message != stackMessage)
+            free(message);
+    }
+    if (sent)
+        return true;
+
+    // a lost connection already failed the request
+    pthread_mutex_lock(&link->lock);
+    bool ours = slot->used && slot->id == *id;
+    if (ours)
+    {
+        slot->used = false;
+        pthread_cond_signal(&link->slotFreed);
+    }
+    pthread_mutex_unlock(&link->lock);
+    if (!ours)
+        return true;
+    proxy_client_release(client);
+    return false;
+}
+
+static void proxy_abandon(ProxyClient *client, int shard, uint32_t id)
+{
+    ProxyLink *link = &proxyLinks[shard][client->pin];
+    pthread_mutex_lock(&link->lock);
+    ProxySlot *slot = &link->slots[(id - 1) % PROXY_LINK_SLOTS];
+    bool ours = slot->used && slot->id == id && slot->client == client;
+    if (ours)
+    {
+        slot->used = false;
+        pthread_cond_signal(&link->slotFreed);
+    }
+    pthread_mutex_unlock(&link->lock);
+    if (!ours)
+        return;
+    proxy_client_release(client);
+
+    unsigned char message[32];
+    unsigned char body[8];
+    int bodyLength = 0;
+    add_integer(body, &bodyLength, id);
+    // the abandon request is the integer itself under its own tag
+    body[0] = LDAP_ABANDON_REQUEST;
+    int headerLength = proxy_message_header(message, PROXY_ABANDON_ID, bodyLength);
+    memcpy(message + headerLength, body, bodyLength);
+    pthread_mutex_lock(&link->sendLock);
+    if (link->socket != -1)
+        proxy_send_all(link->socket, message, headerLength + bodyLength);
+    pthread_mutex_unlock(&link->sendLock);
+}
+
+static int proxy_sweep(ProxyClient *client, ProxyAbandon *abandons, bool all)
+{
+    // collected under the client lock, abandoned after it is released
+    int count = 0;
+    for (int i = 0; i < PROXY_MAX_OPERATIONS; i++)
+    {
+        ProxyOperation *operation = &client->operations[i];
+        if (!operation->used || (!operation->sweep && !all))
+            continue;
+        for (int shard = 0; shard < proxyShards.count; shard++)
+        {
+            if (operation->shards[shard] == 0)
+                continue;
+            abandons[count].shard = shard;
+            abandons[count].id = operation->shards[shard];
+            count++;
+            operation->shards[shard] = 0;
+        }
+        operation->sweep = false;
+        if (operation->finished || all)
+            proxy_operation_end(client, operation);
+    }
+    return count;
+}
+
+static void proxy_dispatch(ProxyClient *client, ProxyOperation *operation, int shard, bool all,
+                           const unsigned char *body, int length)
+{
+    int index = operation - client->operations;
+    uint64_t serial = operation->serial;
+    operation->pending = all ? proxyShards.count : 1;
+    stats_add(all ? &stats->proxyFanouts : &stats->proxyRouted, 1);
+    pthread_mutex_unlock(&client->lock);
+
+    for (int target = all ? 0 : shard; target < (all ? proxyShards.count : shard + 1); target++)
+    {
+        uint32_t id;
+        bool sent = proxy_forward(client, index, serial, target, body, length, &id);
+        pthread_mutex_lock(&client->lock);
+        bool abandon = false;
+        if (!sent)
+        {
+            proxy_operation_fail(client, index, serial, target);
+        }
+        else if (operation->used && operation->serial == serial && !operation->finished &&
+                 !(operation->answered & (1u << target)))
+        {
+            // the shard is still answering, the next sweep abandons it if the search is already over
+            operation->shards[target] = id;
+        }
+        else if (!(operation->used && operation->serial == serial && (operation->answered & (1u << target))))
+        {
+            abandon = true;
+        }
+        pthread_mutex_unlock(&client->lock);
+        if (abandon)
+            proxy_abandon(client, target, id);
+    }
+    pthread_mutex_lock(&client->lock);
+}
+
+static int proxy_shard_of_dn(const unsigned char *data, size_t end, size_t position, bool bind)
+{
+    size_t contentLength;
+    // a bind names the entry after the version
+    if (bind)
+    {
+        if (ber_read_header(data, end, &position, &contentLength) != INTEGER_TYPE)
+            return 0;
+        position += contentLength;
+    }
+    if (ber_read_header(data, end, &position, &contentLength) != OCTET_STRING_TYPE)
+        return 0;
+    const char *dn = arena_strndup(requestArena, (const char *)data + position, contentLength);
+    Field rdn;
+    // names outside of the directory are left to the first shard to reject
+    if (!split_entry_dn(proxyDirectory, dn, &rdn))
+        return 0;
+    return shard_of_value(&proxyShards, rdn);
+}
+
+static ProxyOperation *proxy_page_find(ProxyClient *client, uint64_t cookie)
+{
+    for (int i = 0; i < PROXY_MAX_OPERATIONS; i++)
+    {
+        ProxyOperation *operation = &client->operations[i];
+        if (operation->used && operation->serial == cookie && operation->parked && !operation->finished)
+            return operation;
+    }
+    return NULL;
+}
+
+static void proxy_page_next(ProxyClient *client, ProxyOperation *operation, int messageId, int pageSize)
+{
+    operation->messageId = messageId;
+    operation->parked = false;
+    operation->pageSize = pageSize;
+    operation->pageEntries = 0;
+    operation->startTime = monitor_now();
+    if (pageSize == 0)
+    {
+        // a page of no entries ends the search
+        unsigned char body[RESPONSE_TEMPLATE_SIZE];
+        int length = proxy_template(RESPONSE_SEARCH_DONE, SUCCESS, body);
+        operation->heldStart = operation->heldLength = 0;
+        operation->sweep = true;
+        proxy_operation_finish(client, operation, body, length);
+        return;
+    }
+    proxy_send_held(client, operation);
+    proxy_operation_settle(client, operation);
+}
+
+static bool proxy_search_valid(const unsigned char *data, size_t length)
+{
+    // ldap_search reads without bounds, so everything it reads must lie within the request
+    size_t position = 0, contentLength;
+    if (ber_read_header(data, length, &position, &contentLength) != LDAP_MESSAGE_PREFIX ||
+        proxy_read_integer(data, length, &position, INTEGER_TYPE) == -1 ||
+        ber_read_header(data, length, &position, &contentLength) != LDAP_SEARCH_REQUEST)
+        return false;
+    size_t end = position + contentLength;
+    if (ber_read_header(data, end, &position, &contentLength) != OCTET_STRING_TYPE)
+        return false;
+    position += contentLength;
+    if (proxy_read_integer(data, end, &position, ENUMERATED_TYPE) == -1 ||
+        proxy_read_integer(data, end, &position, ENUMERATED_TYPE) == -1 ||
+        proxy_read_integer(data, end, &position, INTEGER_TYPE) == -1 ||
+        proxy_read_integer(data, end, &position, INTEGER_TYPE) == -1 ||
+        proxy_read_integer(data, end, &position, BOOLEAN_TYPE) == -1)
+        return false;
+    int filterType = ber_read_header(data, end, &position, &contentLength);
+    if (filterType == -1)
+        return false;
+    size_t filterEnd = position + contentLength;
+    if (filterType == EQUALITY_MATCH_FILTER)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            if (ber_read_header(data, filterEnd, &position, &contentLength) != OCTET_STRING_TYPE)
+                return false;
+            position += contentLength;
+        }
+    }
+    else if (filterType == SUBSTRING_FILTER)
+    {
+        if (ber_read_header(data, filterEnd, &position, &contentLength) != OCTET_STRING_TYPE)
+            return false;
+        position += contentLength;
+        if (ber_read_header(data, filterEnd, &position, &contentLength) != LDAP_MESSAGE_PREFIX || contentLength == 0)
+            return false;
+        size_t substringsEnd = position + contentLength;
+        while (position < substringsEnd)
+        {
+            int substringType = ber_read_header(data, substringsEnd, &position, &contentLength);
+            if (substringType < PREFIX || substringType > POSTFIX)
+                return false;
+            position += contentLength;
+        }
+    }
+    position = filterEnd;
+    // the attribute list follows the filter, so the byte after the last substring is part of the request
+    return ber_read_header(data, end, &position, &contentLength) == LDAP_MESSAGE_PREFIX;
+}
+
+static int proxy_search(ProxyClient *client, unsigned char *data, size_t length, int messageId,
+                        const unsigned char *body, int bodyLength, size_t controls)
+{
+    if (!proxy_search_valid(data, length))
+    {
+        unsigned char done[RESPONSE_TEMPLATE_SIZE];
+        int doneLength = proxy_template(RESPONSE_SEARCH_DONE, PROTOCOL_ERROR, done);
+        pthread_mutex_lock(&client->lock);
+        proxy_push(client, messageId, done, doneLength, NULL, 0);
+        pthread_mutex_unlock(&client->lock);
+        return 0;
+    }
+    currentTagPosition = 0;
+    get_ldap_element_info(data);
+    get_int_value(data);
+    get_ldap_element_info(data);
+    LdapSearch search = ldap_search(data, messageId, &proxyDirectory->schema);
+    stats_add(&stats->searches, 1);
+    int pageSize = 0;
+    uint64_t cookie = 0;
+    bool paged = proxy_paged_control(data, length, controls, &pageSize, &cookie);
+
+    pthread_mutex_lock(&client->lock);
+    if (monitor_is_base(search.baseObject))
+    {
+        // the statistics of the proxy itself
+        outputQueue = &client->output;
+        monitor_search(search, client->socket);
+        outputQueue = NULL;
+    }
+    else if (paged && cookie != 0)
+    {
+        ProxyOperation *operation = proxy_page_find(client, cookie);
+        if (operation != NULL)
+            proxy_page_next(client, operation, messageId, pageSize);
+        else
+        {
+            unsigned char done[RESPONSE_TEMPLATE_SIZE];
+            int doneLength = proxy_template(RESPONSE_SEARCH_DONE, UNWILLING_TO_PERFORM, done);
+            proxy_push(client, messageId, done, doneLength, NULL, 0);
+        }
+    }
+    else
+    {
+        ProxyOperation *operation = proxy_operation_start(client, messageId, RESPONSE_SEARCH_DONE, MONITOR_SEARCH);
+        operation->search = true;
+        operation->sizeLimit = search.sizeLimit;
+        operation->paged = paged;
+        operation->pageSize = pageSize;
+        // a page of no entries asks for nothing
+        if (paged && pageSize == 0)
+            operation->pageSize = 0x7FFFFFFF;
+        // an equality lookup of the shard key has all its entries on one shard
+        bool routed = search.returnCode == SUCCESS && search.targetColumn == proxyDirectory->schema.rdn &&
+                      search.filter.filterType == EQUALITY_MATCH_FILTER;
+        int shard = 0;
+        if (routed)
+        {
+            Field key = {search.filter.attributeValue, search.filter.attributeValueLength};
+            shard = shard_of_key(&proxyShards, key);
+        }
+        proxy_dispatch(client, operation, shard, !routed, body, bodyLength);
+    }
+    pthread_mutex_unlock(&client->lock);
+    return 0;
+}
+
+static int proxy_handle_request(ProxyClient *client, unsigned char *data, size_t length)
+{
+    size_t position = 0, contentLength;
+    long messageId = -1;
+    int tag = -1;
+    if (ber_read_header(data, length, &position, &contentLength) == LDAP_MESSAGE_PREFIX)
+        messageId = proxy_read_integer(data, length, &position, INTEGER_TYPE);
+    size_t bodyStart = position;
+    if (messageId != -1)
+        tag = ber_read_header(data, length, &position, &contentLength);
+    size_t bodyEnd = position + contentLength;
+    if (tag == -1)
+    {
+        pthread_mutex_lock(&client->lock);
+        outputQueue = &client->output;
+        ldap_notice_of_disconnection(client->socket);
+        outputQueue = NULL;
+        pthread_mutex_unlock(&client->lock);
+        return -1;
+    }
+    trace(TRACE_INFO, TRACE_REQUEST, messageId, tag, length);
+    const unsigned char *body = data + bodyStart;
+    int bodyLength = bodyEnd - bodyStart;
+
+    int kind, histogram, shard;
+    switch (tag)
+    {
+    case LDAP_SEARCH_REQUEST:
+        return proxy_search(client, data, length, messageId, body, bodyLength, bodyEnd);
+
+    case LDAP_BIND_REQUEST:
+        kind = RESPONSE_BIND;
+        histogram = MONITOR_BIND;
+        shard = proxy_shard_of_dn(data, bodyEnd, position, true);
+        stats_add(&stats->binds, 1);
+        break;
+
+    case LDAP_COMPARE_REQUEST:
+        kind = RESPONSE_COMPARE;
+        histogram = MONITOR_COMPARE;
+        shard = proxy_shard_of_dn(data, bodyEnd, position, false);
+        stats_add(&stats->compares, 1);
+        break;
+
+    case LDAP_ADD_REQUEST:
+    case LDAP_MODIFY_REQUEST:
+        kind = tag == LDAP_ADD_REQUEST ? RESPONSE_ADD : RESPONSE_MODIFY;
+        histogram = MONITOR_UPDATE;
+        shard = proxy_shard_of_dn(data, bodyEnd, position, false);
+        stats_add(&stats->updates, 1);
+        break;
+
+    case LDAP_DELETE_REQUEST:;
+        // the entry name is the content of the request
+        kind = RESPONSE_DELETE;
+        histogram = MONITOR_UPDATE;
+        Field rdn;
+        const char *dn = arena_strndup(requestArena, (const char *)data + position, contentLength);
+        shard = split_entry_dn(proxyDirectory, dn, &rdn) ? shard_of_value(&proxyShards, rdn) : 0;
+        stats_add(&stats->updates, 1);
+        break;
+
+    case LDAP_ABANDON_REQUEST:;
+        long abandonedId = 0;
+        for (size_t i = 0; i < contentLength && i < 4; i++)
+            abandonedId = abandonedId * 256 + data[position + i];
+        pthread_mutex_lock(&client->lock);
+        for (int i = 0; i < PROXY_MAX_OPERATIONS; i++)
+        {
+            ProxyOperation *operation = &client->operations[i];
+            if (operation->used && !operation->finished && !operation->parked && operation->messageId == abandonedId)
+            {
+                operation->finished = true;
+                operation->sweep = true;
+                trace(TRACE_INFO, TRACE_ABANDON, messageId, abandonedId, client->running);
+                stats_add(&stats->abandons, 1);
+            }
+        }
+        pthread_mutex_unlock(&client->lock);
+        return 0;
+
+    case LDAP_UNBIND_REQUEST:
+        trace(TRACE_INFO, TRACE_UNBIND, messageId, 0, 0);
+        return -1;
+
+    default:
+        pthread_mutex_lock(&client->lock);
+        outputQueue = &client->output;
+        ldap_notice_of_disconnection(client->socket);
+        outputQueue = NULL;
+        pthread_mutex_unlock(&client->lock);
+        trace(TRACE_INFO, TRACE_UNSUPPORTED, messageId, tag, length);
+        return -1;
+    }
+
+    pthread_mutex_lock(&client->lock);
+    ProxyOperation *operation = proxy_operation_start(client, messageId, kind, histogram);
+    proxy_dispatch(client, operation, shard, false, body, bodyLength);
+    pthread_mutex_unlock(&client->lock);
+    return 0;
+}
+
+static int proxy_handle_input(ProxyClient *client)
+{
+    size_t position = 0;
+    int result = 0;
+
+    // a request is only forwarded when there is an operation for it, the rest waits in the buffer
+    while (result != -1 && client->running < PROXY_MAX_OPERATIONS)
+    {
+        size_t available = client->inputLength - position;
+        long length = ldap_message_length(client->input + position, available);
+        if (length == -1 || length > CONNECTION_INPUT_SIZE)
+        {
+            pthread_mutex_lock(&client->lock);
+            outputQueue = &client->output;
+            ldap_notice_of_disconnection(client->socket);
+            outputQueue = NULL;
+            pthread_mutex_unlock(&client->lock);
+            result = -1;
+            break;
+        }
+        if (length == 0 || (size_t)length > available)
+            break;
+
+        result = proxy_handle_request(client, client->input + position, length);
+        position += length;
+        stats_add(&stats->requests, 1);
+        arena_reset(&client->arena);
+    }
+
+    memmove(client->input, client->input + position, client->inputLength - position);
+    client->inputLength -= position;
+    return result;
+}
+
+static void proxy_abandon_all(ProxyClient *client, ProxyAbandon *abandons, int count)
+{
+    for (int i = 0; i < count; i++)
+        proxy_abandon(client, abandons[i].shard, abandons[i].id);
+}
+
+void proxy_serve(int clientSocket)
+{
+    ProxyClient *client = (ProxyClient *)calloc(1, sizeof(ProxyClient));
+    if (client == NULL)
+    {
+        perror("calloc");
+        return;
+    }
+    if (pipe(client->wake) == -1)
+    {
+        perror("pipe");
+        free(client);
+        return;
+    }
+    fcntl(client->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(client->wake[1], F_SETFL, O_NONBLOCK);
+    client->socket = clientSocket;
+    client->refs = 1;
+    // the requests of one client stay in order on one connection of every backend
+    client->pin = __atomic_fetch_add(&proxyClients, 1, __ATOMIC_RELAXED) % PROXY_POOL_SIZE;
+    pthread_mutex_init(&client->lock, NULL);
+    arena_init(&client->arena, ARENA_BLOCK_SIZE);
+    requestArena = &client->arena;
+    trace(TRACE_INFO, TRACE_CONNECTION_OPEN, clientSocket, 0, 0);
+
+    ProxyAbandon abandons[PROXY_MAX_OPERATIONS * SHARD_MAX_COUNT];
+    int result = 0;
+    while (result != -1)
+    {
+        pthread_mutex_lock(&client->lock);
+        int count = proxy_sweep(client, abandons, false);
+        size_t pending = output_queue_pending(&client->output);
+        pthread_mutex_unlock(&client->lock);
+        proxy_abandon_all(client, abandons, count);
+
+        // a client not reading its results gets no new requests forwarded until it catches up
+        if (!client->paused && pending >= OUTPUT_HIGH_WATER)
+        {
+            client->paused = true;
+            stats_add(&stats->outputPauses, 1);
+            trace(TRACE_INFO, TRACE_PAUSE, clientSocket, pending, 0);
+        }
+        else if (client->paused && pending <= OUTPUT_LOW_WATER)
+        {
+            client->paused = false;
+            trace(TRACE_INFO, TRACE_RESUME, clientSocket, pending, 0);
+        }
+
+        // requests left in the buffer by a full table of operations are taken without waiting
+        bool readable = client->running < PROXY_MAX_OPERATIONS && !client->paused;
+        long buffered = ldap_message_length(client->input, client->inputLength);
+        bool startable = readable && (buffered == -1 || (buffered > 0 && (size_t)buffered <= client->inputLength));
+        struct pollfd pollFds[2] = {{clientSocket, (readable ? POLLIN : 0) | (pending > 0 ? POLLOUT : 0), 0},
+                                    {client->wake[0], POLLIN, 0}};
+        if (poll(pollFds, 2, startable ? 0 : -1) == -1 && errno != EINTR)
+            break;
+        if (pollFds[1].revents & POLLIN)
+        {
+            char drain[256];
+            while (read(client->wake[0], drain, sizeof(drain)) > 0)
+                ;
+        }
+        if (readable && (pollFds[0].revents & (POLLIN | POLLHUP | POLLERR)))
+        {
+            int received = ldap_receive(clientSocket, client->input + client->inputLength,
+                                        CONNECTION_INPUT_SIZE - client->inputLength);
+            if (received == 0)
+                break;
+            client->inputLength += received;
+            result = proxy_handle_input(client);
+        }
+        else if (startable)
+        {
+            result = proxy_handle_input(client);
+        }
+
+        // the socket is non-blocking for the drain only, so the lock is never held while waiting
+        pthread_mutex_lock(&client->lock);
+        int drained = output_queue_drain(&client->output, clientSocket);
+        pthread_mutex_unlock(&client->lock);
+        if (drained == -1)
+            break;
+    }
+
+    // the responses before an unbind or a disconnection notice are still delivered
+    pthread_mutex_lock(&client->lock);
+    int count = proxy_sweep(client, abandons, true);
+    pthread_mutex_unlock(&client->lock);
+    proxy_abandon_all(client, abandons, count);
+    pthread_mutex_lock(&client->lock);
+    output_queue_flush(&client->output, clientSocket);
+    output_queue_dispose(&client->output);
+    pthread_mutex_unlock(&client->lock);
+
+    arena_dispose(&client->arena);
+    requestArena = NULL;
+    trace(TRACE_INFO, TRACE_CONNECTION_CLOSE, clientSocket, 0, 0);
+    proxy_client_release(client);
+}
+
+int proxy_init(const char *backends, const char *partitioning, Directory *directory)
+{
+    char *addresses[SHARD_MAX_COUNT];
+    int count = 0;
+    char *list = strdup(backends);
+    if (list == NULL)
+        return -1;
+    for (char *save, *address = strtok_r(list, ",", &save); address != NULL; address = strtok_r(NULL, ",", &save))
+    {
+        if (count == SHARD_MAX_COUNT)
+        {
+            fprintf(stderr, "A proxy serves at most %d backends\n", SHARD_MAX_COUNT);
+            return -1;
+        }
+        addresses[count++] = address;
+    }
+    if (shard_parse(&proxyShards, partitioning, count, &directory->schema) == -1)
+        return -1;
+    proxyDirectory = directory;
+
+    for (int shard = 0; shard < count; shard++)
+    {
+        for (int i = 0; i < PROXY_POOL_SIZE; i++)
+        {
+            ProxyLink *link = &proxyLinks[shard][i];
+            link->address = addresses[shard];
+            link->shard = shard;
+            link->socket = -1;
+            pthread_mutex_init(&link->lock, NULL);
+            pthread_mutex_init(&link->sendLock, NULL);
+            pthread_cond_init(&link->slotFreed, NULL);
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, proxy_link_reader, link) != 0)
+            {
+                perror("Thread creation failed");
+                return -1;
+            }
+            pthread_detach(thread);
+        }
+        debug(1, "Shard %d is served by %s\n", shard, addresses[shard]);
+    }
+
+    for (int waited = 0; waited < PROXY_START_TIMEOUT * 10; waited++)
+    {
+        int connected = 0;
+        for (int shard = 0; shard < count; shard++)
+        {
+            for (int i = 0; i < PROXY_POOL_SIZE; i++)
+            {
+                pthread_mutex_lock(&proxyLinks[shard][i].lock);
+                connected += proxyLinks[shard][i].connected;
+                pthread_mutex_unlock(&proxyLinks[shard][i].lock);
+            }
+        }
+        if (connected == count * PROXY_POOL_SIZE)
+            break;
+        usleep(100000);
+    }
+    proxyEnabled = true;
+    return 0;
+}
+
+bool proxy_is_enabled(void)
+{
+    return proxyEnabled;
+}
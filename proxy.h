@@ -0,0 +1,79 @@
+/**
+ *
+ * @file proxy.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _PROXY_H
+#define _PROXY_H
+
+#include <stdbool.h>
+#include "directory.h"
+#include "shard.h"
+
+enum ProxyConst
+{
+    PROXY_POOL_SIZE = 4,                      // connections to every backend, shared by all clients
+    PROXY_LINK_SLOTS = 256,                   // requests in flight on one backend connection
+    PROXY_MAX_OPERATIONS = 64,                // requests of one client in flight, parked pages included
+    PROXY_RETRY = 1,                          // seconds between the attempts to reconnect a backend
+    PROXY_START_TIMEOUT = 30,                 // seconds a starting proxy waits for its backends before it serves anyway
+    PROXY_LINK_BUFFER_SIZE = 64 * 1024,       // initial size of the receive buffer of a backend connection
+    PROXY_ABANDON_ID = 0x7FFFFFFF,            // message id of abandon requests sent to backends, never answered
+    PROXY_COOKIE_SIZE = 8                     // bytes of the cookie of a paged search
+};
+
+#define PROXY_PAGED_RESULTS_OID "1.2.840.113556.1.4.319" // simple paged results control, RFC 2696
+
+/**
+ * Start Sharding Proxy.
+ *
+ * Parses the comma separated backend addresses, <port> or <host>:<port>, one per shard
+ * in shard order, and the partitioning given to shard_parse(). Starts PROXY_POOL_SIZE
+ * connections to every backend, each with a thread reading its responses. A backend that
+ * cannot be reached is retried in the background; its requests fail with unavailable
+ * until it is back. Waits up to PROXY_START_TIMEOUT seconds for every backend to be
+ * connected, so backends started along with the proxy are ready for its first clients.
+ * Has to be called before the first client is served.
+ *
+ * @param backends     The backend addresses.
+ * @param partitioning The partitioning, "hash" or "range:<bound>,...".
+ * @param directory    A pointer to the directory holding the schema and dn suffix of the backends, no rows.
+ *
+ * @return 0 on success, -1 if the addresses or the partitioning are invalid.
+ */
+int proxy_init(const char *backends, const char *partitioning, Directory *directory);
+
+/**
+ * Check Proxy Mode.
+ *
+ * @return true if proxy_init() succeeded, so clients are served by proxy_serve().
+ */
+bool proxy_is_enabled(void);
+
+/**
+ * Serve Client by Backends.
+ *
+ * Forwards the requests of the client to the backends until it unbinds or closes the
+ * connection. Binds, compares, adds, deletes and modifies go to the shard of the entry
+ * they name, equality searches of the rdn attribute to the shard of the value and other
+ * searches to every shard at once. Requests are pipelined on the pooled connections under
+ * message ids of the proxy and answered under the ids of the client. The entries of every
+ * shard are passed on as they arrive, counted against the size limit of the search, and
+ * the search result done is the first unsuccessful one of the shards or else a successful
+ * one. Searches with the simple paged results control are paged by the proxy. Searches
+ * of cn=monitor are answered by the proxy itself.
+ *
+ * Responses for a client that does not read them are kept by the proxy, unlike the
+ * server, which stops producing them.
+ *
+ * @param clientSocket The socket of the connected client.
+ */
+void proxy_serve(int clientSocket);
+
+#endif
@@ -0,0 +1,940 @@
+/**
+ *
+ * @file replication.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "utils.h"
+#include "schema.h"
+#include "overlay.h"
+#include "monitor.h"
+#include "wal.h"
+#include "replication.h"
+
+/**
+ * Structure representing the replication state shared by all connection processes.
+ */
+typedef struct
+{
+    int role;                 /**< The ReplicationRole. */
+    int replicas;             /**< The number of replicas connected to a primary. */
+    bool connected;           /**< Flag indicating whether a replica is connected to its primary. */
+    uint64_t identity;        /**< The identity of the log of the primary the replica follows. */
+    uint64_t applied;         /**< The sequence of the last change applied by a replica. */
+    uint64_t primarySequence; /**< The sequence of the last change on disk at the primary, as last heard. */
+    uint64_t behindSince;     /**< The monotonic time the replica learned of a change it does not have, 0 if none. */
+    uint64_t lastContact;     /**< The monotonic time of the last frame from the primary. */
+    size_t snapshots;         /**< The number of snapshots sent or applied. */
+    size_t changes;           /**< The number of changes sent or applied. */
+} ReplicationState;
+
+/**
+ * Structure representing frames queued to be sent at once.
+ */
+typedef struct
+{
+    int socket;          /**< The socket of the peer. */
+    uint64_t identity;   /**< The log identity put into the queued frames. */
+    unsigned char *data; /**< The queued frames. */
+    size_t length;       /**< The number of queued bytes. */
+    size_t capacity;     /**< The size of the buffer. */
+    bool failed;         /**< Flag indicating whether a send failed. */
+} ReplicationLink;
+
+/**
+ * Structure representing a snapshot compared with the directory of a replica.
+ */
+typedef struct
+{
+    bool active;                        /**< Flag indicating whether a snapshot is being received. */
+    bool failed;                        /**< Flag indicating whether an entry could not be written. */
+    uint64_t sequence;                  /**< The sequence of the snapshot. */
+    int attributeOf[SCHEMA_LINE_SIZE];  /**< The attribute of every database file column or -1. */
+    char *line;                         /**< The start of a line split between frames. */
+    size_t lineLength;                  /**< The length of the split line. */
+    size_t lineCapacity;                /**< The size of the line buffer. */
+    uint64_t *seen;                     /**< One bit per row, set for the rows of the snapshot. */
+    char *scratch;                      /**< A buffer for values of the directory. */
+    size_t written;                     /**< The number of entries written. */
+    size_t deleted;                     /**< The number of entries deleted. */
+} ReplicationResync;
+
+static ReplicationState *replicationState;
+static Directory *replicationDirectory;
+static int listenSocket = -1;
+static int replicaSockets[REPLICATION_MAX_REPLICAS];
+static pthread_mutex_t replicaLock = PTHREAD_MUTEX_INITIALIZER;
+static const char *primaryAddress;
+static int primarySocket = -1;
+static uint32_t primaryAttributes;
+
+static int replication_state_create(int role)
+{
+    replicationState = (ReplicationState *)mmap(NULL, sizeof(ReplicationState), PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (replicationState == MAP_FAILED)
+    {
+        perror("mmap");
+        replicationState = NULL;
+        return -1;
+    }
+    replicationState->role = role;
+    return 0;
+}
+
+static void replication_block_signals(void)
+{
+    // the profile report is left to the accepting thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+}
+
+static int replication_socket(const char *address, bool listening)
+{
+    if (strchr(address, '/') != NULL)
+    {
+        struct sockaddr_un local;
+        memset(&local, 0, sizeof(local));
+        local.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(local.sun_path))
+        {
+            fprintf(stderr, "%s: socket path is too long\n", address);
+            return -1;
+        }
+        strcpy(local.sun_path, address);
+        int unixSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (unixSocket == -1)
+        {
+            perror("socket");
+            return -1;
+        }
+        // a socket left by an earlier run would make the bind fail
+        if (listening)
+            unlink(address);
+        int result = listening ? bind(unixSocket, (struct sockaddr *)&local, sizeof(local))
+                               : connect(unixSocket, (struct sockaddr *)&local, sizeof(local));
+        if (result == 0 && listening)
+            result = listen(unixSocket, REPLICATION_MAX_REPLICAS);
+        if (result == -1)
+        {
+            if (listening)
+                perror(address);
+            close(unixSocket);
+            return -1;
+        }
+        return unixSocket;
+    }
+
+    // <port>, <host>:<port> or [<IPv6 address>]:<port>
+    char host[NI_MAXHOST] = "";
+    const char *port = address;
+    const char *colon = strrchr(address, ':');
+    if (colon != NULL)
+    {
+        const char *start = address;
+        size_t length = colon - address;
+        if (length >= 2 && start[0] == '[' && colon[-1] == ']')
+        {
+            start++;
+            length -= 2;
+        }
+        if (length >= sizeof(host))
+        {
+            fprintf(stderr, "%s: host name is too long\n", address);
+            return -1;
+        }
+        memcpy(host, start, length);
+        host[length] = '\0';
+        port = colon + 1;
+    }
+
+    struct addrinfo hints, *results;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    int error = getaddrinfo(host[0] != '\0' ? host : NULL, port, &hints, &results);
+    if (error != 0)
+    {
+        fprintf(stderr, "%s: %s\n", address, gai_strerror(error));
+        return -1;
+    }
+
+    int tcpSocket = -1, lastError = 0;
+    for (struct addrinfo *candidate = results; candidate != NULL && tcpSocket == -1; candidate = candidate->ai_next)
+    {
+        tcpSocket = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+        if (tcpSocket == -1)
+            continue;
+        if (listening && setsockopt(tcpSocket, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0)
+            perror("setsockopt(SO_REUSEADDR) failed");
+        int result = listening ? bind(tcpSocket, candidate->ai_addr, candidate->ai_addrlen)
+                               : connect(tcpSocket, candidate->ai_addr, candidate->ai_addrlen);
+        if (result == 0 && listening)
+            result = listen(tcpSocket, REPLICATION_MAX_REPLICAS);
+        if (result == -1)
+        {
+            lastError = errno;
+            close(tcpSocket);
+            tcpSocket = -1;
+        }
+    }
+    freeaddrinfo(results);
+    if (tcpSocket == -1 && listening)
+        fprintf(stderr, "%s: %s\n", address, strerror(lastError));
+    return tcpSocket;
+}
+
+static void replication_configure(int socket)
+{
+    // a silent peer is given up, an idle primary sends heartbeats well within the timeout
+    struct timeval timeout = {REPLICATION_TIMEOUT, 0};
+    if (setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+        setsockopt(socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
+        perror("setsockopt(SO_RCVTIMEO) failed");
+    // frames are already coalesced into one send, fails harmlessly on Unix sockets
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+}
+
+static bool replication_queue(ReplicationLink *link, uint32_t type, uint64_t sequence, const void *payload, size_t length)
+{
+    size_t size = link->length + sizeof(ReplicationFrame) + length;
+    if (size > link->capacity)
+    {
+        size_t capacity = link->capacity ? link->capacity : 2 * REPLICATION_FRAME_SIZE;
+        while (capacity < size)
+            capacity *= 2;
+        unsigned char *data = (unsigned char *)realloc(link->data, capacity);
+        if (data == NULL)
+        {
+            link->failed = true;
+            return false;
+        }
+        link->data = data;
+        link->capacity = capacity;
+    }
+
+    ReplicationFrame frame;
+    frame.type = type;
+    frame.length = length;
+    frame.identity = link->identity;
+    frame.sequence = sequence;
+    memcpy(link->data + link->length, &frame, sizeof(frame));
+    if (length > 0)
+        memcpy(link->data + link->length + sizeof(frame), payload, length);
+    link->length = size;
+    return true;
+}
+
+static bool replication_flush(ReplicationLink *link)
+{
+    size_t sent = 0;
+    while (!link->failed && sent < link->length)
+    {
+        ssize_t result = send(link->socket, link->data + sent, link->length - sent, MSG_NOSIGNAL);
+        if (result == -1 && errno == EINTR)
+            continue;
+        if (result <= 0)
+            link->failed = true;
+        else
+            sent += result;
+    }
+    link->length = 0;
+    return !link->failed;
+}
+
+static bool replication_receive_all(int socket, void *data, size_t size)
+{
+    char *position = (char *)data;
+    while (size > 0)
+    {
+        ssize_t received = recv(socket, position, size, 0);
+        if (received == -1 && errno == EINTR)
+            continue;
+        if (received <= 0)
+            return false;
+        position += received;
+        size -= received;
+    }
+    return true;
+}
+
+static bool replication_receive(int socket, ReplicationFrame *frame, unsigned char **payload, size_t *capacity)
+{
+    if (!replication_receive_all(socket, frame, sizeof(*frame)) || frame->length > REPLICATION_MAX_FRAME)
+        return false;
+    if (frame->length > *capacity)
+    {
+        unsigned char *resized = (unsigned char *)realloc(*payload, frame->length);
+        if (resized == NULL)
+            return false;
+        *payload = resized;
+        *capacity = frame->length;
+    }
+    return replication_receive_all(socket, *payload, frame->length);
+}
+
+static bool replication_register(int socket)
+{
+    bool registered = false;
+    pthread_mutex_lock(&replicaLock);
+    for (int i = 0; i < REPLICATION_MAX_REPLICAS && !registered; i++)
+    {
+        if (replicaSockets[i] == -1)
+        {
+            replicaSockets[i] = socket;
+            registered = true;
+        }
+    }
+    pthread_mutex_unlock(&replicaLock);
+    if (registered)
+        __atomic_add_fetch(&replicationState->replicas, 1, __ATOMIC_RELAXED);
+    return registered;
+}
+
+static void replication_release(int socket)
+{
+    pthread_mutex_lock(&replicaLock);
+    for (int i = 0; i < REPLICATION_MAX_REPLICAS; i++)
+    {
+        if (replicaSockets[i] == socket)
+            replicaSockets[i] = -1;
+    }
+    pthread_mutex_unlock(&replicaLock);
+    close(socket);
+    __atomic_sub_fetch(&replicationState->replicas, 1, __ATOMIC_RELAXED);
+}
+
+static ssize_t replication_snapshot_write(void *cookie, const char *data, size_t size)
+{
+    // every buffer of the stream becomes one frame
+    ReplicationLink *link = (ReplicationLink *)cookie;
+    if (!replication_queue(link, REPLICATION_DATA, 0, data, size) || !replication_flush(link))
+        return -1;
+    return size;
+}
+
+static int replication_send_snapshot(ReplicationLink *link, WalCursor *cursor)
+{
+    // the snapshot holds every change on disk when it starts, the later ones are streamed after it
+    uint64_t durable;
+    do
+        link->identity = wal_identity(&durable);
+    while (wal_cursor_open(cursor, durable) == -1);
+
+    if (!replication_queue(link, REPLICATION_SNAPSHOT, durable, NULL, 0) || !replication_flush(link))
+        return -1;
+    cookie_io_functions_t functions = {NULL, replication_snapshot_write, NULL, NULL};
+    FILE *out = fopencookie(link, "w", functions);
+    if (out == NULL)
+    {
+        perror("fopencookie");
+        return -1;
+    }
+    setvbuf(out, NULL, _IOFBF, REPLICATION_FRAME_SIZE);
+    int result = wal_snapshot(replicationDirectory, out);
+    if (fclose(out) != 0 || link->failed)
+        result = -1;
+    if (result == -1 || !replication_queue(link, REPLICATION_SNAPSHOT_END, durable, NULL, 0) || !replication_flush(link))
+        return -1;
+
+    __atomic_add_fetch(&replicationState->snapshots, 1, __ATOMIC_RELAXED);
+    debug(1, "Sent a snapshot of change %llu to a replica\n", (unsigned long long)durable);
+    return 0;
+}
+
+static void replication_serve(ReplicationLink *link)
+{
+    ReplicationFrame hello;
+    unsigned char *payload = NULL;
+    size_t capacity = 0;
+    uint32_t attributeCount = 0;
+    bool introduced = replication_receive(link->socket, &hello, &payload, &capacity) && hello.type == REPLICATION_HELLO &&
+                      hello.length == sizeof(attributeCount);
+    if (introduced)
+        memcpy(&attributeCount, payload, sizeof(attributeCount));
+    free(payload);
+    if (!introduced)
+    {
+        debug(1, "A replica did not introduce itself\n");
+        return;
+    }
+    if ((int)attributeCount != replicationDirectory->schema.attributeCount)
+    {
+        fprintf(stderr, "Refusing a replica with %u attributes, the schema has %d\n", attributeCount,
+                replicationDirectory->schema.attributeCount);
+        return;
+    }
+
+    // a replica of this run of the server continues where it stopped, if the log still has the changes
+    WalCursor cursor;
+    uint64_t durable;
+    link->identity = wal_identity(&durable);
+    if (hello.identity == link->identity && wal_cursor_open(&cursor, hello.sequence) == 0)
+    {
+        if (!replication_queue(link, REPLICATION_RESUME, hello.sequence, NULL, 0) || !replication_flush(link))
+            return;
+        debug(1, "A replica resumed after change %llu\n", (unsigned long long)hello.sequence);
+    }
+    else if (replication_send_snapshot(link, &cursor) == -1)
+    {
+        return;
+    }
+
+    unsigned char *records = NULL;
+    size_t recordCapacity = 0;
+    while (!link->failed)
+    {
+        long length = wal_cursor_read(&cursor, &records, &recordCapacity, REPLICATION_HEARTBEAT_INTERVAL);
+        if (length == -1)
+        {
+            // the changes the replica misses were compacted away
+            if (replication_send_snapshot(link, &cursor) == -1)
+                break;
+            continue;
+        }
+
+        size_t changes = 0;
+        for (long position = 0; position < length; changes++)
+        {
+            WalRecord record;
+            memcpy(&record, records + position, sizeof(record));
+            size_t size = sizeof(record) + record.length;
+            replication_queue(link, REPLICATION_CHANGE, record.sequence, records + position, size);
+            position += size;
+        }
+        wal_identity(&durable);
+        replication_queue(link, REPLICATION_HEARTBEAT, durable, NULL, 0);
+        if (replication_flush(link))
+            __atomic_add_fetch(&replicationState->changes, changes, __ATOMIC_RELAXED);
+    }
+    free(records);
+}
+
+static void *replication_sender(void *arg)
+{
+    replication_block_signals();
+    ReplicationLink link;
+    memset(&link, 0, sizeof(link));
+    link.socket = (int)(intptr_t)arg;
+    replication_serve(&link);
+    free(link.data);
+    replication_release(link.socket);
+    debug(1, "A replica disconnected\n");
+    return NULL;
+}
+
+static void *replication_accept(void *arg)
+{
+    replication_block_signals();
+    while (1)
+    {
+        int socket = accept(listenSocket, NULL, NULL);
+        if (socket == -1)
+        {
+            if (errno == EBADF || errno == EINVAL)
+                return NULL;
+            if (errno != EINTR)
+                perror("Accepting replica failed");
+            continue;
+        }
+        if (!replication_register(socket))
+        {
+            fprintf(stderr, "Refusing a replica, %d are already connected\n", REPLICATION_MAX_REPLICAS);
+            close(socket);
+            continue;
+        }
+        replication_configure(socket);
+
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, replication_sender, (void *)(intptr_t)socket) != 0)
+        {
+            perror("Thread creation failed");
+            replication_release(socket);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+    return NULL;
+}
+
+int replication_listen(const char *address, Directory *directory)
+{
+    if (replication_state_create(REPLICATION_PRIMARY) == -1)
+        return -1;
+    replicationDirectory = directory;
+    for (int i = 0; i < REPLICATION_MAX_REPLICAS; i++)
+        replicaSockets[i] = -1;
+    listenSocket = replication_socket(address, true);
+    if (listenSocket == -1)
+        return -1;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, replication_accept, NULL) != 0)
+    {
+        perror("Thread creation failed");
+        return -1;
+    }
+    pthread_detach(thread);
+    debug(1, "Replicas are accepted on %s...\n", address);
+    return 0;
+}
+
+static int replication_connect(void)
+{
+    int socket = replication_socket(primaryAddress, false);
+    if (socket == -1)
+        return -1;
+    replication_configure(socket);
+
+    // the replica tells which changes it has, the primary decides whether they are enough
+    ReplicationLink link;
+    memset(&link, 0, sizeof(link));
+    link.socket = socket;
+    link.identity = __atomic_load_n(&replicationState->identity, __ATOMIC_RELAXED);
+    uint64_t applied = __atomic_load_n(&replicationState->applied, __ATOMIC_RELAXED);
+    bool sent = replication_queue(&link, REPLICATION_HELLO, applied, &primaryAttributes, sizeof(primaryAttributes)) &&
+                replication_flush(&link);
+    free(link.data);
+    if (!sent)
+    {
+        close(socket);
+        return -1;
+    }
+    return socket;
+}
+
+int replication_fetch(const char *address, const char *path, int attributeCount)
+{
+    if (replication_state_create(REPLICATION_REPLICA) == -1)
+        return -1;
+    primaryAddress = address;
+    primaryAttributes = attributeCount;
+    int socket = replication_connect();
+    if (socket == -1)
+    {
+        fprintf(stderr, "Could not reach the primary %s\n", address);
+        return -1;
+    }
+
+    // a replica fetches a new snapshot on every start, so the file is not synced
+    size_t pathLength = strlen(path);
+    char *tempPath = (char *)malloc(pathLength + sizeof(".replica"));
+    memcpy(tempPath, path, pathLength);
+    memcpy(tempPath + pathLength, ".replica", sizeof(".replica"));
+    FILE *out = fopen(tempPath, "w");
+    if (out == NULL)
+        perror(tempPath);
+
+    ReplicationFrame frame;
+    unsigned char *payload = NULL;
+    size_t capacity = 0;
+    uint64_t sequence = 0;
+    bool complete = false;
+    if (out != NULL && replication_receive(socket, &frame, &payload, &capacity) && frame.type == REPLICATION_SNAPSHOT)
+    {
+        sequence = frame.sequence;
+        bool received;
+        while ((received = replication_receive(socket, &frame, &payload, &capacity)) && frame.type == REPLICATION_DATA &&
+               fwrite(payload, 1, frame.length, out) == frame.length)
+            ;
+        complete = received && frame.type == REPLICATION_SNAPSHOT_END && frame.sequence == sequence;
+    }
+    free(payload);
+    if (out != NULL && fclose(out) != 0)
+        complete = false;
+    if (complete && rename(tempPath, path) == -1)
+    {
+        perror(tempPath);
+        complete = false;
+    }
+    if (!complete)
+    {
+        fprintf(stderr, "Could not fetch the snapshot of the primary %s\n", address);
+        unlink(tempPath);
+        free(tempPath);
+        close(socket);
+        return -1;
+    }
+    free(tempPath);
+
+    replicationState->identity = frame.identity;
+    replicationState->applied = sequence;
+    replicationState->primarySequence = sequence;
+    replicationState->connected = true;
+    replicationState->lastContact = monitor_now();
+    replicationState->snapshots = 1;
+    primarySocket = socket;
+    debug(1, "Fetched the snapshot of change %llu from %s\n", (unsigned long long)sequence, address);
+    return 0;
+}
+
+static bool replication_resync_append(ReplicationResync *resync, const char *data, size_t length)
+{
+    if (resync->lineLength + length > resync->lineCapacity)
+    {
+        size_t capacity = resync->lineCapacity ? resync->lineCapacity : 256;
+        while (capacity < resync->lineLength + length)
+            capacity *= 2;
+        char *line = (char *)realloc(resync->line, capacity);
+        if (line == NULL)
+            return false;
+        resync->line = line;
+        resync->lineCapacity = capacity;
+    }
+    memcpy(resync->line + resync->lineLength, data, length);
+    resync->lineLength += length;
+    return true;
+}
+
+static void replication_resync_line(Directory *directory, ReplicationResync *resync, const char *line, const char *end)
+{
+    const Schema *schema = &directory->schema;
+    if (end > line && end[-1] == '\r')
+        end--;
+    // rows are counted as directory_load() counts them, skipping empty lines
+    if (end == line || resync->failed)
+        return;
+
+    // missing columns are empty
+    Field values[SCHEMA_MAX_ATTRIBUTES];
+    for (int attribute = 0; attribute < schema->attributeCount; attribute++)
+    {
+        values[attribute].value = end;
+        values[attribute].length = 0;
+    }
+    const char *position = line;
+    for (int column = 0; column < schema->csvColumns; column++)
+    {
+        const char *fieldEnd = (const char *)memchr(position, ';', end - position);
+        if (fieldEnd == NULL)
+            fieldEnd = end;
+        int attribute = resync->attributeOf[column];
+        if (attribute != -1)
+        {
+            values[attribute].value = position;
+            values[attribute].length = fieldEnd - position;
+        }
+        if (fieldEnd == end)
+            break;
+        position = fieldEnd + 1;
+    }
+
+    Field rdn = values[schema->rdn];
+    char *key = (char *)malloc(rdn.length + 1);
+    if (key == NULL)
+    {
+        resync->failed = true;
+        return;
+    }
+    Field rdnKey;
+    rdnKey.value = key;
+    rdnKey.length = directory_normalize(&schema->attributes[schema->rdn], rdn, key);
+    size_t row;
+    bool exists = directory_find_row(directory, schema->rdn, rdnKey, resync->scratch, &row);
+    free(key);
+
+    // only entries that differ take room in the overlay
+    bool same = exists;
+    for (int attribute = 0; attribute < schema->attributeCount && same; attribute++)
+    {
+        Field value = directory_value(directory, row, attribute, resync->scratch);
+        same = value.length == values[attribute].length && memcmp(value.value, values[attribute].value, value.length) == 0;
+    }
+    if (!same)
+    {
+        if (!exists)
+            row = directory_row_count(directory);
+        if (overlay_put(directory, row, values) == -1)
+        {
+            resync->failed = true;
+            return;
+        }
+        resync->written++;
+    }
+    resync->seen[row / 64] |= 1ULL << (row % 64);
+}
+
+static void replication_resync_abort(ReplicationResync *resync)
+{
+    resync->active = false;
+    free(resync->seen);
+    resync->seen = NULL;
+}
+
+static void replication_resync_start(Directory *directory, ReplicationResync *resync, uint64_t sequence)
+{
+    replication_resync_abort(resync);
+    // rows are only ever added, so the bitmap covers every row the snapshot can name
+    size_t rows = directory->overlay->baseRows + OVERLAY_MAX_ADDED_ROWS;
+    resync->seen = (uint64_t *)calloc(rows / 64 + 1, sizeof(uint64_t));
+    if (resync->seen == NULL)
+    {
+        perror("calloc");
+        return;
+    }
+    resync->active = true;
+    resync->failed = false;
+    resync->sequence = sequence;
+    resync->lineLength = 0;
+    resync->written = 0;
+    resync->deleted = 0;
+}
+
+static void replication_resync_feed(Directory *directory, ReplicationResync *resync, const char *data, size_t length)
+{
+    const char *end = data + length;
+    overlay_lock(directory->overlay);
+    while (data < end)
+    {
+        const char *newline = (const char *)memchr(data, '\n', end - data);
+        if (newline == NULL)
+        {
+            if (!replication_resync_append(resync, data, end - data))
+                resync->failed = true;
+            break;
+        }
+        if (resync->lineLength == 0)
+        {
+            replication_resync_line(directory, resync, data, newline);
+        }
+        else if (replication_resync_append(resync, data, newline - data))
+        {
+            replication_resync_line(directory, resync, resync->line, resync->line + resync->lineLength);
+            resync->lineLength = 0;
+        }
+        else
+        {
+            resync->failed = true;
+        }
+        data = newline + 1;
+    }
+    overlay_unlock(directory->overlay);
+}
+
+static bool replication_resync_finish(Directory *directory, ReplicationResync *resync)
+{
+    overlay_lock(directory->overlay);
+    // the last line may lack a line ending
+    replication_resync_line(directory, resync, resync->line, resync->line + resync->lineLength);
+    resync->lineLength = 0;
+
+    // entries missing from the snapshot were deleted at the primary
+    for (size_t row = 0; row < directory_row_count(directory) && !resync->failed; row++)
+    {
+        if ((resync->seen[row / 64] & (1ULL << (row % 64))) != 0 || !directory_row_exists(directory, row))
+            continue;
+        if (overlay_delete(directory, row) == -1)
+            resync->failed = true;
+        else
+            resync->deleted++;
+    }
+    overlay_unlock(directory->overlay);
+
+    bool failed = resync->failed;
+    if (failed)
+        fprintf(stderr, "The snapshot of the primary could not be applied, the overlay is full\n");
+    else
+        debug(1, "Applied the snapshot of change %llu, %zu entries written and %zu deleted\n",
+              (unsigned long long)resync->sequence, resync->written, resync->deleted);
+    replication_resync_abort(resync);
+    return !failed;
+}
+
+static void replication_handle(Directory *directory, ReplicationResync *resync, const ReplicationFrame *frame, const unsigned char *payload)
+{
+    ReplicationState *state = replicationState;
+    uint64_t now = monitor_now();
+    __atomic_store_n(&state->lastContact, now, __ATOMIC_RELAXED);
+    __atomic_store_n(&state->connected, true, __ATOMIC_RELAXED);
+
+    switch (frame->type)
+    {
+    case REPLICATION_RESUME:
+        debug(1, "Resumed following the primary after change %llu\n", (unsigned long long)frame->sequence);
+        break;
+    case REPLICATION_SNAPSHOT:
+        replication_resync_start(directory, resync, frame->sequence);
+        break;
+    case REPLICATION_DATA:
+        if (resync->active)
+            replication_resync_feed(directory, resync, (const char *)payload, frame->length);
+        break;
+    case REPLICATION_SNAPSHOT_END:
+        if (!resync->active || frame->sequence != resync->sequence)
+            break;
+        replication_resync_finish(directory, resync);
+        // the sequences of another log are not comparable with the old ones
+        __atomic_store_n(&state->identity, frame->identity, __ATOMIC_RELAXED);
+        __atomic_store_n(&state->applied, frame->sequence, __ATOMIC_RELAXED);
+        __atomic_store_n(&state->primarySequence, frame->sequence, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&state->snapshots, 1, __ATOMIC_RELAXED);
+        break;
+    case REPLICATION_CHANGE:
+        overlay_lock(directory->overlay);
+        if (wal_apply(directory, payload, frame->length) == -1)
+            fprintf(stderr, "Change %llu of the primary could not be applied, the overlay is full or the record is damaged\n",
+                    (unsigned long long)frame->sequence);
+        overlay_unlock(directory->overlay);
+        __atomic_store_n(&state->applied, frame->sequence, __ATOMIC_RELAXED);
+        if (state->primarySequence < frame->sequence)
+            __atomic_store_n(&state->primarySequence, frame->sequence, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&state->changes, 1, __ATOMIC_RELAXED);
+        break;
+    case REPLICATION_HEARTBEAT:
+        __atomic_store_n(&state->primarySequence, frame->sequence, __ATOMIC_RELAXED);
+        break;
+    }
+
+    // the lag in time counts from the moment the replica heard of a change it does not have
+    if (state->applied >= state->primarySequence)
+        __atomic_store_n(&state->behindSince, 0, __ATOMIC_RELAXED);
+    else if (state->behindSince == 0)
+        __atomic_store_n(&state->behindSince, now, __ATOMIC_RELAXED);
+}
+
+static void *replication_receiver(void *arg)
+{
+    Directory *directory = (Directory *)arg;
+    const Schema *schema = &directory->schema;
+    replication_block_signals();
+
+    ReplicationResync resync;
+    memset(&resync, 0, sizeof(resync));
+    for (int column = 0; column < schema->csvColumns; column++)
+        resync.attributeOf[column] = -1;
+    int maxLength = 0;
+    for (int attribute = 0; attribute < schema->attributeCount; attribute++)
+    {
+        resync.attributeOf[schema->attributes[attribute].csvColumn] = attribute;
+        if (directory->columns[attribute].maxLength > maxLength)
+            maxLength = directory->columns[attribute].maxLength;
+    }
+    resync.scratch = (char *)malloc(maxLength + 1);
+
+    ReplicationFrame frame;
+    unsigned char *payload = NULL;
+    size_t capacity = 0;
+    while (1)
+    {
+        if (primarySocket == -1)
+        {
+            sleep(REPLICATION_RETRY);
+            primarySocket = replication_connect();
+            if (primarySocket != -1)
+                debug(1, "Reconnected to the primary %s\n", primaryAddress);
+            continue;
+        }
+        if (!replication_receive(primarySocket, &frame, &payload, &capacity))
+        {
+            fprintf(stderr, "Lost the primary %s, reconnecting\n", primaryAddress);
+            close(primarySocket);
+            primarySocket = -1;
+            __atomic_store_n(&replicationState->connected, false, __ATOMIC_RELAXED);
+            replication_resync_abort(&resync);
+            continue;
+        }
+        replication_handle(directory, &resync, &frame, payload);
+    }
+    return NULL;
+}
+
+int replication_follow(Directory *directory)
+{
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, replication_receiver, directory) != 0)
+    {
+        perror("Thread creation failed");
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+void replication_close(void)
+{
+    // the threads using the sockets only run in the accepting process
+    if (listenSocket != -1)
+    {
+        close(listenSocket);
+        listenSocket = -1;
+        for (int i = 0; i < REPLICATION_MAX_REPLICAS; i++)
+        {
+            if (replicaSockets[i] != -1)
+                close(replicaSockets[i]);
+            replicaSockets[i] = -1;
+        }
+    }
+    if (primarySocket != -1)
+    {
+        close(primarySocket);
+        primarySocket = -1;
+    }
+}
+
+int replication_monitor(const char **types, char values[][32])
+{
+    static const char *names[REPLICATION_MONITOR_FIELDS] = {"role",      "connected", "replicas",  "appliedSequence", "primarySequence",
+                                                            "lagChanges", "lagMs",     "snapshots", "changes"};
+    const ReplicationState *state = replicationState;
+    if (state == NULL)
+        return 0;
+
+    bool replica = state->role == REPLICATION_REPLICA;
+    bool connected = true;
+    uint64_t applied, primary, lag = 0;
+    if (replica)
+    {
+        connected = __atomic_load_n(&state->connected, __ATOMIC_RELAXED);
+        applied = __atomic_load_n(&state->applied, __ATOMIC_RELAXED);
+        primary = __atomic_load_n(&state->primarySequence, __ATOMIC_RELAXED);
+        uint64_t behindSince = __atomic_load_n(&state->behindSince, __ATOMIC_RELAXED);
+        uint64_t lastContact = __atomic_load_n(&state->lastContact, __ATOMIC_RELAXED);
+        // without the primary the replica may miss anything written since it last heard from it
+        uint64_t since = !connected ? lastContact : behindSince;
+        uint64_t now = monitor_now();
+        if (since != 0 && now > since)
+            lag = (now - since) / 1000000;
+    }
+    else
+    {
+        wal_identity(&applied);
+        primary = applied;
+    }
+
+    for (int i = 0; i < REPLICATION_MONITOR_FIELDS; i++)
+        types[i] = names[i];
+    snprintf(values[0], 32, "%s", replica ? "replica" : "primary");
+    snprintf(values[1], 32, "%s", connected ? "TRUE" : "FALSE");
+    snprintf(values[2], 32, "%d", __atomic_load_n(&state->replicas, __ATOMIC_RELAXED));
+    snprintf(values[3], 32, "%llu", (unsigned long long)applied);
+    snprintf(values[4], 32, "%llu", (unsigned long long)primary);
+    snprintf(values[5], 32, "%llu", (unsigned long long)(primary > applied ? primary - applied : 0));
+    snprintf(values[6], 32, "%llu", (unsigned long long)lag);
+    snprintf(values[7], 32, "%zu", __atomic_load_n(&state->snapshots, __ATOMIC_RELAXED));
+    snprintf(values[8], 32, "%zu", __atomic_load_n(&state->changes, __ATOMIC_RELAXED));
+    return REPLICATION_MONITOR_FIELDS;
+}
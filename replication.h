@@ -0,0 +1,128 @@
+/**
+ *
+ * @file replication.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _REPLICATION_H
+#define _REPLICATION_H
+
+#include <stdint.h>
+#include "directory.h"
+
+enum ReplicationConst
+{
+    REPLICATION_HEARTBEAT_INTERVAL = 1000, // milliseconds between heartbeats of a primary without changes
+    REPLICATION_TIMEOUT = 5,               // seconds without a frame after which the other side is given up
+    REPLICATION_RETRY = 1,                 // seconds between the attempts of a replica to reconnect
+    REPLICATION_FRAME_SIZE = 1 << 16,      // bytes of the database file sent in one frame of a snapshot
+    REPLICATION_MAX_FRAME = 1 << 28,       // the largest payload accepted in one frame
+    REPLICATION_MAX_REPLICAS = 16,         // replicas followed by one primary at once
+    REPLICATION_MONITOR_FIELDS = 9         // values of cn=replication,cn=monitor
+};
+
+enum ReplicationRole
+{
+    REPLICATION_NONE = 0,
+    REPLICATION_PRIMARY = 1,
+    REPLICATION_REPLICA = 2
+};
+
+enum ReplicationFrameType
+{
+    REPLICATION_HELLO = 1,        // replica: the attribute count, the log identity and the last applied change
+    REPLICATION_SNAPSHOT = 2,     // primary: a snapshot holding every change up to the sequence follows
+    REPLICATION_DATA = 3,         // primary: bytes of the database file of the snapshot
+    REPLICATION_SNAPSHOT_END = 4, // primary: the snapshot is complete
+    REPLICATION_RESUME = 5,       // primary: the changes after the sequence of the replica follow
+    REPLICATION_CHANGE = 6,       // primary: one record of the write-ahead log
+    REPLICATION_HEARTBEAT = 7     // primary: the sequence of the last change on disk
+};
+
+/**
+ * Structure representing the header of a frame of the replication stream.
+ *
+ * The header is followed by length bytes of payload. Integers are sent in the
+ * byte order of the host, as primary and replica share the log format.
+ */
+typedef struct
+{
+    uint32_t type;     /**< The ReplicationFrameType. */
+    uint32_t length;   /**< The number of payload bytes. */
+    uint64_t identity; /**< The identity of the log of the primary, see wal_identity(). */
+    uint64_t sequence; /**< The sequence of a change, its meaning depends on the type. */
+} ReplicationFrame;
+
+/**
+ * Start Primary.
+ *
+ * Listens for replicas on a TCP port, a host:port pair or a Unix socket path
+ * containing a slash. Every replica is served by a thread of the accepting process:
+ * a replica that knows the current log and whose changes are still in it gets the
+ * changes after its last one, any other one a snapshot of the database first.
+ * Requires an open write-ahead log. Has to be called before the first connection
+ * process is created.
+ *
+ * @param address   The address to listen on.
+ * @param directory A pointer to the directory.
+ *
+ * @return 0 on success, -1 if the address could not be bound.
+ */
+int replication_listen(const char *address, Directory *directory);
+
+/**
+ * Fetch Snapshot From Primary.
+ *
+ * Connects to the primary and writes its snapshot to the database file, replacing it,
+ * so it can be loaded as usual. The connection is kept for replication_follow().
+ *
+ * @param address        The address of the primary, as given to replication_listen().
+ * @param path           The path to the database file.
+ * @param attributeCount The number of attributes of the schema, which has to match the primary.
+ *
+ * @return 0 on success, -1 if the primary could not be reached or refused the replica.
+ */
+int replication_fetch(const char *address, const char *path, int attributeCount);
+
+/**
+ * Follow Primary.
+ *
+ * Starts the thread applying the changes of the primary to the overlay of the directory
+ * loaded from the fetched snapshot. A lost primary is reconnected; a snapshot sent again
+ * is compared with the directory and only the differing entries are written.
+ * Has to be called before the first connection process is created.
+ *
+ * @param directory A pointer to the directory with an overlay.
+ *
+ * @return 0 on success, -1 if the thread could not be started.
+ */
+int replication_follow(Directory *directory);
+
+/**
+ * Close Inherited Replication Sockets.
+ *
+ * Closes the sockets of the accepting process in a connection process, so a closed
+ * replication connection is not kept open by its children.
+ */
+void replication_close(void);
+
+/**
+ * Get Replication Status.
+ *
+ * Fills the values of cn=replication,cn=monitor: the role, the connection, the
+ * followed sequences and the lag of a replica behind its primary in changes and
+ * in milliseconds since it last was up to date.
+ *
+ * @param types  An array of REPLICATION_MONITOR_FIELDS receiving the value names.
+ * @param values An array of REPLICATION_MONITOR_FIELDS receiving the values.
+ *
+ * @return The number of values, 0 if the server neither is a primary nor a replica.
+ */
+int replication_monitor(const char **types, char values[][32]);
+
+#endif
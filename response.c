@@ -0,0 +1,95 @@
+/**
+ *
+ * @file response.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "utils.h"
+#include "bind.h"
+#include "compare.h"
+#include "update.h"
+#include "ldap.h"
+#include "response.h"
+
+/**
+ * Structure representing the encoded protocol operation of a fixed response.
+ */
+typedef struct
+{
+    int length;                                  /**< The number of encoded bytes. */
+    unsigned char bytes[RESPONSE_TEMPLATE_SIZE]; /**< The protocol operation, from its tag on. */
+} ResponseTemplate;
+
+static ResponseTemplate templates[RESPONSE_KIND_COUNT][RESPONSE_RESULT_CODES];
+
+void response_init(void)
+{
+    unsigned char buff[MAX_BUFFER_SIZE];
+    for (int kind = 0; kind < RESPONSE_KIND_COUNT; kind++)
+    {
+        for (int resultCode = 0; resultCode < RESPONSE_RESULT_CODES; resultCode++)
+        {
+            // the templates are made by the same encoders as responses with variable parts
+            int offset = 0;
+            switch (kind)
+            {
+            case RESPONSE_BIND:
+                ldap_bind_response_encode(buff, &offset, resultCode);
+                break;
+            case RESPONSE_SEARCH_DONE:
+                ldap_search_res_done_encode(buff, &offset, resultCode, NULL);
+                break;
+            case RESPONSE_COMPARE:
+                ldap_compare_response_encode(buff, &offset, resultCode);
+                break;
+            case RESPONSE_ADD:
+                ldap_update_response_encode(buff, &offset, LDAP_ADD_RESPONSE, resultCode);
+                break;
+            case RESPONSE_DELETE:
+                ldap_update_response_encode(buff, &offset, LDAP_DELETE_RESPONSE, resultCode);
+                break;
+            case RESPONSE_MODIFY:
+                ldap_update_response_encode(buff, &offset, LDAP_MODIFY_RESPONSE, resultCode);
+                break;
+            default:
+                ldap_notice_of_disconnection_encode(buff, &offset);
+                break;
+            }
+            if (offset > RESPONSE_TEMPLATE_SIZE)
+            {
+                fprintf(stderr, "Response template %d/%d needs %d bytes\n", kind, resultCode, offset);
+                exit(EXIT_FAILURE);
+            }
+            memcpy(templates[kind][resultCode].bytes, buff, offset);
+            templates[kind][resultCode].length = offset;
+        }
+    }
+}
+
+void response_append(unsigned char *buff, int *offset, int kind, int resultCode)
+{
+    if (resultCode < 0 || resultCode >= RESPONSE_RESULT_CODES)
+        resultCode = UNWILLING_TO_PERFORM;
+    const ResponseTemplate *template = &templates[kind][resultCode];
+    memcpy(buff + *offset, template->bytes, template->length);
+    *offset += template->length;
+    set_ldap_length(buff, offset, LDAP_MSG_LENGTH_OFFSET);
+}
+
+void response_send(int kind, int resultCode, int messageId, int clientSocket)
+{
+    int offset = 0;
+    unsigned char buff[RESPONSE_MESSAGE_SIZE];
+    create_ldap_header(buff, &offset, messageId);
+    response_append(buff, &offset, kind, resultCode);
+    ldap_send(buff, clientSocket, offset);
+}
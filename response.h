@@ -0,0 +1,68 @@
+/**
+ *
+ * @file response.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _RESPONSE_H
+#define _RESPONSE_H
+
+enum ResponseConst
+{
+    RESPONSE_RESULT_CODES = 81,                         // result codes with a template up to other, larger ones use unwillingToPerform
+    RESPONSE_TEMPLATE_SIZE = 96,                        // the longest encoded protocol operation
+    RESPONSE_MESSAGE_SIZE = RESPONSE_TEMPLATE_SIZE + 8  // the template with the message header
+};
+
+enum ResponseKind
+{
+    RESPONSE_BIND,
+    RESPONSE_SEARCH_DONE,
+    RESPONSE_COMPARE,
+    RESPONSE_ADD,
+    RESPONSE_DELETE,
+    RESPONSE_MODIFY,
+    RESPONSE_NOTICE, // notice of disconnection, the result code is ignored
+    RESPONSE_KIND_COUNT
+};
+
+/**
+ * Initialize Response Templates.
+ *
+ * Encodes the protocol operation of every fixed response for every result code once,
+ * so a response only needs its message header. Has to be called before the first
+ * connection is served.
+ */
+void response_init(void);
+
+/**
+ * Append Response Template.
+ *
+ * Copies the template after the message header created by create_ldap_header()
+ * and sets the length of the message.
+ *
+ * @param buff       A pointer to the buffer holding the message header.
+ * @param offset     A pointer to the end of the message header, moved past the response.
+ * @param kind       The ResponseKind.
+ * @param resultCode The result code of the response.
+ */
+void response_append(unsigned char *buff, int *offset, int kind, int resultCode);
+
+/**
+ * Send Response Template.
+ *
+ * Encodes the message header with the message id in front of the template and sends it.
+ *
+ * @param kind          The ResponseKind.
+ * @param resultCode    The result code of the response.
+ * @param messageId     The message id of the request.
+ * @param clientSocket  The socket of the client.
+ */
+void response_send(int kind, int resultCode, int messageId, int clientSocket);
+
+#endif
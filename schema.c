@@ -0,0 +1,223 @@
+/**
+ *
+ * @file schema.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "schema.h"
+
+static void add_attribute(Schema *schema, const char *name, int csvColumn, const char *alias)
+{
+    Attribute *attribute = &schema->attributes[schema->attributeCount++];
+    memset(attribute, 0, sizeof(Attribute));
+    strcpy(attribute->name, name);
+    attribute->csvColumn = csvColumn;
+    attribute->rule = CASE_IGNORE_MATCH;
+    attribute->indexed = true;
+    if (alias != NULL)
+        strcpy(attribute->aliases[attribute->aliasCount++], alias);
+}
+
+void schema_default(Schema *schema)
+{
+    memset(schema, 0, sizeof(Schema));
+    add_attribute(schema, "cn", 0, "commonname");
+    add_attribute(schema, "uid", 1, "userid");
+    add_attribute(schema, "mail", 2, NULL);
+    schema->rdn = 1;
+    schema->password = -1;
+    schema->csvColumns = 3;
+}
+
+static bool is_valid_name(const char *name)
+{
+    size_t length = strlen(name);
+    if (length == 0 || length >= SCHEMA_NAME_SIZE || !isalpha((unsigned char)name[0]))
+        return false;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (!isalnum((unsigned char)name[i]) && name[i] != '-')
+            return false;
+    }
+    return true;
+}
+
+static bool is_column_declared(const Schema *schema, int csvColumn)
+{
+    for (int i = 0; i < schema->attributeCount; i++)
+    {
+        if (schema->attributes[i].csvColumn == csvColumn)
+            return true;
+    }
+    return false;
+}
+
+static int parse_option(Attribute *attribute, char *option, bool *rdn)
+{
+    char *value = strchr(option, '=');
+    if (value != NULL)
+        *value++ = '\0';
+
+    if (strcmp(option, "index") == 0 && value == NULL)
+    {
+        attribute->indexed = true;
+    }
+    else if (strcmp(option, "rdn") == 0 && value == NULL)
+    {
+        *rdn = true;
+    }
+    else if (strcmp(option, "password") == 0 && value == NULL)
+    {
+        attribute->password = true;
+    }
+    else if (strcmp(option, "match") == 0 && value != NULL)
+    {
+        if (strcasecmp(value, "caseIgnore") == 0 || strcasecmp(value, "caseIgnoreMatch") == 0)
+            attribute->rule = CASE_IGNORE_MATCH;
+        else if (strcasecmp(value, "caseExact") == 0 || strcasecmp(value, "caseExactMatch") == 0)
+            attribute->rule = CASE_EXACT_MATCH;
+        else
+            return -1;
+    }
+    else if (strcmp(option, "multi") == 0 && value != NULL)
+    {
+        // the separator has to survive normalization unchanged
+        if (strlen(value) != 1 || isalnum((unsigned char)value[0]) || isspace((unsigned char)value[0]) || value[0] == ';')
+            return -1;
+        attribute->separator = value[0];
+    }
+    else if (strcmp(option, "alias") == 0 && value != NULL)
+    {
+        char *save;
+        for (char *alias = strtok_r(value, ",", &save); alias != NULL; alias = strtok_r(NULL, ",", &save))
+        {
+            if (attribute->aliasCount == SCHEMA_MAX_ALIASES || !is_valid_name(alias))
+                return -1;
+            strcpy(attribute->aliases[attribute->aliasCount++], alias);
+        }
+    }
+    else
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int schema_load(Schema *schema, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open schema %s\n", path);
+        return -1;
+    }
+
+    memset(schema, 0, sizeof(Schema));
+    schema->rdn = -1;
+    schema->password = -1;
+    char line[SCHEMA_LINE_SIZE];
+    int lineNumber = 0;
+    int result = 0;
+
+    while (result == 0 && fgets(line, sizeof(line), file) != NULL)
+    {
+        lineNumber++;
+        char *save;
+        char *name = strtok_r(line, " \t\r\n", &save);
+        if (name == NULL || name[0] == '#')
+            continue;
+
+        char *column = strtok_r(NULL, " \t\r\n", &save);
+        char *end = NULL;
+        long csvColumn = column != NULL ? strtol(column, &end, 10) : -1;
+        if (!is_valid_name(name) || column == NULL || *end != '\0' || csvColumn < 0 || csvColumn >= SCHEMA_LINE_SIZE ||
+            schema_find(schema, name) != -1 || is_column_declared(schema, (int)csvColumn) ||
+            schema->attributeCount == SCHEMA_MAX_ATTRIBUTES)
+        {
+            result = -1;
+            break;
+        }
+
+        Attribute *attribute = &schema->attributes[schema->attributeCount];
+        memset(attribute, 0, sizeof(Attribute));
+        strcpy(attribute->name, name);
+        attribute->csvColumn = (int)csvColumn;
+        attribute->rule = CASE_IGNORE_MATCH;
+
+        bool rdn = false;
+        for (char *option = strtok_r(NULL, " \t\r\n", &save); option != NULL && result == 0; option = strtok_r(NULL, " \t\r\n", &save))
+            result = parse_option(attribute, option, &rdn);
+        if (rdn)
+        {
+            // the dn has exactly one value
+            if (schema->rdn != -1 || attribute->separator != 0)
+                result = -1;
+            schema->rdn = schema->attributeCount;
+        }
+        if (attribute->password)
+        {
+            // the hashes are neither indexed nor names of entries
+            if (schema->password != -1 || rdn || attribute->indexed)
+                result = -1;
+            schema->password = schema->attributeCount;
+        }
+        for (int i = 0; i < attribute->aliasCount && result == 0; i++)
+        {
+            if (schema_find(schema, attribute->aliases[i]) != -1)
+                result = -1;
+        }
+
+        schema->attributeCount++;
+        if (attribute->csvColumn + 1 > schema->csvColumns)
+            schema->csvColumns = attribute->csvColumn + 1;
+    }
+    fclose(file);
+
+    if (result == -1)
+    {
+        fprintf(stderr, "Invalid schema %s on line %d\n", path, lineNumber);
+        return -1;
+    }
+    if (schema->attributeCount == 0)
+    {
+        fprintf(stderr, "Schema %s declares no attributes\n", path);
+        return -1;
+    }
+    if (schema->rdn == -1)
+    {
+        if (schema->attributes[0].separator != 0 || schema->attributes[0].password)
+        {
+            fprintf(stderr, "Schema %s needs a single-valued rdn attribute\n", path);
+            return -1;
+        }
+        schema->rdn = 0;
+    }
+    return 0;
+}
+
+int schema_find(const Schema *schema, const char *name)
+{
+    for (int i = 0; i < schema->attributeCount; i++)
+    {
+        const Attribute *attribute = &schema->attributes[i];
+        if (strcasecmp(attribute->name, name) == 0)
+            return i;
+        for (int j = 0; j < attribute->aliasCount; j++)
+        {
+            if (strcasecmp(attribute->aliases[j], name) == 0)
+                return i;
+        }
+    }
+    return -1;
+}
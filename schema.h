@@ -0,0 +1,101 @@
+/**
+ *
+ * @file schema.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _SCHEMA_H
+#define _SCHEMA_H
+
+#include <stdbool.h>
+
+enum SchemaConst
+{
+    SCHEMA_MAX_ATTRIBUTES = 32,
+    SCHEMA_MAX_ALIASES = 4,
+    SCHEMA_NAME_SIZE = 64,
+    SCHEMA_LINE_SIZE = 512
+};
+
+enum MatchingRule
+{
+    CASE_IGNORE_MATCH = 0,
+    CASE_EXACT_MATCH = 1
+};
+
+/**
+ * Structure representing one attribute declared by the schema.
+ */
+typedef struct
+{
+    char name[SCHEMA_NAME_SIZE];                        /**< The attribute name returned to clients. */
+    char aliases[SCHEMA_MAX_ALIASES][SCHEMA_NAME_SIZE]; /**< Other names accepted in filters. */
+    int aliasCount;                                     /**< The number of aliases. */
+    int csvColumn;                                      /**< The column of the database file holding the attribute. */
+    enum MatchingRule rule;                             /**< The matching rule of the attribute. */
+    bool indexed;                                       /**< Flag indicating whether the Bloom filter and equality index are built. */
+    char separator;                                     /**< The separator of multiple values in one field or 0 for single-valued attributes. */
+    bool password;                                      /**< Flag indicating whether the attribute holds password hashes, never returned or matched. */
+} Attribute;
+
+/**
+ * Structure representing the mapping of database file columns to LDAP attributes.
+ */
+typedef struct
+{
+    Attribute attributes[SCHEMA_MAX_ATTRIBUTES]; /**< The declared attributes. */
+    int attributeCount;                          /**< The number of declared attributes. */
+    int rdn;                                     /**< The attribute whose value forms the dn of an entry. */
+    int password;                                /**< The attribute holding the password hashes of simple binds or -1. */
+    int csvColumns;                              /**< The number of database file columns read, the highest declared column plus one. */
+} Schema;
+
+/**
+ * Default Schema.
+ *
+ * Fills the schema of the original database file format: cn, uid and mail in
+ * columns 0, 1 and 2, all matched case insensitively and indexed, with uid as the dn
+ * and no password attribute.
+ *
+ * @param schema A pointer to the schema to fill.
+ */
+void schema_default(Schema *schema);
+
+/**
+ * Load Schema.
+ *
+ * Reads a schema file with one attribute per line in the form
+ * "<name> <column> [alias=<name>[,<name>...]] [match=caseIgnore|caseExact] [index] [multi=<char>] [rdn] [password]".
+ * Every column is mapped to at most one attribute and columns that are not declared are skipped.
+ * The first attribute forms the dn unless another one is marked rdn. Only indexed attributes
+ * get a Bloom filter and an equality index, the others are matched by scanning.
+ * At most one attribute may be marked password, its values are the password hashes
+ * simple binds are verified against and it is never returned, compared or matched.
+ * Empty lines and lines starting with '#' are ignored. Errors are reported to stderr.
+ *
+ * @param schema A pointer to the schema to fill.
+ * @param path   The path to the schema file.
+ *
+ * @return 0 on success, -1 if the file could not be read or is not valid.
+ */
+int schema_load(Schema *schema, const char *path);
+
+/**
+ * Find Attribute.
+ *
+ * Looks up the attribute by its name or one of its aliases, ignoring the letter case.
+ * The password attribute is found too, so callers exposing values have to skip it.
+ *
+ * @param schema A pointer to the schema.
+ * @param name   The attribute description from a request.
+ *
+ * @return The index of the attribute or -1 if it is not declared.
+ */
+int schema_find(const Schema *schema, const char *name);
+
+#endif
@@ -9,20 +9,35 @@
  *
  *
  */
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <ctype.h>
+#include "directory.h"
 #include "ldap.h"
 #include "utils.h"
 #include "search.h"
+#include "arena.h"
+#include "normalize.h"
+#include "hash.h"
+#include "stats.h"
+#include "cache.h"
+#include "flight.h"
+#include "output.h"
+#include "trace.h"
+#include "monitor.h"
+#include "profile.h"
+#include "slowlog.h"
+#include "schema.h"
+#include "response.h"
 
-extern int currentTagPosition;
-LdapSearch ldap_search(unsigned char *data, int messageId)
+extern __thread int currentTagPosition;
+
+LdapSearch ldap_search(unsigned char *data, int messageId, const Schema *schema)
 {
-    debug(1, "****SEARCH REQUEST****\n");
     LdapSearch search;
     search.returnCode = SUCCESS;
     search.messageId = messageId;
@@ -32,33 +47,359 @@ LdapSearch ldap_search(unsigned char *data, int messageId)
     search.sizeLimit = get_int_value(data);
     search.timeLimit = get_int_value(data);
     search.typesOnly = get_int_value(data);
+    int stage = profile_switch(PROFILE_FILTER);
     search.filter = get_ldap_filter(data, &search);
+    search.targetColumn = -1;
+    search.queryKey = NULL;
+    search.queryKeyLength = 0;
+    search.explain = false;
+
+    if (search.returnCode == SUCCESS)
+    {
+        search.targetColumn = get_targeted_column(schema, search.filter);
+        if (search.targetColumn != -1)
+            normalize_filter(&search.filter, &schema->attributes[search.targetColumn]);
+
+        char *key = (char *)arena_alloc(requestArena, CACHE_KEY_SIZE);
+        int keyLength = -1;
+        if (search.targetColumn != -1)
+            keyLength = canonical_filter(search.filter, schema->attributes[search.targetColumn].name, key, CACHE_KEY_SIZE);
+        if (keyLength != -1)
+        {
+            int length = snprintf(key + keyLength, CACHE_KEY_SIZE - keyLength, "#%d", search.sizeLimit);
+            if (keyLength + length < CACHE_KEY_SIZE)
+            {
+                search.queryKey = key;
+                search.queryKeyLength = keyLength + length;
+            }
+        }
+    }
+    profile_switch(stage);
     return search;
 }
 
-void ldap_search_response(LdapSearch search, int clientSocket, FILE *file)
+static int search_filter_histogram(const LdapFilter *filter)
 {
-     debug(1, "****SEARCH RESPONSE****\n");
-    int offset = 0;
-    unsigned char buff[MAX_BUFFER_SIZE];
-    memset(buff, 0, MAX_BUFFER_SIZE); // clear the buffer
+    if (filter->filterType == EQUALITY_MATCH_FILTER)
+        return MONITOR_FILTER_EQUALITY;
+    if (filter->filterType != SUBSTRING_FILTER)
+        return MONITOR_FILTER_OTHER;
+    switch (filter->substringType)
+    {
+    case PREFIX:
+        return MONITOR_FILTER_PREFIX;
+    case POSTFIX:
+        return MONITOR_FILTER_SUFFIX;
+    default:
+        return MONITOR_FILTER_INFIX;
+    }
+}
 
-    create_ldap_header(buff, &offset, search.messageId);
-    if (search.returnCode != SUCCESS)
+static void search_cursor_record(SearchCursor *cursor)
+{
+    static const int pathHistograms[] = {
+        [SEARCH_SOURCE_SCAN] = MONITOR_PATH_SCAN,
+        [SEARCH_SOURCE_INDEX] = MONITOR_PATH_INDEX,
+        [SEARCH_SOURCE_CACHE] = MONITOR_PATH_CACHE,
+        [SEARCH_SOURCE_COALESCED] = MONITOR_PATH_COALESCED,
+        [SEARCH_SOURCE_BLOOM] = MONITOR_PATH_BLOOM,
+        [SEARCH_SOURCE_NONE] = MONITOR_PATH_NONE,
+    };
+    uint64_t elapsed = monitor_now() - cursor->startTime;
+    monitor_record(MONITOR_SEARCH, elapsed);
+    monitor_record(search_filter_histogram(&cursor->search.filter), elapsed);
+    monitor_record(pathHistograms[cursor->source], elapsed);
+    if (cursor->source != SEARCH_SOURCE_COALESCED)
+        monitor_record(MONITOR_ENTRIES, cursor->source == SEARCH_SOURCE_CACHE ? cursor->cachedRowCount : cursor->numberOfEntries);
+
+    if (slowlog_enabled() && elapsed >= slowLogThreshold)
     {
-        ldap_search_res_done(buff, &offset, search.returnCode, clientSocket);
+        char plan[SLOW_LOG_PLAN_SIZE];
+        search_cursor_explain(cursor, elapsed, plan, sizeof(plan));
+        slowlog_submit(cursor->search.messageId, plan);
+    }
+}
+
+void search_cursor_explain(const SearchCursor *cursor, uint64_t elapsed, char *out, int size)
+{
+    static const char *sourceNames[] = {
+        [SEARCH_SOURCE_SCAN] = "scan",
+        [SEARCH_SOURCE_INDEX] = "index",
+        [SEARCH_SOURCE_CACHE] = "cache",
+        [SEARCH_SOURCE_COALESCED] = "coalesced",
+        [SEARCH_SOURCE_BLOOM] = "bloom",
+        [SEARCH_SOURCE_NONE] = "none",
+    };
+    const LdapSearch *search = &cursor->search;
+    char filter[CACHE_KEY_SIZE] = "-";
+    if (search->targetColumn != -1 &&
+        canonical_filter(search->filter, cursor->directory->schema.attributes[search->targetColumn].name, filter, sizeof(filter)) == -1)
+        strcpy(filter, "(...)");
+
+    snprintf(out, size, "filter=%s sizeLimit=%d path=%s examined=%zu returned=%d bytes=%zu elapsed=%.3fms result=%d",
+             filter, search->sizeLimit, sourceNames[cursor->source], cursor->examinedRows,
+             cursor->source == SEARCH_SOURCE_CACHE ? cursor->cachedRowCount : cursor->numberOfEntries,
+             cursor->sentBytes, elapsed / 1e6, search->returnCode);
+}
+
+static int search_cursor_send(SearchCursor *cursor, size_t row)
+{
+    int stage = profile_switch(PROFILE_ENCODE);
+    int length;
+    // timing every entry would cost more than encoding a short one, so only a sample is timed
+    if (cursor->sentEntries++ % MONITOR_ENCODE_SAMPLE != 0)
+    {
+        length = ldap_send_search_res_entry(cursor->header, &cursor->headerLength, cursor->directory, row, cursor->clientSocket);
+    }
+    else
+    {
+        uint64_t start = monitor_now();
+        length = ldap_send_search_res_entry(cursor->header, &cursor->headerLength, cursor->directory, row, cursor->clientSocket);
+        monitor_record(MONITOR_ENCODE, monitor_now() - start);
+    }
+    cursor->sentBytes += length;
+    profile_switch(stage);
+    return length;
+}
+
+static void search_cursor_finish(SearchCursor *cursor)
+{
+    LdapSearch *search = &cursor->search;
+    if (cursor->source == SEARCH_SOURCE_CACHE)
+    {
+        stats_add(&stats->cacheBytesServed, cursor->cachedBytes);
     }
     else
     {
-        ldap_send_search_res_entrys(buff, &offset, &search, file, clientSocket);
-        offset = 0;
-        memset(buff, 0, MAX_BUFFER_SIZE); // clear the buffer
-        create_ldap_header(buff, &offset, search.messageId);
-        ldap_search_res_done(buff, &offset, search.returnCode, clientSocket);
+        if (cursor->bloomChecked && cursor->numberOfEntries == 0)
+            stats_add(&stats->bloomFalsePositives, 1);
+        if (cursor->rows != NULL)
+            cache_store(search->queryKey, search->queryKeyLength, cursor->version, cursor->rows, cursor->numberOfEntries, search->returnCode);
+    }
+
+    trace(TRACE_INFO, TRACE_SEARCH_DONE, search->messageId,
+          cursor->source == SEARCH_SOURCE_CACHE ? cursor->cachedRowCount : cursor->numberOfEntries, search->returnCode);
+    // the plan is complete except for the result done message itself
+    char *plan = NULL;
+    if (search->explain)
+    {
+        plan = (char *)arena_alloc(requestArena, SLOW_LOG_PLAN_SIZE);
+        search_cursor_explain(cursor, monitor_now() - cursor->startTime, plan, SLOW_LOG_PLAN_SIZE);
+    }
+
+    int offset = cursor->headerLength;
+    int stage = profile_switch(PROFILE_ENCODE);
+    ldap_search_res_done(cursor->header, &offset, search->returnCode, plan, cursor->clientSocket);
+    profile_switch(stage);
+    if (cursor->flight != NULL)
+    {
+        responseCapture = NULL;
+        flight_finish(cursor->flight);
+        cursor->flight = NULL;
+    }
+    cursor->state = SEARCH_DONE;
+    search_cursor_record(cursor);
+}
+
+static void search_cursor_plan(SearchCursor *cursor)
+{
+    LdapSearch *search = &cursor->search;
+    Directory *directory = cursor->directory;
+    int targetColumn = search->targetColumn;
+    // writes that come later may or may not be seen by the search
+    cursor->version = directory_version(directory);
+    cursor->rowCount = directory_row_count(directory);
+
+    if (targetColumn == -1)
+    {
+        cursor->source = SEARCH_SOURCE_NONE;
+        search_cursor_finish(cursor);
+        return;
+    }
+
+    if (search->filter.filterType == EQUALITY_MATCH_FILTER && directory->schema.attributes[targetColumn].indexed)
+    {
+        // most equality misses end here without touching the columns
+        uint64_t hash = hash_bytes(search->filter.attributeValue, search->filter.attributeValueLength);
+        stats_add(&stats->bloomChecks, 1);
+        if (!directory_may_contain(directory, targetColumn, hash))
+        {
+            stats_add(&stats->bloomNegatives, 1);
+            cursor->source = SEARCH_SOURCE_BLOOM;
+            search_cursor_finish(cursor);
+            return;
+        }
+        cursor->bloomChecked = true;
+    }
+
+    // the result of the same query with the same size limit is taken from the cache
+    if (cache_enabled() && search->queryKey != NULL)
+    {
+        cursor->rows = (uint32_t *)arena_alloc(requestArena, CACHE_SLOT_ROWS * sizeof(uint32_t));
+
+        int resultCode;
+        if (cache_lookup(search->queryKey, search->queryKeyLength, cursor->version, cursor->rows, &cursor->cachedRowCount, &resultCode))
+        {
+            search->returnCode = resultCode;
+            cursor->source = SEARCH_SOURCE_CACHE;
+            return;
+        }
+    }
+
+    // equality searches of indexed attributes only visit the rows in the bucket of the value
+    cursor->source = SEARCH_SOURCE_SCAN;
+    if (search->filter.filterType == EQUALITY_MATCH_FILTER)
+    {
+        Field key = {search->filter.attributeValue, search->filter.attributeValueLength};
+        if (directory_index_lookup(directory, targetColumn, key, &cursor->cursor))
+            cursor->source = SEARCH_SOURCE_INDEX;
+    }
+    else if (search->filter.filterType == SUBSTRING_FILTER && search->filter.attributeValueLength > 0 &&
+             (search->filter.substringType == PREFIX || search->filter.substringType == ANY_CENTER))
+    {
+        // a disk index also serves the rows whose keys start with the initial string
+        Field prefix = {search->filter.attributeValue, search->filter.attributeValueLength};
+        if (directory_prefix_lookup(directory, targetColumn, prefix, &cursor->cursor))
+            cursor->source = SEARCH_SOURCE_INDEX;
+    }
+    cursor->scratch = (char *)arena_alloc(requestArena, directory->columns[targetColumn].maxLength + 1);
+}
+
+void search_cursor_begin(SearchCursor *cursor, LdapSearch search, Directory *directory, int clientSocket)
+{
+    memset(cursor, 0, sizeof(SearchCursor));
+    cursor->search = search;
+    cursor->directory = directory;
+    cursor->clientSocket = clientSocket;
+    cursor->previousRow = SIZE_MAX;
+    cursor->state = SEARCH_RUNNING;
+    cursor->startTime = monitor_now();
+    cursor->header = (unsigned char *)arena_alloc(requestArena, MAX_BUFFER_SIZE);
+    create_ldap_header(cursor->header, &cursor->headerLength, search.messageId);
+
+    if (search.returnCode != SUCCESS)
+    {
+        cursor->source = SEARCH_SOURCE_NONE;
+        search_cursor_finish(cursor);
+        return;
+    }
+
+    // identical searches running at the same time are answered by one of them
+    // an explained search needs a plan of its own
+    if (flight_enabled() && search.queryKey != NULL && !search.explain)
+    {
+        bool leader = true;
+        cursor->flight = flight_begin(search.queryKey, search.queryKeyLength, &leader);
+        if (!leader)
+        {
+            cursor->state = SEARCH_FOLLOWING;
+            cursor->source = SEARCH_SOURCE_COALESCED;
+            return;
+        }
+    }
+
+    responseCapture = cursor->flight != NULL ? &cursor->flight->result : NULL;
+    search_cursor_plan(cursor);
+    responseCapture = NULL;
+}
+
+bool search_cursor_waiting(SearchCursor *cursor)
+{
+    return cursor->state == SEARCH_FOLLOWING && !flight_ready(cursor->flight);
+}
+
+bool search_cursor_step(SearchCursor *cursor, int budget, size_t outputBudget)
+{
+    LdapSearch *search = &cursor->search;
+    Directory *directory = cursor->directory;
+
+    if (cursor->state == SEARCH_FOLLOWING)
+    {
+        if (!flight_ready(cursor->flight))
+            return false;
+        cursor->sentBytes = cursor->flight->result.length;
+        bool followed = flight_follow(cursor->flight, search->messageId, cursor->clientSocket);
+        cursor->flight = NULL;
+        cursor->state = followed ? SEARCH_DONE : SEARCH_RUNNING;
+        if (followed)
+        {
+            search_cursor_record(cursor);
+            return true;
+        }
+        // the leader was abandoned, the search runs on its own
+        search_cursor_plan(cursor);
+    }
+
+    responseCapture = cursor->flight != NULL ? &cursor->flight->result : NULL;
+    size_t queuedBefore = outputQueue != NULL ? output_queue_pending(outputQueue) : 0;
+    for (int visited = 0; cursor->state == SEARCH_RUNNING && visited < budget; visited++)
+    {
+        // the cursor is suspended here once it used its share or until the client reads what was already produced
+        if (outputQueue != NULL &&
+            (output_queue_full(outputQueue) || output_queue_pending(outputQueue) - queuedBefore >= outputBudget))
+            break;
+        size_t i;
+        if (cursor->source == SEARCH_SOURCE_CACHE)
+        {
+            if (cursor->row == (size_t)cursor->cachedRowCount)
+            {
+                search_cursor_finish(cursor);
+                break;
+            }
+            i = cursor->rows[cursor->row++];
+            cursor->cachedBytes += search_cursor_send(cursor, i);
+            continue;
+        }
+
+        if (cursor->source == SEARCH_SOURCE_INDEX ? !index_cursor_next(&cursor->cursor, &i) : cursor->row >= cursor->rowCount)
+        {
+            search_cursor_finish(cursor);
+            break;
+        }
+        if (cursor->source == SEARCH_SOURCE_SCAN)
+            i = cursor->row++;
+
+        // a row with the same value twice is chained twice
+        if (i == cursor->previousRow)
+            continue;
+        cursor->previousRow = i;
+        if (!directory_row_exists(directory, i))
+            continue;
+        cursor->examinedRows++;
+
+        if (is_row_matching(search->filter, directory, i, search->targetColumn, cursor->scratch))
+        {
+            if (search->sizeLimit != 0 && cursor->numberOfEntries == search->sizeLimit)
+            {
+                search->returnCode = SIZE_LIMIT_EXCEEDED;
+                search_cursor_finish(cursor);
+                break;
+            }
+            if (cursor->rows != NULL && cursor->numberOfEntries < CACHE_SLOT_ROWS)
+                cursor->rows[cursor->numberOfEntries] = i;
+            cursor->numberOfEntries++;
+            search_cursor_send(cursor, i);
+        }
     }
+    responseCapture = NULL;
+    trace(TRACE_DEBUG, TRACE_SEARCH_STEP, search->messageId, cursor->row, cursor->numberOfEntries);
+    return cursor->state == SEARCH_DONE;
 }
 
-void ldap_search_res_done(unsigned char *buff, int *offset, int returnCode, int clientSocket)
+void search_cursor_abandon(SearchCursor *cursor)
+{
+    if (cursor->flight != NULL)
+    {
+        if (cursor->state == SEARCH_FOLLOWING)
+            flight_leave(cursor->flight);
+        else
+            flight_abandon(cursor->flight);
+        cursor->flight = NULL;
+    }
+    cursor->state = SEARCH_DONE;
+}
+
+void ldap_search_res_done_encode(unsigned char *buff, int *offset, int returnCode, const char *message)
 {
     add_ldap_byte(buff, offset, LDAP_SEARCH_RESULT_DONE);
     int resultLengthOffset = (*offset);
@@ -66,34 +407,56 @@ void ldap_search_res_done(unsigned char *buff, int *offset, int returnCode, int
     add_ldap_byte(buff, offset, ENUMERATED_TYPE);
     add_ldap_byte(buff, offset, 0x01);
 
+    const char *defaultMessage;
     switch (returnCode)
     {
     case SUCCESS:
         add_ldap_byte(buff, offset, SUCCESS);
-        add_ldap_string(buff, offset, "");
-        add_ldap_string(buff, offset, "");
+        defaultMessage = "";
         break;
     case UNSUPORTED_FILTER:
         add_ldap_byte(buff, offset, UNWILLING_TO_PERFORM);
-        add_ldap_string(buff, offset, "");
-        add_ldap_string(buff, offset, "Usage of unsupported filter.");
+        defaultMessage = "Usage of unsupported filter.";
         break;
     case SIZE_LIMIT_EXCEEDED:
         add_ldap_byte(buff, offset, SIZE_LIMIT_EXCEEDED);
-        add_ldap_string(buff, offset, "");
-        add_ldap_string(buff, offset, "Size limit exceeded.");
+        defaultMessage = "Size limit exceeded.";
+        break;
+    case UNAVAILABLE:
+        add_ldap_byte(buff, offset, UNAVAILABLE);
+        defaultMessage = "A shard of the directory is unavailable.";
+        break;
+    case PROTOCOL_ERROR:
+        add_ldap_byte(buff, offset, PROTOCOL_ERROR);
+        defaultMessage = "Malformed search request.";
         break;
 
     default:
         add_ldap_byte(buff, offset, UNWILLING_TO_PERFORM);
-        add_ldap_string(buff, offset, "");
-        add_ldap_string(buff, offset, "Internal error.");
+        defaultMessage = "Internal error.";
         break;
     }
-    buff[resultLengthOffset] = (*offset) - resultLengthOffset - 1;
-    buff[1] = (*offset) - 2;
+    add_ldap_string(buff, offset, "");
+    if (message == NULL)
+        message = defaultMessage;
+    add_ldap_octets(buff, offset, message, strlen(message));
+
+    // an explained result does not fit into a short length
+    set_ldap_length(buff, offset, resultLengthOffset);
+}
+
+void ldap_search_res_done(unsigned char *buff, int *offset, int returnCode, const char *message, int clientSocket)
+{
+    if (message == NULL)
+    {
+        response_append(buff, offset, RESPONSE_SEARCH_DONE, returnCode);
+    }
+    else
+    {
+        ldap_search_res_done_encode(buff, offset, returnCode, message);
+        set_ldap_length(buff, offset, LDAP_MSG_LENGTH_OFFSET);
+    }
     ldap_send(buff, clientSocket, *offset);
-    print_hex_message(buff, *offset);
 }
 
 void to_lowercase(char *string)
@@ -103,163 +466,209 @@ void to_lowercase(char *string)
         string[i] = tolower(string[i]);
     }
 }
-int get_targeted_column(LdapFilter filter)
+int get_targeted_column(const Schema *schema, LdapFilter filter)
 {
-    to_lowercase(filter.attributeDescription);
-    if (strcmp(filter.attributeDescription, "cn") == 0 || strcmp(filter.attributeDescription, "commonname") == 0)
-        return COMMON_NAME;
-
-    if (strcmp(filter.attributeDescription, "uid") == 0 || strcmp(filter.attributeDescription, "userid") == 0)
-        return UID;
-
-    if (strcmp(filter.attributeDescription, "mail") == 0)
-        return MAIL;
-
-    printf("ERROR: Unknown ldap filter attribute \n");
-    return -1;
+    int column = schema_find(schema, filter.attributeDescription);
+    if (column == -1)
+        printf("ERROR: Unknown ldap filter attribute \n");
+    // filters on the password hashes would reveal them
+    return column == schema->password ? -1 : column;
 }
-void ldap_send_search_res_entrys(unsigned char *buff, int *offset, LdapSearch *search, FILE *file, int clientSocket)
+
+void normalize_filter(LdapFilter *filter, const Attribute *attribute)
 {
-    char line[1024];
-    char fullLine[1024];
-    char *saveptr; // Used to maintain the tokenizer state
-    int targetColumn = get_targeted_column(search->filter);
-    int numberOfEntries = 0;
-    rewind(file);
+    bool foldCase = attribute->rule == CASE_IGNORE_MATCH;
+    bool trim = filter->filterType == EQUALITY_MATCH_FILTER;
 
-    while (fgets(line, sizeof(line), file))
+    filter->attributeValueLength = normalize_value(filter->attributeValue, filter->attributeValueLength, filter->attributeValue, trim, foldCase);
+    filter->attributeValue[filter->attributeValueLength] = '\0';
+    if (filter->attributeValue2 != NULL)
     {
-        strcpy(fullLine, line);
-        char *token = strtok_r(line, ";", &saveptr);
-        int column = 0;
+        filter->attributeValue2Length = normalize_value(filter->attributeValue2, filter->attributeValue2Length, filter->attributeValue2, trim, foldCase);
+        filter->attributeValue2[filter->attributeValue2Length] = '\0';
+    }
+}
 
-        while (token != NULL)
+static int add_canonical_value(char *out, int size, int length, const char *value, int valueLength)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+    for (int i = 0; i < valueLength && length != -1; i++)
+    {
+        unsigned char byte = value[i];
+        if (byte == '*' || byte == '(' || byte == ')' || byte == '\\' || byte == '\0')
         {
-            removeEOL(token);
-            if (column == targetColumn)
-            {
-                if (is_token_equal_filter_value(search->filter, token))
-                {
-                    if (search->sizeLimit != 0 && numberOfEntries == search->sizeLimit)
-                    {
-                        search->returnCode = SIZE_LIMIT_EXCEEDED;
-                        return;
-                    }
-                    token = strtok_r(fullLine, ";", &saveptr);
-                    FileLine fl;
-
-                    // Extract commonname
-                    if (token != NULL)
-                        fl.cn = token;
-                    // Extract uid
-                    token = strtok_r(NULL, ";", &saveptr);
-                    if (token != NULL)
-                        fl.uid = token;
-                    // Extract mail
-                    token = strtok_r(NULL, ";", &saveptr);
-                    if (token != NULL)
-                    {
-                        removeEOL(token);
-                        fl.mail = token;
-                    }
-                    numberOfEntries++;
-                    ldap_send_search_res_entry(buff, offset, fl, clientSocket);
-                }
-                break;
-            }
-
-            token = strtok_r(NULL, ";", &saveptr);
-            column++;
+            if (length + 3 > size)
+                return -1;
+            out[length++] = '\\';
+            out[length++] = hexDigits[byte >> 4];
+            out[length++] = hexDigits[byte & 0x0F];
+        }
+        else
+        {
+            if (length + 1 > size)
+                return -1;
+            out[length++] = byte;
         }
     }
+    return length;
 }
-void removeEOL(char *str)
+
+int canonical_filter(LdapFilter filter, const char *attribute, char *out, int size)
 {
-    int len = strlen(str);
-    for (int i = 0; i < len; i++)
+    int length = snprintf(out, size, "(%s=", attribute);
+    if (length >= size)
+        return -1;
+
+    bool leadingStar = filter.filterType == SUBSTRING_FILTER && (filter.substringType == INFIX || filter.substringType == POSTFIX);
+    bool trailingStar = filter.filterType == SUBSTRING_FILTER && (filter.substringType == INFIX || filter.substringType == PREFIX);
+
+    if (leadingStar && length < size)
+        out[length++] = '*';
+    length = add_canonical_value(out, size, length, filter.attributeValue, filter.attributeValueLength);
+    if (length != -1 && filter.filterType == SUBSTRING_FILTER && filter.substringType == ANY_CENTER)
     {
-        if (str[i] == '\r' || str[i] == '\n')
-            str[i] = '\0';
+        if (length < size)
+            out[length++] = '*';
+        length = add_canonical_value(out, size, length, filter.attributeValue2, filter.attributeValue2Length);
     }
+    if (length == -1 || length + 2 > size)
+        return -1;
+    if (trailingStar)
+        out[length++] = '*';
+    out[length++] = ')';
+    return length;
 }
-void ldap_send_search_res_entry(unsigned char *buff, int *offset, FileLine fl, int clientSocket)
+
+bool is_row_matching(LdapFilter filter, Directory *directory, size_t row, int column, char *scratch)
 {
+    Field rest = directory_key(directory, row, column, scratch), value;
+    char separator = directory->schema.attributes[column].separator;
+
+    while (field_next_value(&rest, separator, &value))
+    {
+        if (is_token_equal_filter_value(filter, value.value, value.length))
+            return true;
+    }
+    return false;
+}
 
-    char uid[100];
-    strcpy(uid, fl.uid);
-    strcat(uid, ",dc=fit,dc=vut,dc=cz");
+int ldap_send_search_res_entry(unsigned char *buff, int *offset, Directory *directory, size_t row, int clientSocket)
+{
+    ArenaMark mark = arena_mark(requestArena);
+    const Schema *schema = &directory->schema;
+    int maxLength = 0;
+    for (int column = 0; column < schema->attributeCount; column++)
+    {
+        if (directory->columns[column].maxLength > maxLength)
+            maxLength = directory->columns[column].maxLength;
+    }
+    char *scratch = (char *)arena_alloc(requestArena, maxLength + 1);
+
+    // size the entry before encoding it
     int newoffset = (*offset);
-    unsigned char newbuff[MAX_BUFFER_SIZE]; // coppy header
-    memset(newbuff, 0, MAX_BUFFER_SIZE);    // clear the buffer
-    memcpy(newbuff, buff, MAX_BUFFER_SIZE);
+    int suffixLength = strlen(directory->dnSuffix);
+    int size = newoffset + suffixLength + SEARCH_ENTRY_OVERHEAD;
+    for (int column = 0; column < schema->attributeCount; column++)
+    {
+        Field rest = directory_value(directory, row, column, scratch), value;
+        size += strlen(schema->attributes[column].name) + SEARCH_ATTRIBUTE_OVERHEAD;
+        while (field_next_value(&rest, schema->attributes[column].separator, &value))
+            size += value.length + SEARCH_VALUE_OVERHEAD;
+    }
+    unsigned char *newbuff = (unsigned char *)arena_alloc(requestArena, size);
+    memcpy(newbuff, buff, newoffset); // coppy header
 
     add_ldap_byte(newbuff, &newoffset, LDAP_SEARCH_RESULT_ENTRY);
     int resultLengthOffset = newoffset;
     add_ldap_byte(newbuff, &newoffset, LDAP_PLACEHOLDER);
-    add_ldap_string(newbuff, &newoffset, uid);
+
+    // dn is the rdn value followed by the domain suffix
+    Field rdn = directory_value(directory, row, schema->rdn, scratch);
+    add_ldap_byte(newbuff, &newoffset, OCTET_STRING_TYPE);
+    add_ldap_length(newbuff, &newoffset, rdn.length + suffixLength);
+    memcpy(newbuff + newoffset, rdn.value, rdn.length);
+    memcpy(newbuff + newoffset + rdn.length, directory->dnSuffix, suffixLength);
+    newoffset += rdn.length + suffixLength;
+
     add_ldap_byte(newbuff, &newoffset, LDAP_PARTIAL_ATTRIBUTE_LIST);
     int attributeListoffset = newoffset;
     add_ldap_byte(newbuff, &newoffset, LDAP_PLACEHOLDER);
-    add_ldap_attribute_list(newbuff, &newoffset, "cn", fl.cn);
-    add_ldap_attribute_list(newbuff, &newoffset, "mail", fl.mail);
+    for (int column = 0; column < schema->attributeCount; column++)
+    {
+        if (column == schema->rdn || column == schema->password)
+            continue;
+        Field value = directory_value(directory, row, column, scratch);
+        add_ldap_attribute_list(newbuff, &newoffset, schema->attributes[column].name, value, schema->attributes[column].separator);
+    }
 
-    newbuff[resultLengthOffset] = newoffset - resultLengthOffset - 1;
-    newbuff[attributeListoffset] = newoffset - attributeListoffset - 1;
-    newbuff[LDAP_MSG_LENGTH_OFFSET] = newoffset - 2;
+    set_ldap_length(newbuff, &newoffset, attributeListoffset);
+    set_ldap_length(newbuff, &newoffset, resultLengthOffset);
+    set_ldap_length(newbuff, &newoffset, LDAP_MSG_LENGTH_OFFSET);
     ldap_send(newbuff, clientSocket, newoffset);
+    arena_release(requestArena, mark);
+    return newoffset;
 }
-void add_ldap_attribute_list(unsigned char *buff, int *offset, char *type, char *value)
+void add_ldap_attribute_list(unsigned char *buff, int *offset, const char *type, Field value, char separator)
 {
+    // empty values of multi-valued attributes are left out and so is an attribute without values
+    Field rest = value, part;
+    bool empty = separator != 0;
+    while (empty && field_next_value(&rest, separator, &part))
+        empty = part.length == 0;
+    if (empty)
+        return;
+
     add_ldap_byte(buff, offset, LDAP_PARTIAL_ATTRIBUTE_LIST);
     int partialListOffset = (*offset);
-    add_ldap_byte(buff, offset, LDAP_PLACEHOLDER);  
-    add_ldap_string(buff, offset, type);   
+    add_ldap_byte(buff, offset, LDAP_PLACEHOLDER);
+    add_ldap_octets(buff, offset, type, strlen(type));
     add_ldap_byte(buff, offset, LDAP_PARTIAL_ATTRIBUTE_LIST_VALUE);
     int partialListValueOffset = (*offset);
     add_ldap_byte(buff, offset, LDAP_PLACEHOLDER);
-    add_ldap_string(buff, offset, value);
-    buff[partialListValueOffset] = (*offset) - partialListValueOffset - 1;
-    buff[partialListOffset] = (*offset) - partialListOffset - 1;
+    rest = value;
+    while (field_next_value(&rest, separator, &part))
+    {
+        if (separator == 0 || part.length > 0)
+            add_ldap_octets(buff, offset, part.value, part.length);
+    }
+    set_ldap_length(buff, offset, partialListValueOffset);
+    set_ldap_length(buff, offset, partialListOffset);
 };
 
-bool is_token_equal_filter_value(LdapFilter filter, char *token)
+bool is_token_equal_filter_value(LdapFilter filter, const char *token, int length)
 { // ! substring not working correctly for multiple *
     bool match = false;
+    int valueLen = filter.attributeValueLength;
 
-    if (filter.filterType == EQUALITY_MATCH_FILTER && strcmp(filter.attributeValue, token) == 0)
+    if (filter.filterType == EQUALITY_MATCH_FILTER)
     { // Full match
-        match = true;
+        match = length == valueLen && memcmp(filter.attributeValue, token, length) == 0;
     }
-    else if (filter.substringType == PREFIX && strncmp(filter.attributeValue, token, strlen(filter.attributeValue)) == 0)
+    else if (filter.substringType == PREFIX && length >= valueLen && memcmp(filter.attributeValue, token, valueLen) == 0)
     { // Prefix
         match = true;
     }
-    else if (filter.substringType == INFIX && strstr(token, filter.attributeValue) != NULL)
+    else if (filter.substringType == INFIX && memmem(token, length, filter.attributeValue, valueLen) != NULL)
     { // Infix
         match = true;
     }
     else if (filter.substringType == POSTFIX)
     { // Postfix
-        int tokenLen = strlen(token);
-        int valueLen = strlen(filter.attributeValue);
-
-        if (tokenLen >= valueLen && strcmp(filter.attributeValue, token + (tokenLen - valueLen)) == 0)
+        if (length >= valueLen && memcmp(filter.attributeValue, token + (length - valueLen), valueLen) == 0)
         {
             match = true;
         }
     }
     else if (filter.substringType == ANY_CENTER)
     {
-
-        int tokenLen = strlen(token);
-        int valueLen = strlen(filter.attributeValue2);
+        int value2Len = filter.attributeValue2Length;
         bool found = false;
 
-        if (tokenLen >= valueLen && strcmp(filter.attributeValue2, token + (tokenLen - valueLen)) == 0)
+        if (length >= value2Len && memcmp(filter.attributeValue2, token + (length - value2Len), value2Len) == 0)
         {
             found = true;
         }
-        if (found && strncmp(filter.attributeValue, token, strlen(filter.attributeValue)) == 0)
+        if (found && length >= valueLen && memcmp(filter.attributeValue, token, valueLen) == 0)
         {
             match = true;
         }
@@ -273,10 +682,12 @@ LdapFilter get_ldap_filter(unsigned char *data, LdapSearch *search)
     LdapFilter filter;
     filter.filterType = get_ldap_element_info(data).tagValue;
     filter.attributeValue2 = NULL;
+    filter.attributeValueLength = 0;
+    filter.attributeValue2Length = 0;
 
     if (filter.filterType != EQUALITY_MATCH_FILTER && filter.filterType != SUBSTRING_FILTER)
     { // suported filters
-        debug(1, "Received unsupported filter %02X \n", filter.filterType);
+        trace(TRACE_INFO, TRACE_UNSUPPORTED, search->messageId, filter.filterType, 0);
         search->returnCode = UNSUPORTED_FILTER;
         filter.attributeDescription = NULL;
         filter.attributeValue = NULL;
@@ -288,42 +699,21 @@ LdapFilter get_ldap_filter(unsigned char *data, LdapSearch *search)
     if (filter.filterType == EQUALITY_MATCH_FILTER)
     {
         filter.attributeValue = get_string_value(data);
+        filter.attributeValueLength = strlen(filter.attributeValue);
     }
     else
     {
         get_ldap_element_info(data);
         filter.substringType = data[currentTagPosition];
         filter.attributeValue = get_string_value(data);
+        filter.attributeValueLength = strlen(filter.attributeValue);
         if (data[currentTagPosition] == POSTFIX)
         {
             filter.substringType = ANY_CENTER;
             filter.attributeValue2 = get_string_value(data);
+            filter.attributeValue2Length = strlen(filter.attributeValue2);
         }
     }
 
     return filter;
 }
-void dispose_ldap_search(LdapSearch search)
-{
-    free(search.filter.attributeDescription);
-    free(search.filter.attributeValue);
-    free(search.filter.attributeValue2);
-    free(search.baseObject);
-}
-
-void print_ldap_search(LdapSearch search)
-{
-    debug(2, "LDAP search print:\n");
-    debug(2, "Return code: %d\n", search.returnCode);
-    debug(2, "MessageId: %d\n", search.messageId);
-    debug(2, "BaseObject: %s\n", search.baseObject);
-    debug(2, "Scope: %d\n", search.scope);
-    debug(2, "DerefAliases: %d\n", search.derefAliases);
-    debug(2, "Size limit: %d\n", search.sizeLimit);
-    debug(2, "Time limit: %d\n", search.timeLimit);
-    debug(2, "TypesOnly: %d\n", search.typesOnly);
-    debug(2, "Filter type: %02X\n", search.filter.filterType);
-    debug(2, "Filter attribute description: %s\n", search.filter.attributeDescription);
-    debug(2, "Filter attribute value: %s\n", search.filter.attributeValue);
-    debug(2, "Filter attribute value2: %s\n", search.filter.attributeValue2);
-}
@@ -14,12 +14,10 @@
 #ifndef _SEARCH_H
 #define _SEARCH_H
 
-typedef struct
-{
-    char *uid;
-    char *cn;
-    char *mail;
-} FileLine;
+#include "utils.h"
+#include "directory.h"
+#include "schema.h"
+#include "flight.h"
 
 enum FilterType
 {
@@ -30,30 +28,37 @@ enum FilterType
     SUBSTRING_FILTER = 0xA4
 };
 
-enum CSVOffset
-{
-    COMMON_NAME = 0,
-    UID = 1,
-    MAIL = 2,
-};
-
 enum LdapSearchResponseCodes
 {
     LDAP_PARTIAL_ATTRIBUTE_LIST = 0x30,
     LDAP_PARTIAL_ATTRIBUTE_LIST_VALUE = 0x31,
 };
 
+enum SearchConst
+{
+    SEARCH_ENTRY_OVERHEAD = 32,     // upper bound of the tags and lengths around the dn and attribute list of one entry
+    SEARCH_ATTRIBUTE_OVERHEAD = 24, // upper bound of the tags and lengths of one attribute
+    SEARCH_VALUE_OVERHEAD = 6,      // upper bound of the tag and length of one attribute value
+    SEARCH_SLICE_ROWS = 4096        // rows visited by one step of a search before other operations run
+};
+
+#define SEARCH_EXPLAIN_OID "1.3.6.1.4.1.4203.666.5.99" // control asking for the plan in the search result done
+
 /**
  * Structure representing an LDAP Filter for search criteria.
  *
  * The LdapFilter structure is used to represent an LDAP Filter.
  * It includes the attribute description, attribute value, and filter type.
+ * The attribute values are normalized once the targeted attribute is known, so they
+ * can be compared directly with the normalized keys of the directory.
  */
 typedef struct
 {
     char *attributeDescription; /**< The description of the attribute being filtered. */
-    char *attributeValue;       /**< The value used for the filter. */
-    char *attributeValue2;      /**< The second value used for the filter. */
+    char *attributeValue;       /**< The normalized value used for the filter. */
+    char *attributeValue2;      /**< The normalized second value used for the filter. */
+    int attributeValueLength;   /**< The length of the normalized value. */
+    int attributeValue2Length;  /**< The length of the normalized second value. */
     enum FilterType filterType; /**< The type of filter (e.g., equality, presence, etc.). */
     enum SubstringType substringType;
 } LdapFilter;
@@ -75,6 +80,10 @@ typedef struct
     int typesOnly;              /**< Flag indicating whether to return attribute types only (0 for no, 1 for yes). */
     LdapFilter filter;          /**< The LDAP filter for the search. */
     enum ResultCode returnCode; /**< Return code indicating whether the search was successful. */
+    int targetColumn;           /**< The column targeted by the filter or -1. */
+    char *queryKey;             /**< The canonical filter and size limit or NULL if it is too long. */
+    int queryKeyLength;         /**< The length of the query key. */
+    bool explain;               /**< Flag indicating whether the plan explanation control was sent. */
 } LdapSearch;
 
 
@@ -82,13 +91,16 @@ typedef struct
  * LDAP Search Operation.
  *
  * Initiates an LDAP search operation using the provided data and message ID.
+ * The targeted column, the filter values normalized by its matching rule and the
+ * query key used by the query cache and search coalescing are computed once here.
  *
  * @param data A pointer to the data required for the search operation.
  * @param messageId An integer representing the unique identifier for the LDAP message.
+ * @param schema A pointer to the schema of the directory.
  *
  * @return An LdapSearch structure representing the result of the search operation.
  */
-LdapSearch ldap_search(unsigned char *data, int messageId);
+LdapSearch ldap_search(unsigned char *data, int messageId, const Schema *schema);
 
 /**
  * Get LDAP Filter.
@@ -99,110 +111,226 @@ LdapSearch ldap_search(unsigned char *data, int messageId);
  * @param search    A pointer to the LdapSearch structure to associate the filter with.
  *
  * @return          An LdapFilter structure representing the extracted LDAP filter.
- *                  The caller is responsible for managing any associated memory.
+ *                  The filter strings are allocated from the request arena and
+ *                  are not normalized yet.
  */
 LdapFilter get_ldap_filter(unsigned char *data, LdapSearch *search);
 
 /**
- * Dispose LDAP Search.
+ * Normalize LDAP Filter.
  *
- * Releases resources associated with the provided LdapSearch structure.
+ * Normalizes the filter values in place by the matching rule of the targeted attribute,
+ * so they can be compared directly with the normalized keys of the directory.
  *
- * @param search    The LdapSearch structure to be disposed of.
- *             
+ * @param filter    A pointer to the filter to normalize.
+ * @param attribute A pointer to the attribute targeted by the filter.
  */
-void dispose_ldap_search(LdapSearch search);
+void normalize_filter(LdapFilter *filter, const Attribute *attribute);
+
+enum SearchSource
+{
+    SEARCH_SOURCE_SCAN = 0,  // every row of the column is checked
+    SEARCH_SOURCE_INDEX = 1, // only the rows of one equality index bucket or disk index range are checked
+    SEARCH_SOURCE_CACHE = 2, // the rows are taken from the query cache
+    SEARCH_SOURCE_COALESCED = 3, // the result is copied from an identical search in flight
+    SEARCH_SOURCE_BLOOM = 4, // the Bloom filter ruled out every row
+    SEARCH_SOURCE_NONE = 5   // the search failed before any row was checked
+};
+
+enum SearchState
+{
+    SEARCH_RUNNING = 0,
+    SEARCH_FOLLOWING = 1, // waiting for an identical search of another connection
+    SEARCH_DONE = 2
+};
+
+/**
+ * Structure representing a search in progress.
+ *
+ * A search is answered in steps, so other operations of the connection can run
+ * between them and an abandoned search can stop in the middle of a scan.
+ * Everything the search allocates lives in the arena that was current when it began,
+ * which has to be made current again for every step.
+ */
+typedef struct
+{
+    LdapSearch search;         /**< The search request. */
+    Directory *directory;      /**< The loaded database file. */
+    int clientSocket;          /**< The socket the responses are sent to. */
+    enum SearchState state;    /**< The state of the search. */
+    enum SearchSource source;  /**< Where the candidate rows come from. */
+    IndexCursor cursor;        /**< The position in the equality index bucket. */
+    size_t row;                /**< The next row to scan or the next cached row. */
+    size_t rowCount;           /**< The number of rows when the search was planned, the end of a scan. */
+    unsigned long version;     /**< The directory version when the search was planned, the version of its cached result. */
+    size_t previousRow;        /**< The last visited row, used to skip rows chained twice. */
+    int numberOfEntries;       /**< The number of sent entries. */
+    int sentEntries;           /**< The number of encoded entries including cached ones. */
+    uint32_t *rows;            /**< The matching rows kept for the query cache or the cached rows, or NULL. */
+    int cachedRowCount;        /**< The number of cached rows. */
+    size_t cachedBytes;        /**< The number of bytes sent from cached rows. */
+    bool bloomChecked;         /**< Flag indicating whether the Bloom filter let the search through. */
+    char *scratch;             /**< A buffer for assembled keys of the targeted column. */
+    unsigned char *header;     /**< A buffer holding the message header. */
+    int headerLength;          /**< The length of the message header. */
+    Flight *flight;            /**< The coalesced search led or followed, or NULL. */
+    uint64_t startTime;        /**< The monitor time the search began. */
+    size_t examinedRows;       /**< The number of rows checked against the filter. */
+    size_t sentBytes;          /**< The number of bytes of the sent entries. */
+} SearchCursor;
 
 /**
- * LDAP Search Response.
+ * Begin Search.
  *
- * Sends an LDAP search response.
+ * Checks the Bloom filter and the query cache and positions the cursor at the first
+ * candidate row. Equality searches of indexed attributes visit only the rows of the
+ * equality index bucket of the value, other searches scan the column. Searches that
+ * cannot match anything are answered right away.
  *
- * @param search        The LdapSearch structure containing information for the search response.
+ * @param cursor        A pointer to the cursor to initialize.
+ * @param search        The LdapSearch structure containing search parameters.
+ * @param directory     A pointer to the loaded database file.
  * @param clientSocket  The socket to which the LDAP search response will be sent.
- * @param file          A pointer to a FILE structure representing the database file.
  */
-void ldap_search_response(LdapSearch search, int clientSocket, FILE *file);
+void search_cursor_begin(SearchCursor *cursor, LdapSearch search, Directory *directory, int clientSocket);
 
 /**
- * Print LDAP Search.
+ * Step Search.
  *
- * Prints the content of the provided LdapSearch structure to the standard output.
+ * Visits up to the given number of candidate rows and sends the matching entries.
+ * The search result done message is sent by the step that finishes the search.
+ * The step ends early once it queued outputBudget bytes or the output queue is full.
+ *
+ * @param cursor       A pointer to the cursor.
+ * @param budget       The maximal number of rows to visit.
+ * @param outputBudget The number of bytes of entries the step may queue.
+ *
+ * @return true if the search is finished, false otherwise.
  */
-void print_ldap_search(LdapSearch search);
+bool search_cursor_step(SearchCursor *cursor, int budget, size_t outputBudget);
+
+/**
+ * Check whether Search is Waiting.
+ *
+ * @param cursor    A pointer to the cursor.
+ *
+ * @return true if the search follows an identical search that has not finished yet,
+ *         so stepping it would make no progress.
+ */
+bool search_cursor_waiting(SearchCursor *cursor);
+
+/**
+ * Abandon Search.
+ *
+ * Stops the search without sending anything more. Followers of an abandoned
+ * coalesced search run the search themselves.
+ *
+ * @param cursor    A pointer to the cursor.
+ */
+void search_cursor_abandon(SearchCursor *cursor);
+
+/**
+ * Explain Search.
+ *
+ * Describes how the search was answered, e.g.
+ * "filter=(mail=*@vut.cz) sizeLimit=0 path=scan examined=120000 returned=3 bytes=411 elapsed=5.120ms result=0".
+ * The same explanation is logged for slow searches and returned to searches sent with
+ * the SEARCH_EXPLAIN_OID control.
+ *
+ * @param cursor    A pointer to the cursor.
+ * @param elapsed   The time the search took in nanoseconds.
+ * @param out       A pointer to the output buffer.
+ * @param size      The size of the output buffer.
+ */
+void search_cursor_explain(const SearchCursor *cursor, uint64_t elapsed, char *out, int size);
 
 /**
  * Check Token Equality with LDAP Filter Value.
  *
- * Compares the provided token to the value in the given LDAP filter.
+ * Compares the provided normalized token to the value in the given LDAP filter.
  *
  * @param filter    The LdapFilter structure containing the filter value to compare.
- * @param token     A pointer to the token to compare with the filter value.
+ * @param token     A pointer to the normalized token to compare with the filter value.
+ * @param length    The length of the token in bytes.
  *
  * @return          Returns true if the token is equal to the filter value, false otherwise.
  */
-bool is_token_equal_filter_value(LdapFilter filter, char *token);
+bool is_token_equal_filter_value(LdapFilter filter, const char *token, int length);
 
 /**
- * LDAP Send Search Result Entry.
+ * Check Row against LDAP Filter.
  *
- * Creates and sends an LDAP search result entry based on the provided FileLine structure.
+ * Compares every value of the field of the row with the filter value.
  *
- * @param buff          A pointer to the buffer where the LDAP search result entry will be constructed.
- * @param offset        A pointer to the offset in the buffer where the LDAP search result entry will be added.
- * @param fl            The FileLine structure containing information for constructing the LDAP entry.
- * @param clientSocket  The socket to which the LDAP search result entry will be sent.
+ * @param filter    The LdapFilter structure with normalized values.
+ * @param directory A pointer to the loaded database file.
+ * @param row       The row to check.
+ * @param column    The column targeted by the filter.
+ * @param scratch   A pointer to a buffer of at least maxLength bytes of the column.
+ *
+ * @return          Returns true if any value of the field matches the filter, false otherwise.
  */
-void ldap_send_search_res_entry(unsigned char *buff, int *offset, FileLine fl, int clientSocket);
+bool is_row_matching(LdapFilter filter, Directory *directory, size_t row, int column, char *scratch);
 
 /**
- * LDAP Send Search Result Entries.
+ * LDAP Send Search Result Entry.
  *
- * Retrieves entries from a file based on the LDAP search filter, constructs
- * LDAP search result entries, and sends them to the specified client socket.
+ * Creates and sends an LDAP search result entry based on the provided directory row.
+ * Every declared attribute except the one forming the dn is returned.
  *
- * @param buff          A pointer to the buffer where the LDAP search result entries will be constructed.
- * @param offset        A pointer to the offset in the buffer where the LDAP search result entries will be added.
- * @param search        A pointer to the LdapSearch structure containing search parameters.
- * @param file          A pointer to the FILE structure representing the database file.
- * @param clientSocket  The socket to which the LDAP search result entries will be sent.
+ * @param buff          A pointer to the buffer containing the LDAP message header.
+ * @param offset        A pointer to the offset in the buffer where the LDAP search result entry will be added.
+ * @param directory     A pointer to the loaded database file.
+ * @param row           The row of the directory to send.
+ * @param clientSocket  The socket to which the LDAP search result entry will be sent.
+ *
+ * @return              The number of sent bytes.
  */
-void ldap_send_search_res_entrys(unsigned char *buff, int *offset, LdapSearch *search, FILE *file, int clientSocket);
+int ldap_send_search_res_entry(unsigned char *buff, int *offset, Directory *directory, size_t row, int clientSocket);
 
 /**
  * Add LDAP Attribute list to LDAP response.
  *
- * Adds an LDAP attribute with the specified type and value to the buffer
- * at the specified offset.
+ * Adds an LDAP attribute with the specified type and values to the buffer
+ * at the specified offset. Empty values of multi-valued attributes are left out.
  *
  * @param buff      A pointer to the buffer where the LDAP attribute will be added.
  * @param offset    A pointer to the offset in the buffer where the LDAP attribute will be added.
  * @param type      A pointer to the string representing the attribute type.
- * @param value     A pointer to the string representing the attribute value.
+ * @param value     The field containing the attribute values.
+ * @param separator The separator of the values or 0 for single-valued attributes.
  */
-void add_ldap_attribute_list(unsigned char *buff, int *offset, char *type, char *value);
+void add_ldap_attribute_list(unsigned char *buff, int *offset, const char *type, Field value, char separator);
 
 /**
- * Remove EOL characters from string.
+ * Get Targeted Column based on LDAP Filter Attribute.
  *
- * Modifies the provided string in-place by removing EOL characters
+ * Looks up the attribute description of the provided LDAP filter among the names
+ * and aliases declared by the schema, ignoring the letter case.
  *
- * @param str   A pointer to the  string to be modified.
+ * @param schema    A pointer to the schema of the directory.
+ * @param filter    The LdapFilter structure containing the attribute description.
+ *
+ * @return          An integer representing the targeted column based on the attribute.
+ *                  Returns -1 if the attribute is not recognized or holds passwords.
  */
-void removeEOL(char *str);
+int get_targeted_column(const Schema *schema, LdapFilter filter);
 
 /**
- * Get Targeted Column based on LDAP Filter Attribute.
+ * Get Canonical Filter.
  *
- * Converts the attribute description in the provided LDAP filter to lowercase
- * and determines the corresponding column based on recognized attribute names.
+ * Writes the normalized filter in its string representation, e.g. "(uid=xbal*)",
+ * with special characters escaped as described in RFC 4515. Equal filters have equal
+ * canonical representations regardless of the letter case used by the client.
  *
- * @param filter    The LdapFilter structure containing the attribute description.
+ * @param filter    The LdapFilter structure with normalized values.
+ * @param attribute The name of the attribute targeted by the filter.
+ * @param out       A pointer to the output buffer.
+ * @param size      The size of the output buffer.
  *
- * @return          An integer representing the targeted column based on the attribute.
- *                  Returns -1 if the attribute is not recognized.
+ * @return          The length of the canonical filter or -1 if it does not fit into the buffer.
  */
-int get_targeted_column(LdapFilter filter);
+int canonical_filter(LdapFilter filter, const char *attribute, char *out, int size);
 
 /**
  * Convert String to Lowercase.
@@ -0,0 +1,179 @@
+/**
+ *
+ * @file sha256.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <string.h>
+#include "sha256.h"
+
+static const uint32_t roundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+static uint32_t rotate(uint32_t value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+static void sha256_block(uint32_t *state, const unsigned char *block)
+{
+    uint32_t words[64];
+    for (int i = 0; i < 16; i++)
+        words[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 | (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = rotate(words[i - 15], 7) ^ rotate(words[i - 15], 18) ^ (words[i - 15] >> 3);
+        uint32_t s1 = rotate(words[i - 2], 17) ^ rotate(words[i - 2], 19) ^ (words[i - 2] >> 10);
+        words[i] = words[i - 16] + s0 + words[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t t1 = h + (rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25)) + ((e & f) ^ (~e & g)) + roundConstants[i] + words[i];
+        uint32_t t2 = (rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void sha256_init(Sha256 *sha)
+{
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(sha->state, initial, sizeof(initial));
+    sha->length = 0;
+    sha->blockLength = 0;
+}
+
+void sha256_update(Sha256 *sha, const void *data, size_t length)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    sha->length += length;
+    while (length > 0)
+    {
+        size_t chunk = SHA256_BLOCK_SIZE - sha->blockLength;
+        if (chunk > length)
+            chunk = length;
+        memcpy(sha->block + sha->blockLength, bytes, chunk);
+        sha->blockLength += chunk;
+        bytes += chunk;
+        length -= chunk;
+        if (sha->blockLength == SHA256_BLOCK_SIZE)
+        {
+            sha256_block(sha->state, sha->block);
+            sha->blockLength = 0;
+        }
+    }
+}
+
+void sha256_final(Sha256 *sha, unsigned char *digest)
+{
+    // the padding is a one bit, zeros and the length in bits in the last 8 bytes of a block
+    uint64_t bits = sha->length * 8;
+    unsigned char padding = 0x80;
+    sha256_update(sha, &padding, 1);
+    padding = 0;
+    while (sha->blockLength != SHA256_BLOCK_SIZE - 8)
+        sha256_update(sha, &padding, 1);
+    unsigned char length[8];
+    for (int i = 0; i < 8; i++)
+        length[i] = bits >> (56 - 8 * i);
+    sha256_update(sha, length, 8);
+
+    for (int i = 0; i < 8; i++)
+    {
+        digest[4 * i] = sha->state[i] >> 24;
+        digest[4 * i + 1] = sha->state[i] >> 16;
+        digest[4 * i + 2] = sha->state[i] >> 8;
+        digest[4 * i + 3] = sha->state[i];
+    }
+}
+
+void pbkdf2_sha256(const void *password, size_t passwordLength, const void *salt, size_t saltLength,
+                   unsigned long iterations, unsigned char *key, size_t keyLength)
+{
+    // the keyed inner and outer states are computed once, every iteration only hashes one block each
+    unsigned char pad[SHA256_BLOCK_SIZE], hashedPassword[SHA256_DIGEST_SIZE];
+    if (passwordLength > SHA256_BLOCK_SIZE)
+    {
+        Sha256 sha;
+        sha256_init(&sha);
+        sha256_update(&sha, password, passwordLength);
+        sha256_final(&sha, hashedPassword);
+        password = hashedPassword;
+        passwordLength = SHA256_DIGEST_SIZE;
+    }
+    Sha256 inner, outer;
+    memset(pad, 0x36, sizeof(pad));
+    for (size_t i = 0; i < passwordLength; i++)
+        pad[i] ^= ((const unsigned char *)password)[i];
+    sha256_init(&inner);
+    sha256_update(&inner, pad, sizeof(pad));
+    memset(pad, 0x5c, sizeof(pad));
+    for (size_t i = 0; i < passwordLength; i++)
+        pad[i] ^= ((const unsigned char *)password)[i];
+    sha256_init(&outer);
+    sha256_update(&outer, pad, sizeof(pad));
+
+    for (uint32_t blockIndex = 1; keyLength > 0; blockIndex++)
+    {
+        unsigned char counter[4] = {blockIndex >> 24, blockIndex >> 16, blockIndex >> 8, blockIndex};
+        unsigned char u[SHA256_DIGEST_SIZE], t[SHA256_DIGEST_SIZE];
+        Sha256 sha = inner;
+        sha256_update(&sha, salt, saltLength);
+        sha256_update(&sha, counter, sizeof(counter));
+        sha256_final(&sha, u);
+        sha = outer;
+        sha256_update(&sha, u, sizeof(u));
+        sha256_final(&sha, u);
+        memcpy(t, u, sizeof(t));
+
+        for (unsigned long i = 1; i < iterations; i++)
+        {
+            sha = inner;
+            sha256_update(&sha, u, sizeof(u));
+            sha256_final(&sha, u);
+            sha = outer;
+            sha256_update(&sha, u, sizeof(u));
+            sha256_final(&sha, u);
+            for (int j = 0; j < SHA256_DIGEST_SIZE; j++)
+                t[j] ^= u[j];
+        }
+
+        size_t chunk = keyLength < SHA256_DIGEST_SIZE ? keyLength : SHA256_DIGEST_SIZE;
+        memcpy(key, t, chunk);
+        key += chunk;
+        keyLength -= chunk;
+    }
+    memset(pad, 0, sizeof(pad));
+    memset(hashedPassword, 0, sizeof(hashedPassword));
+}
@@ -0,0 +1,75 @@
+/**
+ *
+ * @file sha256.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _SHA256_H
+#define _SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum Sha256Const
+{
+    SHA256_BLOCK_SIZE = 64,
+    SHA256_DIGEST_SIZE = 32
+};
+
+/**
+ * Structure representing a SHA-256 computation in progress.
+ */
+typedef struct
+{
+    uint32_t state[8];                       /**< The intermediate hash value. */
+    uint64_t length;                         /**< The number of hashed bytes. */
+    unsigned char block[SHA256_BLOCK_SIZE];  /**< Bytes not forming a whole block yet. */
+    size_t blockLength;                      /**< The number of bytes in block. */
+} Sha256;
+
+/**
+ * Start SHA-256.
+ *
+ * @param sha A pointer to the computation.
+ */
+void sha256_init(Sha256 *sha);
+
+/**
+ * Hash Bytes with SHA-256.
+ *
+ * @param sha    A pointer to the computation.
+ * @param data   A pointer to the bytes.
+ * @param length The number of bytes.
+ */
+void sha256_update(Sha256 *sha, const void *data, size_t length);
+
+/**
+ * Finish SHA-256.
+ *
+ * @param sha    A pointer to the computation.
+ * @param digest A pointer to the SHA256_DIGEST_SIZE bytes receiving the digest.
+ */
+void sha256_final(Sha256 *sha, unsigned char *digest);
+
+/**
+ * Derive Key with PBKDF2-HMAC-SHA256.
+ *
+ * Computes the key as described in RFC 8018.
+ *
+ * @param password       A pointer to the password.
+ * @param passwordLength The length of the password.
+ * @param salt           A pointer to the salt.
+ * @param saltLength     The length of the salt.
+ * @param iterations     The iteration count.
+ * @param key            A pointer to the buffer receiving the key.
+ * @param keyLength      The length of the key.
+ */
+void pbkdf2_sha256(const void *password, size_t passwordLength, const void *salt, size_t saltLength,
+                   unsigned long iterations, unsigned char *key, size_t keyLength);
+
+#endif
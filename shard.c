@@ -0,0 +1,106 @@
+/**
+ *
+ * @file shard.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "normalize.h"
+#include "shard.h"
+
+static int shard_compare(const char *left, int leftLength, const char *right, int rightLength)
+{
+    int length = leftLength < rightLength ? leftLength : rightLength;
+    int result = memcmp(left, right, length);
+    return result != 0 ? result : leftLength - rightLength;
+}
+
+int shard_parse(ShardMap *map, const char *spec, int count, const Schema *schema)
+{
+    memset(map, 0, sizeof(ShardMap));
+    map->count = count;
+    map->attribute = schema->attributes[schema->rdn];
+    if (count < 1 || count > SHARD_MAX_COUNT)
+    {
+        fprintf(stderr, "A directory can be split into 1 to %d shards, not %d\n", SHARD_MAX_COUNT, count);
+        return -1;
+    }
+    if (strcmp(spec, "hash") == 0)
+    {
+        map->method = SHARD_HASH;
+        return 0;
+    }
+    if (strncmp(spec, "range:", 6) != 0)
+    {
+        fprintf(stderr, "Unknown partitioning %s, expected hash or range:<bound>,...\n", spec);
+        return -1;
+    }
+
+    map->method = SHARD_RANGE;
+    const char *position = spec + 6;
+    int bounds = 0;
+    while (*position != '\0')
+    {
+        const char *end = strchr(position, ',');
+        if (end == NULL)
+            end = position + strlen(position);
+        if (bounds + 1 >= count || end - position >= SHARD_MAX_BOUND)
+        {
+            fprintf(stderr, "%s: %d shards take %d bounds shorter than %d bytes\n", spec, count, count - 1, SHARD_MAX_BOUND);
+            return -1;
+        }
+        bounds++;
+        map->boundLengths[bounds] = normalize_value(position, end - position, map->bounds[bounds], true,
+                                                    map->attribute.rule == CASE_IGNORE_MATCH);
+        if (bounds > 1 && shard_compare(map->bounds[bounds - 1], map->boundLengths[bounds - 1], map->bounds[bounds],
+                                        map->boundLengths[bounds]) >= 0)
+        {
+            fprintf(stderr, "%s: bounds have to be ascending\n", spec);
+            return -1;
+        }
+        position = *end == ',' ? end + 1 : end;
+    }
+    if (bounds != count - 1)
+    {
+        fprintf(stderr, "%s: %d shards take %d bounds\n", spec, count, count - 1);
+        return -1;
+    }
+    return 0;
+}
+
+int shard_of_key(const ShardMap *map, Field key)
+{
+    if (map->method == SHARD_HASH)
+        return hash_bytes(key.value, key.length) % map->count;
+
+    // a handful of bounds, a binary search would not pay off
+    int shard = 0;
+    while (shard + 1 < map->count &&
+           shard_compare(key.value, key.length, map->bounds[shard + 1], map->boundLengths[shard + 1]) >= 0)
+        shard++;
+    return shard;
+}
+
+int shard_of_value(const ShardMap *map, Field value)
+{
+    char stackKey[SHARD_MAX_BOUND];
+    char *key = value.length <= SHARD_MAX_BOUND ? stackKey : (char *)malloc(value.length);
+    if (key == NULL)
+        return 0;
+    Field normalized;
+    normalized.value = key;
+    normalized.length = normalize_value(value.value, value.length, key, true, map->attribute.rule == CASE_IGNORE_MATCH);
+    int shard = shard_of_key(map, normalized);
+    if (key != stackKey)
+        free(key);
+    return shard;
+}
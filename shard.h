@@ -0,0 +1,82 @@
+/**
+ *
+ * @file shard.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include "schema.h"
+#include "directory.h"
+
+enum ShardConst
+{
+    SHARD_MAX_COUNT = 16,   // backends a directory can be split across
+    SHARD_MAX_BOUND = 256   // the longest normalized lower bound of a range
+};
+
+enum ShardMethod
+{
+    SHARD_HASH = 0, // rows go to the shard of the hash of their rdn key
+    SHARD_RANGE = 1 // rows go to the last shard whose lower bound is not above their rdn key
+};
+
+/**
+ * Structure representing how the rows of a directory are split across shards.
+ *
+ * Rows are assigned by the normalized key of their rdn attribute, so a lookup of the
+ * rdn and the row itself always agree on the shard whatever the letter case or spacing.
+ */
+typedef struct
+{
+    enum ShardMethod method;                          /**< The ShardMethod. */
+    int count;                                        /**< The number of shards. */
+    Attribute attribute;                              /**< The rdn attribute, whose matching rule normalizes the keys. */
+    char bounds[SHARD_MAX_COUNT][SHARD_MAX_BOUND];    /**< The normalized lower bounds of shards 1 to count - 1 of a range. */
+    int boundLengths[SHARD_MAX_COUNT];                /**< The lengths of the bounds. */
+} ShardMap;
+
+/**
+ * Parse Shard Map.
+ *
+ * Parses "hash" or "range:<bound>,<bound>,..." with one bound less than the shards,
+ * in ascending order. The first shard takes every key below the first bound.
+ *
+ * @param map    A pointer to the map to fill.
+ * @param spec   The partitioning.
+ * @param count  The number of shards.
+ * @param schema A pointer to the schema, whose rdn attribute is the shard key.
+ *
+ * @return 0 on success, -1 if the partitioning is invalid.
+ */
+int shard_parse(ShardMap *map, const char *spec, int count, const Schema *schema);
+
+/**
+ * Get Shard of Key.
+ *
+ * @param map A pointer to the map.
+ * @param key The normalized rdn key.
+ *
+ * @return The shard holding the key.
+ */
+int shard_of_key(const ShardMap *map, Field key);
+
+/**
+ * Get Shard of Value.
+ *
+ * Normalizes the rdn value by the matching rule of the rdn attribute first.
+ *
+ * @param map   A pointer to the map.
+ * @param value The rdn value as stored in the database file or named by a dn.
+ *
+ * @return The shard holding the value.
+ */
+int shard_of_value(const ShardMap *map, Field value);
+
+#endif
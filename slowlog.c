@@ -0,0 +1,146 @@
+/**
+ *
+ * @file slowlog.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include "stats.h"
+#include "slowlog.h"
+
+/**
+ * Structure representing the queue of slow searches shared by all connections.
+ *
+ * Connections reserve a record by advancing head and publish it by setting its sequence,
+ * the writer thread consumes complete records in order and advances tail.
+ */
+typedef struct
+{
+    uint64_t head;                          /**< The number of reserved records. */
+    uint64_t tail;                          /**< The number of written records. */
+    SlowLogRecord records[SLOW_LOG_SLOTS];  /**< The ring of records. */
+} SlowLogQueue;
+
+__thread const char *clientAddress;
+uint64_t slowLogThreshold;
+static SlowLogQueue *queue;
+static int logFile = -1;
+static pthread_mutex_t writerLock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool slowlog_write_next(void)
+{
+    uint64_t tail = queue->tail;
+    SlowLogRecord *record = &queue->records[tail % SLOW_LOG_SLOTS];
+    if (__atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE) != tail + 1)
+        return false;
+
+    struct tm time;
+    gmtime_r(&record->time.tv_sec, &time);
+    char line[SLOW_LOG_CLIENT_SIZE + SLOW_LOG_PLAN_SIZE + 96];
+    int length = strftime(line, sizeof(line), "%Y-%m-%dT%H:%M:%S", &time);
+    length += snprintf(line + length, sizeof(line) - length, ".%03ldZ client=%s messageId=%d %s\n",
+                       record->time.tv_nsec / 1000000, record->client, record->messageId, record->plan);
+    if (length >= (int)sizeof(line))
+        length = sizeof(line) - 1;
+
+    // stdio is not used, a connection process forked while the writer holds its lock would inherit it
+    if (write(logFile, line, length) == -1)
+        perror("slow query log");
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+void slowlog_flush(void)
+{
+    if (queue == NULL)
+        return;
+    pthread_mutex_lock(&writerLock);
+    while (slowlog_write_next())
+        ;
+    pthread_mutex_unlock(&writerLock);
+}
+
+static void *slowlog_writer(void *arg)
+{
+    // the signal handlers flush the log themselves, they must not interrupt the writer holding the lock
+    sigset_t signals;
+    sigfillset(&signals);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    struct timespec pause = {0, SLOW_LOG_INTERVAL_MS * 1000000};
+    while (true)
+    {
+        slowlog_flush();
+        nanosleep(&pause, NULL);
+    }
+    return NULL;
+}
+
+int slowlog_init(const char *path, double threshold)
+{
+    logFile = path == NULL ? STDERR_FILENO : open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (logFile == -1)
+    {
+        perror(path);
+        return -1;
+    }
+
+    queue = (SlowLogQueue *)mmap(NULL, sizeof(SlowLogQueue), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (queue == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+    slowLogThreshold = threshold * 1000000;
+
+    pthread_t writer;
+    if (pthread_create(&writer, NULL, slowlog_writer, NULL) != 0)
+    {
+        perror("Thread creation failed");
+        exit(1);
+    }
+    pthread_detach(writer);
+    return 0;
+}
+
+bool slowlog_enabled(void)
+{
+    return queue != NULL;
+}
+
+void slowlog_submit(int messageId, const char *plan)
+{
+    stats_add(&stats->slowQueries, 1);
+
+    uint64_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    do
+    {
+        // a full queue loses the record rather than making the search wait for the disk
+        if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) >= SLOW_LOG_SLOTS)
+        {
+            stats_add(&stats->slowQueriesDropped, 1);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&queue->head, &head, head + 1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    SlowLogRecord *record = &queue->records[head % SLOW_LOG_SLOTS];
+    clock_gettime(CLOCK_REALTIME, &record->time);
+    record->messageId = messageId;
+    snprintf(record->client, sizeof(record->client), "%s", clientAddress != NULL ? clientAddress : "-");
+    snprintf(record->plan, sizeof(record->plan), "%s", plan);
+    __atomic_store_n(&record->sequence, head + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,88 @@
+/**
+ *
+ * @file slowlog.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _SLOWLOG_H
+#define _SLOWLOG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+enum SlowLogConst
+{
+    SLOW_LOG_SLOTS = 1024,        // queued records, a power of two
+    SLOW_LOG_CLIENT_SIZE = 64,    // the longest client address
+    SLOW_LOG_PLAN_SIZE = 384,     // the longest plan explanation
+    SLOW_LOG_INTERVAL_MS = 50     // pause of the writer when nothing is queued
+};
+
+/**
+ * Structure representing one slow search waiting to be written.
+ */
+typedef struct
+{
+    uint64_t sequence;                /**< The position of the record plus one once it is complete. */
+    struct timespec time;             /**< The wall clock time the search finished. */
+    int messageId;                    /**< The message id of the search. */
+    char client[SLOW_LOG_CLIENT_SIZE]; /**< The address of the client. */
+    char plan[SLOW_LOG_PLAN_SIZE];    /**< The plan explanation of the search. */
+} SlowLogRecord;
+
+/**
+ * The address of the client served by the current thread, set by the connection.
+ */
+extern __thread const char *clientAddress;
+
+/**
+ * Searches taking at least this many nanoseconds are logged.
+ */
+extern uint64_t slowLogThreshold;
+
+/**
+ * Initialize Slow Query Log.
+ *
+ * Maps the shared queue of slow searches and starts the thread writing them. Has to be
+ * called before the first connection process is created, the records of all processes
+ * are written by the thread of the listening process.
+ *
+ * @param path      The log file, appended to, or NULL to log to the standard error.
+ * @param threshold The threshold in milliseconds.
+ *
+ * @return 0 on success, -1 if the log could not be opened.
+ */
+int slowlog_init(const char *path, double threshold);
+
+/**
+ * Check whether the Slow Query Log is Enabled.
+ *
+ * @return true if slowlog_init() succeeded.
+ */
+bool slowlog_enabled(void);
+
+/**
+ * Queue Slow Search.
+ *
+ * Copies the record into the shared queue and returns without waiting for any I/O.
+ * The record is dropped and counted when the queue is full.
+ *
+ * @param messageId The message id of the search.
+ * @param plan      The null-terminated plan explanation.
+ */
+void slowlog_submit(int messageId, const char *plan);
+
+/**
+ * Write Queued Searches.
+ *
+ * Writes everything queued so far, used before the server exits.
+ */
+void slowlog_flush(void);
+
+#endif
@@ -0,0 +1,123 @@
+/**
+ *
+ * @file stats.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include "utils.h"
+#include "stats.h"
+
+Stats *stats;
+
+const StatsCounter statsCounters[] = {
+    {"requests", offsetof(Stats, requests)},
+    {"searches", offsetof(Stats, searches)},
+    {"compares", offsetof(Stats, compares)},
+    {"abandons", offsetof(Stats, abandons)},
+    {"outputPauses", offsetof(Stats, outputPauses)},
+    {"arenaAllocations", offsetof(Stats, arenaAllocations)},
+    {"arenaHeapCalls", offsetof(Stats, arenaHeapCalls)},
+    {"bloomChecks", offsetof(Stats, bloomChecks)},
+    {"bloomNegatives", offsetof(Stats, bloomNegatives)},
+    {"bloomFalsePositives", offsetof(Stats, bloomFalsePositives)},
+    {"compareBloomChecks", offsetof(Stats, compareBloomChecks)},
+    {"compareBloomNegatives", offsetof(Stats, compareBloomNegatives)},
+    {"cacheHits", offsetof(Stats, cacheHits)},
+    {"cacheMisses", offsetof(Stats, cacheMisses)},
+    {"cacheStores", offsetof(Stats, cacheStores)},
+    {"cacheEvictions", offsetof(Stats, cacheEvictions)},
+    {"cacheUncacheable", offsetof(Stats, cacheUncacheable)},
+    {"cacheBytesServed", offsetof(Stats, cacheBytesServed)},
+    {"searchesCoalesced", offsetof(Stats, searchesCoalesced)},
+    {"slowQueries", offsetof(Stats, slowQueries)},
+    {"slowQueriesDropped", offsetof(Stats, slowQueriesDropped)},
+    {"binds", offsetof(Stats, binds)},
+    {"bindFailures", offsetof(Stats, bindFailures)},
+    {"passwordVerifications", offsetof(Stats, passwordVerifications)},
+    {"credentialCacheHits", offsetof(Stats, credentialCacheHits)},
+    {"credentialCacheMisses", offsetof(Stats, credentialCacheMisses)},
+    {"updates", offsetof(Stats, updates)},
+    {"updateFailures", offsetof(Stats, updateFailures)},
+    {"walSyncs", offsetof(Stats, walSyncs)},
+    {"walCompactions", offsetof(Stats, walCompactions)},
+    {"proxyRouted", offsetof(Stats, proxyRouted)},
+    {"proxyFanouts", offsetof(Stats, proxyFanouts)},
+    {"indexPageHits", offsetof(Stats, indexPageHits)},
+    {"indexPageMisses", offsetof(Stats, indexPageMisses)},
+    {NULL, 0}};
+
+void stats_init(void)
+{
+    stats = (Stats *)mmap(NULL, sizeof(Stats), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+}
+
+void stats_add(size_t *counter, size_t value)
+{
+    __atomic_add_fetch(counter, value, __ATOMIC_RELAXED);
+}
+
+void stats_print(int level)
+{
+    debug(level, "Requests: %zu\n", stats->requests);
+    debug(level, "Searches: %zu\n", stats->searches);
+    debug(level, "Compares: %zu\n", stats->compares);
+    debug(level, "Searches abandoned: %zu\n", stats->abandons);
+    debug(level, "Paused for slow clients: %zu\n", stats->outputPauses);
+    debug(level, "Arena allocations: %zu\n", stats->arenaAllocations);
+    debug(level, "Arena heap calls: %zu\n", stats->arenaHeapCalls);
+    debug(level, "Bloom checks: %zu\n", stats->bloomChecks);
+    debug(level, "Bloom negatives: %zu\n", stats->bloomNegatives);
+    debug(level, "Bloom false positives: %zu\n", stats->bloomFalsePositives);
+    size_t misses = stats->bloomNegatives + stats->bloomFalsePositives;
+    debug(level, "Bloom false positive rate: %.4f\n", misses ? (double)stats->bloomFalsePositives / misses : 0.0);
+    debug(level, "Compare Bloom checks: %zu\n", stats->compareBloomChecks);
+    debug(level, "Compare Bloom negatives: %zu\n", stats->compareBloomNegatives);
+    debug(level, "Cache hits: %zu\n", stats->cacheHits);
+    debug(level, "Cache misses: %zu\n", stats->cacheMisses);
+    size_t lookups = stats->cacheHits + stats->cacheMisses;
+    debug(level, "Cache hit ratio: %.4f\n", lookups ? (double)stats->cacheHits / lookups : 0.0);
+    debug(level, "Cache stores: %zu\n", stats->cacheStores);
+    debug(level, "Cache evictions: %zu\n", stats->cacheEvictions);
+    debug(level, "Cache uncacheable: %zu\n", stats->cacheUncacheable);
+    debug(level, "Cache bytes served: %zu\n", stats->cacheBytesServed);
+    debug(level, "Searches coalesced: %zu\n", stats->searchesCoalesced);
+    debug(level, "Slow queries: %zu\n", stats->slowQueries);
+    debug(level, "Slow queries dropped: %zu\n", stats->slowQueriesDropped);
+    debug(level, "Binds: %zu\n", stats->binds);
+    debug(level, "Bind failures: %zu\n", stats->bindFailures);
+    debug(level, "Password verifications: %zu\n", stats->passwordVerifications);
+    debug(level, "Credential cache hits: %zu\n", stats->credentialCacheHits);
+    debug(level, "Credential cache misses: %zu\n", stats->credentialCacheMisses);
+    size_t credentials = stats->credentialCacheHits + stats->credentialCacheMisses;
+    debug(level, "Credential cache hit ratio: %.4f\n", credentials ? (double)stats->credentialCacheHits / credentials : 0.0);
+    debug(level, "Updates: %zu\n", stats->updates);
+    debug(level, "Update failures: %zu\n", stats->updateFailures);
+    debug(level, "Log syncs: %zu\n", stats->walSyncs);
+    debug(level, "Log compactions: %zu\n", stats->walCompactions);
+    debug(level, "Proxy requests routed: %zu\n", stats->proxyRouted);
+    debug(level, "Proxy searches fanned out: %zu\n", stats->proxyFanouts);
+    debug(level, "Index page hits: %zu\n", stats->indexPageHits);
+    debug(level, "Index page misses: %zu\n", stats->indexPageMisses);
+    size_t pages = stats->indexPageHits + stats->indexPageMisses;
+    debug(level, "Index page hit ratio: %.4f\n", pages ? (double)stats->indexPageHits / pages : 0.0);
+}
+
+size_t stats_get(const StatsCounter *counter)
+{
+    return __atomic_load_n((size_t *)((char *)stats + counter->offset), __ATOMIC_RELAXED);
+}
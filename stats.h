@@ -0,0 +1,116 @@
+/**
+ *
+ * @file stats.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <stddef.h>
+
+/**
+ * Structure representing server wide statistics.
+ *
+ * The structure lives in memory shared by the listening process and all connection
+ * processes, so every counter has to be updated with stats_add().
+ */
+typedef struct
+{
+    size_t requests;          /**< Number of handled LDAP requests. */
+    size_t searches;          /**< Number of handled search requests. */
+    size_t compares;          /**< Number of handled compare requests. */
+    size_t abandons;          /**< Number of searches abandoned while running. */
+    size_t outputPauses;      /**< Number of times a connection paused for a slow client. */
+    size_t arenaAllocations;  /**< Number of arena allocations made by requests. */
+    size_t arenaHeapCalls;    /**< Number of heap calls made by request arenas. */
+    size_t bloomChecks;       /**< Number of equality searches checked against a Bloom filter. */
+    size_t bloomNegatives;    /**< Number of searches answered by a Bloom filter miss. */
+    size_t bloomFalsePositives; /**< Number of Bloom filter hits that matched no entry. */
+    size_t compareBloomChecks;  /**< Number of compares checked against a Bloom filter, kept apart from searches. */
+    size_t compareBloomNegatives; /**< Number of compares answered false by a Bloom filter miss. */
+    size_t cacheHits;         /**< Number of searches answered from the query cache. */
+    size_t cacheMisses;       /**< Number of searches not found in the query cache. */
+    size_t cacheStores;       /**< Number of results stored in the query cache. */
+    size_t cacheEvictions;    /**< Number of results evicted from the query cache. */
+    size_t cacheUncacheable;  /**< Number of results too large for the query cache. */
+    size_t cacheBytesServed;  /**< Number of response bytes sent from cached results. */
+    size_t searchesCoalesced; /**< Number of searches answered by an identical search in flight. */
+    size_t slowQueries;       /**< Number of searches reaching the slow query threshold. */
+    size_t slowQueriesDropped; /**< Number of slow searches not logged because the log queue was full. */
+    size_t binds;             /**< Number of handled bind requests. */
+    size_t bindFailures;      /**< Number of binds rejected for invalid credentials. */
+    size_t passwordVerifications; /**< Number of password hashes derived to verify a bind. */
+    size_t credentialCacheHits;   /**< Number of binds verified by the credential cache. */
+    size_t credentialCacheMisses; /**< Number of binds not found in the credential cache. */
+    size_t updates;           /**< Number of handled add, delete and modify requests. */
+    size_t updateFailures;    /**< Number of add, delete and modify requests that changed nothing. */
+    size_t walSyncs;          /**< Number of syncs of the write-ahead log, each committing every change written before it. */
+    size_t walCompactions;    /**< Number of times the write-ahead log was compacted into the database file. */
+    size_t proxyRouted;       /**< Number of requests a proxy forwarded to the one shard holding their entry. */
+    size_t proxyFanouts;      /**< Number of searches a proxy forwarded to every shard. */
+    size_t indexPageHits;     /**< Number of disk index pages found in the buffer pool. */
+    size_t indexPageMisses;   /**< Number of disk index pages read from their file. */
+} Stats;
+
+/**
+ * Structure naming one counter of the statistics.
+ */
+typedef struct
+{
+    const char *name; /**< The name of the counter, usable as an attribute name. */
+    size_t offset;    /**< The offset of the counter in Stats. */
+} StatsCounter;
+
+/**
+ * Server wide statistics.
+ */
+extern Stats *stats;
+
+/**
+ * Names of all counters, terminated by an entry with a NULL name.
+ */
+extern const StatsCounter statsCounters[];
+
+/**
+ * Initialize Statistics.
+ *
+ * Maps the shared memory holding the statistics. Has to be called before
+ * the first connection process is created.
+ */
+void stats_init(void);
+
+/**
+ * Add Value to Statistics Counter.
+ *
+ * Atomically adds the value to the counter.
+ *
+ * @param counter A pointer to the counter in the shared statistics.
+ * @param value   The value to add.
+ */
+void stats_add(size_t *counter, size_t value);
+
+/**
+ * Print Statistics.
+ *
+ * Prints all counters using debug output.
+ *
+ * @param level The debug level of the output.
+ */
+void stats_print(int level);
+
+/**
+ * Get Statistics Counter.
+ *
+ * @param counter A pointer to the name of the counter.
+ *
+ * @return The current value of the counter.
+ */
+size_t stats_get(const StatsCounter *counter);
+
+#endif
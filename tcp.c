@@ -14,22 +14,48 @@
 
 
 #include <stdio.h>
+#include <errno.h>
 #include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
+#include <time.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "utils.h"
+#include "directory.h"
+#include "btree.h"
+#include "schema.h"
+#include "cache.h"
+#include "flight.h"
+#include "arena.h"
+#include "output.h"
+#include "stats.h"
+#include "trace.h"
+#include "monitor.h"
+#include "profile.h"
+#include "slowlog.h"
+#include "capture.h"
+#include "credcache.h"
+#include "overlay.h"
+#include "wal.h"
+#include "replication.h"
+#include "proxy.h"
+#include "response.h"
 #include "tcp.h"
 #include "ldap.h"
 
 volatile int ctrl_c_received = false;
+volatile sig_atomic_t profileRequested = false;
 int clientSocket, serverSocket;
-FILE *filePtr;
+Directory directory;
 pid_t pid;
+bool isChild = false; // set in a forked connection process, whose pid is not 0 once it ran getpid()
 
 Conn ParseArgs(int argc, char *const argv[])
 {
@@ -37,8 +63,25 @@ Conn ParseArgs(int argc, char *const argv[])
     Conn conn;
     conn.port = DEFAULT_PORT;
     conn.filePath = NULL;
-
-    while ((opt = getopt(argc, argv, "p:f:")) != -1)
+    conn.schemaPath = NULL;
+    conn.cacheBudget = CACHE_DEFAULT_BUDGET;
+    conn.threaded = false;
+    conn.traceLevel = TRACE_OFF;
+    conn.tracePath = NULL;
+    conn.profilePath = NULL;
+    conn.slowThreshold = -1;
+    conn.slowLogPath = NULL;
+    conn.capturePath = NULL;
+    conn.credentialTtl = CREDENTIAL_CACHE_DEFAULT_TTL;
+    conn.walPath = NULL;
+    conn.walCompactSize = WAL_DEFAULT_COMPACT_SIZE;
+    conn.replicationAddress = NULL;
+    conn.primaryAddress = NULL;
+    conn.backends = NULL;
+    conn.partitioning = "hash";
+    conn.indexPoolSize = 0;
+
+    while ((opt = getopt(argc, argv, "p:f:s:c:td:T:P:S:L:C:K:w:W:R:r:X:H:I:")) != -1)
     {
         switch (opt)
         {
@@ -48,13 +91,64 @@ Conn ParseArgs(int argc, char *const argv[])
         case 'f':
             conn.filePath = optarg;
             break;
+        case 's':
+            conn.schemaPath = optarg;
+            break;
+        case 'c':
+            conn.cacheBudget = strtoull(optarg, NULL, 10);
+            break;
+        case 't':
+            conn.threaded = true;
+            break;
+        case 'd':
+            conn.traceLevel = atoi(optarg);
+            break;
+        case 'T':
+            conn.tracePath = optarg;
+            break;
+        case 'P':
+            conn.profilePath = optarg;
+            break;
+        case 'S':
+            conn.slowThreshold = atof(optarg);
+            break;
+        case 'L':
+            conn.slowLogPath = optarg;
+            break;
+        case 'C':
+            conn.capturePath = optarg;
+            break;
+        case 'K':
+            conn.credentialTtl = atof(optarg);
+            break;
+        case 'w':
+            conn.walPath = optarg;
+            break;
+        case 'W':
+            conn.walCompactSize = strtoull(optarg, NULL, 10);
+            break;
+        case 'R':
+            conn.replicationAddress = optarg;
+            break;
+        case 'r':
+            conn.primaryAddress = optarg;
+            break;
+        case 'X':
+            conn.backends = optarg;
+            break;
+        case 'H':
+            conn.partitioning = optarg;
+            break;
+        case 'I':
+            conn.indexPoolSize = strtoull(optarg, NULL, 10);
+            break;
         default:
-            fprintf(stderr, "Usage: %s -p <port> -f <file>\n", argv[0]);
+            fprintf(stderr, "Usage: %s -p <port> -f <file> [-s <schema>] [-c <cache bytes>] [-t] [-d <level>] [-T <trace dir>] [-P <profile file>] [-S <slow ms> [-L <slow log>]] [-C <capture file>] [-K <credential ttl s>] [-w <write-ahead log> [-W <compaction bytes>] [-R <replication address>]] [-r <primary address>] [-X <backend,...> [-H hash|range:<bound>,...]] [-I <index pool bytes>]\n", argv[0]);
             exit(EXIT_FAILURE);
         }
     }
 
-    if (conn.port == -1 || conn.filePath == NULL)
+    if (conn.port == -1 || (conn.filePath == NULL && conn.backends == NULL))
     {
         fprintf(stderr, "Usage: %s  -p <port> -f <file> port %d  filePath %s\n", argv[0], conn.port, conn.filePath);
         exit(EXIT_FAILURE);
@@ -66,13 +160,76 @@ Conn ParseArgs(int argc, char *const argv[])
         exit(EXIT_FAILURE);
     }
 
-    conn.filePtr = fopen(conn.filePath, "r");
-    filePtr = conn.filePtr;
-    if (conn.filePtr == NULL)
+    // replicas stream the log of the primary, they have none of their own
+    if (conn.replicationAddress != NULL && conn.walPath == NULL)
+    {
+        fprintf(stderr, "Serving replicas with -R requires a write-ahead log given by -w\n");
+        exit(EXIT_FAILURE);
+    }
+    if (conn.primaryAddress != NULL && conn.walPath != NULL)
+    {
+        fprintf(stderr, "A replica given -r is read-only and cannot have a write-ahead log\n");
+        exit(EXIT_FAILURE);
+    }
+    // the backends hold the rows and logs, every client thread of a proxy shares its connections to them
+    if (conn.backends != NULL &&
+        (conn.walPath != NULL || conn.replicationAddress != NULL || conn.primaryAddress != NULL || conn.indexPoolSize != 0))
+    {
+        fprintf(stderr, "A proxy given -X keeps no rows and cannot have a write-ahead log, replicas or disk indexes\n");
+        exit(EXIT_FAILURE);
+    }
+    if (conn.backends != NULL)
+        conn.threaded = true;
+
+    // the level decides which startup messages are printed
+    if (trace_init(conn.tracePath, conn.traceLevel) == -1)
+        exit(EXIT_FAILURE);
+
+    Schema schema;
+    if (conn.schemaPath == NULL)
+        schema_default(&schema);
+    else if (schema_load(&schema, conn.schemaPath) == -1)
+        exit(EXIT_FAILURE);
+
+    conn.directory = &directory;
+    if (conn.backends != NULL)
+    {
+        // entries are named and routed by the schema and suffix shared with the backends
+        directory.schema = schema;
+        directory.dnSuffix = DIRECTORY_DN_SUFFIX;
+        return conn;
+    }
+
+    // a replica loads the snapshot of its primary instead of the file it was left with
+    if (conn.primaryAddress != NULL && replication_fetch(conn.primaryAddress, conn.filePath, schema.attributeCount) == -1)
+        exit(EXIT_FAILURE);
+
+    struct timespec loadStart, loadEnd;
+    clock_gettime(CLOCK_MONOTONIC, &loadStart);
+    if (directory_load(&directory, &schema, conn.filePath, 0) == -1)
     {
         fprintf(stderr, "Failed to open file %s\n", conn.filePath);
         exit(EXIT_FAILURE);
     }
+    clock_gettime(CLOCK_MONOTONIC, &loadEnd);
+    double loadTime = (loadEnd.tv_sec - loadStart.tv_sec) + (loadEnd.tv_nsec - loadStart.tv_nsec) / 1e9;
+    debug(1, "Loaded %zu lines (%zu bytes) in %.3f s\n", directory.lineCount, directory.size, loadTime);
+
+    // the disk indexes are kept next to the file and rebuilt once it changed
+    if (conn.indexPoolSize != 0)
+    {
+        int built = directory_open_trees(&directory, conn.filePath);
+        if (built == -1)
+        {
+            fprintf(stderr, "Failed to open the disk indexes of %s\n", conn.filePath);
+            exit(EXIT_FAILURE);
+        }
+        debug(1, "Disk indexes: %zu bytes, %d rebuilt, buffer pool %zu bytes\n", directory.treeSize, built, conn.indexPoolSize);
+    }
+    if (directory.lineCount > 0)
+        debug(1, "Memory per line: %.1f bytes (%.1f bytes without interning), indexes %.1f bytes\n",
+              (double)directory.memory / directory.lineCount, (double)directory.naiveMemory / directory.lineCount,
+              (double)directory.indexMemory / directory.lineCount);
 
     return conn;
 }
@@ -131,8 +288,10 @@ void handle_sigint(int signum)
     // Set the ctrl_c_received flag to indicate that a Ctrl+C signal was received
     ctrl_c_received = 1;
 
-    if (pid == 0)
+    if (isChild)
     {
+        // the records of the connection are still in its buffer
+        capture_close();
        debug(1, "Client socket closing..\n");
         if (close(clientSocket) == 0)
            debug(1, "Client socket closed.\n");
@@ -143,16 +302,58 @@ void handle_sigint(int signum)
         if (close(serverSocket) == 0)
            debug(1, "Welcome socket closed.\n");
     }
-    if (fclose(filePtr) == 0)
-       debug(1, "file ptr closed.\n");
+    directory_dispose(&directory);
+    debug(1, "directory closed.\n");
+    if (!isChild)
+    {
+        slowlog_flush();
+        stats_print(1);
+    }
 
     exit(EXIT_SUCCESS);
 }
 
+void handle_sigusr2(int signum)
+{
+    // cycles through the trace levels of all connections
+    trace_set_level((*traceLevel + 1) % (TRACE_VERBOSE + 1));
+}
+
+void handle_sigusr1(int signum)
+{
+    // the report is printed by the accept loop, printf is not safe in a handler
+    profileRequested = true;
+}
+
+void *ClientThread(void *arg)
+{
+    int socket = (int)(intptr_t)arg;
+
+    // the profile report is left to the accepting thread
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    if (proxy_is_enabled())
+        proxy_serve(socket);
+    else
+        ldap(socket, &directory);
+
+    if (close(socket) == -1)
+        printf("Unable to close socket. %d\n", (int)pid);
+    trace_close();
+    return NULL;
+}
+
 void Accept(Conn conn)
 {
-    struct sockaddr_in client_addr;
-    socklen_t client_addr_len = sizeof(client_addr);
+    // the listening socket is IPv6, the address of a client does not fit into sockaddr_in
+    struct sockaddr_storage client_addr;
+    socklen_t client_addr_len;
+
+    if (conn.threaded)
+        pid = getpid();
 
     while (1)
     {
@@ -163,15 +364,43 @@ void Accept(Conn conn)
             // then it will exit.
             break;
         }
+        if (profileRequested)
+        {
+            profileRequested = false;
+            profile_dump();
+        }
 
+        client_addr_len = sizeof(client_addr);
         clientSocket = accept(serverSocket, (struct sockaddr *)&client_addr, &client_addr_len);
         if (clientSocket == -1)
         {
-            perror("Accepting connection failed");
+            // a signal interrupting the wait is not an error
+            if (errno != EINTR)
+                perror("Accepting connection failed");
             continue;
         }
+        // responses are already coalesced into one write per round, waiting for more only adds latency
+        if (setsockopt(clientSocket, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int)) < 0)
+            perror("setsockopt(TCP_NODELAY) failed");
 
-        // Create a new process to handle the client
+        if (conn.threaded)
+        {
+            // Create a new thread to handle the client
+            pthread_t thread;
+            if (pthread_create(&thread, NULL, ClientThread, (void *)(intptr_t)clientSocket) != 0)
+            {
+                perror("Thread creation failed");
+                if (close(clientSocket) == -1)
+                    printf("Unable to close socket. %d\n", (int)pid);
+                continue;
+            }
+            pthread_detach(thread);
+            continue;
+        }
+
+        // Create a new process to handle the client, buffered output would be written by both
+        fflush(stdout);
+        fflush(stderr);
         pid = fork();
         if (pid == -1)
         {
@@ -192,17 +421,19 @@ void Accept(Conn conn)
         if (pid == 0)
         {
             pid = getpid();
+            isChild = true;
             //* Child process
+            trace_after_fork();
             if (close(serverSocket) == -1)
                 printf("Unable to close socket. %d\n", (int)pid); // Close the server socket in the child process
+            replication_close();
 
-            debug(1, "New client connection established: socket fd=%d\n", clientSocket);
-            ldap(clientSocket, conn.filePtr);
-            debug(1,"Comunication done closing client socket fd=%d\n", clientSocket);
+            ldap(clientSocket, conn.directory);
 
             if (close(clientSocket) == -1)
                 printf("Unable to close socket. %d\n", (int)pid);
 
+            trace_close();
             exit(EXIT_SUCCESS);
         }
     }
@@ -210,54 +441,91 @@ void Accept(Conn conn)
 
 void ldap_send(unsigned char *bufin, int clientSocket, int offset)
 {
-    int bytestx;
+    int stage = profile_switch(PROFILE_SEND);
+    trace_bytes(bufin, offset);
+    capture_data(CAPTURE_RESPONSE, bufin, offset);
+    if (responseCapture != NULL)
+        flight_capture(bufin, offset);
+
+    // the connection loop sends the queue once the socket is writable
+    if (outputQueue != NULL)
+    {
+        output_queue_push(outputQueue, bufin, offset);
+        profile_switch(stage);
+        return;
+    }
+
     // try to send buffer to connected client
-    bytestx = send(clientSocket, bufin, offset, 0);
-    if (bytestx < 0)
-        perror("ERROR in sendto");
-    debug(1,"Data has been sent to connected client:\n");
+    int bytestx = 0;
+    while (bytestx < offset)
+    {
+        int sent = send(clientSocket, bufin + bytestx, offset - bytestx, MSG_NOSIGNAL);
+        if (sent < 0)
+        {
+            perror("ERROR in sendto");
+            break;
+        }
+        bytestx += sent;
+    }
+    profile_switch(stage);
 }
 
-unsigned char *ldap_receive(int clientSocket, size_t *receivedBytes)
+int ldap_receive(int clientSocket, unsigned char *buffer, size_t size)
 {
-    unsigned char buffer[MAX_BUFFER_SIZE];
-    int bytesReceived;
-
-    // Receive data into the buffer using recv
-    bytesReceived = recv(clientSocket, buffer, sizeof(buffer), 0);
+    int bytesReceived = recv(clientSocket, buffer, size, 0);
 
     if (bytesReceived < 0)
     {
+        // handled as a closed connection
         perror("recv");
-        exit(1);
-    }
-
-    // Allocate memory for the received data
-    unsigned char *receivedData = (unsigned char *)malloc(bytesReceived);
-    if (receivedData == NULL)
-    {
-        perror("malloc");
-        exit(1);
+        bytesReceived = 0;
     }
+    capture_data(CAPTURE_REQUEST, buffer, bytesReceived);
 
-    // Copy the received data to the allocated array
-    memcpy(receivedData, buffer, bytesReceived);
-
-    // Set the receivedBytes to the actual number of received bytes
-    *receivedBytes = bytesReceived;
-
-    return receivedData;
+    return bytesReceived;
 }
 
 int main(int argc, char *const argv[])
 {
     signal(SIGINT, handle_sigint);
+    signal(SIGUSR2, handle_sigusr2);
     Conn conn = ParseArgs(argc, argv);
+    response_init();
+    if (conn.profilePath != NULL)
+    {
+        // without SA_RESTART the signal wakes up the blocked accept() to print the report
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = handle_sigusr1;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, NULL);
+        profile_init(conn.profilePath);
+    }
+    stats_init();
+    if (conn.slowThreshold >= 0 && slowlog_init(conn.slowLogPath, conn.slowThreshold) == -1)
+        exit(EXIT_FAILURE);
+    if (conn.capturePath != NULL && capture_init(conn.capturePath) == -1)
+        exit(EXIT_FAILURE);
+    monitor_init();
+    cache_init(conn.cacheBudget);
+    btree_pool_init(conn.indexPoolSize);
+    credcache_init(conn.credentialTtl);
+    if (conn.walPath != NULL &&
+        (overlay_create(conn.directory) == -1 || wal_open(conn.directory, conn.walPath, conn.filePath, conn.walCompactSize) == -1))
+        exit(EXIT_FAILURE);
+    if (conn.replicationAddress != NULL && replication_listen(conn.replicationAddress, conn.directory) == -1)
+        exit(EXIT_FAILURE);
+    if (conn.backends != NULL && proxy_init(conn.backends, conn.partitioning, conn.directory) == -1)
+        exit(EXIT_FAILURE);
+    if (conn.primaryAddress != NULL && (overlay_create(conn.directory) == -1 || replication_follow(conn.directory) == -1))
+        exit(EXIT_FAILURE);
+    if (conn.threaded)
+        flight_init();
     serverSocket = CreateSocket();
     BindSocket(conn);
     Listen(conn);
     Accept(conn);
-    fclose(conn.filePtr);
+    directory_dispose(conn.directory);
     close(serverSocket);
     return 1;
 }
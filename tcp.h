@@ -32,12 +32,83 @@ int DEFAULT_PORT = 389;
  *
  * @var char* Conn::file
  * Path to the csv file containing ldap database
+ *
+ * @var char* Conn::schemaPath
+ * Path to the schema of the csv file or NULL for the default cn, uid and mail columns
+ *
+ * @var Directory* Conn::directory
+ * The loaded ldap database
+ *
+ * @var size_t Conn::cacheBudget
+ * Memory budget of the query cache in bytes
+ *
+ * @var bool Conn::threaded
+ * Serve clients by threads instead of processes
+ *
+ * @var int Conn::traceLevel
+ * Initial trace level, changed at runtime by SIGUSR2
+ *
+ * @var char* Conn::tracePath
+ * Directory receiving the trace rings or NULL to trace nothing
+ *
+ * @var char* Conn::profilePath
+ * File receiving the folded stage profile on SIGUSR1 or NULL to not profile
+ *
+ * @var double Conn::slowThreshold
+ * Searches taking at least this many milliseconds are logged, negative to log none
+ *
+ * @var char* Conn::slowLogPath
+ * File the slow searches are appended to or NULL for the standard error
+ *
+ * @var char* Conn::capturePath
+ * File recording the traffic of all connections or NULL to capture nothing
+ *
+ * @var double Conn::credentialTtl
+ * Seconds a verified bind password is remembered by the credential cache, 0 to verify every bind
+ *
+ * @var char* Conn::walPath
+ * Write-ahead log of add, delete and modify requests or NULL to serve the database read-only
+ *
+ * @var size_t Conn::walCompactSize
+ * Log size in bytes that makes a write compact the log into the database file, 0 to never compact
+ *
+ * @var char* Conn::replicationAddress
+ * Port, host:port or Unix socket path replicas connect to or NULL to serve no replicas
+ *
+ * @var char* Conn::primaryAddress
+ * Address of the primary followed by this read-only replica or NULL to serve the database file
+ *
+ * @var char* Conn::backends
+ * Comma separated addresses of the shards served as a proxy or NULL to serve the database file
+ *
+ * @var char* Conn::partitioning
+ * How the rows are split across the shards, "hash" or "range:<bound>,..."
+ *
+ * @var size_t Conn::indexPoolSize
+ * Memory budget in bytes of the buffer pool of the disk indexes or 0 to keep the indexes in memory
  */
 typedef struct
 {
     int port;
     char *filePath;
-    FILE *filePtr;
+    char *schemaPath;
+    Directory *directory;
+    size_t cacheBudget;
+    bool threaded;
+    int traceLevel;
+    char *tracePath;
+    char *profilePath;
+    double slowThreshold;
+    char *slowLogPath;
+    char *capturePath;
+    double credentialTtl;
+    char *walPath;
+    size_t walCompactSize;
+    char *replicationAddress;
+    char *primaryAddress;
+    char *backends;
+    char *partitioning;
+    size_t indexPoolSize;
 
 } Conn;
 
@@ -47,6 +118,10 @@ typedef struct
  * @param argc Count of arguments passed by user.
  * @param argv Array od arguments.
  *
+ * Loads the database file given by the -f option with the schema given by the -s option.
+ * A replica given the -r option first replaces the file with the snapshot of its primary.
+ * A proxy given the -X option loads no file, only the schema its backends share.
+ *
  * @return Struct Conn containing connection information.
  */
 Conn ParseArgs(int argc, char *const argv[]);
@@ -74,9 +149,16 @@ void BindSocket(Conn conn);
  */
 void Listen(Conn conn);
 
+/**
+ * Serve client in a thread
+ *  @param arg Client socket cast to a pointer
+ *
+ */
+void *ClientThread(void *arg);
+
 /**
  * Accept connection from client
- * Creates new process using fork and new client socket
+ * Creates new process using fork (or new thread in threaded mode) and new client socket
  *  @param conn Conn structure containig connection information
  *
  */
@@ -0,0 +1,176 @@
+/**
+ *
+ * @file gendir.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * Generator of synthetic database files with skewed names and domains.
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+enum GenConst
+{
+    GEN_BUFFER_SIZE = 1 << 20 // bytes written at once
+};
+
+/**
+ * Structure representing a name and its ASCII spelling used in mail addresses.
+ */
+typedef struct
+{
+    const char *name;  /**< The name as written, UTF-8. */
+    const char *ascii; /**< The lowercase ASCII spelling. */
+} GenName;
+
+// ordered from the most to the least common, the Zipf distribution follows the order
+static const GenName surnames[] = {
+    {"Novák", "novak"}, {"Svoboda", "svoboda"}, {"Novotný", "novotny"}, {"Dvořák", "dvorak"},
+    {"Černý", "cerny"}, {"Procházka", "prochazka"}, {"Kučera", "kucera"}, {"Veselý", "vesely"},
+    {"Horák", "horak"}, {"Němec", "nemec"}, {"Marek", "marek"}, {"Pospíšil", "pospisil"},
+    {"Pokorný", "pokorny"}, {"Hájek", "hajek"}, {"Král", "kral"}, {"Jelínek", "jelinek"},
+    {"Růžička", "ruzicka"}, {"Beneš", "benes"}, {"Fiala", "fiala"}, {"Sedláček", "sedlacek"},
+    {"Doležal", "dolezal"}, {"Zeman", "zeman"}, {"Kolář", "kolar"}, {"Navrátil", "navratil"},
+    {"Čermák", "cermak"}, {"Vaněk", "vanek"}, {"Urban", "urban"}, {"Blažek", "blazek"},
+    {"Kříž", "kriz"}, {"Kovář", "kovar"}, {"Kratochvíl", "kratochvil"}, {"Bartoš", "bartos"},
+    {"Müller", "muller"}, {"Schmidt", "schmidt"}, {"Nguyen", "nguyen"}, {"Nguyễn Văn", "nguyenvan"},
+    {"García", "garcia"}, {"Østergaard", "ostergaard"}, {"Łukasiewicz", "lukasiewicz"}, {"Smith", "smith"},
+    {"Иванов", "ivanov"}, {"Παπαδόπουλος", "papadopoulos"}, {"王", "wang"}, {"佐藤", "sato"},
+    {"Balek", "balek"}, {"Balušík", "balusik"}, {"O'Brien", "obrien"}, {"da Silva", "dasilva"},
+};
+
+static const GenName givenNames[] = {
+    {"Jan", "jan"}, {"Petr", "petr"}, {"Jiří", "jiri"}, {"Tomáš", "tomas"}, {"Jana", "jana"},
+    {"Marie", "marie"}, {"Martin", "martin"}, {"Eva", "eva"}, {"Lukáš", "lukas"}, {"Hana", "hana"},
+    {"Miroslav", "miroslav"}, {"Lucie", "lucie"}, {"Ondřej", "ondrej"}, {"Kateřina", "katerina"},
+    {"Zuzana", "zuzana"}, {"Šárka", "sarka"}, {"David", "david"}, {"Tereza", "tereza"},
+    {"Zoë", "zoe"}, {"José", "jose"}, {"Søren", "soren"}, {"Анна", "anna"}, {"明", "ming"}, {"Aiyana", "aiyana"},
+};
+
+static const char *domains[] = {
+    "stud.fit.vutbr.cz", "fit.vutbr.cz", "vutbr.cz", "seznam.cz", "gmail.com", "centrum.cz",
+    "email.cz", "outlook.com", "muni.cz", "cvut.cz", "example.org", "mail.ru",
+};
+
+static const size_t surnameCount = sizeof(surnames) / sizeof(surnames[0]);
+static const size_t givenNameCount = sizeof(givenNames) / sizeof(givenNames[0]);
+static const size_t domainCount = sizeof(domains) / sizeof(domains[0]);
+
+static uint64_t state;
+
+static double next_random(void)
+{
+    // xorshift64*, the upper 53 bits form the fraction
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return ((state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double *zipf_table(size_t count, double skew)
+{
+    double *cumulative = (double *)malloc(count * sizeof(double));
+    double sum = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        sum += 1.0 / pow(i + 1, skew);
+        cumulative[i] = sum;
+    }
+    for (size_t i = 0; i < count; i++)
+        cumulative[i] /= sum;
+    return cumulative;
+}
+
+static size_t zipf_pick(const double *cumulative, size_t count)
+{
+    double value = next_random();
+    size_t low = 0, high = count - 1;
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        if (cumulative[middle] < value)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+int main(int argc, char *const argv[])
+{
+    int opt;
+    size_t rows = 10000;
+    double skew = 1.0;
+    const char *output = NULL;
+    state = 0x9E3779B97F4A7C15ULL;
+
+    while ((opt = getopt(argc, argv, "n:z:s:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            rows = strtoull(optarg, NULL, 10);
+            break;
+        case 'z':
+            skew = atof(optarg);
+            break;
+        case 's':
+            state = strtoull(optarg, NULL, 10) * 0x9E3779B97F4A7C15ULL + 1;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n rows] [-z skew] [-s seed] [-o file]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (skew < 0)
+    {
+        fprintf(stderr, "Usage: %s [-n rows] [-z skew] [-s seed] [-o file]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *file = output == NULL ? stdout : fopen(output, "w");
+    if (file == NULL)
+    {
+        perror(output);
+        exit(EXIT_FAILURE);
+    }
+    static char buffer[GEN_BUFFER_SIZE];
+    setvbuf(file, buffer, _IOFBF, sizeof(buffer));
+
+    double *surnameTable = zipf_table(surnameCount, skew);
+    double *givenTable = zipf_table(givenNameCount, skew);
+    double *domainTable = zipf_table(domainCount, skew);
+
+    // the uids are the ones the load generator uses with -n, the mail contains the uid so infix searches find it
+    for (size_t row = 0; row < rows; row++)
+    {
+        const GenName *surname = &surnames[zipf_pick(surnameTable, surnameCount)];
+        const GenName *given = &givenNames[zipf_pick(givenTable, givenNameCount)];
+        const char *domain = domains[zipf_pick(domainTable, domainCount)];
+        fprintf(file, "%s %s;x%07zu;%s.%s.x%07zu@%s\r\n", surname->name, given->name, row,
+                given->ascii, surname->ascii, row, domain);
+    }
+
+    free(surnameTable);
+    free(givenTable);
+    free(domainTable);
+    if (fclose(file) != 0)
+    {
+        perror(output != NULL ? output : "stdout");
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
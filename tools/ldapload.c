@@ -0,0 +1,745 @@
+/**
+ *
+ * @file ldapload.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * Load generator sending a mix of binds, searches and compares over many connections.
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "histogram.h"
+
+enum LoadConst
+{
+    LOAD_MAX_DEPTH = 256,       // requests of one connection waiting for a response
+    LOAD_BUFFER_SIZE = 1 << 16, // bytes buffered per connection and direction
+    LOAD_REQUEST_SIZE = 512,    // the longest encoded request
+    LOAD_DRAIN_MS = 2000        // time the responses to the last requests are waited for
+};
+
+enum LoadKind
+{
+    LOAD_BIND,
+    LOAD_EQUALITY,
+    LOAD_PREFIX,
+    LOAD_INFIX,
+    LOAD_COMPARE,
+    LOAD_BOOLEAN,
+    LOAD_KIND_COUNT
+};
+
+static const char *kindNames[LOAD_KIND_COUNT] = {"bind", "equality", "prefix", "infix", "compare", "boolean"};
+
+/**
+ * Structure representing one connection to the server.
+ */
+typedef struct
+{
+    int socket;                                /**< The connected socket or -1 once it failed. */
+    unsigned char input[LOAD_BUFFER_SIZE];     /**< Received bytes not parsed yet. */
+    size_t inputLength;                        /**< The number of received bytes not parsed yet. */
+    unsigned char output[LOAD_BUFFER_SIZE];    /**< Encoded requests not sent yet. */
+    size_t outputLength;                       /**< The number of encoded bytes not sent yet. */
+    uint64_t started[LOAD_MAX_DEPTH];          /**< The time every waiting request was due. */
+    unsigned char kinds[LOAD_MAX_DEPTH];       /**< The LoadKind of every waiting request. */
+    bool waiting[LOAD_MAX_DEPTH];              /**< Flags of the slots holding a waiting request. */
+    int outstanding;                           /**< The number of waiting requests. */
+    int nextId;                                /**< The message id of the next request. */
+    uint64_t due;                              /**< The time the next request is due in the open loop. */
+} LoadConnection;
+
+/**
+ * Structure representing one thread driving a group of connections.
+ */
+typedef struct
+{
+    pthread_t thread;                          /**< The thread. */
+    LoadConnection *connections;               /**< The connections of the thread. */
+    int count;                                 /**< The number of connections. */
+    uint64_t random;                           /**< The state of the random generator. */
+    Histogram latency[LOAD_KIND_COUNT];        /**< The latencies in nanoseconds by request kind. */
+    uint64_t errors[LOAD_KIND_COUNT];          /**< The number of failed requests by kind. */
+    uint64_t entries;                          /**< The number of received search result entries. */
+    uint64_t bytes;                            /**< The number of received bytes. */
+    uint64_t sent;                             /**< The number of sent requests. */
+} LoadWorker;
+
+/**
+ * Structure representing the parameters of the run.
+ */
+typedef struct
+{
+    const char *host;               /**< The address of the server. */
+    const char *port;               /**< The port of the server. */
+    int connections;                /**< The number of connections. */
+    int threads;                    /**< The number of threads. */
+    double duration;                /**< The length of the run in seconds. */
+    double rate;                    /**< Requests per second of all connections, 0 for the closed loop. */
+    int depth;                      /**< Requests kept waiting per connection in the closed loop. */
+    int weights[LOAD_KIND_COUNT];   /**< The relative frequency of every request kind. */
+    int weightSum;                  /**< The sum of the weights. */
+    char **keys;                    /**< The uid values requests are made of. */
+    size_t keyCount;                /**< The number of uid values. */
+    const char *suffix;             /**< The dn suffix of the directory. */
+    bool json;                      /**< Flag indicating whether the results are printed as JSON. */
+    double wait;                    /**< Seconds the server is waited for, e.g. while it loads its file. */
+} LoadConfig;
+
+static LoadConfig config;
+static uint64_t endTime;
+
+static uint64_t now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    // xorshift64*, good enough to pick keys and request kinds
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+static void put_length(unsigned char *buff, int *offset, int length)
+{
+    if (length < 0x80)
+    {
+        buff[(*offset)++] = length;
+        return;
+    }
+    buff[(*offset)++] = 0x82;
+    buff[(*offset)++] = length >> 8;
+    buff[(*offset)++] = length & 0xFF;
+}
+
+static void put_element(unsigned char *buff, int *offset, int tag, const void *value, int length)
+{
+    buff[(*offset)++] = tag;
+    put_length(buff, offset, length);
+    memcpy(buff + *offset, value, length);
+    *offset += length;
+}
+
+static void put_integer(unsigned char *buff, int *offset, int tag, int value)
+{
+    unsigned char bytes[5];
+    int length = 0;
+    // the leading zero keeps values with the highest bit set positive
+    for (int shift = 24; shift >= 0; shift -= 8)
+    {
+        if (length == 0 && shift > 0 && ((value >> shift) & 0xFF) == 0 && ((value >> (shift - 8)) & 0x80) == 0)
+            continue;
+        bytes[length++] = (value >> shift) & 0xFF;
+    }
+    put_element(buff, offset, tag, bytes, length);
+}
+
+static int encode_filter(unsigned char *buff, int kind, const char *key)
+{
+    unsigned char substrings[LOAD_REQUEST_SIZE];
+    int offset = 0, length = 0;
+    int keyLength = strlen(key);
+
+    switch (kind)
+    {
+    case LOAD_EQUALITY:
+        put_element(substrings, &length, 0x04, "uid", 3);
+        put_element(substrings, &length, 0x04, key, keyLength);
+        put_element(buff, &offset, 0xA3, substrings, length);
+        return offset;
+
+    case LOAD_PREFIX:;
+        // the key without its last character matches a handful of entries
+        unsigned char initial[LOAD_REQUEST_SIZE];
+        int initialLength = 0;
+        put_element(initial, &initialLength, 0x80, key, keyLength > 1 ? keyLength - 1 : keyLength);
+        put_element(substrings, &length, 0x04, "uid", 3);
+        put_element(substrings, &length, 0x30, initial, initialLength);
+        put_element(buff, &offset, 0xA4, substrings, length);
+        return offset;
+
+    case LOAD_BOOLEAN:
+        // the equality and the infix filter of the same key, both match the same entry
+        length = encode_filter(substrings, LOAD_EQUALITY, key);
+        length += encode_filter(substrings + length, LOAD_INFIX, key);
+        put_element(buff, &offset, 0xA0, substrings, length);
+        return offset;
+
+    default:;
+        // the middle of the key can be anywhere in the mail, so every row is scanned
+        unsigned char any[LOAD_REQUEST_SIZE];
+        int anyLength = 0;
+        int start = keyLength / 4, end = keyLength - keyLength / 4;
+        put_element(any, &anyLength, 0x81, key + start, end > start ? end - start : keyLength);
+        put_element(substrings, &length, 0x04, "mail", 4);
+        put_element(substrings, &length, 0x30, any, anyLength);
+        put_element(buff, &offset, 0xA4, substrings, length);
+        return offset;
+    }
+}
+
+static int encode_request(unsigned char *buff, int kind, int messageId, const char *key)
+{
+    unsigned char operation[LOAD_REQUEST_SIZE], body[LOAD_REQUEST_SIZE], tail[LOAD_REQUEST_SIZE];
+    int operationLength = 0, bodyLength = 0, tailLength = 0, offset = 0;
+
+    switch (kind)
+    {
+    case LOAD_BIND:
+        put_integer(body, &bodyLength, 0x02, 3);
+        put_element(body, &bodyLength, 0x04, "", 0);
+        put_element(body, &bodyLength, 0x80, "", 0);
+        put_element(operation, &operationLength, 0x60, body, bodyLength);
+        break;
+
+    case LOAD_COMPARE:;
+        char dn[LOAD_REQUEST_SIZE / 2];
+        int dnLength = snprintf(dn, sizeof(dn), "uid=%s,%s", key, config.suffix);
+        put_element(tail, &tailLength, 0x04, "uid", 3);
+        put_element(tail, &tailLength, 0x04, key, strlen(key));
+        put_element(body, &bodyLength, 0x04, dn, dnLength);
+        put_element(body, &bodyLength, 0x30, tail, tailLength);
+        put_element(operation, &operationLength, 0x6E, body, bodyLength);
+        break;
+
+    default:
+        put_element(body, &bodyLength, 0x04, config.suffix, strlen(config.suffix));
+        put_integer(body, &bodyLength, 0x0A, 2); // whole subtree
+        put_integer(body, &bodyLength, 0x0A, 0); // never dereference aliases
+        put_integer(body, &bodyLength, 0x02, 0); // no size limit
+        put_integer(body, &bodyLength, 0x02, 0); // no time limit
+        put_element(body, &bodyLength, 0x01, "\x00", 1);
+        bodyLength += encode_filter(body + bodyLength, kind, key);
+        put_element(body, &bodyLength, 0x30, "", 0);
+        put_element(operation, &operationLength, 0x63, body, bodyLength);
+        break;
+    }
+
+    tailLength = 0;
+    put_integer(tail, &tailLength, 0x02, messageId);
+    memcpy(tail + tailLength, operation, operationLength);
+    put_element(buff, &offset, 0x30, tail, tailLength + operationLength);
+    return offset;
+}
+
+static bool send_request(LoadWorker *worker, LoadConnection *connection, uint64_t due)
+{
+    int slot = connection->nextId % LOAD_MAX_DEPTH;
+    if (connection->waiting[slot] || connection->outputLength + LOAD_REQUEST_SIZE > LOAD_BUFFER_SIZE)
+        return false;
+
+    int pick = next_random(&worker->random) % config.weightSum;
+    int kind = 0;
+    while (pick >= config.weights[kind])
+        pick -= config.weights[kind++];
+    const char *key = config.keys[next_random(&worker->random) % config.keyCount];
+
+    connection->outputLength += encode_request(connection->output + connection->outputLength, kind, connection->nextId, key);
+    connection->started[slot] = due;
+    connection->kinds[slot] = kind;
+    connection->waiting[slot] = true;
+    connection->outstanding++;
+    // message id 0 is reserved for unsolicited notifications
+    connection->nextId = connection->nextId == INT32_MAX ? 1 : connection->nextId + 1;
+    worker->sent++;
+    return true;
+}
+
+static int read_length(const unsigned char *data, size_t length, size_t *position, size_t *elementLength)
+{
+    if (*position + 2 > length)
+        return -1;
+    (*position)++;
+    size_t value = data[(*position)++];
+    if (value & 0x80)
+    {
+        int lengthOfLength = value & 0x7F;
+        if (*position + lengthOfLength > length)
+            return -1;
+        value = 0;
+        for (int i = 0; i < lengthOfLength; i++)
+            value = value * 256 + data[(*position)++];
+    }
+    *elementLength = value;
+    return 0;
+}
+
+static int handle_responses(LoadWorker *worker, LoadConnection *connection)
+{
+    size_t position = 0;
+    uint64_t time = now();
+    while (true)
+    {
+        size_t start = position, messageLength, idLength, operationLength;
+        if (read_length(connection->input, connection->inputLength, &position, &messageLength) == -1 ||
+            position + messageLength > connection->inputLength)
+        {
+            position = start;
+            break;
+        }
+        size_t end = position + messageLength;
+        if (read_length(connection->input, end, &position, &idLength) == -1)
+            return -1;
+        int messageId = 0;
+        for (size_t i = 0; i < idLength; i++)
+            messageId = messageId * 256 + connection->input[position + i];
+        position += idLength;
+        int tag = connection->input[position];
+        if (read_length(connection->input, end, &position, &operationLength) == -1)
+            return -1;
+
+        if (tag == 0x64)
+        {
+            worker->entries++;
+        }
+        else if (tag == 0x61 || tag == 0x65 || tag == 0x6F)
+        {
+            int slot = messageId % LOAD_MAX_DEPTH;
+            if (!connection->waiting[slot])
+                return -1;
+            // the result code follows the enumerated tag and its length
+            int resultCode = connection->input[position + 2];
+            int kind = connection->kinds[slot];
+            bool failed = tag == 0x6F ? resultCode != 5 && resultCode != 6 : resultCode != 0 && resultCode != 4;
+            if (failed)
+                worker->errors[kind]++;
+            histogram_record(&worker->latency[kind], time - connection->started[slot]);
+            connection->waiting[slot] = false;
+            connection->outstanding--;
+        }
+        else
+        {
+            // a notice of disconnection or anything unexpected ends the connection
+            return -1;
+        }
+        position = end;
+    }
+    memmove(connection->input, connection->input + position, connection->inputLength - position);
+    connection->inputLength -= position;
+    return 0;
+}
+
+static void close_connection(LoadWorker *worker, LoadConnection *connection)
+{
+    // requests that will never be answered are counted as failed
+    for (int slot = 0; slot < LOAD_MAX_DEPTH; slot++)
+    {
+        if (connection->waiting[slot])
+            worker->errors[connection->kinds[slot]]++;
+        connection->waiting[slot] = false;
+    }
+    connection->outstanding = 0;
+    close(connection->socket);
+    connection->socket = -1;
+}
+
+static void *run_worker(void *arg)
+{
+    LoadWorker *worker = (LoadWorker *)arg;
+    struct pollfd *polls = (struct pollfd *)calloc(worker->count, sizeof(struct pollfd));
+    uint64_t interval = config.rate > 0 ? (uint64_t)(1e9 * config.connections / config.rate) : 0;
+    uint64_t drainTime = endTime + (uint64_t)LOAD_DRAIN_MS * 1000000;
+
+    while (true)
+    {
+        uint64_t time = now();
+        int open = 0, waiting = 0;
+        uint64_t nextDue = UINT64_MAX;
+        for (int i = 0; i < worker->count; i++)
+        {
+            LoadConnection *connection = &worker->connections[i];
+            polls[i].fd = connection->socket;
+            polls[i].events = 0;
+            if (connection->socket == -1)
+                continue;
+            open++;
+
+            if (time < endTime)
+            {
+                if (interval == 0)
+                {
+                    while (connection->outstanding < config.depth && send_request(worker, connection, time))
+                        ;
+                }
+                else
+                {
+                    // latency counts from the time a request was due, not from the time it could be sent
+                    while (connection->due <= time && connection->due < endTime && send_request(worker, connection, connection->due))
+                        connection->due += interval;
+                    if (connection->due < nextDue)
+                        nextDue = connection->due;
+                }
+            }
+            waiting += connection->outstanding;
+            polls[i].events = POLLIN | (connection->outputLength > 0 ? POLLOUT : 0);
+        }
+        if (open == 0 || (time >= endTime && (waiting == 0 || time >= drainTime)))
+            break;
+
+        // sleep until a response arrives or the next request is due, a busy loop would slow down a local server
+        uint64_t wake = time >= endTime ? drainTime : nextDue < endTime ? nextDue : endTime;
+        struct timespec timeout = {(wake - time) / 1000000000, (wake - time) % 1000000000};
+        if (wake <= time)
+            timeout.tv_sec = timeout.tv_nsec = 0;
+        if (ppoll(polls, worker->count, &timeout, NULL) < 0)
+            continue;
+
+        for (int i = 0; i < worker->count; i++)
+        {
+            LoadConnection *connection = &worker->connections[i];
+            if (connection->socket == -1)
+                continue;
+            if (connection->outputLength > 0)
+            {
+                ssize_t sent = send(connection->socket, connection->output, connection->outputLength, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (sent > 0)
+                {
+                    memmove(connection->output, connection->output + sent, connection->outputLength - sent);
+                    connection->outputLength -= sent;
+                }
+            }
+            if (polls[i].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                ssize_t received = recv(connection->socket, connection->input + connection->inputLength,
+                                        LOAD_BUFFER_SIZE - connection->inputLength, MSG_DONTWAIT);
+                if (received <= 0)
+                {
+                    close_connection(worker, connection);
+                    continue;
+                }
+                worker->bytes += received;
+                connection->inputLength += received;
+                if (handle_responses(worker, connection) == -1 || connection->inputLength == LOAD_BUFFER_SIZE)
+                    close_connection(worker, connection);
+            }
+        }
+    }
+
+    for (int i = 0; i < worker->count; i++)
+    {
+        if (worker->connections[i].socket != -1)
+            close_connection(worker, &worker->connections[i]);
+    }
+    free(polls);
+    return NULL;
+}
+
+static int connect_server(void)
+{
+    struct addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    int error = getaddrinfo(config.host, config.port, &hints, &addresses);
+    if (error != 0)
+    {
+        fprintf(stderr, "%s: %s\n", config.host, gai_strerror(error));
+        return -1;
+    }
+
+    int fd = -1;
+    uint64_t deadline = now() + (uint64_t)(config.wait * 1e9);
+    while (true)
+    {
+        for (struct addrinfo *address = addresses; address != NULL && fd == -1; address = address->ai_next)
+        {
+            fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (fd != -1 && connect(fd, address->ai_addr, address->ai_addrlen) == -1)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (fd != -1 || now() >= deadline)
+            break;
+        struct timespec pause = {0, 100000000};
+        nanosleep(&pause, NULL);
+    }
+    freeaddrinfo(addresses);
+    if (fd == -1)
+    {
+        perror("connect");
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+    return fd;
+}
+
+static int parse_mix(const char *mix)
+{
+    memset(config.weights, 0, sizeof(config.weights));
+    config.weightSum = 0;
+    char *copy = strdup(mix), *save = NULL;
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save))
+    {
+        char *equals = strchr(item, '=');
+        int weight = equals != NULL ? atoi(equals + 1) : 1;
+        if (equals != NULL)
+            *equals = '\0';
+        int kind = 0;
+        while (kind < LOAD_KIND_COUNT && strcmp(kindNames[kind], item) != 0)
+            kind++;
+        if (kind == LOAD_KIND_COUNT || weight < 0)
+        {
+            fprintf(stderr, "Unknown request kind %s, use bind, equality, prefix, infix, compare or boolean\n", item);
+            free(copy);
+            return -1;
+        }
+        config.weights[kind] += weight;
+        config.weightSum += weight;
+    }
+    free(copy);
+    return config.weightSum > 0 ? 0 : -1;
+}
+
+static int load_keys(const char *path, size_t rows)
+{
+    size_t capacity = 1024;
+    config.keys = (char **)malloc(capacity * sizeof(char *));
+    config.keyCount = 0;
+
+    if (path == NULL)
+    {
+        // the same uids as the generated benchmark files
+        for (size_t i = 0; i < rows; i++)
+        {
+            if (config.keyCount == capacity)
+                config.keys = (char **)realloc(config.keys, (capacity *= 2) * sizeof(char *));
+            char key[32];
+            snprintf(key, sizeof(key), "x%07zu", i);
+            config.keys[config.keyCount++] = strdup(key);
+        }
+        return 0;
+    }
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    // the uid is the second field of every line
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        char *uid = strchr(line, ';');
+        if (uid == NULL)
+            continue;
+        uid++;
+        uid[strcspn(uid, ";\r\n")] = '\0';
+        if (*uid == '\0')
+            continue;
+        if (config.keyCount == capacity)
+            config.keys = (char **)realloc(config.keys, (capacity *= 2) * sizeof(char *));
+        config.keys[config.keyCount++] = strdup(uid);
+    }
+    fclose(file);
+    return config.keyCount > 0 ? 0 : -1;
+}
+
+static void print_results(LoadWorker *workers, double seconds)
+{
+    Histogram *all = (Histogram *)calloc(LOAD_KIND_COUNT + 1, sizeof(Histogram));
+    uint64_t errors[LOAD_KIND_COUNT + 1] = {0}, entries = 0, bytes = 0, sent = 0;
+    for (int t = 0; t < config.threads; t++)
+    {
+        for (int kind = 0; kind < LOAD_KIND_COUNT; kind++)
+        {
+            histogram_merge(&all[kind], &workers[t].latency[kind]);
+            histogram_merge(&all[LOAD_KIND_COUNT], &workers[t].latency[kind]);
+            errors[kind] += workers[t].errors[kind];
+            errors[LOAD_KIND_COUNT] += workers[t].errors[kind];
+        }
+        entries += workers[t].entries;
+        bytes += workers[t].bytes;
+        sent += workers[t].sent;
+    }
+
+    if (!config.json)
+    {
+        printf("%d connections, %s, %.2f s, %llu sent, %llu entries, %.1f MB received\n", config.connections,
+               config.rate > 0 ? "open loop" : "closed loop", seconds, (unsigned long long)sent,
+               (unsigned long long)entries, bytes / 1e6);
+        printf("%-9s %10s %8s %12s %10s %10s %10s %10s %10s\n", "kind", "responses", "errors", "per second",
+               "p50 us", "p90 us", "p99 us", "p999 us", "max us");
+    }
+    for (int kind = 0; kind <= LOAD_KIND_COUNT; kind++)
+    {
+        const Histogram *histogram = &all[kind];
+        if (histogram->count == 0 && kind != LOAD_KIND_COUNT)
+            continue;
+        const char *name = kind == LOAD_KIND_COUNT ? "all" : kindNames[kind];
+        if (config.json)
+        {
+            printf("{\"kind\":\"%s\",\"connections\":%d,\"mode\":\"%s\",\"rate\":%.0f,\"depth\":%d,\"seconds\":%.3f,"
+                   "\"responses\":%llu,\"errors\":%llu,\"throughput\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,"
+                   "\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f,\"entries\":%llu,\"bytes\":%llu}\n",
+                   name, config.connections, config.rate > 0 ? "open" : "closed", config.rate, config.depth, seconds,
+                   (unsigned long long)histogram->count, (unsigned long long)errors[kind], histogram->count / seconds,
+                   histogram_quantile(histogram, 0.5) / 1e3, histogram_quantile(histogram, 0.9) / 1e3,
+                   histogram_quantile(histogram, 0.99) / 1e3, histogram_quantile(histogram, 0.999) / 1e3,
+                   histogram_max(histogram) / 1e3, (unsigned long long)entries, (unsigned long long)bytes);
+            continue;
+        }
+        printf("%-9s %10llu %8llu %12.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+               (unsigned long long)histogram->count, (unsigned long long)errors[kind], histogram->count / seconds,
+               histogram_quantile(histogram, 0.5) / 1e3, histogram_quantile(histogram, 0.9) / 1e3,
+               histogram_quantile(histogram, 0.99) / 1e3, histogram_quantile(histogram, 0.999) / 1e3,
+               histogram_max(histogram) / 1e3);
+    }
+    free(all);
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-h host] [-p port] [-c connections] [-t threads] [-d seconds] [-r rate | -q depth]\n"
+                    "       [-m bind=1,equality=6,prefix=2,infix=1,compare=1,boolean=0] [-f file | -n rows] [-b suffix] [-w seconds] [-j]\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *const argv[])
+{
+    int opt;
+    const char *keyFile = NULL;
+    size_t rows = 10000;
+    config.host = "127.0.0.1";
+    config.port = "389";
+    config.connections = 16;
+    config.threads = 0;
+    config.duration = 10;
+    config.rate = 0;
+    config.depth = 1;
+    config.suffix = "dc=fit,dc=vut,dc=cz";
+    config.json = false;
+    config.wait = 0;
+    parse_mix("equality");
+
+    while ((opt = getopt(argc, argv, "h:p:c:t:d:r:q:m:f:n:b:w:j")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            config.host = optarg;
+            break;
+        case 'p':
+            config.port = optarg;
+            break;
+        case 'c':
+            config.connections = atoi(optarg);
+            break;
+        case 't':
+            config.threads = atoi(optarg);
+            break;
+        case 'd':
+            config.duration = atof(optarg);
+            break;
+        case 'r':
+            config.rate = atof(optarg);
+            break;
+        case 'q':
+            config.depth = atoi(optarg);
+            break;
+        case 'm':
+            if (parse_mix(optarg) == -1)
+                usage(argv[0]);
+            break;
+        case 'f':
+            keyFile = optarg;
+            break;
+        case 'n':
+            rows = strtoull(optarg, NULL, 10);
+            break;
+        case 'b':
+            config.suffix = optarg;
+            break;
+        case 'w':
+            config.wait = atof(optarg);
+            break;
+        case 'j':
+            config.json = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (config.connections < 1 || config.duration <= 0 || config.depth < 1 || config.depth > LOAD_MAX_DEPTH || rows == 0)
+        usage(argv[0]);
+    if (config.threads < 1 || config.threads > config.connections)
+        config.threads = config.connections < 4 ? config.connections : 4;
+    if (load_keys(keyFile, rows) == -1)
+        exit(EXIT_FAILURE);
+
+    LoadConnection *connections = (LoadConnection *)calloc(config.connections, sizeof(LoadConnection));
+    LoadWorker *workers = (LoadWorker *)calloc(config.threads, sizeof(LoadWorker));
+    if (connections == NULL || workers == NULL)
+    {
+        perror("calloc");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < config.connections; i++)
+    {
+        connections[i].socket = connect_server();
+        if (connections[i].socket == -1)
+            exit(EXIT_FAILURE);
+        connections[i].nextId = 1;
+    }
+
+    uint64_t startTime = now();
+    endTime = startTime + (uint64_t)(config.duration * 1e9);
+    // the open loop spreads the first requests of the connections over one interval
+    for (int i = 0; i < config.connections && config.rate > 0; i++)
+        connections[i].due = startTime + (uint64_t)(1e9 / config.rate * i);
+
+    int first = 0;
+    for (int t = 0; t < config.threads; t++)
+    {
+        LoadWorker *worker = &workers[t];
+        worker->count = config.connections / config.threads + (t < config.connections % config.threads);
+        worker->connections = &connections[first];
+        worker->random = 0x9E3779B97F4A7C15ULL * (t + 1);
+        first += worker->count;
+        if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0)
+        {
+            perror("Thread creation failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int t = 0; t < config.threads; t++)
+        pthread_join(workers[t].thread, NULL);
+
+    double seconds = (now() - startTime) / 1e9;
+    if (seconds > config.duration)
+        seconds = config.duration;
+    print_results(workers, seconds);
+
+    for (size_t i = 0; i < config.keyCount; i++)
+        free(config.keys[i]);
+    free(config.keys);
+    free(connections);
+    free(workers);
+    return 0;
+}
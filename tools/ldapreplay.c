@@ -0,0 +1,771 @@
+/**
+ *
+ * @file ldapreplay.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * Replays a traffic capture against a server and compares the responses with the captured ones.
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "capture.h"
+#include "histogram.h"
+
+enum ReplayConst
+{
+    REPLAY_RECEIVE_SIZE = 1 << 16, // bytes received at once
+    REPLAY_TABLE_SIZE = 64         // initial message slots of a connection, a power of two
+};
+
+enum ReplayKind
+{
+    REPLAY_BIND,
+    REPLAY_SEARCH,
+    REPLAY_COMPARE,
+    REPLAY_OTHER,
+    REPLAY_KIND_COUNT
+};
+
+enum ReplayState
+{
+    REPLAY_PENDING, // not connected yet
+    REPLAY_OPEN,
+    REPLAY_DONE
+};
+
+static const char *kindNames[REPLAY_KIND_COUNT] = {"bind", "search", "compare", "other"};
+
+/**
+ * Structure representing the responses to one message id, captured and replayed.
+ */
+typedef struct
+{
+    bool used;              /**< Flag indicating whether the slot holds a message. */
+    int messageId;          /**< The message id. */
+    unsigned char kind;     /**< The ReplayKind of the request. */
+    bool expectedDone;      /**< Flag indicating whether the capture holds the final response. */
+    bool actualDone;        /**< Flag indicating whether the final response was received. */
+    uint64_t expectedHash;  /**< FNV-1a hash of the captured responses. */
+    uint64_t actualHash;    /**< FNV-1a hash of the received responses. */
+    size_t expectedLength;  /**< The number of captured response bytes. */
+    size_t actualLength;    /**< The number of received response bytes. */
+    uint64_t sent;          /**< The time the request was sent. */
+} ReplayMessage;
+
+/**
+ * Structure representing one chunk of requests received by the server at once.
+ */
+typedef struct
+{
+    size_t end;      /**< The end of the chunk in the request stream of the connection. */
+    uint64_t time;   /**< The captured time of the chunk. */
+    size_t awaited;  /**< The number of operations the server had completed before the chunk. */
+} ReplayChunk;
+
+/**
+ * Structure representing one captured connection and its replay.
+ */
+typedef struct
+{
+    uint32_t id;                 /**< The number of the connection in the capture. */
+    uint64_t first;              /**< The captured time of the first record. */
+    unsigned char *requests;     /**< The captured request stream. */
+    size_t requestLength;        /**< The length of the request stream. */
+    size_t requestCapacity;      /**< The allocated size of the request stream. */
+    ReplayChunk *chunks;         /**< The chunks of the request stream. */
+    size_t chunkCount;           /**< The number of chunks. */
+    size_t chunkCapacity;        /**< The allocated number of chunks. */
+    unsigned char *expected;     /**< Captured response bytes not parsed yet. */
+    size_t expectedLength;       /**< The number of captured response bytes not parsed yet. */
+    size_t expectedCapacity;     /**< The allocated size of the captured responses. */
+    size_t expectedCompletions;  /**< The number of captured final responses. */
+    ReplayMessage *messages;     /**< The table of message ids. */
+    size_t messageCapacity;      /**< The number of slots of the table. */
+    size_t messageCount;         /**< The number of used slots. */
+    int state;                   /**< The ReplayState. */
+    int socket;                  /**< The connected socket. */
+    size_t nextChunk;            /**< The first chunk not released for sending. */
+    size_t released;             /**< The end of the released requests. */
+    size_t sent;                 /**< The end of the sent requests. */
+    size_t parsed;               /**< The end of the requests whose message ids were noted. */
+    unsigned char *input;        /**< Received bytes not parsed yet. */
+    size_t inputLength;          /**< The number of received bytes not parsed yet. */
+    size_t inputCapacity;        /**< The allocated size of the received bytes. */
+    size_t completions;          /**< The number of received final responses. */
+    uint64_t activity;           /**< The time anything was last sent or received. */
+} ReplayConnection;
+
+/**
+ * Structure representing the parameters of the replay.
+ */
+typedef struct
+{
+    const char *host;     /**< The address of the server. */
+    const char *port;     /**< The port of the server. */
+    double speed;         /**< The speed relative to the capture, 0 for as fast as possible. */
+    int connections;      /**< The largest number of connections open at once. */
+    double timeout;       /**< Seconds a connection may wait for the server. */
+    double wait;          /**< Seconds the server is waited for, e.g. while it loads its file. */
+    bool json;            /**< Flag indicating whether the results are printed as JSON. */
+    bool verbose;         /**< Flag indicating whether every mismatch is printed. */
+    bool unordered;       /**< Flag indicating whether the responses to one message may come in any order. */
+} ReplayConfig;
+
+static ReplayConfig config;
+static ReplayConnection *connections;
+static size_t connectionCount;
+static size_t connectionCapacity;
+static uint64_t captureStart;
+static Histogram latency[REPLAY_KIND_COUNT];
+static uint64_t mismatches[REPLAY_KIND_COUNT];
+static uint64_t missing[REPLAY_KIND_COUNT];
+
+static uint64_t now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void *grow(void *data, size_t *capacity, size_t needed, size_t size)
+{
+    if (needed <= *capacity)
+        return data;
+    size_t newCapacity = *capacity == 0 ? 1024 : *capacity;
+    while (newCapacity < needed)
+        newCapacity *= 2;
+    data = realloc(data, newCapacity * size);
+    if (data == NULL)
+    {
+        perror("realloc");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = newCapacity;
+    return data;
+}
+
+static ReplayMessage *message_get(ReplayConnection *connection, int messageId)
+{
+    if (connection->messageCount * 2 >= connection->messageCapacity)
+    {
+        // rehash into a table twice the size
+        ReplayMessage *old = connection->messages;
+        size_t oldCapacity = connection->messageCapacity;
+        connection->messageCapacity = oldCapacity == 0 ? REPLAY_TABLE_SIZE : oldCapacity * 2;
+        connection->messages = (ReplayMessage *)calloc(connection->messageCapacity, sizeof(ReplayMessage));
+        connection->messageCount = 0;
+        for (size_t i = 0; i < oldCapacity; i++)
+        {
+            if (old[i].used)
+                *message_get(connection, old[i].messageId) = old[i];
+        }
+        free(old);
+    }
+
+    size_t mask = connection->messageCapacity - 1;
+    size_t slot = ((uint32_t)messageId * 2654435761u) & mask;
+    while (connection->messages[slot].used && connection->messages[slot].messageId != messageId)
+        slot = (slot + 1) & mask;
+    ReplayMessage *message = &connection->messages[slot];
+    if (!message->used)
+    {
+        memset(message, 0, sizeof(*message));
+        message->used = true;
+        message->messageId = messageId;
+        message->kind = REPLAY_OTHER;
+        message->expectedHash = message->actualHash = 0xCBF29CE484222325ULL;
+        connection->messageCount++;
+    }
+    return message;
+}
+
+static uint64_t hash_bytes(uint64_t hash, const unsigned char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+static int read_length(const unsigned char *data, size_t length, size_t *position, size_t *elementLength)
+{
+    if (*position + 2 > length)
+        return -1;
+    (*position)++;
+    size_t value = data[(*position)++];
+    if (value & 0x80)
+    {
+        int lengthOfLength = value & 0x7F;
+        if (lengthOfLength > 4 || *position + lengthOfLength > length)
+            return -1;
+        value = 0;
+        for (int i = 0; i < lengthOfLength; i++)
+            value = value * 256 + data[(*position)++];
+    }
+    *elementLength = value;
+    return 0;
+}
+
+/**
+ * Reads the header of the LDAP message at the start of the data.
+ *
+ * @return The length of the whole message, 0 if it is not complete yet.
+ */
+static size_t read_message(const unsigned char *data, size_t length, int *messageId, int *tag)
+{
+    size_t position = 0, messageLength, idLength;
+    if (read_length(data, length, &position, &messageLength) == -1 || position + messageLength > length)
+        return 0;
+    size_t end = position + messageLength;
+    if (read_length(data, end, &position, &idLength) == -1 || position + idLength >= end)
+    {
+        *messageId = -1;
+        *tag = -1;
+        return end;
+    }
+    *messageId = 0;
+    for (size_t i = 0; i < idLength; i++)
+        *messageId = *messageId * 256 + data[position + i];
+    *tag = data[position + idLength];
+    return end;
+}
+
+static int request_kind(int tag)
+{
+    switch (tag)
+    {
+    case 0x60:
+        return REPLAY_BIND;
+    case 0x63:
+        return REPLAY_SEARCH;
+    case 0x6E:
+        return REPLAY_COMPARE;
+    default:
+        return REPLAY_OTHER;
+    }
+}
+
+static uint64_t hash_response(uint64_t hash, const unsigned char *data, size_t length)
+{
+    // a sum of the hashes of the responses does not depend on their order, as the entries merged by a proxy
+    if (config.unordered)
+        return hash + hash_bytes(0xCBF29CE484222325ULL, data, length);
+    return hash_bytes(hash, data, length);
+}
+
+static size_t parse_responses(ReplayConnection *connection, const unsigned char *data, size_t length, bool actual)
+{
+    size_t position = 0;
+    uint64_t time = actual ? now() : 0;
+    while (position < length)
+    {
+        int messageId, tag;
+        size_t messageLength = read_message(data + position, length - position, &messageId, &tag);
+        if (messageLength == 0)
+            break;
+        ReplayMessage *message = message_get(connection, messageId);
+        // search entries and references are followed by the result, a notice of disconnection has no request
+        bool final = tag != 0x64 && tag != 0x73 && messageId != 0;
+        if (actual)
+        {
+            message->actualHash = hash_response(message->actualHash, data + position, messageLength);
+            message->actualLength += messageLength;
+            if (final)
+            {
+                message->actualDone = true;
+                connection->completions++;
+                if (message->sent != 0)
+                    histogram_record(&latency[message->kind], time - message->sent);
+            }
+        }
+        else
+        {
+            message->expectedHash = hash_response(message->expectedHash, data + position, messageLength);
+            message->expectedLength += messageLength;
+            if (final)
+            {
+                message->expectedDone = true;
+                connection->expectedCompletions++;
+            }
+        }
+        position += messageLength;
+    }
+    return position;
+}
+
+static void parse_requests(ReplayConnection *connection, uint64_t time)
+{
+    while (connection->parsed < connection->released)
+    {
+        int messageId, tag;
+        size_t messageLength = read_message(connection->requests + connection->parsed,
+                                            connection->released - connection->parsed, &messageId, &tag);
+        if (messageLength == 0)
+            break;
+        // unbind and abandon requests are never answered
+        if (tag != 0x42 && tag != 0x50 && messageId > 0)
+        {
+            ReplayMessage *message = message_get(connection, messageId);
+            message->kind = request_kind(tag);
+            message->sent = time;
+        }
+        connection->parsed += messageLength;
+    }
+}
+
+static ReplayConnection *connection_get(uint32_t id)
+{
+    // connections are numbered from 1 in the order they were accepted
+    if (id > connectionCapacity)
+    {
+        size_t capacity = connectionCapacity;
+        connections = (ReplayConnection *)grow(connections, &capacity, id, sizeof(ReplayConnection));
+        memset(connections + connectionCapacity, 0, (capacity - connectionCapacity) * sizeof(ReplayConnection));
+        for (size_t i = connectionCapacity; i < capacity; i++)
+            connections[i].id = i + 1;
+        connectionCapacity = capacity;
+    }
+    if (id > connectionCount)
+        connectionCount = id;
+    return &connections[id - 1];
+}
+
+static int load_capture(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+    CaptureHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != CAPTURE_MAGIC || header.version != CAPTURE_VERSION)
+    {
+        fprintf(stderr, "%s is not a capture file\n", path);
+        fclose(file);
+        return -1;
+    }
+    captureStart = UINT64_MAX;
+
+    CaptureRecord record;
+    static unsigned char data[CAPTURE_MAX_CHUNK];
+    while (fread(&record, sizeof(record), 1, file) == 1)
+    {
+        if (record.connection == 0 || fread(data, 1, record.length, file) != record.length)
+        {
+            fprintf(stderr, "%s is truncated\n", path);
+            break;
+        }
+        ReplayConnection *connection = connection_get(record.connection);
+        if (connection->first == 0)
+            connection->first = record.time;
+        if (record.time < captureStart)
+            captureStart = record.time;
+
+        if (record.type == CAPTURE_REQUEST)
+        {
+            connection->requests = (unsigned char *)grow(connection->requests, &connection->requestCapacity,
+                                                         connection->requestLength + record.length, 1);
+            memcpy(connection->requests + connection->requestLength, data, record.length);
+            connection->requestLength += record.length;
+            connection->chunks = (ReplayChunk *)grow(connection->chunks, &connection->chunkCapacity,
+                                                     connection->chunkCount + 1, sizeof(ReplayChunk));
+            // the records of a connection are in order, so the responses captured so far were sent before the chunk
+            ReplayChunk *chunk = &connection->chunks[connection->chunkCount++];
+            chunk->end = connection->requestLength;
+            chunk->time = record.time;
+            chunk->awaited = connection->expectedCompletions;
+        }
+        else if (record.type == CAPTURE_RESPONSE)
+        {
+            connection->expected = (unsigned char *)grow(connection->expected, &connection->expectedCapacity,
+                                                         connection->expectedLength + record.length, 1);
+            memcpy(connection->expected + connection->expectedLength, data, record.length);
+            connection->expectedLength += record.length;
+            size_t parsed = parse_responses(connection, connection->expected, connection->expectedLength, false);
+            memmove(connection->expected, connection->expected + parsed, connection->expectedLength - parsed);
+            connection->expectedLength -= parsed;
+        }
+    }
+    fclose(file);
+
+    for (size_t i = 0; i < connectionCount; i++)
+    {
+        free(connections[i].expected);
+        connections[i].expected = NULL;
+        // connection numbers lost to a crashed process leave gaps
+        if (connections[i].chunkCount == 0)
+            connections[i].state = REPLAY_DONE;
+    }
+    return 0;
+}
+
+static int connect_server(double wait)
+{
+    struct addrinfo hints, *addresses;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    int error = getaddrinfo(config.host, config.port, &hints, &addresses);
+    if (error != 0)
+    {
+        fprintf(stderr, "%s: %s\n", config.host, gai_strerror(error));
+        return -1;
+    }
+
+    int fd = -1;
+    uint64_t deadline = now() + (uint64_t)(wait * 1e9);
+    while (true)
+    {
+        for (struct addrinfo *address = addresses; address != NULL && fd == -1; address = address->ai_next)
+        {
+            fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+            if (fd != -1 && connect(fd, address->ai_addr, address->ai_addrlen) == -1)
+            {
+                close(fd);
+                fd = -1;
+            }
+        }
+        if (fd != -1 || now() >= deadline)
+            break;
+        struct timespec pause = {0, 100000000};
+        nanosleep(&pause, NULL);
+    }
+    freeaddrinfo(addresses);
+    if (fd == -1)
+    {
+        perror("connect");
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &(int){1}, sizeof(int));
+    return fd;
+}
+
+static uint64_t due_time(uint64_t captured, uint64_t replayStart)
+{
+    if (config.speed <= 0)
+        return 0;
+    return replayStart + (uint64_t)((captured - captureStart) / config.speed);
+}
+
+static void finish_connection(ReplayConnection *connection)
+{
+    if (connection->socket != -1)
+        close(connection->socket);
+    connection->socket = -1;
+    connection->state = REPLAY_DONE;
+
+    for (size_t i = 0; i < connection->messageCapacity; i++)
+    {
+        ReplayMessage *message = &connection->messages[i];
+        if (!message->used || message->messageId == 0)
+            continue;
+        if (message->expectedDone && !message->actualDone)
+        {
+            missing[message->kind]++;
+            if (config.verbose)
+                fprintf(stderr, "connection %u message %d: no response\n", connection->id, message->messageId);
+        }
+        else if (message->expectedLength != message->actualLength || message->expectedHash != message->actualHash)
+        {
+            mismatches[message->kind]++;
+            if (config.verbose)
+                fprintf(stderr, "connection %u message %d: responses differ, %zu bytes captured, %zu bytes received\n",
+                        connection->id, message->messageId, message->expectedLength, message->actualLength);
+        }
+    }
+    free(connection->requests);
+    free(connection->chunks);
+    free(connection->messages);
+    free(connection->input);
+    connection->requests = NULL;
+    connection->chunks = NULL;
+    connection->messages = NULL;
+    connection->input = NULL;
+}
+
+static void receive_responses(ReplayConnection *connection)
+{
+    connection->input = (unsigned char *)grow(connection->input, &connection->inputCapacity,
+                                              connection->inputLength + REPLAY_RECEIVE_SIZE, 1);
+    ssize_t received = recv(connection->socket, connection->input + connection->inputLength, REPLAY_RECEIVE_SIZE, MSG_DONTWAIT);
+    if (received <= 0)
+    {
+        finish_connection(connection);
+        return;
+    }
+    connection->inputLength += received;
+    connection->activity = now();
+    size_t parsed = parse_responses(connection, connection->input, connection->inputLength, true);
+    memmove(connection->input, connection->input + parsed, connection->inputLength - parsed);
+    connection->inputLength -= parsed;
+}
+
+static void replay(void)
+{
+    struct pollfd *polls = (struct pollfd *)calloc(config.connections, sizeof(struct pollfd));
+    ReplayConnection **open = (ReplayConnection **)calloc(config.connections, sizeof(ReplayConnection *));
+    int openCount = 0;
+    size_t nextPending = 0;
+    uint64_t replayStart = now();
+    uint64_t timeout = (uint64_t)(config.timeout * 1e9);
+
+    while (true)
+    {
+        uint64_t time = now();
+        uint64_t wake = UINT64_MAX;
+
+        // connections are opened in the captured order, at most config.connections at once
+        while (nextPending < connectionCount && connections[nextPending].state == REPLAY_DONE)
+            nextPending++;
+        while (nextPending < connectionCount && openCount < config.connections)
+        {
+            ReplayConnection *connection = &connections[nextPending];
+            uint64_t due = due_time(connection->first, replayStart);
+            if (due > time)
+            {
+                wake = due;
+                break;
+            }
+            connection->socket = connect_server(0);
+            if (connection->socket == -1)
+                exit(EXIT_FAILURE);
+            connection->state = REPLAY_OPEN;
+            connection->activity = time;
+            open[openCount++] = connection;
+            while (++nextPending < connectionCount && connections[nextPending].state == REPLAY_DONE)
+                ;
+        }
+        if (openCount == 0 && nextPending >= connectionCount)
+            break;
+
+        for (int i = 0; i < openCount; i++)
+        {
+            ReplayConnection *connection = open[i];
+            // a chunk is released once it is due and the server answered what it had answered when it was captured
+            while (connection->nextChunk < connection->chunkCount)
+            {
+                ReplayChunk *chunk = &connection->chunks[connection->nextChunk];
+                uint64_t due = due_time(chunk->time, replayStart);
+                if (connection->completions < chunk->awaited)
+                    break;
+                if (due > time)
+                {
+                    if (due < wake)
+                        wake = due;
+                    break;
+                }
+                connection->released = chunk->end;
+                connection->nextChunk++;
+            }
+            parse_requests(connection, time);
+
+            if (connection->sent < connection->released)
+            {
+                ssize_t sent = send(connection->socket, connection->requests + connection->sent,
+                                    connection->released - connection->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+                if (sent > 0)
+                {
+                    connection->sent += sent;
+                    connection->activity = time;
+                }
+            }
+            if (time - connection->activity >= timeout)
+            {
+                fprintf(stderr, "connection %u timed out\n", connection->id);
+                finish_connection(connection);
+            }
+            else if (connection->nextChunk == connection->chunkCount && connection->sent == connection->requestLength &&
+                     connection->completions >= connection->expectedCompletions)
+            {
+                finish_connection(connection);
+            }
+            if (connection->activity + timeout < wake)
+                wake = connection->activity + timeout;
+        }
+
+        // finished connections leave the poll set
+        int kept = 0;
+        for (int i = 0; i < openCount; i++)
+        {
+            if (open[i]->state == REPLAY_OPEN)
+                open[kept++] = open[i];
+        }
+        openCount = kept;
+        for (int i = 0; i < openCount; i++)
+        {
+            polls[i].fd = open[i]->socket;
+            polls[i].events = POLLIN | (open[i]->sent < open[i]->released ? POLLOUT : 0);
+            polls[i].revents = 0;
+        }
+        if (openCount == 0 && nextPending >= connectionCount)
+            break;
+
+        struct timespec sleep = {0, 0};
+        if (wake > time)
+        {
+            sleep.tv_sec = (wake - time) / 1000000000;
+            sleep.tv_nsec = (wake - time) % 1000000000;
+        }
+        if (ppoll(polls, openCount, wake == UINT64_MAX ? NULL : &sleep, NULL) <= 0)
+            continue;
+        for (int i = 0; i < openCount; i++)
+        {
+            if (polls[i].revents & (POLLIN | POLLHUP | POLLERR))
+                receive_responses(open[i]);
+        }
+    }
+    free(polls);
+    free(open);
+}
+
+static void print_results(double seconds, size_t requests)
+{
+    Histogram all;
+    memset(&all, 0, sizeof(all));
+    uint64_t allMismatches = 0, allMissing = 0;
+    for (int kind = 0; kind < REPLAY_KIND_COUNT; kind++)
+    {
+        histogram_merge(&all, &latency[kind]);
+        allMismatches += mismatches[kind];
+        allMissing += missing[kind];
+    }
+
+    if (!config.json)
+    {
+        if (config.speed > 0)
+            printf("%zu connections, %zu request bytes, %gx speed, %.2f s\n", connectionCount, requests, config.speed, seconds);
+        else
+            printf("%zu connections, %zu request bytes, unlimited speed, %.2f s\n", connectionCount, requests, seconds);
+        printf("%-8s %10s %10s %8s %12s %10s %10s %10s %10s %10s\n", "kind", "responses", "mismatch", "missing",
+               "per second", "p50 us", "p90 us", "p99 us", "p999 us", "max us");
+    }
+    for (int kind = 0; kind <= REPLAY_KIND_COUNT; kind++)
+    {
+        const Histogram *histogram = kind == REPLAY_KIND_COUNT ? &all : &latency[kind];
+        uint64_t kindMismatches = kind == REPLAY_KIND_COUNT ? allMismatches : mismatches[kind];
+        uint64_t kindMissing = kind == REPLAY_KIND_COUNT ? allMissing : missing[kind];
+        if (histogram->count == 0 && kindMissing == 0 && kind != REPLAY_KIND_COUNT)
+            continue;
+        const char *name = kind == REPLAY_KIND_COUNT ? "all" : kindNames[kind];
+        if (config.json)
+        {
+            printf("{\"kind\":\"%s\",\"connections\":%zu,\"speed\":%g,\"seconds\":%.3f,\"responses\":%llu,"
+                   "\"mismatches\":%llu,\"missing\":%llu,\"throughput\":%.1f,\"p50_us\":%.1f,\"p90_us\":%.1f,"
+                   "\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+                   name, connectionCount, config.speed, seconds, (unsigned long long)histogram->count,
+                   (unsigned long long)kindMismatches, (unsigned long long)kindMissing, histogram->count / seconds,
+                   histogram_quantile(histogram, 0.5) / 1e3, histogram_quantile(histogram, 0.9) / 1e3,
+                   histogram_quantile(histogram, 0.99) / 1e3, histogram_quantile(histogram, 0.999) / 1e3,
+                   histogram_max(histogram) / 1e3);
+            continue;
+        }
+        printf("%-8s %10llu %10llu %8llu %12.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", name,
+               (unsigned long long)histogram->count, (unsigned long long)kindMismatches, (unsigned long long)kindMissing,
+               histogram->count / seconds, histogram_quantile(histogram, 0.5) / 1e3,
+               histogram_quantile(histogram, 0.9) / 1e3, histogram_quantile(histogram, 0.99) / 1e3,
+               histogram_quantile(histogram, 0.999) / 1e3, histogram_max(histogram) / 1e3);
+    }
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-h host] [-p port] [-s speed] [-c connections] [-T timeout] [-w seconds] [-j] [-v] [-u] <capture file>\n",
+            program);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *const argv[])
+{
+    int opt;
+    config.host = "127.0.0.1";
+    config.port = "389";
+    config.speed = 1;
+    config.connections = 256;
+    config.timeout = 10;
+    config.wait = 0;
+    config.json = false;
+    config.verbose = false;
+    config.unordered = false;
+
+    while ((opt = getopt(argc, argv, "h:p:s:c:T:w:jvu")) != -1)
+    {
+        switch (opt)
+        {
+        case 'h':
+            config.host = optarg;
+            break;
+        case 'p':
+            config.port = optarg;
+            break;
+        case 's':
+            config.speed = atof(optarg);
+            break;
+        case 'c':
+            config.connections = atoi(optarg);
+            break;
+        case 'T':
+            config.timeout = atof(optarg);
+            break;
+        case 'w':
+            config.wait = atof(optarg);
+            break;
+        case 'j':
+            config.json = true;
+            break;
+        case 'v':
+            config.verbose = true;
+            break;
+        case 'u':
+            config.unordered = true;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || config.speed < 0 || config.connections < 1 || config.timeout <= 0)
+        usage(argv[0]);
+    if (load_capture(argv[optind]) == -1)
+        exit(EXIT_FAILURE);
+
+    size_t requests = 0;
+    for (size_t i = 0; i < connectionCount; i++)
+        requests += connections[i].requestLength;
+
+    // the first connection waits for a server that is still loading its file
+    if (config.wait > 0)
+    {
+        int fd = connect_server(config.wait);
+        if (fd == -1)
+            exit(EXIT_FAILURE);
+        close(fd);
+    }
+
+    uint64_t startTime = now();
+    replay();
+    print_results((now() - startTime) / 1e9, requests);
+
+    uint64_t failures = 0;
+    for (int kind = 0; kind < REPLAY_KIND_COUNT; kind++)
+        failures += mismatches[kind] + missing[kind];
+    free(connections);
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,117 @@
+/**
+ *
+ * @file loadbench.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * Benchmark of the parallel database file loader.
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <time.h>
+#include "directory.h"
+#include "schema.h"
+
+// the directory links the server, which sends through tcp.c; nothing is sent here
+void ldap_send(unsigned char *bufin, int clientSocket, int offset)
+{
+}
+
+int ldap_receive(int clientSocket, unsigned char *buffer, size_t size)
+{
+    return 0;
+}
+
+static double elapsed(struct timespec start, struct timespec end)
+{
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+int main(int argc, char *const argv[])
+{
+    int opt;
+    int threads = 0;
+    int repeat = 5;
+    bool json = false;
+    Schema schema;
+    schema_default(&schema);
+
+    while ((opt = getopt(argc, argv, "t:r:s:j")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'r':
+            repeat = atoi(optarg);
+            break;
+        case 's':
+            if (schema_load(&schema, optarg) == -1)
+                exit(EXIT_FAILURE);
+            break;
+        case 'j':
+            json = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t threads] [-r repeat] [-s schema] [-j] <file>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc || repeat < 1)
+    {
+        fprintf(stderr, "Usage: %s [-t threads] [-r repeat] [-s schema] [-j] <file>\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    double best = 0, total = 0;
+    size_t lines = 0, size = 0, memory = 0, indexMemory = 0, naiveMemory = 0;
+    for (int i = 0; i < repeat; i++)
+    {
+        Directory directory;
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (directory_load(&directory, &schema, argv[optind], threads) == -1)
+        {
+            fprintf(stderr, "Failed to load file %s\n", argv[optind]);
+            exit(EXIT_FAILURE);
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        lines = directory.lineCount;
+        size = directory.size;
+        memory = directory.memory;
+        indexMemory = directory.indexMemory;
+        naiveMemory = directory.naiveMemory;
+        directory_dispose(&directory);
+
+        double time = elapsed(start, end);
+        total += time;
+        if (i == 0 || time < best)
+            best = time;
+    }
+
+    if (json)
+    {
+        printf("{\"file\":\"%s\",\"bytes\":%zu,\"lines\":%zu,\"threads\":%d,\"runs\":%d,\"best_s\":%.4f,\"mean_s\":%.4f,"
+               "\"throughput_mbs\":%.1f,\"bytes_per_line\":%.1f,\"index_bytes_per_line\":%.1f}\n",
+               argv[optind], size, lines, threads, repeat, best, total / repeat, size / best / 1e6,
+               lines ? (double)memory / lines : 0.0, lines ? (double)indexMemory / lines : 0.0);
+        return 0;
+    }
+
+    printf("file=%s bytes=%zu lines=%zu threads=%d runs=%d best=%.4fs mean=%.4fs throughput=%.1fMB/s\n",
+           argv[optind], size, lines, threads, repeat, best, total / repeat, size / best / 1e6);
+    if (lines > 0)
+        printf("memory=%zu bytes_per_line=%.1f naive_bytes_per_line=%.1f ratio=%.2f index_bytes_per_line=%.1f\n",
+               memory, (double)memory / lines, (double)naiveMemory / lines, (double)naiveMemory / (memory ? memory : 1),
+               (double)indexMemory / lines);
+    return 0;
+}
@@ -0,0 +1,375 @@
+/**
+ *
+ * @file microbench.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * Micro-benchmarks of the BER codec, the entry encoder and the filter matcher.
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <sched.h>
+#include "utils.h"
+#include "arena.h"
+#include "directory.h"
+#include "schema.h"
+#include "search.h"
+#include "bind.h"
+#include "response.h"
+
+enum MicroConst
+{
+    MICRO_WARMUP_MS = 200,   // time every benchmark runs before it is measured
+    MICRO_MAX_RUNS = 100
+};
+
+extern __thread int currentTagPosition;
+
+/**
+ * Structure representing one micro-benchmark.
+ */
+typedef struct
+{
+    const char *name;                          /**< The name printed in the report. */
+    void (*run)(const void *argument, size_t iterations); /**< Runs the measured operation the given number of times. */
+    const void *argument;                      /**< The input of the operation. */
+} MicroBenchmark;
+
+static volatile uint64_t sink;
+static size_t sentBytes;
+static Directory directory;
+static Arena arena;
+
+// the server sends through tcp.c, here the encoded messages are only counted
+void ldap_send(unsigned char *bufin, int clientSocket, int offset)
+{
+    sentBytes += offset;
+}
+
+int ldap_receive(int clientSocket, unsigned char *buffer, size_t size)
+{
+    return 0;
+}
+
+/*
+ * Search requests as sent by ldapsearch -x -b dc=fit,dc=vut,dc=cz, captured from the wire.
+ */
+static const unsigned char equalityPdu[] = {
+    0x30, 0x3c, 0x02, 0x01, 0x02, 0x63, 0x37, 0x04, 0x13, 'd', 'c', '=', 'f', 'i', 't', ',', 'd', 'c', '=', 'v',
+    'u', 't', ',', 'd', 'c', '=', 'c', 'z', 0x0a, 0x01, 0x02, 0x0a, 0x01, 0x00, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+    0x01, 0x01, 0x00, 0xa3, 0x0f, 0x04, 0x03, 'u', 'i', 'd', 0x04, 0x08, 'x', 'b', 'a', 'l', 'e', 'k', '0', '2',
+    0x30, 0x00};
+
+static const unsigned char substringPdu[] = {
+    0x30, 0x41, 0x02, 0x01, 0x02, 0x63, 0x3c, 0x04, 0x13, 'd', 'c', '=', 'f', 'i', 't', ',', 'd', 'c', '=', 'v',
+    'u', 't', ',', 'd', 'c', '=', 'c', 'z', 0x0a, 0x01, 0x02, 0x0a, 0x01, 0x00, 0x02, 0x01, 0x00, 0x02, 0x01, 0x00,
+    0x01, 0x01, 0x00, 0xa4, 0x14, 0x04, 0x04, 'm', 'a', 'i', 'l', 0x30, 0x0c, 0x81, 0x0a, 's', 't', 'u', 'd', '.',
+    'f', 'i', 't', '.', 'v', 0x30, 0x00};
+
+static const unsigned char sizeLimitPdu[] = {
+    0x30, 0x43, 0x02, 0x02, 0x01, 0x2c, 0x63, 0x3d, 0x04, 0x13, 'd', 'c', '=', 'f', 'i', 't', ',', 'd', 'c', '=',
+    'v', 'u', 't', ',', 'd', 'c', '=', 'c', 'z', 0x0a, 0x01, 0x02, 0x0a, 0x01, 0x00, 0x02, 0x02, 0x03, 0xe8, 0x02,
+    0x01, 0x1e, 0x01, 0x01, 0x00, 0xa4, 0x0e, 0x04, 0x02, 'c', 'n', 0x30, 0x08, 0x80, 0x06, 'n', 'o', 'v', 'a', 'k',
+    ' ', 0x30, 0x06, 0x04, 0x04, 'm', 'a', 'i', 'l'};
+
+static void run_element_info(const void *argument, size_t iterations)
+{
+    unsigned char *data = (unsigned char *)argument;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        currentTagPosition = 0;
+        get_ldap_element_info(data);
+        sink += get_int_value(data);
+        sink += get_ldap_element_info(data).tagValue;
+    }
+}
+
+static void run_int_value(const void *argument, size_t iterations)
+{
+    unsigned char *data = (unsigned char *)argument;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        currentTagPosition = 0;
+        sink += get_int_value(data);
+    }
+}
+
+static void run_decode_search(const void *argument, size_t iterations)
+{
+    unsigned char *data = (unsigned char *)argument;
+    for (size_t i = 0; i < iterations; i++)
+    {
+        currentTagPosition = 0;
+        get_ldap_element_info(data);
+        int messageId = get_int_value(data);
+        get_ldap_element_info(data);
+        LdapSearch search = ldap_search(data, messageId, &directory.schema);
+        sink += search.queryKeyLength;
+        arena_reset(&arena);
+    }
+}
+
+static void run_add_integer(const void *argument, size_t iterations)
+{
+    int value = *(const int *)argument;
+    unsigned char buff[16];
+    for (size_t i = 0; i < iterations; i++)
+    {
+        int offset = 0;
+        add_integer(buff, &offset, value);
+        sink += buff[offset - 1];
+    }
+}
+
+static void run_add_string(const void *argument, size_t iterations)
+{
+    char *string = (char *)argument;
+    unsigned char buff[MAX_BUFFER_SIZE];
+    for (size_t i = 0; i < iterations; i++)
+    {
+        int offset = 0;
+        add_ldap_string(buff, &offset, string);
+        sink += buff[offset - 1];
+    }
+}
+
+static void run_encode_entry(const void *argument, size_t iterations)
+{
+    size_t row = *(const size_t *)argument;
+    unsigned char header[MAX_BUFFER_SIZE];
+    int headerLength = 0;
+    create_ldap_header(header, &headerLength, 2);
+    for (size_t i = 0; i < iterations; i++)
+    {
+        sink += ldap_send_search_res_entry(header, &headerLength, &directory, row, 0);
+        arena_reset(&arena);
+    }
+}
+
+static void run_bind_response(const void *argument, size_t iterations)
+{
+    LdapBind bind = {1, 3, "", SIMPLE_BIND, "", 0};
+    for (size_t i = 0; i < iterations; i++)
+    {
+        bind.messageId = i & 0xFFFF;
+        ldap_bind_response(bind, SUCCESS, 0);
+    }
+    sink += sentBytes;
+}
+
+static void run_search_done(const void *argument, size_t iterations)
+{
+    unsigned char buff[MAX_BUFFER_SIZE];
+    for (size_t i = 0; i < iterations; i++)
+    {
+        int offset = 0;
+        create_ldap_header(buff, &offset, i & 0xFFFF);
+        ldap_search_res_done(buff, &offset, SUCCESS, NULL, 0);
+    }
+    sink += sentBytes;
+}
+
+static void run_match(const void *argument, size_t iterations)
+{
+    const LdapFilter *filter = (const LdapFilter *)argument;
+    static const char *tokens[] = {"xbalek02@stud.fit.vutbr.cz", "petr.novak.x0001234@seznam.cz",
+                                   "jana.cerny.x0000001@stud.fit.vutbr.cz", "xnovak00@gmail.com"};
+    int lengths[4];
+    for (int t = 0; t < 4; t++)
+        lengths[t] = strlen(tokens[t]);
+    for (size_t i = 0; i < iterations; i++)
+        sink += is_token_equal_filter_value(*filter, tokens[i & 3], lengths[i & 3]);
+}
+
+static uint64_t now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t)time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+static void measure(const MicroBenchmark *benchmark, int runs, double runTime)
+{
+    // the warmup also finds the number of iterations filling one run
+    size_t iterations = 1;
+    uint64_t warmupEnd = now() + (uint64_t)MICRO_WARMUP_MS * 1000000, elapsed = 0;
+    while (now() < warmupEnd || elapsed < runTime * 1e9 / 4)
+    {
+        uint64_t start = now();
+        benchmark->run(benchmark->argument, iterations);
+        elapsed = now() - start;
+        if (elapsed < runTime * 1e9)
+            iterations *= 2;
+    }
+
+    double results[MICRO_MAX_RUNS];
+    double sum = 0, best = 0;
+    for (int run = 0; run < runs; run++)
+    {
+        uint64_t start = now();
+        benchmark->run(benchmark->argument, iterations);
+        results[run] = (double)(now() - start) / iterations;
+        sum += results[run];
+        if (run == 0 || results[run] < best)
+            best = results[run];
+    }
+    double mean = sum / runs, variance = 0;
+    for (int run = 0; run < runs; run++)
+        variance += (results[run] - mean) * (results[run] - mean);
+    double deviation = runs > 1 ? sqrt(variance / (runs - 1)) : 0;
+
+    printf("%-24s %12zu %10.2f %10.2f %10.2f %7.2f%%\n", benchmark->name, iterations, mean, best, deviation,
+           mean > 0 ? deviation / mean * 100 : 0);
+}
+
+static int load_directory(void)
+{
+    // entries from one value per attribute to many long values
+    char path[] = "/tmp/microbench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1)
+    {
+        perror("mkstemp");
+        return -1;
+    }
+    FILE *file = fdopen(fd, "w");
+    fprintf(file, "Balek Miroslav;xbalek02;xbalek02@stud.fit.vutbr.cz\r\n");
+    fprintf(file, "Novák Petr;xnovak00;");
+    for (int i = 0; i < 8; i++)
+        fprintf(file, "%spetr.novak.%d@stud.fit.vutbr.cz", i ? "," : "", i);
+    fprintf(file, "\r\nDvořák Jan;xdvora00;");
+    for (int i = 0; i < 48; i++)
+        fprintf(file, "%sjan.dvorak.with.a.long.alias.%d@stud.fit.vutbr.cz", i ? "," : "", i);
+    fprintf(file, "\r\n");
+    fclose(file);
+
+    Schema schema;
+    schema_default(&schema);
+    int result = directory_load(&directory, &schema, path, 1);
+    unlink(path);
+    return result;
+}
+
+static LdapFilter make_filter(enum FilterType type, enum SubstringType substringType, char *value, char *value2)
+{
+    LdapFilter filter;
+    memset(&filter, 0, sizeof(filter));
+    filter.filterType = type;
+    filter.substringType = substringType;
+    filter.attributeValue = value;
+    filter.attributeValueLength = strlen(value);
+    filter.attributeValue2 = value2;
+    filter.attributeValue2Length = value2 != NULL ? strlen(value2) : 0;
+    return filter;
+}
+
+int main(int argc, char *const argv[])
+{
+    int opt;
+    int runs = 10;
+    int cpu = -1;
+    double runTime = 0.05;
+    const char *only = NULL;
+
+    while ((opt = getopt(argc, argv, "r:t:c:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 't':
+            runTime = atof(optarg) / 1000;
+            break;
+        case 'c':
+            cpu = atoi(optarg);
+            break;
+        case 'b':
+            only = optarg;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-r runs] [-t ms per run] [-c cpu] [-b name prefix]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (runs < 1 || runs > MICRO_MAX_RUNS || runTime <= 0)
+    {
+        fprintf(stderr, "Usage: %s [-r runs] [-t ms per run] [-c cpu] [-b name prefix]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // a migration to another core in the middle of a run would show up as variance
+    if (cpu == -1)
+        cpu = sched_getcpu();
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1)
+        perror("sched_setaffinity");
+
+    response_init();
+    if (load_directory() == -1)
+        exit(EXIT_FAILURE);
+    arena_init(&arena, ARENA_BLOCK_SIZE);
+    requestArena = &arena;
+
+    static int smallInteger = 2, largeInteger = 1000000;
+    static size_t rows[] = {0, 1, 2};
+    static char shortString[] = "xbalek02";
+    static char longString[] = "Dvořák Jan, jan.dvorak.with.a.long.alias.0@stud.fit.vutbr.cz, and a long description";
+    static LdapFilter equality, prefix, infix, postfix, anyCenter, infixMiss;
+    equality = make_filter(EQUALITY_MATCH_FILTER, PREFIX, "xbalek02@stud.fit.vutbr.cz", NULL);
+    prefix = make_filter(SUBSTRING_FILTER, PREFIX, "petr.", NULL);
+    infix = make_filter(SUBSTRING_FILTER, INFIX, "x000", NULL);
+    postfix = make_filter(SUBSTRING_FILTER, POSTFIX, "@stud.fit.vutbr.cz", NULL);
+    anyCenter = make_filter(SUBSTRING_FILTER, ANY_CENTER, "jana", "vutbr.cz");
+    infixMiss = make_filter(SUBSTRING_FILTER, INFIX, "nowhere", NULL);
+
+    MicroBenchmark benchmarks[] = {
+        {"decode-element-info", run_element_info, equalityPdu},
+        {"decode-int-value", run_int_value, sizeLimitPdu + 2},
+        {"decode-search-equality", run_decode_search, equalityPdu},
+        {"decode-search-substring", run_decode_search, substringPdu},
+        {"decode-search-limits", run_decode_search, sizeLimitPdu},
+        {"encode-integer-small", run_add_integer, &smallInteger},
+        {"encode-integer-large", run_add_integer, &largeInteger},
+        {"encode-string-short", run_add_string, shortString},
+        {"encode-string-long", run_add_string, longString},
+        {"encode-bind-response", run_bind_response, NULL},
+        {"encode-search-done", run_search_done, NULL},
+        {"encode-entry-small", run_encode_entry, &rows[0]},
+        {"encode-entry-medium", run_encode_entry, &rows[1]},
+        {"encode-entry-large", run_encode_entry, &rows[2]},
+        {"match-equality", run_match, &equality},
+        {"match-prefix", run_match, &prefix},
+        {"match-infix", run_match, &infix},
+        {"match-infix-miss", run_match, &infixMiss},
+        {"match-postfix", run_match, &postfix},
+        {"match-any-center", run_match, &anyCenter},
+    };
+
+    printf("cpu %d, %d runs of %.0f ms after %d ms of warmup\n", cpu, runs, runTime * 1000, MICRO_WARMUP_MS);
+    printf("%-24s %12s %10s %10s %10s %8s\n", "benchmark", "iterations", "ns/op", "best", "stddev", "rsd");
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+    {
+        if (only == NULL || strncmp(benchmarks[i].name, only, strlen(only)) == 0)
+            measure(&benchmarks[i], runs, runTime);
+    }
+
+    arena_dispose(&arena);
+    directory_dispose(&directory);
+    return 0;
+}
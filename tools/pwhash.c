@@ -0,0 +1,75 @@
+/**
+ *
+ * @file pwhash.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * Hashes passwords for the password attribute of a database file.
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "password.h"
+
+static int print_hash(const char *password, size_t length, unsigned long iterations)
+{
+    char hash[PASSWORD_HASH_SIZE];
+    if (password_hash(password, length, iterations, hash, sizeof(hash)) == -1)
+    {
+        fprintf(stderr, "Failed to hash the password\n");
+        return -1;
+    }
+    printf("%s\n", hash);
+    return 0;
+}
+
+int main(int argc, char *const argv[])
+{
+    int opt;
+    unsigned long iterations = PASSWORD_DEFAULT_ITERATIONS;
+
+    while ((opt = getopt(argc, argv, "i:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i':
+            iterations = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-i iterations] [password]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (iterations == 0 || iterations > PASSWORD_MAX_ITERATIONS || argc - optind > 1)
+    {
+        fprintf(stderr, "Usage: %s [-i iterations] [password]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (optind < argc)
+        return print_hash(argv[optind], strlen(argv[optind]), iterations) == 0 ? 0 : EXIT_FAILURE;
+
+    // one password per line, so a whole column can be hashed at once
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &size, stdin)) != -1)
+    {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+            length--;
+        if (print_hash(line, length, iterations) == -1)
+        {
+            free(line);
+            exit(EXIT_FAILURE);
+        }
+    }
+    free(line);
+    return 0;
+}
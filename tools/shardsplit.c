@@ -0,0 +1,133 @@
+/**
+ *
+ * @file shardsplit.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * Splitter of a database file into the files of the shards served by a proxy.
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "schema.h"
+#include "shard.h"
+
+static void usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [-s schema] [-m hash|range:<bound>,...] -n shards -o prefix <file>\n", program);
+    fprintf(stderr, "Writes the lines of every shard to <prefix>-<shard>.csv, split as a proxy given -H routes them.\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *schemaPath = NULL;
+    const char *partitioning = "hash";
+    const char *prefix = NULL;
+    int count = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:m:n:o:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            schemaPath = optarg;
+            break;
+        case 'm':
+            partitioning = optarg;
+            break;
+        case 'n':
+            count = atoi(optarg);
+            break;
+        case 'o':
+            prefix = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || prefix == NULL)
+        usage(argv[0]);
+
+    Schema schema;
+    if (schemaPath == NULL)
+        schema_default(&schema);
+    else if (schema_load(&schema, schemaPath) == -1)
+        return EXIT_FAILURE;
+    ShardMap map;
+    if (shard_parse(&map, partitioning, count, &schema) == -1)
+        return EXIT_FAILURE;
+
+    FILE *in = fopen(argv[optind], "r");
+    if (in == NULL)
+    {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+    FILE *out[SHARD_MAX_COUNT];
+    for (int shard = 0; shard < count; shard++)
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s-%d.csv", prefix, shard);
+        out[shard] = fopen(path, "w");
+        if (out[shard] == NULL)
+        {
+            perror(path);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // the rdn field decides the shard, the line is copied as it is
+    int column = schema.attributes[schema.rdn].csvColumn;
+    size_t rows[SHARD_MAX_COUNT] = {0};
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    while ((length = getline(&line, &capacity, in)) != -1)
+    {
+        size_t end = length;
+        while (end > 0 && (line[end - 1] == '\n' || line[end - 1] == '\r'))
+            end--;
+        if (end == 0)
+            continue;
+
+        const char *field = line;
+        const char *lineEnd = line + end;
+        for (int i = 0; i < column && field != NULL; i++)
+        {
+            field = memchr(field, ';', lineEnd - field);
+            if (field != NULL)
+                field++;
+        }
+        Field value = {"", 0};
+        if (field != NULL)
+        {
+            const char *fieldEnd = memchr(field, ';', lineEnd - field);
+            value.value = field;
+            value.length = (fieldEnd != NULL ? fieldEnd : lineEnd) - field;
+        }
+        int shard = shard_of_value(&map, value);
+        fwrite(line, 1, length, out[shard]);
+        rows[shard]++;
+    }
+    free(line);
+    fclose(in);
+
+    for (int shard = 0; shard < count; shard++)
+    {
+        printf("%s-%d.csv: %zu lines\n", prefix, shard, rows[shard]);
+        if (fclose(out[shard]) != 0)
+        {
+            perror(prefix);
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
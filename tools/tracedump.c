@@ -0,0 +1,138 @@
+/**
+ *
+ * @file tracedump.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * Decoder of the trace rings written by the server.
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "trace.h"
+
+/**
+ * Structure representing one decoded event with the thread that wrote it.
+ */
+typedef struct
+{
+    TraceRecord record; /**< The event. */
+    uint32_t pid;       /**< The process of the thread. */
+    uint64_t tid;       /**< The thread. */
+} Event;
+
+static Event *events;
+static size_t eventCount;
+static size_t eventCapacity;
+
+static int load_ring(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        perror(path);
+        return -1;
+    }
+
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC || header.version != TRACE_VERSION)
+    {
+        fprintf(stderr, "%s is not a trace file\n", path);
+        fclose(file);
+        return -1;
+    }
+
+    // only the last capacity events survive in the ring
+    uint64_t first = header.written > header.capacity ? header.written - header.capacity : 0;
+    TraceRecord *records = (TraceRecord *)malloc((size_t)header.capacity * sizeof(TraceRecord));
+    if (records == NULL || fread(records, sizeof(TraceRecord), header.capacity, file) != header.capacity)
+    {
+        fprintf(stderr, "%s is truncated\n", path);
+        free(records);
+        fclose(file);
+        return -1;
+    }
+    fclose(file);
+
+    for (uint64_t n = first; n < header.written; n++)
+    {
+        if (eventCount == eventCapacity)
+        {
+            eventCapacity = eventCapacity ? eventCapacity * 2 : 4096;
+            events = (Event *)realloc(events, eventCapacity * sizeof(Event));
+            if (events == NULL)
+            {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        events[eventCount].record = records[n % header.capacity];
+        events[eventCount].pid = header.pid;
+        events[eventCount].tid = header.tid;
+        eventCount++;
+    }
+    if (first > 0)
+        fprintf(stderr, "%s: %llu older events were overwritten\n", path, (unsigned long long)first);
+    free(records);
+    return 0;
+}
+
+static int compare_events(const void *a, const void *b)
+{
+    uint64_t timeA = ((const Event *)a)->record.time;
+    uint64_t timeB = ((const Event *)b)->record.time;
+    return timeA < timeB ? -1 : timeA > timeB;
+}
+
+static void print_event(const Event *event, uint64_t start)
+{
+    const TraceRecord *record = &event->record;
+    printf("%12.6f %6u %6llu %-16s ", (record->time - start) / 1e9, event->pid, (unsigned long long)event->tid,
+           trace_event_name(record->event));
+
+    if (record->event == TRACE_BYTES)
+    {
+        unsigned char chunk[TRACE_BYTES_PER_EVENT];
+        memcpy(chunk, &record->arg1, sizeof(record->arg1));
+        memcpy(chunk + sizeof(record->arg1), &record->arg2, sizeof(record->arg2));
+        int length = record->arg0 & 0xFF;
+        printf("%04X:", record->arg0 >> 8);
+        for (int i = 0; i < length && i < TRACE_BYTES_PER_EVENT; i++)
+            printf(" %02X", chunk[i]);
+        printf("\n");
+        return;
+    }
+
+    printf(trace_event_format(record->event), record->arg0, (unsigned long long)record->arg1, (unsigned long long)record->arg2);
+    printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf(stderr, "Usage: %s <trace file>...\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 1; i < argc; i++)
+        load_ring(argv[i]);
+    if (eventCount == 0)
+        return 0;
+
+    // the rings of all threads are merged into one timeline
+    qsort(events, eventCount, sizeof(Event), compare_events);
+    printf("%12s %6s %6s %-16s %s\n", "time", "pid", "tid", "event", "arguments");
+    for (size_t i = 0; i < eventCount; i++)
+        print_event(&events[i], events[0].record.time);
+
+    free(events);
+    return 0;
+}
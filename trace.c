@@ -0,0 +1,245 @@
+/**
+ *
+ * @file trace.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "trace.h"
+
+/**
+ * Structure representing the ring of one thread.
+ */
+typedef struct
+{
+    TraceHeader *header;  /**< The mapped trace file. */
+    TraceRecord *records; /**< The records following the header. */
+    bool failed;          /**< Flag indicating whether the trace file could not be created. */
+    int slot;             /**< The trace file owned by the thread. */
+} TraceRing;
+
+/**
+ * Structure representing the tracing state shared with the connection processes.
+ */
+typedef struct
+{
+    int level;                          /**< The current level. */
+    unsigned next;                      /**< The slot tried first by the next ring. */
+    pid_t owners[TRACE_MAX_RINGS];      /**< The process owning every trace file or 0 if it is free. */
+} TraceShared;
+
+static int initialLevel = TRACE_OFF;
+int *traceLevel = &initialLevel;
+static TraceShared *shared;
+static const char *traceDirectory;
+static __thread TraceRing ring;
+
+static const struct
+{
+    const char *name;
+    const char *format;
+} events[TRACE_EVENT_COUNT] = {
+    [TRACE_CONNECTION_OPEN] = {"connection-open", "socket=%u"},
+    [TRACE_CONNECTION_CLOSE] = {"connection-close", "socket=%u requests=%llu"},
+    [TRACE_REQUEST] = {"request", "id=%u op=0x%02llX length=%llu"},
+    [TRACE_BYTES] = {"bytes", ""},
+    [TRACE_ELEMENT] = {"element", "tag=0x%02X length=%llu start=%llu"},
+    [TRACE_BIND] = {"bind", "id=%u version=%llu result=%llu"},
+    [TRACE_SEARCH] = {"search", "id=%u filter=0x%02llX sizeLimit=%llu"},
+    [TRACE_SEARCH_STEP] = {"search-step", "id=%u row=%llu entries=%llu"},
+    [TRACE_SEARCH_DONE] = {"search-done", "id=%u entries=%llu result=%llu"},
+    [TRACE_COMPARE] = {"compare", "id=%u result=%llu"},
+    [TRACE_ABANDON] = {"abandon", "id=%u target=%llu running=%llu"},
+    [TRACE_UNBIND] = {"unbind", "id=%u"},
+    [TRACE_UNSUPPORTED] = {"unsupported", "id=%u op=0x%02llX length=%llu"},
+    [TRACE_ARENA] = {"arena", "id=%u allocations=%llu heapCalls=%llu"},
+    [TRACE_SEND] = {"send", "socket=%u bytes=%llu pending=%llu"},
+    [TRACE_PAUSE] = {"pause", "socket=%u pending=%llu"},
+    [TRACE_RESUME] = {"resume", "socket=%u pending=%llu"},
+    [TRACE_UPDATE] = {"update", "id=%u op=0x%02llX result=%llu"},
+};
+
+int trace_init(const char *directory, int level)
+{
+    shared = (TraceShared *)mmap(NULL, sizeof(TraceShared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+    traceLevel = &shared->level;
+    trace_set_level(level);
+
+    if (directory != NULL && access(directory, W_OK) == -1)
+    {
+        perror(directory);
+        return -1;
+    }
+    traceDirectory = directory;
+    return 0;
+}
+
+void trace_set_level(int level)
+{
+    if (level < TRACE_OFF)
+        level = TRACE_OFF;
+    if (level > TRACE_VERBOSE)
+        level = TRACE_VERBOSE;
+    __atomic_store_n(traceLevel, level, __ATOMIC_RELAXED);
+}
+
+static int trace_claim_slot(pid_t owner)
+{
+    // slots are handed out round robin, so the file of a closed connection is kept as long as possible
+    unsigned start = __atomic_fetch_add(&shared->next, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < TRACE_MAX_RINGS; i++)
+    {
+        int slot = (start + i) % TRACE_MAX_RINGS;
+        pid_t current = __atomic_load_n(&shared->owners[slot], __ATOMIC_ACQUIRE);
+        // the file of a connection process that died without closing its ring is taken over
+        if (current != 0 && (kill(current, 0) == 0 || errno != ESRCH))
+            continue;
+        if (__atomic_compare_exchange_n(&shared->owners[slot], &current, owner, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return slot;
+    }
+    return -1;
+}
+
+static void trace_release_slot(void)
+{
+    __atomic_store_n(&shared->owners[ring.slot], 0, __ATOMIC_RELEASE);
+}
+
+static bool trace_open_ring(void)
+{
+    ring.failed = true;
+    if (traceDirectory == NULL)
+        return false;
+
+    // every thread beyond TRACE_MAX_RINGS at once goes untraced
+    ring.slot = trace_claim_slot(getpid());
+    if (ring.slot == -1)
+        return false;
+
+    char path[4096];
+    pid_t tid = syscall(SYS_gettid);
+    snprintf(path, sizeof(path), "%s/trace-%d.bin", traceDirectory, ring.slot);
+    size_t size = sizeof(TraceHeader) + (size_t)TRACE_RING_EVENTS * sizeof(TraceRecord);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1)
+    {
+        perror(path);
+        trace_release_slot();
+        return false;
+    }
+    if (ftruncate(fd, size) == -1)
+    {
+        perror(path);
+        close(fd);
+        trace_release_slot();
+        return false;
+    }
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED)
+    {
+        perror("mmap");
+        trace_release_slot();
+        return false;
+    }
+
+    // the file stays readable by the decoder even if the process crashes, a reused one starts over
+    ring.header = (TraceHeader *)memory;
+    ring.records = (TraceRecord *)(ring.header + 1);
+    ring.header->magic = TRACE_MAGIC;
+    ring.header->version = TRACE_VERSION;
+    ring.header->capacity = TRACE_RING_EVENTS;
+    ring.header->pid = getpid();
+    ring.header->tid = tid;
+    ring.header->written = 0;
+    ring.failed = false;
+    return true;
+}
+
+void trace_write(uint32_t event, uint32_t arg0, uint64_t arg1, uint64_t arg2)
+{
+    if (ring.header == NULL && (ring.failed || !trace_open_ring()))
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    uint64_t written = ring.header->written;
+    TraceRecord *record = &ring.records[written & (TRACE_RING_EVENTS - 1)];
+    record->time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    record->event = event;
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+    record->arg2 = arg2;
+
+    // a reader of a live file sees the count only after the record
+    __atomic_store_n(&ring.header->written, written + 1, __ATOMIC_RELEASE);
+}
+
+void trace_bytes(const unsigned char *data, size_t length)
+{
+    if (TRACE_DEBUG > TRACE_COMPILED_LEVEL || TRACE_DEBUG > *traceLevel)
+        return;
+
+    for (size_t offset = 0; offset < length; offset += TRACE_BYTES_PER_EVENT)
+    {
+        unsigned char chunk[TRACE_BYTES_PER_EVENT] = {0};
+        size_t chunkLength = length - offset < TRACE_BYTES_PER_EVENT ? length - offset : TRACE_BYTES_PER_EVENT;
+        memcpy(chunk, data + offset, chunkLength);
+
+        uint64_t low, high;
+        memcpy(&low, chunk, sizeof(low));
+        memcpy(&high, chunk + sizeof(low), sizeof(high));
+        // arg0 holds the offset of the chunk and its length in the low byte
+        trace_write(TRACE_BYTES, (uint32_t)(offset << 8 | chunkLength), low, high);
+    }
+}
+
+void trace_close(void)
+{
+    if (ring.header != NULL)
+    {
+        munmap(ring.header, sizeof(TraceHeader) + (size_t)ring.header->capacity * sizeof(TraceRecord));
+        trace_release_slot();
+    }
+    trace_after_fork();
+}
+
+void trace_after_fork(void)
+{
+    ring.header = NULL;
+    ring.records = NULL;
+    ring.failed = false;
+}
+
+const char *trace_event_name(uint32_t event)
+{
+    return event < TRACE_EVENT_COUNT && events[event].name != NULL ? events[event].name : "unknown";
+}
+
+const char *trace_event_format(uint32_t event)
+{
+    return event < TRACE_EVENT_COUNT && events[event].format != NULL ? events[event].format : "%u %llu %llu";
+}
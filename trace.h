@@ -0,0 +1,191 @@
+/**
+ *
+ * @file trace.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum TraceLevel
+{
+    TRACE_OFF = 0,
+    TRACE_INFO = 1,    // connections, requests and their results
+    TRACE_DEBUG = 2,   // search steps, sends, arena usage and message bytes
+    TRACE_VERBOSE = 3  // every decoded BER element
+};
+
+// call sites above this level are removed by the compiler, set by the Makefile
+#ifndef TRACE_COMPILED_LEVEL
+#define TRACE_COMPILED_LEVEL TRACE_DEBUG
+#endif
+
+enum TraceConst
+{
+    TRACE_RING_EVENTS = 1 << 16, // events kept per thread, a power of two
+    TRACE_MAX_RINGS = 64,        // trace files of a trace directory, reused once their threads exit
+    TRACE_MAGIC = 0x5254444C,    // "LDTR"
+    TRACE_VERSION = 1,
+    TRACE_BYTES_PER_EVENT = 16   // message bytes carried by one TRACE_BYTES event
+};
+
+enum TraceEvent
+{
+    TRACE_CONNECTION_OPEN,
+    TRACE_CONNECTION_CLOSE,
+    TRACE_REQUEST,
+    TRACE_BYTES,
+    TRACE_ELEMENT,
+    TRACE_BIND,
+    TRACE_SEARCH,
+    TRACE_SEARCH_STEP,
+    TRACE_SEARCH_DONE,
+    TRACE_COMPARE,
+    TRACE_ABANDON,
+    TRACE_UNBIND,
+    TRACE_UNSUPPORTED,
+    TRACE_ARENA,
+    TRACE_SEND,
+    TRACE_PAUSE,
+    TRACE_RESUME,
+    TRACE_UPDATE,
+    TRACE_EVENT_COUNT
+};
+
+/**
+ * Structure representing one traced event.
+ */
+typedef struct
+{
+    uint64_t time;  /**< CLOCK_MONOTONIC time of the event in nanoseconds. */
+    uint32_t event; /**< The TraceEvent. */
+    uint32_t arg0;  /**< The first argument, meaning given by the event. */
+    uint64_t arg1;  /**< The second argument. */
+    uint64_t arg2;  /**< The third argument. */
+} TraceRecord;
+
+/**
+ * Structure representing the header of a trace file.
+ *
+ * The file holds the ring of one thread: the header followed by capacity records.
+ * Event number n is stored in record n modulo capacity, so once more than capacity
+ * events were written only the last capacity ones are kept.
+ */
+typedef struct
+{
+    uint32_t magic;    /**< TRACE_MAGIC. */
+    uint32_t version;  /**< TRACE_VERSION. */
+    uint32_t capacity; /**< The number of records in the ring. */
+    uint32_t pid;      /**< The process of the thread. */
+    uint64_t tid;      /**< The kernel thread id. */
+    uint64_t written;  /**< The number of events written so far. */
+} TraceHeader;
+
+/**
+ * Current trace level, shared by all connection processes.
+ */
+extern int *traceLevel;
+
+/**
+ * Trace Event.
+ *
+ * Records the event in the ring of the calling thread when the level is enabled.
+ * Call sites above TRACE_COMPILED_LEVEL compile to nothing.
+ */
+#define trace(level, event, arg0, arg1, arg2)                                   \
+    do                                                                          \
+    {                                                                           \
+        if ((level) <= TRACE_COMPILED_LEVEL && (level) <= *traceLevel)          \
+            trace_write((event), (uint32_t)(arg0), (uint64_t)(arg1), (uint64_t)(arg2)); \
+    } while (0)
+
+/**
+ * Initialize Tracing.
+ *
+ * Allocates the level and the owners of the trace files shared with the connection
+ * processes. Rings are created lazily by the first event of every thread.
+ *
+ * @param directory The directory receiving the trace files or NULL to only
+ *                  print debugging output.
+ * @param level     The initial level.
+ *
+ * @return 0 on success, -1 if the directory is not writable.
+ */
+int trace_init(const char *directory, int level);
+
+/**
+ * Set Trace Level.
+ *
+ * Safe to call from a signal handler.
+ *
+ * @param level The new level, clamped to <TRACE_OFF, TRACE_VERBOSE>.
+ */
+void trace_set_level(int level);
+
+/**
+ * Write Trace Event.
+ *
+ * Appends the event to the ring of the calling thread. Only the owning thread writes
+ * to a ring, so no locks are taken. Use the trace() macro instead of calling this directly.
+ *
+ * @param event The TraceEvent.
+ * @param arg0  The first argument.
+ * @param arg1  The second argument.
+ * @param arg2  The third argument.
+ */
+void trace_write(uint32_t event, uint32_t arg0, uint64_t arg1, uint64_t arg2);
+
+/**
+ * Trace Message Bytes.
+ *
+ * Records the bytes of an encoded message at TRACE_DEBUG, TRACE_BYTES_PER_EVENT bytes per event.
+ *
+ * @param data   A pointer to the bytes.
+ * @param length The number of bytes.
+ */
+void trace_bytes(const unsigned char *data, size_t length);
+
+/**
+ * Detach Ring After Fork.
+ *
+ * The child of a fork starts its own ring instead of writing into the ring of its parent.
+ */
+void trace_after_fork(void);
+
+/**
+ * Close Ring.
+ *
+ * Unmaps the ring of the calling thread and frees its trace file for the ring of
+ * another thread, called by threads and connection processes before they exit.
+ */
+void trace_close(void);
+
+/**
+ * Get Event Name.
+ *
+ * @param event The TraceEvent.
+ *
+ * @return The name of the event.
+ */
+const char *trace_event_name(uint32_t event);
+
+/**
+ * Get Event Format.
+ *
+ * @param event The TraceEvent.
+ *
+ * @return The printf format of the arguments of the event, taking arg0, arg1 and arg2
+ *         as unsigned, unsigned long long and unsigned long long. Trailing arguments
+ *         the event does not use are left out of the format.
+ */
+const char *trace_event_format(uint32_t event);
+
+#endif
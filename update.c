@@ -0,0 +1,464 @@
+/**
+ *
+ * @file update.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+#include "utils.h"
+#include "arena.h"
+#include "directory.h"
+#include "schema.h"
+#include "normalize.h"
+#include "overlay.h"
+#include "wal.h"
+#include "password.h"
+#include "search.h"
+#include "compare.h"
+#include "stats.h"
+#include "trace.h"
+#include "response.h"
+#include "update.h"
+
+/**
+ * Structure representing the values of one attribute while an entry is changed.
+ */
+typedef struct
+{
+    Field *items; /**< The values, allocated from the request arena. */
+    int count;    /**< The number of values. */
+} UpdateValues;
+
+static bool update_read_string(const unsigned char *data, size_t end, size_t *position, Field *value)
+{
+    size_t length;
+    if (ber_read_header(data, end, position, &length) != OCTET_STRING_TYPE)
+        return false;
+    value->value = (const char *)data + *position;
+    value->length = length;
+    *position += length;
+    return true;
+}
+
+static bool update_read_attribute(const unsigned char *data, size_t end, size_t *position, LdapChange *change)
+{
+    // an attribute of an add and of a modification are both encoded as a partial attribute
+    size_t length;
+    if (ber_read_header(data, end, position, &length) != LDAP_PARTIAL_ATTRIBUTE_LIST)
+        return false;
+    size_t attributeEnd = *position + length;
+    Field type;
+    if (!update_read_string(data, attributeEnd, position, &type) ||
+        ber_read_header(data, attributeEnd, position, &length) != LDAP_PARTIAL_ATTRIBUTE_LIST_VALUE)
+        return false;
+
+    // every value takes at least two bytes
+    size_t valuesEnd = *position + length;
+    change->type = arena_strndup(requestArena, type.value, type.length);
+    change->values = (Field *)arena_alloc(requestArena, (length / 2 + 1) * sizeof(Field));
+    change->valueCount = 0;
+    while (*position < valuesEnd)
+    {
+        if (!update_read_string(data, valuesEnd, position, &change->values[change->valueCount]))
+            return false;
+        change->valueCount++;
+    }
+    *position = attributeEnd;
+    return true;
+}
+
+LdapUpdate ldap_update(const unsigned char *data, size_t length, int messageId)
+{
+    LdapUpdate update;
+    update.messageId = messageId;
+    update.requestType = -1;
+    update.entry = "";
+    update.changeCount = 0;
+    update.valid = false;
+
+    size_t position = 0, elementLength;
+    if (ber_read_header(data, length, &position, &elementLength) != LDAP_MESSAGE_PREFIX ||
+        ber_read_header(data, length, &position, &elementLength) != INTEGER_TYPE)
+        return update;
+    position += elementLength;
+    update.requestType = ber_read_header(data, length, &position, &elementLength);
+    if (update.requestType == -1)
+        return update;
+    size_t end = position + elementLength;
+
+    // the dn is the whole content of a delete request
+    if (update.requestType == LDAP_DELETE_REQUEST)
+    {
+        update.entry = arena_strndup(requestArena, (const char *)data + position, elementLength);
+        update.valid = true;
+        return update;
+    }
+
+    Field entry;
+    if (!update_read_string(data, end, &position, &entry) ||
+        ber_read_header(data, end, &position, &elementLength) != LDAP_MESSAGE_PREFIX)
+        return update;
+    update.entry = arena_strndup(requestArena, entry.value, entry.length);
+
+    size_t listEnd = position + elementLength;
+    while (position < listEnd)
+    {
+        if (update.changeCount == UPDATE_MAX_CHANGES)
+            return update;
+        LdapChange *change = &update.changes[update.changeCount++];
+        if (update.requestType != LDAP_MODIFY_REQUEST)
+        {
+            change->operation = MODIFY_ADD;
+            if (!update_read_attribute(data, listEnd, &position, change))
+                return update;
+            continue;
+        }
+
+        size_t changeLength, operationLength;
+        if (ber_read_header(data, listEnd, &position, &changeLength) != LDAP_MESSAGE_PREFIX)
+            return update;
+        size_t changeEnd = position + changeLength;
+        if (ber_read_header(data, changeEnd, &position, &operationLength) != ENUMERATED_TYPE || operationLength != 1)
+            return update;
+        change->operation = data[position++];
+        if (!update_read_attribute(data, changeEnd, &position, change))
+            return update;
+        position = changeEnd;
+    }
+    update.valid = true;
+    return update;
+}
+
+static bool update_value_valid(const Attribute *attribute, Field value)
+{
+    // the database file has no quoting, so its separators cannot be stored
+    if (value.length == 0)
+        return false;
+    for (int i = 0; i < value.length; i++)
+    {
+        char c = value.value[i];
+        if (c == ';' || c == '\n' || c == '\r' || c == '\0' || (attribute->separator != 0 && c == attribute->separator))
+            return false;
+    }
+    return true;
+}
+
+static bool update_value_equal(const Attribute *attribute, Field a, Field b)
+{
+    bool foldCase = attribute->rule == CASE_IGNORE_MATCH;
+    ArenaMark mark = arena_mark(requestArena);
+    char *keyA = (char *)arena_alloc(requestArena, a.length + 1);
+    char *keyB = (char *)arena_alloc(requestArena, b.length + 1);
+    int lengthA = normalize_value(a.value, a.length, keyA, true, foldCase);
+    int lengthB = normalize_value(b.value, b.length, keyB, true, foldCase);
+    bool equal = lengthA == lengthB && memcmp(keyA, keyB, lengthA) == 0;
+    arena_release(requestArena, mark);
+    return equal;
+}
+
+static int update_find_value(const Attribute *attribute, const UpdateValues *values, Field value)
+{
+    for (int i = 0; i < values->count; i++)
+    {
+        if (update_value_equal(attribute, values->items[i], value))
+            return i;
+    }
+    return -1;
+}
+
+static void update_load(const Directory *directory, size_t row, int column, char *scratch, UpdateValues *values)
+{
+    const Attribute *attribute = &directory->schema.attributes[column];
+    Field field = directory_value(directory, row, column, scratch), rest, value;
+
+    // the scratch is reused by the next column
+    field.value = arena_strndup(requestArena, field.value, field.length);
+    values->count = 0;
+    rest = field;
+    while (field_next_value(&rest, attribute->separator, &value))
+        values->count++;
+    values->items = (Field *)arena_alloc(requestArena, values->count * sizeof(Field));
+    values->count = 0;
+    rest = field;
+    while (field_next_value(&rest, attribute->separator, &value))
+    {
+        if (value.length > 0)
+            values->items[values->count++] = value;
+    }
+}
+
+static Field update_join(const Attribute *attribute, const UpdateValues *values)
+{
+    size_t length = 0;
+    for (int i = 0; i < values->count; i++)
+        length += values->items[i].length + 1;
+    char *joined = (char *)arena_alloc(requestArena, length + 1);
+
+    Field field;
+    field.value = joined;
+    field.length = 0;
+    for (int i = 0; i < values->count; i++)
+    {
+        if (i > 0)
+            joined[field.length++] = attribute->separator;
+        memcpy(joined + field.length, values->items[i].value, values->items[i].length);
+        field.length += values->items[i].length;
+    }
+    return field;
+}
+
+static int update_apply(const Attribute *attribute, UpdateValues *values, const LdapChange *change)
+{
+    if (change->operation == MODIFY_DELETE)
+    {
+        if (change->valueCount == 0)
+        {
+            if (values->count == 0)
+                return NO_SUCH_ATTRIBUTE;
+            values->count = 0;
+            return SUCCESS;
+        }
+        for (int i = 0; i < change->valueCount; i++)
+        {
+            int found = update_find_value(attribute, values, change->values[i]);
+            if (found == -1)
+                return NO_SUCH_ATTRIBUTE;
+            memmove(&values->items[found], &values->items[found + 1], (values->count - found - 1) * sizeof(Field));
+            values->count--;
+        }
+        return SUCCESS;
+    }
+    if (change->operation != MODIFY_ADD && change->operation != MODIFY_REPLACE)
+        return PROTOCOL_ERROR;
+
+    for (int i = 0; i < change->valueCount; i++)
+    {
+        if (!update_value_valid(attribute, change->values[i]))
+            return INVALID_ATTRIBUTE_SYNTAX;
+    }
+    int kept = change->operation == MODIFY_REPLACE ? 0 : values->count;
+    Field *items = (Field *)arena_alloc(requestArena, (kept + change->valueCount) * sizeof(Field));
+    memcpy(items, values->items, kept * sizeof(Field));
+    values->items = items;
+    values->count = kept;
+    for (int i = 0; i < change->valueCount; i++)
+    {
+        if (update_find_value(attribute, values, change->values[i]) != -1)
+            return ATTRIBUTE_OR_VALUE_EXISTS;
+        values->items[values->count++] = change->values[i];
+    }
+    if (attribute->separator == 0 && values->count > 1)
+        return CONSTRAINT_VIOLATION;
+    return SUCCESS;
+}
+
+static int update_hash_passwords(LdapUpdate *update, const Directory *directory, const int *columns)
+{
+    // hashing takes long, so it is done before the writers are serialized
+    size_t schemeLength = strlen(PASSWORD_SCHEME);
+    for (int i = 0; i < update->changeCount; i++)
+    {
+        LdapChange *change = &update->changes[i];
+        if (columns[i] == -1 || columns[i] != directory->schema.password || change->operation == MODIFY_DELETE)
+            continue;
+        for (int j = 0; j < change->valueCount; j++)
+        {
+            Field *value = &change->values[j];
+            if ((size_t)value->length >= schemeLength && memcmp(value->value, PASSWORD_SCHEME, schemeLength) == 0)
+                continue;
+            if (value->length == 0)
+                continue;
+            char *hash = (char *)arena_alloc(requestArena, PASSWORD_HASH_SIZE);
+            if (password_hash(value->value, value->length, PASSWORD_DEFAULT_ITERATIONS, hash, PASSWORD_HASH_SIZE) == -1)
+                return OTHER;
+            value->value = hash;
+            value->length = strlen(hash);
+        }
+    }
+    return SUCCESS;
+}
+
+static int update_entry(const LdapUpdate *update, Directory *directory, const int *columns, Field rdn, uint64_t *sequence)
+{
+    const Schema *schema = &directory->schema;
+    size_t row;
+    bool exists = find_entry_by_dn(directory, update->entry, &row);
+    if (update->requestType == LDAP_DELETE_REQUEST)
+    {
+        if (!exists)
+            return NO_SUCH_OBJECT;
+        if (!overlay_has_room(directory, row, NULL))
+            return ADMIN_LIMIT_EXCEEDED;
+        return wal_delete(directory, row, sequence) == 0 ? SUCCESS : OTHER;
+    }
+    if (update->requestType == LDAP_ADD_REQUEST)
+    {
+        if (exists)
+            return ENTRY_ALREADY_EXISTS;
+        row = directory_row_count(directory);
+    }
+    else if (!exists)
+    {
+        return NO_SUCH_OBJECT;
+    }
+
+    int maxLength = 0;
+    for (int column = 0; column < schema->attributeCount; column++)
+    {
+        if (directory->columns[column].maxLength > maxLength)
+            maxLength = directory->columns[column].maxLength;
+    }
+    char *scratch = (char *)arena_alloc(requestArena, maxLength + 1);
+    UpdateValues *values = (UpdateValues *)arena_alloc(requestArena, schema->attributeCount * sizeof(UpdateValues));
+    for (int column = 0; column < schema->attributeCount; column++)
+    {
+        if (exists)
+        {
+            update_load(directory, row, column, scratch, &values[column]);
+        }
+        else
+        {
+            values[column].items = NULL;
+            values[column].count = 0;
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < update->changeCount; i++)
+    {
+        if (columns[i] == -1)
+            continue;
+        int resultCode = update_apply(&schema->attributes[columns[i]], &values[columns[i]], &update->changes[i]);
+        if (resultCode != SUCCESS)
+            return resultCode;
+        changed = true;
+    }
+
+    // the rdn value of an entry is its dn
+    UpdateValues *rdnValues = &values[schema->rdn];
+    if (!exists && rdnValues->count == 0)
+    {
+        rdnValues->items = (Field *)arena_alloc(requestArena, sizeof(Field));
+        rdnValues->items[0] = rdn;
+        rdnValues->count = 1;
+    }
+    if (rdnValues->count != 1 || !update_value_equal(&schema->attributes[schema->rdn], rdnValues->items[0], rdn))
+        return exists ? NOT_ALLOWED_ON_RDN : NAMING_VIOLATION;
+    if (exists && !changed)
+        return SUCCESS;
+
+    Field *joined = (Field *)arena_alloc(requestArena, schema->attributeCount * sizeof(Field));
+    for (int column = 0; column < schema->attributeCount; column++)
+        joined[column] = update_join(&schema->attributes[column], &values[column]);
+    if (!overlay_has_room(directory, row, joined))
+        return ADMIN_LIMIT_EXCEEDED;
+    return wal_put(directory, row, joined, sequence) == 0 ? SUCCESS : OTHER;
+}
+
+static int update_write(LdapUpdate *update, Directory *directory)
+{
+    if (!update->valid)
+        return PROTOCOL_ERROR;
+    if (!wal_is_open())
+        return UNWILLING_TO_PERFORM;
+
+    Field rdn;
+    if (!split_entry_dn(directory, update->entry, &rdn))
+        return NO_SUCH_OBJECT;
+    if (update->requestType == LDAP_ADD_REQUEST &&
+        (rdn.length == 0 || memchr(rdn.value, '=', rdn.length) != NULL || memchr(rdn.value, ',', rdn.length) != NULL ||
+         !update_value_valid(&directory->schema.attributes[directory->schema.rdn], rdn)))
+        return INVALID_DN_SYNTAX;
+
+    // there is a single object class, so it is accepted and left out
+    int columns[UPDATE_MAX_CHANGES];
+    for (int i = 0; i < update->changeCount; i++)
+    {
+        columns[i] = schema_find(&directory->schema, update->changes[i].type);
+        if (columns[i] == -1 && strcasecmp(update->changes[i].type, "objectClass") != 0)
+            return UNDEFINED_ATTRIBUTE_TYPE;
+    }
+    int resultCode = update_hash_passwords(update, directory, columns);
+    if (resultCode != SUCCESS)
+        return resultCode;
+
+    // the change is visible as soon as the lock is released, durable once committed
+    uint64_t sequence = 0;
+    overlay_lock(directory->overlay);
+    resultCode = update_entry(update, directory, columns, rdn, &sequence);
+    overlay_unlock(directory->overlay);
+    if (sequence == 0)
+        return resultCode;
+    if (wal_commit(sequence) == -1)
+        return OTHER;
+    wal_compact_if_due(directory);
+    return SUCCESS;
+}
+
+int ldap_update_evaluate(LdapUpdate update, Directory *directory)
+{
+    int resultCode = update_write(&update, directory);
+    stats_add(&stats->updates, 1);
+    if (resultCode != SUCCESS)
+        stats_add(&stats->updateFailures, 1);
+    return resultCode;
+}
+
+void ldap_update_response_encode(unsigned char *buff, int *offset, int tag, int resultCode)
+{
+    add_ldap_byte(buff, offset, tag);
+    int resultLengthOffset = *offset;
+    add_ldap_byte(buff, offset, LDAP_PLACEHOLDER);
+
+    add_ldap_byte(buff, offset, ENUMERATED_TYPE);
+    add_ldap_byte(buff, offset, 0x01);
+    add_ldap_byte(buff, offset, resultCode);
+    add_ldap_string(buff, offset, "");
+    switch (resultCode)
+    {
+    case NO_SUCH_OBJECT:
+        add_ldap_string(buff, offset, "No such entry.");
+        break;
+    case UNDEFINED_ATTRIBUTE_TYPE:
+        add_ldap_string(buff, offset, "Unknown attribute.");
+        break;
+    case UNWILLING_TO_PERFORM:
+        add_ldap_string(buff, offset, "The directory is read-only.");
+        break;
+    case ADMIN_LIMIT_EXCEEDED:
+        add_ldap_string(buff, offset, "No room for more changes until the server restarts.");
+        break;
+    case NOT_ALLOWED_ON_RDN:
+        add_ldap_string(buff, offset, "The rdn of an entry cannot be modified.");
+        break;
+    case OTHER:
+        add_ldap_string(buff, offset, "The change could not be written to disk.");
+        break;
+    default:
+        add_ldap_string(buff, offset, "");
+        break;
+    }
+
+    set_ldap_length(buff, offset, resultLengthOffset);
+}
+
+void ldap_update_response(LdapUpdate update, int resultCode, int clientSocket)
+{
+    trace(TRACE_INFO, TRACE_UPDATE, update.messageId, update.requestType, resultCode);
+    int kind = RESPONSE_MODIFY;
+    if (update.requestType == LDAP_ADD_REQUEST)
+        kind = RESPONSE_ADD;
+    else if (update.requestType == LDAP_DELETE_REQUEST)
+        kind = RESPONSE_DELETE;
+    response_send(kind, resultCode, update.messageId, clientSocket);
+}
@@ -0,0 +1,106 @@
+/**
+ *
+ * @file update.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _UPDATE_H
+#define _UPDATE_H
+
+#include <stdbool.h>
+#include "directory.h"
+
+enum UpdateConst
+{
+    UPDATE_MAX_CHANGES = 64 // attributes of an add and changes of a modify
+};
+
+enum ModifyOperation
+{
+    MODIFY_ADD = 0,
+    MODIFY_DELETE = 1,
+    MODIFY_REPLACE = 2
+};
+
+/**
+ * Structure representing one attribute of an add or one change of a modify.
+ */
+typedef struct
+{
+    int operation;  /**< The ModifyOperation, MODIFY_ADD in an add request. */
+    char *type;     /**< The attribute description. */
+    Field *values;  /**< The values, pointing into the message. */
+    int valueCount; /**< The number of values. */
+} LdapChange;
+
+/**
+ * Structure representing an LDAP Add, Delete or Modify request.
+ */
+typedef struct
+{
+    int messageId;                          /**< The unique identifier for the LDAP message. */
+    int requestType;                        /**< LDAP_ADD_REQUEST, LDAP_DELETE_REQUEST or LDAP_MODIFY_REQUEST. */
+    char *entry;                            /**< The dn of the added, deleted or modified entry. */
+    LdapChange changes[UPDATE_MAX_CHANGES]; /**< The attributes of an add or the changes of a modify. */
+    int changeCount;                        /**< The number of changes. */
+    bool valid;                             /**< Flag indicating whether the request could be decoded. */
+} LdapUpdate;
+
+/**
+ * LDAP Update Operation.
+ *
+ * Decodes an add, delete or modify request.
+ *
+ * @param data      A pointer to the message.
+ * @param length    The length of the message.
+ * @param messageId An integer representing the unique identifier for the LDAP message.
+ *
+ * @return An LdapUpdate structure. The dn and the types are allocated from the request arena,
+ *         the values point into the message.
+ */
+LdapUpdate ldap_update(const unsigned char *data, size_t length, int messageId);
+
+/**
+ * Evaluate LDAP Update.
+ *
+ * Builds the new values of every attribute of the entry under the overlay lock,
+ * logs them, publishes them and waits until the log is on disk. objectClass is
+ * accepted and ignored, as the server has a single object class. Values of the
+ * password attribute that are not hashes are hashed. The rdn of an entry cannot
+ * be modified. Without a write-ahead log the directory is read-only.
+ *
+ * @param update    The LdapUpdate structure.
+ * @param directory A pointer to the loaded database file.
+ *
+ * @return The result code of the update.
+ */
+int ldap_update_evaluate(LdapUpdate update, Directory *directory);
+
+/**
+ * Encode LDAP Update Response.
+ *
+ * Encodes the protocol operation of an add, delete or modify response without
+ * a message header, used to build the response templates.
+ *
+ * @param buff       A pointer to the buffer.
+ * @param offset     A pointer to the offset in the buffer, moved past the response.
+ * @param tag        LDAP_ADD_RESPONSE, LDAP_DELETE_RESPONSE or LDAP_MODIFY_RESPONSE.
+ * @param resultCode The result code of the update.
+ */
+void ldap_update_response_encode(unsigned char *buff, int *offset, int tag, int resultCode);
+
+/**
+ * Send an LDAP Update response to the client.
+ *
+ * @param update       The LdapUpdate structure representing the request.
+ * @param resultCode   The result code returned by ldap_update_evaluate().
+ * @param clientSocket The socket for communication with the client.
+ */
+void ldap_update_response(LdapUpdate update, int resultCode, int clientSocket);
+
+#endif
@@ -15,8 +15,10 @@
 #include <string.h>
 #include <stdarg.h>
 #include "utils.h"
+#include "arena.h"
+#include "trace.h"
 
-extern int currentTagPosition;
+extern __thread int currentTagPosition;
 
 void create_ldap_header(unsigned char *buff, int *offset, int messageId)
 {
@@ -61,20 +63,62 @@ void add_ldap_byte(unsigned char *buff, int *offset, int value)
 
 void add_ldap_string(unsigned char *buff, int *offset, char *string)
 {
-    int lenght = strlen(string);
+    add_ldap_octets(buff, offset, string, strlen(string));
+}
+
+void add_ldap_octets(unsigned char *buff, int *offset, const char *string, int length)
+{
     add_ldap_byte(buff, offset, OCTET_STRING_TYPE);
-    add_ldap_byte(buff, offset, lenght);
-    for (size_t i = 0; i < lenght; i++)
+    add_ldap_length(buff, offset, length);
+    memcpy(buff + *offset, string, length);
+    (*offset) += length;
+}
+
+int ldap_length_size(int length)
+{
+    int size = 1;
+    if (length >= 0x80)
     {
-        add_ldap_byte(buff, offset, string[i]);
+        for (int temp = length; temp > 0; temp >>= 8)
+            size++;
+    }
+    return size;
+}
+
+void add_ldap_length(unsigned char *buff, int *offset, int length)
+{
+    int size = ldap_length_size(length);
+    if (size == 1)
+    {
+        add_ldap_byte(buff, offset, length);
+        return;
+    }
+    add_ldap_byte(buff, offset, 0x80 | (size - 1));
+    for (int i = size - 1; i > 0; i--)
+    {
+        add_ldap_byte(buff, offset, (length >> ((i - 1) * 8)) & 0xFF);
+    }
+}
+
+void set_ldap_length(unsigned char *buff, int *offset, int lengthOffset)
+{
+    int length = (*offset) - lengthOffset - 1;
+    int extraBytes = ldap_length_size(length) - 1;
+    if (extraBytes > 0)
+    {
+        // make room for the long form length
+        memmove(buff + lengthOffset + 1 + extraBytes, buff + lengthOffset + 1, length);
+        (*offset) += extraBytes;
     }
+    int lengthEnd = lengthOffset;
+    add_ldap_length(buff, &lengthEnd, length);
 }
 
 void add_ldap_oid(unsigned char *buff, int *offset, char *string)
 {
     int lenght = strlen(string);
     add_ldap_byte(buff, offset, EXTENDED_RESPONSE_OID);
-    add_ldap_byte(buff, offset, lenght);
+    add_ldap_length(buff, offset, lenght);
     for (size_t i = 0; i < lenght; i++)
     {
         add_ldap_byte(buff, offset, string[i]);
@@ -109,8 +153,7 @@ void set_application_type(unsigned char *data, LdapElementInfo *elementInfo, int
 
     if (lengthValue >= 0x81 && lengthValue <= 0xFE)
         elementInfo->lengthOfData = lengthValue - 0x80;
-
-    if (lengthValue <= 0x76)
+    else
         elementInfo->lengthOfData = 0;
 
     elementInfo->start = currentTagPosition + 1;
@@ -121,7 +164,7 @@ void set_application_type(unsigned char *data, LdapElementInfo *elementInfo, int
 void set_universal_type(unsigned char *data, LdapElementInfo *elementInfo, int lengthValue)
 {
 
-    if (lengthValue <= 0x76) // maximum of length that can be encoded in one byte
+    if (lengthValue <= 0x7F) // maximum of length that can be encoded in one byte
     {
 
         elementInfo->lengthOfData = data[currentTagPosition + 1];
@@ -149,18 +192,35 @@ void get_long_length_info(unsigned char *data, LdapElementInfo *elementInfo, int
     }
 }
 
+int ber_read_header(const unsigned char *data, size_t length, size_t *position, size_t *contentLength)
+{
+    if (*position + 2 > length)
+        return -1;
+    int tag = data[(*position)++];
+    size_t elementLength = data[(*position)++];
+    if (elementLength & 0x80)
+    {
+        int lengthOfLength = elementLength & 0x7F;
+        if (lengthOfLength == 0 || lengthOfLength > 4 || *position + lengthOfLength > length)
+            return -1;
+        elementLength = 0;
+        for (int i = 0; i < lengthOfLength; i++)
+            elementLength = elementLength * 256 + data[(*position)++];
+    }
+    if (elementLength > length - *position)
+        return -1;
+    *contentLength = elementLength;
+    return tag;
+}
+
 void print_ldap_element_info(LdapElementInfo elementInfo)
 {
-    debug(3, "Tag Value: %02X\n", elementInfo.tagValue);
-    debug(3, "Length of Data: %d\n", elementInfo.lengthOfData);
-    debug(3, "Start: %d\n", elementInfo.start);
-    debug(3, "End: %d\n", elementInfo.end);
-    debug(3, "New Tag Position: %d\n\n", elementInfo.nextTagPosition);
+    trace(TRACE_VERBOSE, TRACE_ELEMENT, elementInfo.tagValue, elementInfo.lengthOfData, elementInfo.start);
 }
 
 void debug(int level, const char *format, ...)
 {
-    if (DEBUG_LEVEL >= level)
+    if (*traceLevel >= level)
     {
         va_list args;
         va_start(args, format);
@@ -173,22 +233,7 @@ char *get_string_value(unsigned char *data)
 {
     LdapElementInfo LdapInfo = get_ldap_element_info(data);
 
-    char *extractedString = (char *)malloc(LdapInfo.lengthOfData + 1); // +1 for null terminator
-    if (extractedString)
-    {
-        for (int i = LdapInfo.start, j = 0; i <= LdapInfo.end; i++, j++)
-        {
-            extractedString[j] = data[i];
-        }
-        extractedString[LdapInfo.lengthOfData] = '\0'; // Null-terminate the string
-
-        return extractedString;
-    }
-    else
-    {
-        printf("Allocation failed.");
-        return NULL; // Return an error indicator
-    }
+    return arena_strndup(requestArena, (char *)data + LdapInfo.start, LdapInfo.lengthOfData);
 }
 
 long long get_int_value(unsigned char *data)
@@ -212,13 +257,4 @@ long long get_int_value(unsigned char *data)
     }
 
     return combinedDecimalNumber;
-}
-
-void print_hex_message(const unsigned char *data, size_t length)
-{
-    for (size_t i = 0; i < length; i++)
-    {
-        debug(2, "%02X ", data[i]); // Print each byte in hexadecimal format
-    }
-    debug(2, "\n\n");
 }
\ No newline at end of file
@@ -17,8 +17,7 @@ enum MyConst
     LDAP_MESSAGE_PREFIX = 0x30,
     MAX_BUFFER_SIZE = 2048,
     LDAP_MSG_LENGTH_OFFSET = 1,
-    LDAP_PLACEHOLDER = 0x00,
-    DEBUG_LEVEL = 0 // change this in range <0,3> 
+    LDAP_PLACEHOLDER = 0x00
 };
 
 enum SubstringType
@@ -62,10 +61,24 @@ enum ResultCode
     TIME_LIMIT_EXCEEDED = 3,
     SIZE_LIMIT_EXCEEDED = 4,
     UNSUPORTED_FILTER = 5,
+    COMPARE_FALSE = 5,
+    COMPARE_TRUE = 6,
     AUTH_METHOD_NOT_SUPPORTED = 7,
+    ADMIN_LIMIT_EXCEEDED = 11,
+    NO_SUCH_ATTRIBUTE = 16,
+    UNDEFINED_ATTRIBUTE_TYPE = 17,
+    CONSTRAINT_VIOLATION = 19,
+    ATTRIBUTE_OR_VALUE_EXISTS = 20,
+    INVALID_ATTRIBUTE_SYNTAX = 21,
+    NO_SUCH_OBJECT = 32,
     INVALID_DN_SYNTAX = 34,
+    INVALID_CREDENTIALS = 49,
     UNAVAILABLE = 52,
-    UNWILLING_TO_PERFORM = 53
+    UNWILLING_TO_PERFORM = 53,
+    NAMING_VIOLATION = 64,
+    NOT_ALLOWED_ON_RDN = 67,
+    ENTRY_ALREADY_EXISTS = 68,
+    OTHER = 80
 };
 enum TagType
 {
@@ -76,6 +89,7 @@ enum TagType
     OCTET_STRING_TYPE = 0x04,
     NULL_TYPE = 0x05,
     ENUMERATED_TYPE = 0x0A,
+    CONTROLS_TYPE = 0xA0, // the controls following the protocol operation of a message
     EXTENDED_RESPONSE_OID = 0x8A
 };
 
@@ -95,22 +109,10 @@ typedef struct
 } LdapElementInfo;
 
 /**
- * Print a hexadecimal representation of received data.
+ * Trace LDAP element information.
  *
- * This function prints the hexadecimal representation of received data to the standard
- * output. It is useful for displaying received data in a hexadecimal format.
- *
- * @param data   A pointer to the received data to be printed in hexadecimal.
- * @param length The length of the received data in bytes.
- */
-void print_hex_message(const unsigned char *data, size_t length);
-
-/**
- * Print LDAP element information to the standard output.
- *
- * This function is used to display detailed information about an LDAP element,
- * including its start position, end position, length of data, next tag position,
- * and tag value, to the standard output.
+ * This function records the tag value, length of data and start position of an
+ * LDAP element as a TRACE_VERBOSE event.
  *
  */
 void print_ldap_element_info(LdapElementInfo elementInfo);
@@ -131,9 +133,10 @@ long long get_int_value(unsigned char *data);
  *
  * This function retrieves a string value from the received data at the element position specified
  * by the global variable 'currentTagPosition' and increments the 'currentTagPosition'.
+ * The string is allocated from the request arena.
  *
  * @param data A pointer to the data containing the string value.
- * @return The extracted string value or NULL if allocation failed.
+ * @return The extracted null-terminated string value.
  */
 char *get_string_value(unsigned char *data);
 
@@ -231,6 +234,68 @@ void set_universal_type(unsigned char *data, LdapElementInfo *elementInfo, int l
  */
 void add_ldap_string(unsigned char *buff, int *offset, char *string);
 
+/**
+ * Add LDAP Octet String to Buffer.
+ *
+ * Adds an octet string of the given length to the buffer at the specified offset.
+ * The string does not have to be null-terminated.
+ *
+ * @param buff      A pointer to the buffer where the octet string will be added.
+ * @param offset    A pointer to the offset in the buffer where the octet string will be added.
+ * @param string    A pointer to the first byte of the string.
+ * @param length    The length of the string in bytes.
+ */
+void add_ldap_octets(unsigned char *buff, int *offset, const char *string, int length);
+
+/**
+ * Read BER Header.
+ *
+ * Reads the tag and the definite length of the element at the position, checking
+ * that the element fits into the data. Unlike get_ldap_element_info() it does not
+ * use the shared tag position.
+ *
+ * @param data          A pointer to the encoded data.
+ * @param length        The number of bytes the element has to fit into.
+ * @param position      A pointer to the position of the element, moved to its content.
+ * @param contentLength A pointer receiving the length of the content.
+ *
+ * @return The tag of the element or -1 if it is malformed or does not fit.
+ */
+int ber_read_header(const unsigned char *data, size_t length, size_t *position, size_t *contentLength);
+
+/**
+ * Get Size of Encoded Length.
+ *
+ * @param length    The length to be encoded.
+ *
+ * @return          The number of bytes the BER definite length encoding of the length takes.
+ */
+int ldap_length_size(int length);
+
+/**
+ * Add Length to Buffer.
+ *
+ * Adds the BER definite length, using the long form for lengths over 127 bytes.
+ *
+ * @param buff      A pointer to the buffer where the length will be added.
+ * @param offset    A pointer to the offset in the buffer where the length will be added.
+ * @param length    The length to be added.
+ */
+void add_ldap_length(unsigned char *buff, int *offset, int length);
+
+/**
+ * Set Length Placeholder.
+ *
+ * Replaces the one byte placeholder at 'lengthOffset' with the length of everything
+ * written after it. If the length needs the long form, the content is moved to make room
+ * and the offset is updated. Nested placeholders have to be set from the innermost one.
+ *
+ * @param buff          A pointer to the buffer containing the placeholder.
+ * @param offset        A pointer to the offset of the end of the content.
+ * @param lengthOffset  The offset of the placeholder.
+ */
+void set_ldap_length(unsigned char *buff, int *offset, int lengthOffset);
+
 /**
  * Add LDAP Object Identifier to Buffer.
  *
@@ -243,25 +308,41 @@ void add_ldap_string(unsigned char *buff, int *offset, char *string);
  */
 void add_ldap_oid(unsigned char *buff, int *offset, char *string);
 
+/**
+ * Encode LDAP Search Result Done.
+ *
+ * Encodes the protocol operation of a search result done without a message header,
+ * used to build the response templates and for results with a diagnostic message.
+ *
+ * @param buff          A pointer to the buffer.
+ * @param offset        A pointer to the offset in the buffer, moved past the result.
+ * @param returnCode    An integer representing the return code for the LDAP search result done.
+ * @param message       The diagnostic message or NULL for the message of the return code.
+ */
+void ldap_search_res_done_encode(unsigned char *buff, int *offset, int returnCode, const char *message);
+
 /**
  * LDAP Search Result Done.
  *
  * Adds LDAP search result done information to the buffer at the specified offset
- * and sends it to the specified client socket.
+ * and sends it to the specified client socket. Without a message the result is
+ * copied from its template.
  *
  * @param buff          A pointer to the buffer where the LDAP search result done information will be added.
  * @param offset        A pointer to the offset in the buffer where the information will be added.
  * @param returnCode    An integer representing the return code for the LDAP search result done.
+ * @param message       The diagnostic message or NULL for the message of the return code.
  * @param clientSocket  The socket to which the LDAP search result done information will be sent.
  */
-void ldap_search_res_done(unsigned char *buff, int *offset, int returnCode, int clientSocket);
+void ldap_search_res_done(unsigned char *buff, int *offset, int returnCode, const char *message, int clientSocket);
 
 /**
  * Debugging Output.
  *
  * Outputs debugging information based on the specified level and format string,
- * similar to the behavior of printf. Variable arguments can be used to include
- * additional values in the output.
+ * similar to the behavior of printf, when the current trace level is at least the given
+ * level. Variable arguments can be used to include additional values in the output.
+ * Used for startup and shutdown messages, requests are traced with trace().
  *
  * @param level     The level of the debugging information.
  * @param format    The format string for the debugging output.
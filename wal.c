@@ -0,0 +1,719 @@
+/**
+ *
+ * @file wal.c
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libgen.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include "utils.h"
+#include "hash.h"
+#include "schema.h"
+#include "overlay.h"
+#include "stats.h"
+#include "wal.h"
+
+/**
+ * Structure representing the state of the log shared by all connection processes.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;   /**< Process shared lock guarding the sync state. */
+    pthread_cond_t synced;  /**< Signalled whenever a sync finishes. */
+    uint64_t written;       /**< The sequence of the last written record, changed under the overlay lock. */
+    uint64_t durable;       /**< The sequence of the last record known to be on disk. */
+    bool syncing;           /**< Flag indicating whether a writer is syncing the log. */
+    bool failed;            /**< Flag indicating whether a sync failed. */
+    size_t size;            /**< The size of the log, changed under the overlay lock. */
+    size_t nextCompaction;  /**< The log size that makes a write compact the log. */
+    uint64_t identity;      /**< Random number telling this run of the server from others. */
+    uint64_t generation;    /**< The number of times the log was emptied. */
+    uint64_t compactedThrough; /**< The sequence up to which records may be missing from the log. */
+} WalState;
+
+static WalState *walState;
+static int walFile = -1;
+static int baseFile = -1;
+static const char *basePath;
+static size_t walCompactSize;
+
+static uint32_t wal_checksum(const unsigned char *record, uint32_t length)
+{
+    // the sequence, the type and the payload follow each other
+    uint64_t hash = hash_bytes(record + offsetof(WalRecord, sequence), sizeof(WalRecord) - offsetof(WalRecord, sequence) + length);
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static int wal_write_all(int file, const void *data, size_t size)
+{
+    const char *position = (const char *)data;
+    while (size > 0)
+    {
+        ssize_t written = write(file, position, size);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        position += written;
+        size -= written;
+    }
+    return 0;
+}
+
+static void wal_sync_directory(const char *path)
+{
+    // a created or renamed file is only durable once its directory is
+    char *copy = strdup(path);
+    int file = open(dirname(copy), O_RDONLY | O_DIRECTORY);
+    if (file == -1 || fsync(file) == -1)
+        perror(path);
+    if (file != -1)
+        close(file);
+    free(copy);
+}
+
+static unsigned char *wal_record_create(uint32_t type, size_t length)
+{
+    unsigned char *buffer = (unsigned char *)malloc(sizeof(WalRecord) + length);
+    if (buffer == NULL)
+        return NULL;
+    WalRecord *record = (WalRecord *)buffer;
+    record->length = length;
+    record->type = type;
+    record->reserved = 0;
+    return buffer;
+}
+
+static size_t wal_payload_field(unsigned char *payload, size_t position, Field field)
+{
+    uint32_t length = field.length;
+    memcpy(payload + position, &length, sizeof(length));
+    memcpy(payload + position + sizeof(length), field.value, field.length);
+    return position + sizeof(length) + field.length;
+}
+
+static int wal_append(unsigned char *buffer, uint64_t *sequence)
+{
+    WalRecord *record = (WalRecord *)buffer;
+    if (walState->failed)
+    {
+        free(buffer);
+        return -1;
+    }
+    record->sequence = walState->written + 1;
+    record->checksum = wal_checksum(buffer, record->length);
+
+    size_t size = sizeof(WalRecord) + record->length;
+    int result = wal_write_all(walFile, buffer, size);
+    free(buffer);
+    if (result == -1)
+    {
+        // a partly written record would hide every later one from the replay
+        perror("write");
+        if (ftruncate(walFile, walState->size) == -1)
+            perror("ftruncate");
+        return -1;
+    }
+
+    walState->size += size;
+    pthread_mutex_lock(&walState->lock);
+    walState->written++;
+    pthread_mutex_unlock(&walState->lock);
+    *sequence = walState->written;
+    return 0;
+}
+
+int wal_put(Directory *directory, size_t row, const Field *values, uint64_t *sequence)
+{
+    const Schema *schema = &directory->schema;
+    if (!overlay_has_room(directory, row, values))
+        return -1;
+
+    size_t length = 0;
+    for (int column = 0; column < schema->attributeCount; column++)
+        length += sizeof(uint32_t) + values[column].length;
+    unsigned char *buffer = wal_record_create(WAL_PUT, length);
+    if (buffer == NULL)
+        return -1;
+    size_t position = 0;
+    for (int column = 0; column < schema->attributeCount; column++)
+        position = wal_payload_field(buffer + sizeof(WalRecord), position, values[column]);
+
+    if (wal_append(buffer, sequence) == -1)
+        return -1;
+    return overlay_put(directory, row, values);
+}
+
+int wal_delete(Directory *directory, size_t row, uint64_t *sequence)
+{
+    if (!overlay_has_room(directory, row, NULL))
+        return -1;
+
+    // the row number is only valid until the next restart, the rdn value is not
+    char *scratch = (char *)malloc(directory->columns[directory->schema.rdn].maxLength + 1);
+    if (scratch == NULL)
+        return -1;
+    Field rdn = directory_value(directory, row, directory->schema.rdn, scratch);
+    unsigned char *buffer = wal_record_create(WAL_DELETE, sizeof(uint32_t) + rdn.length);
+    if (buffer != NULL)
+        wal_payload_field(buffer + sizeof(WalRecord), 0, rdn);
+    free(scratch);
+
+    if (buffer == NULL || wal_append(buffer, sequence) == -1)
+        return -1;
+    return overlay_delete(directory, row);
+}
+
+int wal_commit(uint64_t sequence)
+{
+    pthread_mutex_lock(&walState->lock);
+    while (walState->durable < sequence && !walState->failed)
+    {
+        if (walState->syncing)
+        {
+            pthread_cond_wait(&walState->synced, &walState->lock);
+            continue;
+        }
+
+        // this writer syncs every record written so far, the others wait for it
+        walState->syncing = true;
+        uint64_t target = walState->written;
+        pthread_mutex_unlock(&walState->lock);
+        int result = fdatasync(walFile);
+        pthread_mutex_lock(&walState->lock);
+        walState->syncing = false;
+        if (result == -1)
+        {
+            perror("fdatasync");
+            walState->failed = true;
+        }
+        else
+        {
+            if (target > walState->durable)
+                walState->durable = target;
+            stats_add(&stats->walSyncs, 1);
+        }
+        pthread_cond_broadcast(&walState->synced);
+    }
+    int result = walState->durable >= sequence ? 0 : -1;
+    pthread_mutex_unlock(&walState->lock);
+    return result;
+}
+
+static int wal_attribute_of(const Schema *schema, int column)
+{
+    for (int attribute = 0; attribute < schema->attributeCount; attribute++)
+    {
+        if (schema->attributes[attribute].csvColumn == column)
+            return attribute;
+    }
+    return -1;
+}
+
+static void wal_write_line(FILE *out, const Schema *schema, const OverlayRecord *record, const char *line, const char *end, const char *newline)
+{
+    // declared columns take the written values, the others keep the old ones
+    const char *position = line;
+    for (int column = 0;; column++)
+    {
+        const char *fieldEnd = NULL;
+        if (position != NULL)
+        {
+            fieldEnd = (const char *)memchr(position, ';', end - position);
+            if (fieldEnd == NULL)
+                fieldEnd = end;
+        }
+        if (column > 0)
+            fputc(';', out);
+        int attribute = wal_attribute_of(schema, column);
+        if (attribute != -1)
+        {
+            Field value = overlay_value(record, attribute);
+            fwrite(value.value, 1, value.length, out);
+        }
+        else if (position != NULL)
+        {
+            fwrite(position, 1, fieldEnd - position, out);
+        }
+        if (position != NULL)
+            position = fieldEnd < end ? fieldEnd + 1 : NULL;
+        if (position == NULL && column + 1 >= schema->csvColumns)
+            break;
+    }
+    fputs(newline, out);
+}
+
+static int wal_write_database(const Directory *directory, const char *data, size_t size, FILE *out)
+{
+    const Overlay *overlay = directory->overlay;
+    const Schema *schema = &directory->schema;
+    const char *end = data + size;
+
+    // added rows take the line endings of the first line
+    const char *newline = "\n";
+    const char *firstEnd = size > 0 ? (const char *)memchr(data, '\n', size) : NULL;
+    if (firstEnd != NULL && firstEnd > data && firstEnd[-1] == '\r')
+        newline = "\r\n";
+
+    // rows are counted as directory_load() counts them, skipping empty lines
+    size_t row = 0;
+    for (const char *line = data; line < end;)
+    {
+        const char *lineEnd = (const char *)memchr(line, '\n', end - line);
+        if (lineEnd == NULL)
+            lineEnd = end;
+        const char *contentEnd = lineEnd;
+        if (contentEnd > line && contentEnd[-1] == '\r')
+            contentEnd--;
+        if (contentEnd > line)
+        {
+            if (row >= overlay->baseRows)
+                return -1;
+            const OverlayRecord *record = overlay_record(overlay, row);
+            if (record == NULL)
+            {
+                fwrite(line, 1, lineEnd - line, out);
+                fputs(lineEnd < end ? "\n" : newline, out);
+            }
+            else if (!record->deleted)
+            {
+                wal_write_line(out, schema, record, line, contentEnd, newline);
+            }
+            row++;
+        }
+        line = lineEnd < end ? lineEnd + 1 : end;
+    }
+    if (row != overlay->baseRows)
+        return -1;
+
+    for (; row < directory_row_count(directory); row++)
+    {
+        const OverlayRecord *record = overlay_record(overlay, row);
+        if (record != NULL && !record->deleted)
+            wal_write_line(out, schema, record, NULL, NULL, newline);
+    }
+    return 0;
+}
+
+int wal_snapshot(const Directory *directory, FILE *out)
+{
+    // the loaded file stays open, every snapshot starts from it and all changes since the start
+    struct stat info;
+    if (fstat(baseFile, &info) == -1)
+    {
+        perror(basePath);
+        return -1;
+    }
+    const char *data = "";
+    if (info.st_size > 0)
+    {
+        data = (const char *)mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, baseFile, 0);
+        if (data == MAP_FAILED)
+        {
+            perror("mmap");
+            return -1;
+        }
+    }
+    int result = wal_write_database(directory, data, info.st_size, out);
+    if (result == -1)
+        fprintf(stderr, "%s: rows differ from the loaded file\n", basePath);
+    if (info.st_size > 0)
+        munmap((void *)data, info.st_size);
+    return result;
+}
+
+static int wal_compact(Directory *directory)
+{
+    struct stat info;
+    if (fstat(baseFile, &info) == -1)
+    {
+        perror(basePath);
+        return -1;
+    }
+
+    size_t pathLength = strlen(basePath);
+    char *tempPath = (char *)malloc(pathLength + sizeof(".compact"));
+    memcpy(tempPath, basePath, pathLength);
+    memcpy(tempPath + pathLength, ".compact", sizeof(".compact"));
+    int result = -1;
+    FILE *out = fopen(tempPath, "w");
+    if (out == NULL)
+    {
+        perror(tempPath);
+    }
+    else
+    {
+        setvbuf(out, NULL, _IOFBF, WAL_COMPACT_BUFFER_SIZE);
+        fchmod(fileno(out), info.st_mode & 0777);
+        if (wal_snapshot(directory, out) == 0)
+        {
+            if (fflush(out) != 0 || fsync(fileno(out)) == -1)
+                perror(tempPath);
+            else
+                result = 0;
+        }
+        if (fclose(out) != 0)
+            result = -1;
+    }
+
+    if (result == 0 && rename(tempPath, basePath) == -1)
+    {
+        perror(tempPath);
+        result = -1;
+    }
+    if (result == -1)
+    {
+        unlink(tempPath);
+        free(tempPath);
+        return -1;
+    }
+    free(tempPath);
+    wal_sync_directory(basePath);
+
+    // cursors learn that the log is emptied before it is, so they never read a shortened log
+    pthread_mutex_lock(&walState->lock);
+    walState->durable = walState->written;
+    walState->compactedThrough = walState->written;
+    walState->generation++;
+    pthread_cond_broadcast(&walState->synced);
+    pthread_mutex_unlock(&walState->lock);
+
+    // the log is only emptied once the database file holds every change
+    if (ftruncate(walFile, sizeof(WalHeader)) == -1 || fdatasync(walFile) == -1)
+    {
+        perror("ftruncate");
+        return -1;
+    }
+    walState->size = sizeof(WalHeader);
+    stats_add(&stats->walCompactions, 1);
+    return 0;
+}
+
+void wal_compact_if_due(Directory *directory)
+{
+    if (walCompactSize == 0 || __atomic_load_n(&walState->size, __ATOMIC_RELAXED) < walState->nextCompaction)
+        return;
+
+    overlay_lock(directory->overlay);
+    // another writer may have compacted the log while this one waited for the lock
+    if (walState->size >= walState->nextCompaction)
+    {
+        if (wal_compact(directory) == 0)
+            walState->nextCompaction = walCompactSize;
+        else
+            walState->nextCompaction = walState->size + walCompactSize; // not retried by every write
+    }
+    overlay_unlock(directory->overlay);
+}
+
+static bool wal_apply_record(Directory *directory, const WalRecord *record, const unsigned char *payload, char *scratch)
+{
+    const Schema *schema = &directory->schema;
+    Field values[SCHEMA_MAX_ATTRIBUTES];
+    int count = record->type == WAL_PUT ? schema->attributeCount : 1;
+    if (record->type != WAL_PUT && record->type != WAL_DELETE)
+        return false;
+
+    size_t position = 0;
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t length;
+        if (position + sizeof(length) > record->length)
+            return false;
+        memcpy(&length, payload + position, sizeof(length));
+        position += sizeof(length);
+        if (length > record->length - position)
+            return false;
+        values[i].value = (const char *)payload + position;
+        values[i].length = length;
+        position += length;
+    }
+    if (position != record->length)
+        return false;
+
+    // both kinds of records name the entry by its rdn value, so replaying them twice does no harm
+    Field rdn = record->type == WAL_PUT ? values[schema->rdn] : values[0];
+    char *key = (char *)malloc(rdn.length + 1);
+    Field rdnKey;
+    rdnKey.value = key;
+    rdnKey.length = directory_normalize(&schema->attributes[schema->rdn], rdn, key);
+    size_t row;
+    bool exists = directory_find_row(directory, schema->rdn, rdnKey, scratch, &row);
+    free(key);
+
+    if (record->type == WAL_DELETE)
+        return !exists || overlay_delete(directory, row) == 0;
+    return overlay_put(directory, exists ? row : directory_row_count(directory), values) == 0;
+}
+
+static int wal_replay(Directory *directory, const char *path, size_t size, size_t *valid)
+{
+    const unsigned char *data = (const unsigned char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, walFile, 0);
+    if (data == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+
+    WalHeader header;
+    memcpy(&header, data, size < sizeof(header) ? size : sizeof(header));
+    if (size < sizeof(header) || header.magic != WAL_MAGIC || header.version != WAL_VERSION)
+    {
+        fprintf(stderr, "%s is not a write-ahead log\n", path);
+        munmap((void *)data, size);
+        return -1;
+    }
+    if ((int)header.attributeCount != directory->schema.attributeCount)
+    {
+        fprintf(stderr, "%s was written for %u attributes, the schema has %d\n", path, header.attributeCount,
+                directory->schema.attributeCount);
+        munmap((void *)data, size);
+        return -1;
+    }
+
+    char *scratch = (char *)malloc(directory->columns[directory->schema.rdn].maxLength + 1);
+    size_t position = sizeof(header), changes = 0;
+    int result = 0;
+    while (position + sizeof(WalRecord) <= size)
+    {
+        // records are aligned only by chance, so the header is copied
+        WalRecord record;
+        memcpy(&record, data + position, sizeof(WalRecord));
+        if (record.length > size - position - sizeof(WalRecord) || wal_checksum(data + position, record.length) != record.checksum)
+            break;
+        if (!wal_apply_record(directory, &record, data + position + sizeof(WalRecord), scratch))
+        {
+            fprintf(stderr, "%s: change %llu could not be applied, the overlay is full or the record is damaged\n", path,
+                    (unsigned long long)record.sequence);
+            result = -1;
+            break;
+        }
+        walState->written = record.sequence;
+        position += sizeof(WalRecord) + record.length;
+        changes++;
+    }
+    free(scratch);
+    munmap((void *)data, size);
+
+    *valid = position;
+    debug(1, "Replayed %zu changes from %s\n", changes, path);
+    return result;
+}
+
+int wal_open(Directory *directory, const char *path, const char *filePath, size_t compactSize)
+{
+    walState = (WalState *)mmap(NULL, sizeof(WalState), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (walState == MAP_FAILED)
+    {
+        perror("mmap");
+        return -1;
+    }
+    pthread_mutexattr_t mutexAttributes;
+    pthread_mutexattr_init(&mutexAttributes);
+    pthread_mutexattr_setpshared(&mutexAttributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&walState->lock, &mutexAttributes);
+    pthread_mutexattr_destroy(&mutexAttributes);
+    pthread_condattr_t condAttributes;
+    pthread_condattr_init(&condAttributes);
+    pthread_condattr_setpshared(&condAttributes, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&walState->synced, &condAttributes);
+    pthread_condattr_destroy(&condAttributes);
+
+    basePath = filePath;
+    walCompactSize = compactSize;
+    walState->nextCompaction = compactSize;
+    if (getrandom(&walState->identity, sizeof(walState->identity), 0) != sizeof(walState->identity))
+        walState->identity = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+    baseFile = open(filePath, O_RDONLY);
+    walFile = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (baseFile == -1 || walFile == -1)
+    {
+        perror(baseFile == -1 ? filePath : path);
+        return -1;
+    }
+
+    struct stat info;
+    if (fstat(walFile, &info) == -1)
+    {
+        perror(path);
+        return -1;
+    }
+    size_t size = info.st_size;
+    if (size == 0)
+    {
+        WalHeader header;
+        header.magic = WAL_MAGIC;
+        header.version = WAL_VERSION;
+        header.attributeCount = directory->schema.attributeCount;
+        header.reserved = 0;
+        if (wal_write_all(walFile, &header, sizeof(header)) == -1 || fdatasync(walFile) == -1)
+        {
+            perror(path);
+            return -1;
+        }
+        wal_sync_directory(path);
+        size = sizeof(header);
+    }
+    else
+    {
+        size_t valid;
+        if (wal_replay(directory, path, size, &valid) == -1)
+            return -1;
+
+        // a crash in the middle of a write leaves a torn record at the end
+        if (valid < size)
+        {
+            fprintf(stderr, "%s: cutting off %zu bytes of an incomplete change\n", path, size - valid);
+            if (ftruncate(walFile, valid) == -1 || fdatasync(walFile) == -1)
+            {
+                perror(path);
+                return -1;
+            }
+            size = valid;
+        }
+    }
+    walState->size = size;
+    walState->durable = walState->written;
+    walState->compactedThrough = walState->written; // records of earlier runs are not streamed
+
+    wal_compact_if_due(directory);
+    return 0;
+}
+
+bool wal_is_open(void)
+{
+    return walState != NULL;
+}
+
+uint64_t wal_identity(uint64_t *durable)
+{
+    pthread_mutex_lock(&walState->lock);
+    *durable = walState->durable;
+    pthread_mutex_unlock(&walState->lock);
+    return walState->identity;
+}
+
+int wal_apply(Directory *directory, const unsigned char *record, size_t length)
+{
+    WalRecord header;
+    if (length < sizeof(header))
+        return -1;
+    memcpy(&header, record, sizeof(header));
+    if (header.length != length - sizeof(header) || wal_checksum(record, header.length) != header.checksum)
+        return -1;
+
+    char *scratch = (char *)malloc(directory->columns[directory->schema.rdn].maxLength + 1);
+    bool applied = scratch != NULL && wal_apply_record(directory, &header, record + sizeof(header), scratch);
+    free(scratch);
+    return applied ? 0 : -1;
+}
+
+int wal_cursor_open(WalCursor *cursor, uint64_t sequence)
+{
+    pthread_mutex_lock(&walState->lock);
+    int result = sequence >= walState->compactedThrough && sequence <= walState->durable ? 0 : -1;
+    cursor->generation = walState->generation;
+    cursor->offset = sizeof(WalHeader);
+    cursor->sequence = sequence;
+    pthread_mutex_unlock(&walState->lock);
+    return result;
+}
+
+static bool wal_cursor_reserve(unsigned char **buffer, size_t *capacity, size_t size)
+{
+    if (size <= *capacity)
+        return true;
+    size_t grown = *capacity ? *capacity : WAL_COMPACT_BUFFER_SIZE;
+    while (grown < size)
+        grown *= 2;
+    unsigned char *resized = (unsigned char *)realloc(*buffer, grown);
+    if (resized == NULL)
+        return false;
+    *buffer = resized;
+    *capacity = grown;
+    return true;
+}
+
+long wal_cursor_read(WalCursor *cursor, unsigned char **buffer, size_t *capacity, int timeout)
+{
+    pthread_mutex_lock(&walState->lock);
+    if (walState->durable <= cursor->sequence && walState->generation == cursor->generation)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (long)(timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&walState->synced, &walState->lock, &deadline);
+    }
+    uint64_t durable = walState->durable;
+    if (walState->generation != cursor->generation)
+    {
+        // records the cursor did not read yet may be gone with the emptied log
+        if (cursor->sequence < walState->compactedThrough)
+        {
+            pthread_mutex_unlock(&walState->lock);
+            return -1;
+        }
+        cursor->generation = walState->generation;
+        cursor->offset = sizeof(WalHeader);
+    }
+    uint64_t generation = cursor->generation;
+    pthread_mutex_unlock(&walState->lock);
+    if (durable <= cursor->sequence)
+        return 0;
+
+    // only records known to be on disk are returned, so a replica never gets ahead of a crashed primary
+    size_t offset = cursor->offset, length = 0;
+    uint64_t sequence = cursor->sequence;
+    while (length < WAL_COMPACT_BUFFER_SIZE && wal_cursor_reserve(buffer, capacity, length + sizeof(WalRecord)))
+    {
+        WalRecord record;
+        if (pread(walFile, &record, sizeof(record), offset) != (ssize_t)sizeof(record) || record.sequence > durable)
+            break;
+        size_t size = sizeof(WalRecord) + record.length;
+        if (!wal_cursor_reserve(buffer, capacity, length + size) ||
+            pread(walFile, *buffer + length, size, offset) != (ssize_t)size ||
+            wal_checksum(*buffer + length, record.length) != record.checksum)
+            break;
+        offset += size;
+        if (record.sequence <= sequence)
+            continue;
+        sequence = record.sequence;
+        length += size;
+    }
+
+    // what was read is only valid if the log was not emptied meanwhile
+    pthread_mutex_lock(&walState->lock);
+    bool valid = walState->generation == generation;
+    pthread_mutex_unlock(&walState->lock);
+    if (!valid)
+        return 0;
+    cursor->offset = offset;
+    cursor->sequence = sequence;
+    return length;
+}
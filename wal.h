@@ -0,0 +1,216 @@
+/**
+ *
+ * @file wal.h
+ *
+ * @brief Project: ISA LDAP server
+ *
+ * @author xbalek02 Miroslav Bálek
+ *
+ *
+ *
+ */
+#ifndef _WAL_H
+#define _WAL_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "directory.h"
+
+enum WalConst
+{
+    WAL_MAGIC = 0x4C41574C,                      // "LWAL"
+    WAL_VERSION = 1,
+    WAL_DEFAULT_COMPACT_SIZE = 64 * 1024 * 1024, // log size that makes a write compact the log into the database file
+    WAL_COMPACT_BUFFER_SIZE = 1 << 20            // bytes of the database file written at once while compacting
+};
+
+enum WalType
+{
+    WAL_PUT = 1,   // the values of every attribute of an entry, added or replaced
+    WAL_DELETE = 2 // the rdn value of a deleted entry
+};
+
+/**
+ * Structure representing the header of a log file.
+ */
+typedef struct
+{
+    uint32_t magic;          /**< WAL_MAGIC. */
+    uint32_t version;        /**< WAL_VERSION. */
+    uint32_t attributeCount; /**< The number of attributes of the schema the log was written for. */
+    uint32_t reserved;       /**< Zero. */
+} WalHeader;
+
+/**
+ * Structure representing one logged change.
+ *
+ * The record is followed by its payload. A put carries the length and the bytes of
+ * the value of every attribute in schema order, a delete the length and the bytes of
+ * the rdn value, lengths as 32-bit integers. Both name the entry by its rdn value, so
+ * replaying a record twice gives the same entry.
+ */
+typedef struct
+{
+    uint32_t length;   /**< The number of payload bytes. */
+    uint32_t checksum; /**< The checksum of the type, the sequence and the payload. */
+    uint64_t sequence; /**< The number of the change, counted on from the last record replayed at the start. */
+    uint32_t type;     /**< The WalType. */
+    uint32_t reserved; /**< Zero. */
+} WalRecord;
+
+/**
+ * Structure representing a reader following the log, such as a replica.
+ */
+typedef struct
+{
+    uint64_t generation; /**< The number of times the log was emptied when the offset was taken. */
+    size_t offset;       /**< The offset of the next record to read. */
+    uint64_t sequence;   /**< The sequence of the last record returned. */
+} WalCursor;
+
+/**
+ * Open Write-Ahead Log.
+ *
+ * Creates the log or replays the changes it holds into the overlay of the directory.
+ * A torn record at the end, left by a crash in the middle of a write, is cut off.
+ * Keeps the loaded database file open, so it can be compacted even after it was replaced.
+ * Has to be called before the first connection process is created.
+ *
+ * @param directory   A pointer to the directory with an overlay.
+ * @param path        The path to the log.
+ * @param filePath    The path to the loaded database file, replaced by compactions.
+ * @param compactSize The log size in bytes that makes a write compact the log, 0 to never compact.
+ *
+ * @return 0 on success, -1 if the log could not be opened or was written for another schema.
+ */
+int wal_open(Directory *directory, const char *path, const char *filePath, size_t compactSize);
+
+/**
+ * Log and Write Row.
+ *
+ * Appends a put record to the log and publishes the row in the overlay. The record
+ * is not durable until wal_commit() returns. The caller has to hold the overlay lock.
+ *
+ * @param directory A pointer to the directory.
+ * @param row       The row to replace or the row count to add a row.
+ * @param values    The values of every attribute of the schema.
+ * @param sequence  A pointer receiving the sequence of the record.
+ *
+ * @return 0 on success, -1 if the overlay is full or the log could not be written.
+ */
+int wal_put(Directory *directory, size_t row, const Field *values, uint64_t *sequence);
+
+/**
+ * Log and Delete Row.
+ *
+ * Appends a delete record to the log and deletes the row in the overlay. The caller
+ * has to hold the overlay lock.
+ *
+ * @param directory A pointer to the directory.
+ * @param row       The row to delete.
+ * @param sequence  A pointer receiving the sequence of the record.
+ *
+ * @return 0 on success, -1 if the overlay is full or the log could not be written.
+ */
+int wal_delete(Directory *directory, size_t row, uint64_t *sequence);
+
+/**
+ * Commit Logged Changes.
+ *
+ * Waits until the record is on disk. One of the waiting writers syncs the log for
+ * every record written so far while the others wait for it, so concurrent writers
+ * share one sync. After a failed sync no commit succeeds any more, as the kernel may
+ * have dropped the unsynced pages. Must not be called with the overlay lock held.
+ *
+ * @param sequence The sequence of the record.
+ *
+ * @return 0 once the record is durable, -1 if the log could not be synced.
+ */
+int wal_commit(uint64_t sequence);
+
+/**
+ * Compact Log if Due.
+ *
+ * Once the log reaches the compaction size, writes the loaded database file with every
+ * change applied next to the current one, replaces it and empties the log. Writers wait
+ * for the compaction, readers do not. Must not be called with the overlay lock held.
+ *
+ * @param directory A pointer to the directory.
+ */
+void wal_compact_if_due(Directory *directory);
+
+/**
+ * Check Write-Ahead Log.
+ *
+ * @return true if wal_open() succeeded, so the directory accepts writes.
+ */
+bool wal_is_open(void);
+
+/**
+ * Write Database Snapshot.
+ *
+ * Writes the loaded database file with every change applied, as a compaction does.
+ * Runs without the overlay lock, so the snapshot may hold some changes made while it
+ * is written; it holds every change committed before it started.
+ *
+ * @param directory A pointer to the directory.
+ * @param out       The stream receiving the file.
+ *
+ * @return 0 on success, -1 if the loaded file could not be read.
+ */
+int wal_snapshot(const Directory *directory, FILE *out);
+
+/**
+ * Get Log Identity.
+ *
+ * @param durable A pointer receiving the sequence of the last record on disk.
+ *
+ * @return A random number drawn by wal_open(), telling this run of the server from others.
+ */
+uint64_t wal_identity(uint64_t *durable);
+
+/**
+ * Apply Streamed Record.
+ *
+ * Applies a record read by wal_cursor_read() on another server to the overlay,
+ * as the replay does. The caller has to hold the overlay lock.
+ *
+ * @param directory A pointer to the directory with an overlay.
+ * @param record    A pointer to the record and its payload.
+ * @param length    The length of the record with its payload.
+ *
+ * @return 0 on success, -1 if the record is damaged or the overlay is full.
+ */
+int wal_apply(Directory *directory, const unsigned char *record, size_t length);
+
+/**
+ * Open Log Cursor.
+ *
+ * @param cursor   A pointer to the cursor.
+ * @param sequence The sequence of the last record the reader has.
+ *
+ * @return 0 if every record after the sequence can be read, -1 if some were compacted
+ *         away or the sequence is not known, so the reader needs a snapshot.
+ */
+int wal_cursor_open(WalCursor *cursor, uint64_t sequence);
+
+/**
+ * Read Log Cursor.
+ *
+ * Waits up to the timeout for records on disk after the cursor and reads whole
+ * records into the buffer, about WAL_COMPACT_BUFFER_SIZE bytes at most, unless one
+ * record is larger.
+ *
+ * @param cursor   A pointer to the cursor, advanced past the returned records.
+ * @param buffer   A pointer to a buffer allocated by malloc() or NULL, grown as needed.
+ * @param capacity A pointer to the size of the buffer.
+ * @param timeout  The longest wait in milliseconds.
+ *
+ * @return The number of bytes read, 0 if there was nothing new, -1 if records after the
+ *         cursor were compacted away and the reader needs a snapshot.
+ */
+long wal_cursor_read(WalCursor *cursor, unsigned char **buffer, size_t *capacity, int timeout);
+
+#endif